@@ -20,7 +20,10 @@
 #include "NDS.h"
 #include "ARM.h"
 #include "ARMInterpreter.h"
+#include "ARMJIT.h"
+#include "ARMIdleLoop.h"
 #include "AREngine.h"
+#include "Profiler.h"
 
 
 // instruction timing notes
@@ -94,6 +97,9 @@ void ARM::Reset()
     ExceptionBase = Num ? 0x00000000 : 0xFFFF0000;
 
     CodeMem.Mem = NULL;
+    CodeMemRegion = 0xFFFFFFFF;
+    CodeMemRegionMask = 0xFF800000;
+    CodeMemStale = false;
 
     // zorp
     JumpTo(ExceptionBase);
@@ -135,6 +141,7 @@ void ARM::DoSavestate(Savestate* file)
         }
         else
         {
+            SetupCodeMem(R[15]);
             CodeRegion = R[15] >> 24;
             CodeCycles = R[15] >> 15; // cheato
         }
@@ -156,15 +163,24 @@ void ARM::SetupCodeMem(u32 addr)
     }
     else
     {
-        // not sure it's worth it for the ARM7
-        // esp. as everything there generally runs on WRAM
-        // and due to how it's mapped, we can't use this optimization
-        //NDS::ARM7GetMemRegion(addr, false, &CodeMem);
+        // WRAM mirrors don't line up across 0x03800000, so CodeMem
+        // is only used within the 8MB region it was set up for.
+        // the BIOS isn't mirrored, fetches past 0x4000 take the slow path
+        CodeMemStale.store(false, std::memory_order_relaxed);
+        CodeMemRegionMask = (addr < 0x00004000) ? 0xFFFFC000 : 0xFF800000;
+        if (NDS::ARM7GetMemRegion(addr, false, &CodeMem))
+            CodeMemRegion = addr & CodeMemRegionMask;
+        else
+            CodeMemRegion = 0xFFFFFFFF;
     }
 }
 
 void ARMv5::JumpTo(u32 addr, bool restorecpsr)
 {
+    // short backwards jumps might be a loop polling something
+    if (ARMIdleLoop::Enabled && !restorecpsr && (R[15] - (addr & ~0x1)) <= ARMIdleLoop::kMaxLoopSize)
+        ARMIdleLoop::CheckLoop(this, addr);
+
     if (restorecpsr)
     {
         RestoreCPSR();
@@ -237,6 +253,10 @@ void ARMv5::JumpTo(u32 addr, bool restorecpsr)
 
 void ARMv4::JumpTo(u32 addr, bool restorecpsr)
 {
+    // short backwards jumps might be a loop polling something
+    if (ARMIdleLoop::Enabled && !restorecpsr && (R[15] - (addr & ~0x1)) <= ARMIdleLoop::kMaxLoopSize)
+        ARMIdleLoop::CheckLoop(this, addr);
+
     if (restorecpsr)
     {
         RestoreCPSR();
@@ -245,9 +265,6 @@ void ARMv4::JumpTo(u32 addr, bool restorecpsr)
         else                addr &= ~0x1;
     }
 
-    u32 oldregion = R[15] >> 23;
-    u32 newregion = addr >> 23;
-
     CodeRegion = addr >> 24;
     CodeCycles = addr >> 15; // cheato
 
@@ -256,7 +273,7 @@ void ARMv4::JumpTo(u32 addr, bool restorecpsr)
         addr &= ~0x1;
         R[15] = addr+2;
 
-        //if (newregion != oldregion) SetupCodeMem(addr);
+        if ((addr & CodeMemRegionMask) != CodeMemRegion || CodeMemStale.load(std::memory_order_relaxed)) SetupCodeMem(addr);
 
         NextInstr[0] = CodeRead16(addr);
         NextInstr[1] = CodeRead16(addr+2);
@@ -269,7 +286,7 @@ void ARMv4::JumpTo(u32 addr, bool restorecpsr)
         addr &= ~0x3;
         R[15] = addr+4;
 
-        //if (newregion != oldregion) SetupCodeMem(addr);
+        if ((addr & CodeMemRegionMask) != CodeMemRegion || CodeMemStale.load(std::memory_order_relaxed)) SetupCodeMem(addr);
 
         NextInstr[0] = CodeRead32(addr);
         NextInstr[1] = CodeRead32(addr+4);
@@ -460,6 +477,8 @@ void ARMv5::DataAbort()
 
 void ARMv5::Execute()
 {
+    PROFILE_SCOPE(Prof_ARM9);
+
     if (Halted)
     {
         if (Halted == 2)
@@ -481,7 +500,13 @@ void ARMv5::Execute()
 
     while (NDS::ARM9Timestamp < NDS::ARM9Target)
     {
-        if (CPSR & 0x20) // THUMB
+        ARMJIT::JitBlockEntry block = ARMJIT::Enabled ? ARMJIT::LookUpBlock(this) : NULL;
+
+        if (block)
+        {
+            block(this);
+        }
+        else if (CPSR & 0x20) // THUMB
         {
             // prefetch
             R[15] += 2;
@@ -523,6 +548,18 @@ void ARMv5::Execute()
             {
                 NDS::ARM9Timestamp = NDS::ARM9Target;
             }
+            else if (Halted == 3)
+            {
+                // idle loop: it would just go around until the target
+                NDS::ARM9Timestamp += Cycles;
+                Cycles = 0;
+                if (NDS::ARM9Timestamp < NDS::ARM9Target)
+                {
+                    ARMIdleLoop::CyclesSkipped[0] += NDS::ARM9Target - NDS::ARM9Timestamp;
+                    ARMIdleLoop::NumSkips[0]++;
+                    NDS::ARM9Timestamp = NDS::ARM9Target;
+                }
+            }
             break;
         }
         /*if (NDS::IF[0] & NDS::IE[0])
@@ -536,12 +573,14 @@ void ARMv5::Execute()
         Cycles = 0;
     }
 
-    if (Halted == 2)
+    if (Halted == 2 || Halted == 3)
         Halted = 0;
 }
 
 void ARMv4::Execute()
 {
+    PROFILE_SCOPE(Prof_ARM7);
+
     if (Halted)
     {
         if (Halted == 2)
@@ -563,7 +602,13 @@ void ARMv4::Execute()
 
     while (NDS::ARM7Timestamp < NDS::ARM7Target)
     {
-        if (CPSR & 0x20) // THUMB
+        ARMJIT::JitBlockEntry block = ARMJIT::Enabled ? ARMJIT::LookUpBlock(this) : NULL;
+
+        if (block)
+        {
+            block(this);
+        }
+        else if (CPSR & 0x20) // THUMB
         {
             // prefetch
             R[15] += 2;
@@ -600,6 +645,18 @@ void ARMv4::Execute()
             {
                 NDS::ARM7Timestamp = NDS::ARM7Target;
             }
+            else if (Halted == 3)
+            {
+                // idle loop: it would just go around until the target
+                NDS::ARM7Timestamp += Cycles;
+                Cycles = 0;
+                if (NDS::ARM7Timestamp < NDS::ARM7Target)
+                {
+                    ARMIdleLoop::CyclesSkipped[1] += NDS::ARM7Target - NDS::ARM7Timestamp;
+                    ARMIdleLoop::NumSkips[1]++;
+                    NDS::ARM7Timestamp = NDS::ARM7Target;
+                }
+            }
             break;
         }
         /*if (NDS::IF[1] & NDS::IE[1])
@@ -613,6 +670,6 @@ void ARMv4::Execute()
         Cycles = 0;
     }
 
-    if (Halted == 2)
+    if (Halted == 2 || Halted == 3)
         Halted = 0;
 }
@@ -20,6 +20,7 @@
 #define ARM_H
 
 #include <algorithm>
+#include <atomic>
 
 #include "types.h"
 #include "NDS.h"
@@ -130,6 +131,9 @@ public:
     u32 ExceptionBase;
 
     NDS::MemRegion CodeMem;
+    u32 CodeMemRegion; // ARM7: start of the range CodeMem covers
+    u32 CodeMemRegionMask; // ARM7: size of that range, 16K for the BIOS and 8MB otherwise
+    std::atomic<bool> CodeMemStale; // ARM7: set when CodeMem has to be set up again before the next fetch from it
 
     static u32 ConditionTable[16];
 };
@@ -272,11 +276,15 @@ public:
 
     u16 CodeRead16(u32 addr)
     {
+        if ((addr & CodeMemRegionMask) == CodeMemRegion) return *(u16*)&CodeMem.Mem[addr & CodeMem.Mask];
+
         return NDS::ARM7Read16(addr);
     }
 
     u32 CodeRead32(u32 addr)
     {
+        if ((addr & CodeMemRegionMask) == CodeMemRegion) return *(u32*)&CodeMem.Mem[addr & CodeMem.Mask];
+
         return NDS::ARM7Read32(addr);
     }
 
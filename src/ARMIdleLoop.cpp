@@ -0,0 +1,428 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "Config.h"
+#include "NDS.h"
+#include "ARM.h"
+#include "ARMIdleLoop.h"
+
+
+namespace ARMIdleLoop
+{
+
+// how it works
+//
+// on every short backwards jump, the register state is compared to the one
+// from the previous jump. if they're identical, the loop body went around
+// without changing anything. if it also doesn't store anything, and only
+// reads memory that can't change before the next scheduler event (or before
+// the other CPU gets to run), it's going to keep doing that until the target.
+//
+// loads must use a base register the loop doesn't modify, so the addresses
+// they read are known from the current registers.
+
+typedef struct
+{
+    u32 Start, End;
+    u32 R[16];
+    u32 CPSR;
+
+} Snapshot;
+
+typedef struct
+{
+    int Base; // -1: absolute address
+    s32 Offset;
+    u32 Size;
+
+} LoadInfo;
+
+const int kMaxLoads = 8;
+
+typedef struct
+{
+    int NumLoads;
+    LoadInfo Loads[kMaxLoads];
+    u16 Written;
+
+} LoopInfo;
+
+bool Enabled;
+
+u64 CyclesSkipped[2];
+u32 NumSkips[2];
+
+Snapshot LastJump[2];
+
+
+void Reset()
+{
+    Enabled = (Config::IdleLoopSkip != 0);
+
+    memset(CyclesSkipped, 0, sizeof(CyclesSkipped));
+    memset(NumSkips, 0, sizeof(NumSkips));
+    memset(LastJump, 0, sizeof(LastJump));
+}
+
+void PrintStats()
+{
+    if (!NumSkips[0] && !NumSkips[1]) return;
+
+    printf("idle loops: ARM9 skipped %llu cycles in %u loops, ARM7 skipped %llu cycles in %u loops\n",
+           (unsigned long long)CyclesSkipped[0], NumSkips[0],
+           (unsigned long long)CyclesSkipped[1], NumSkips[1]);
+}
+
+
+bool AddLoad(LoopInfo* info, int base, s32 offset, u32 size)
+{
+    if (info->NumLoads >= kMaxLoads) return false;
+
+    LoadInfo* load = &info->Loads[info->NumLoads++];
+    load->Base = base;
+    load->Offset = offset;
+    load->Size = size;
+    return true;
+}
+
+bool IsExitOrLoop(u32 target, u32 start, u32 end, bool last)
+{
+    if (last) return target == start;
+    return target < start || target > end;
+}
+
+bool AnalyzeARM(u32 instr, u32 addr, u32 start, u32 end, LoopInfo* info)
+{
+    bool last = (addr == end);
+    u32 cond = instr >> 28;
+    if (cond == 0xF) return false;
+
+    if ((instr & 0x0E000000) == 0x0A000000) // B
+    {
+        if (instr & (1<<24)) return false; // BL
+
+        s32 offset = (s32)(instr << 8) >> 6;
+        return IsExitOrLoop(addr + 8 + offset, start, end, last);
+    }
+    if (last) return false;
+
+    int rd = (instr >> 12) & 0xF;
+    int rn = (instr >> 16) & 0xF;
+
+    if ((instr & 0x0E000090) == 0x00000090) // multiplies, halfword transfers
+    {
+        if ((instr & 0x60) == 0)
+        {
+            if ((instr & 0x0F000000) != 0) return false; // SWP
+
+            if (instr & (1<<23)) // long multiply
+            {
+                if (rd == 15 || rn == 15) return false;
+                info->Written |= (1 << rd) | (1 << rn);
+            }
+            else
+            {
+                if (rn == 15) return false;
+                info->Written |= (1 << rn);
+            }
+            return true;
+        }
+
+        // only pre-indexed loads with an immediate offset and no writeback
+        if ((instr & 0x01700000) != 0x01500000) return false;
+        if (rd == 15) return false;
+
+        s32 offset = (instr & 0xF) | ((instr >> 4) & 0xF0);
+        if (!(instr & (1<<23))) offset = -offset;
+        u32 size = ((instr & 0x60) == 0x40) ? 1 : 2;
+
+        info->Written |= (1 << rd);
+        if (rn == 15) return AddLoad(info, -1, addr + 8 + offset, size);
+        return AddLoad(info, rn, offset, size);
+    }
+
+    if ((instr & 0x0C000000) == 0x00000000) // data processing
+    {
+        u32 op = (instr >> 21) & 0xF;
+        bool s = !!(instr & (1<<20));
+
+        if (op >= 0x8 && op <= 0xB && !s)
+        {
+            // MRS is fine, everything else in there isn't
+            if ((instr & 0x0FBF0FFF) != 0x010F0000) return false;
+            if (rd == 15) return false;
+            info->Written |= (1 << rd);
+            return true;
+        }
+
+        if (op >= 0x8 && op <= 0xB) return true;
+        if (rd == 15) return false;
+        info->Written |= (1 << rd);
+        return true;
+    }
+
+    if ((instr & 0x0C000000) == 0x04000000) // LDR/STR
+    {
+        // same deal, no register offsets
+        if ((instr & 0x03300000) != 0x01100000) return false;
+        if (rd == 15) return false;
+
+        s32 offset = instr & 0xFFF;
+        if (!(instr & (1<<23))) offset = -offset;
+        u32 size = (instr & (1<<22)) ? 1 : 4;
+
+        info->Written |= (1 << rd);
+        if (rn == 15) return AddLoad(info, -1, addr + 8 + offset, size);
+        return AddLoad(info, rn, offset, size);
+    }
+
+    return false;
+}
+
+bool AnalyzeTHUMB(u32 instr, u32 addr, u32 start, u32 end, LoopInfo* info)
+{
+    bool last = (addr == end);
+    instr &= 0xFFFF;
+
+    if ((instr & 0xF000) == 0xD000) // conditional branch
+    {
+        if ((instr & 0x0F00) >= 0x0E00) return false; // SWI, undefined
+
+        s32 offset = (s32)(instr << 24) >> 23;
+        return IsExitOrLoop(addr + 4 + offset, start, end, last);
+    }
+    if ((instr & 0xF800) == 0xE000) // B
+    {
+        s32 offset = (s32)((instr & 0x7FF) << 21) >> 20;
+        return IsExitOrLoop(addr + 4 + offset, start, end, last);
+    }
+    if (last) return false;
+
+    switch (instr >> 11)
+    {
+    case 0x00: case 0x01: case 0x02: // shifts
+    case 0x03: // add/sub
+        info->Written |= (1 << (instr & 0x7));
+        return true;
+
+    case 0x04: case 0x06: case 0x07: // MOV/ADD/SUB imm
+        info->Written |= (1 << ((instr >> 8) & 0x7));
+        return true;
+    case 0x05: // CMP imm
+        return true;
+
+    case 0x08:
+        if (!(instr & 0x0400)) // ALU ops
+        {
+            u32 op = (instr >> 6) & 0xF;
+            if (op != 0x8 && op != 0xA && op != 0xB)
+                info->Written |= (1 << (instr & 0x7));
+            return true;
+        }
+        else // hi register ops
+        {
+            u32 op = (instr >> 8) & 0x3;
+            int rd = (instr & 0x7) | ((instr >> 4) & 0x8);
+            if (op == 3) return false; // BX/BLX
+            if (op == 1) return true; // CMP
+            if (rd == 15) return false;
+            info->Written |= (1 << rd);
+            return true;
+        }
+
+    case 0x09: // LDR PC-relative
+        info->Written |= (1 << ((instr >> 8) & 0x7));
+        return AddLoad(info, -1, ((addr + 4) & ~0x2) + ((instr & 0xFF) << 2), 4);
+
+    case 0x0D: // LDR imm
+        info->Written |= (1 << (instr & 0x7));
+        return AddLoad(info, (instr >> 3) & 0x7, ((instr >> 6) & 0x1F) << 2, 4);
+    case 0x0F: // LDRB imm
+        info->Written |= (1 << (instr & 0x7));
+        return AddLoad(info, (instr >> 3) & 0x7, (instr >> 6) & 0x1F, 1);
+    case 0x11: // LDRH imm
+        info->Written |= (1 << (instr & 0x7));
+        return AddLoad(info, (instr >> 3) & 0x7, ((instr >> 6) & 0x1F) << 1, 2);
+    case 0x13: // LDR SP-relative
+        info->Written |= (1 << ((instr >> 8) & 0x7));
+        return AddLoad(info, 13, (instr & 0xFF) << 2, 4);
+
+    case 0x14: case 0x15: // ADD PC/SP
+        info->Written |= (1 << ((instr >> 8) & 0x7));
+        return true;
+
+    case 0x16: // ADD SP imm
+        if ((instr & 0x0700) != 0) return false;
+        info->Written |= (1 << 13);
+        return true;
+    }
+
+    return false;
+}
+
+// only code that lives in memory we can read without side effects
+bool CanReadCode(ARM* cpu, u32 addr)
+{
+    if (cpu->Num == 0)
+    {
+        if (addr < ((ARMv5*)cpu)->ITCMSize) return true;
+        u32 region = addr >> 24;
+        return region == 0x02 || region == 0x03 || (addr & 0xFFFF0000) == 0xFFFF0000;
+    }
+    else
+    {
+        if (addr < 0x4000) return true;
+        u32 region = addr >> 24;
+        return region == 0x02 || region == 0x03;
+    }
+}
+
+u32 ReadCode(ARM* cpu, u32 addr, bool thumb)
+{
+    if (cpu->Num == 0)
+    {
+        ARMv5* arm9 = (ARMv5*)cpu;
+        s32 oldcycles = arm9->CodeCycles;
+        u32 ret = arm9->CodeRead32(addr & ~0x3, false);
+        arm9->CodeCycles = oldcycles;
+
+        if (thumb && (addr & 0x2)) ret >>= 16;
+        return ret;
+    }
+    else
+    {
+        ARMv4* arm7 = (ARMv4*)cpu;
+        if (thumb) return arm7->CodeRead16(addr);
+        return arm7->CodeRead32(addr);
+    }
+}
+
+bool Analyze(ARM* cpu, u32 start, u32 end, bool thumb, LoopInfo* info)
+{
+    if (!CanReadCode(cpu, start) || !CanReadCode(cpu, end)) return false;
+
+    info->NumLoads = 0;
+    info->Written = 0;
+
+    u32 size = thumb ? 2 : 4;
+    for (u32 addr = start; addr <= end; addr += size)
+    {
+        u32 instr = ReadCode(cpu, addr, thumb);
+        bool ok = thumb ? AnalyzeTHUMB(instr, addr, start, end, info)
+                        : AnalyzeARM(instr, addr, start, end, info);
+        if (!ok) return false;
+    }
+
+    return true;
+}
+
+// registers that only change on scheduler events, or when the other CPU runs
+// counters and FIFO receive registers aren't in there
+const u32 PollableIO[][2] =
+{
+    {0x04000004, 4}, // DISPSTAT, VCOUNT
+    {0x040000B0, 0x30}, // DMA
+    {0x04000130, 2}, // KEYINPUT
+    {0x04000136, 2}, // EXTKEYIN
+    {0x04000180, 2}, // IPCSYNC
+    {0x04000184, 2}, // IPCFIFOCNT
+    {0x04000208, 4}, // IME
+    {0x04000210, 8}, // IE, IF
+    {0x04000600, 4}, // GXSTAT
+};
+
+bool IsPollable(ARM* cpu, u32 addr, u32 size)
+{
+    addr &= ~(size-1);
+
+    switch (addr >> 24)
+    {
+    case 0x02:
+    case 0x03:
+        return true;
+
+    case 0x04:
+        for (u32 i = 0; i < sizeof(PollableIO)/sizeof(PollableIO[0]); i++)
+        {
+            if (addr >= PollableIO[i][0] && (addr + size) <= (PollableIO[i][0] + PollableIO[i][1]))
+                return true;
+        }
+        return false;
+    }
+
+    if (cpu->Num == 0)
+    {
+        ARMv5* arm9 = (ARMv5*)cpu;
+        if (addr < arm9->ITCMSize) return true;
+        if (addr >= arm9->DTCMBase && addr < (arm9->DTCMBase + arm9->DTCMSize)) return true;
+    }
+
+    return false;
+}
+
+void CheckLoop(ARM* cpu, u32 addr)
+{
+    Snapshot* last = &LastJump[cpu->Num];
+
+    // a pending IRQ ends the loop, skipping ahead would keep it from being taken
+    if (cpu->IRQ && !(cpu->CPSR & 0x80)) return;
+
+    bool thumb = !!(cpu->CPSR & 0x20);
+    if (thumb != !!(addr & 0x1)) return;
+
+    u32 start = addr & ~0x1;
+    u32 end = cpu->R[15] - (thumb ? 4 : 8);
+
+    if (last->Start != start || last->End != end ||
+        last->CPSR != cpu->CPSR || memcmp(last->R, cpu->R, sizeof(last->R)))
+    {
+        last->Start = start;
+        last->End = end;
+        last->CPSR = cpu->CPSR;
+        memcpy(last->R, cpu->R, sizeof(last->R));
+        return;
+    }
+
+    // went around without changing anything
+    // the analysis isn't kept around since the code could be overwritten
+    LoopInfo info;
+    if (!Analyze(cpu, start, end, thumb, &info))
+        return;
+
+    for (int i = 0; i < info.NumLoads; i++)
+    {
+        LoadInfo* load = &info.Loads[i];
+        u32 loadaddr = load->Offset;
+
+        if (load->Base >= 0)
+        {
+            if (info.Written & (1 << load->Base)) return;
+            loadaddr += cpu->R[load->Base];
+        }
+
+        if (!IsPollable(cpu, loadaddr, load->Size))
+            return;
+    }
+
+    // stop here, the Execute() loop will skip ahead
+    cpu->Halted = 3;
+}
+
+}
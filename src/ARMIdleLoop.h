@@ -0,0 +1,50 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef ARMIDLELOOP_H
+#define ARMIDLELOOP_H
+
+#include "types.h"
+
+class ARM;
+
+namespace ARMIdleLoop
+{
+
+// loops that just poll memory, like waiting for VCOUNT or IPCSYNC to change,
+// can't end before something else happens. once one is caught going around
+// without changing anything, the CPU skips ahead to its target like when halted
+
+// short backwards jumps are looked at
+const u32 kMaxLoopSize = 0x40;
+
+extern bool Enabled;
+
+// stats for the current title, cleared on reset
+extern u64 CyclesSkipped[2];
+extern u32 NumSkips[2];
+
+void Reset();
+void PrintStats();
+
+// called by JumpTo() for jumps at most kMaxLoopSize bytes backwards
+void CheckLoop(ARM* cpu, u32 addr);
+
+}
+
+#endif // ARMIDLELOOP_H
@@ -0,0 +1,486 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "Config.h"
+#include "NDS.h"
+#include "ARM.h"
+#include "ARMJIT.h"
+#include "ARMJIT_x64.h"
+#include "ARMJIT_CachedInterp.h"
+
+
+namespace ARMJIT
+{
+
+// block cache notes
+//
+// blocks are looked up by start address, THUMB bit and, for the ARM9, the code
+// timing that was in effect (RegionCodeCycles), since cycle counts get baked in.
+//
+// each block covers a range of canonical memory: its instructions plus the two
+// words the pipeline holds when leaving it. blocks are registered in all the
+// 512-byte pages that range touches, so writes to code memory can find them.
+//
+// mapping changes (shared WRAM, ITCM size) drop the blocks whose virtual
+// address is affected.
+
+typedef struct
+{
+    u32 Num;
+    u64 Key;
+    u32 StartAddr;
+    u32 CanonStart, CanonEnd;
+    u32 Pipeline[2];
+    JitBlockEntry Entry;
+    void* Cached; // cached interpreter data, if that's what we're using
+
+} Block;
+
+typedef struct
+{
+    u64 Key;
+    Block* Blk;
+
+} FastEntry;
+
+const u32 kFastTableSize = 0x1000;
+
+bool Available;
+bool Enabled;
+bool Recompiling;
+int MaxBlockSize;
+
+u32 CodePageMap[kCodePageCount];
+u8 ExitRequest;
+
+std::unordered_map<u64, Block*> BlockMap[2];
+std::vector<Block*> PageBlocks[kCodePageCount];
+FastEntry FastTable[2][kFastTableSize];
+
+
+bool Init()
+{
+    Available = ARMJIT_x64::Init();
+    if (!Available)
+        printf("JIT: recompiler not available, only the cached interpreter can be used\n");
+
+    Enabled = false;
+    Recompiling = false;
+    MaxBlockSize = 32;
+
+    memset(CodePageMap, 0, sizeof(CodePageMap));
+    memset(FastTable, 0, sizeof(FastTable));
+
+    return true;
+}
+
+void DeInit()
+{
+    InvalidateAll();
+
+    if (Available)
+        ARMJIT_x64::DeInit();
+}
+
+void Reset()
+{
+    InvalidateAll();
+
+    if (Available)
+        ARMJIT_x64::Reset();
+
+    Enabled = (Config::JIT_Enable != 0);
+    if (Enabled && Config::ThreadedARM7)
+    {
+        // both CPUs share the block cache, which isn't safe to use from two threads
+        printf("JIT: not available with the threaded ARM7, using the interpreter\n");
+        Enabled = false;
+    }
+    Recompiling = Enabled && Available && (Config::JIT_CachedInterp == 0);
+
+    MaxBlockSize = Config::JIT_MaxBlockSize;
+    if (MaxBlockSize < 1) MaxBlockSize = 1;
+    else if (MaxBlockSize > kMaxBlockSize) MaxBlockSize = kMaxBlockSize;
+}
+
+
+bool TranslateAddr(ARM* cpu, u32 addr, u32* canon)
+{
+    if (cpu->Num == 0)
+    {
+        if (addr < ((ARMv5*)cpu)->ITCMSize)
+        {
+            *canon = Canon_ITCM + (addr & 0x7FFF);
+            return true;
+        }
+
+        switch (addr & 0xFF000000)
+        {
+        case 0x02000000:
+            *canon = Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1));
+            return true;
+
+        case 0x03000000:
+            if (!NDS::SWRAM_ARM9) return false;
+            *canon = Canon_SWRAM + (NDS::SWRAM_ARM9 - NDS::SharedWRAM) + (addr & NDS::SWRAM_ARM9Mask);
+            return true;
+
+        case 0xFF000000:
+            if ((addr & 0xFFFFF000) != 0xFFFF0000) return false;
+            *canon = Canon_ARM9BIOS + (addr & 0xFFF);
+            return true;
+        }
+    }
+    else
+    {
+        if (addr < 0x00004000)
+        {
+            *canon = Canon_ARM7BIOS + addr;
+            return true;
+        }
+
+        switch (addr & 0xFF800000)
+        {
+        case 0x02000000:
+        case 0x02800000:
+            *canon = Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1));
+            return true;
+
+        case 0x03000000:
+            if (NDS::SWRAM_ARM7)
+                *canon = Canon_SWRAM + (NDS::SWRAM_ARM7 - NDS::SharedWRAM) + (addr & NDS::SWRAM_ARM7Mask);
+            else
+                *canon = Canon_ARM7WRAM + (addr & 0xFFFF);
+            return true;
+
+        case 0x03800000:
+            *canon = Canon_ARM7WRAM + (addr & 0xFFFF);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+u8* CanonPtr(ARM* cpu, u32 canon)
+{
+    if (canon < Canon_SWRAM)    return &NDS::MainRAM[canon - Canon_MainRAM];
+    if (canon < Canon_ARM7WRAM) return &NDS::SharedWRAM[canon - Canon_SWRAM];
+    if (canon < Canon_ITCM)     return &NDS::ARM7WRAM[canon - Canon_ARM7WRAM];
+    if (canon < Canon_ARM9BIOS) return &((ARMv5*)cpu)->ITCM[canon - Canon_ITCM];
+    if (canon < Canon_ARM7BIOS) return &NDS::ARM9BIOS[canon - Canon_ARM9BIOS];
+    return &NDS::ARM7BIOS[canon - Canon_ARM7BIOS];
+}
+
+// instruction word as it would end up in CurInstr
+// the ARM9 fetches THUMB code 32 bits at a time, so the upper half may hold the next opcode
+u32 FetchInstr(ARM* cpu, u32 addr, u32 canon, bool thumb)
+{
+    u8* ptr = CanonPtr(cpu, canon);
+
+    if (!thumb || (cpu->Num == 0 && !(addr & 0x2)))
+        return *(u32*)ptr;
+
+    return *(u16*)ptr;
+}
+
+// whether the instruction is likely to leave the block
+// this is only used to decide where blocks end. the generated code checks
+// whether R15 went somewhere else after each interpreted instruction.
+bool IsBranch(u32 instr, bool thumb)
+{
+    if (thumb)
+    {
+        if ((instr & 0xF000) == 0xD000) return true; // conditional branch, SWI
+        if ((instr & 0xE000) == 0xE000 && (instr & 0x1800) != 0x1000) return true; // B, BL/BLX second half
+        if ((instr & 0xFF00) == 0x4700) return true; // BX, BLX
+        if ((instr & 0xFF00) == 0xBD00) return true; // POP with PC
+        if ((instr & 0xFC00) == 0x4400 && (instr & 0x0300) != 0x0100 &&
+            ((instr & 0x7) | ((instr >> 4) & 0x8)) == 15) return true; // ADD/MOV to PC
+
+        return false;
+    }
+    else
+    {
+        if ((instr & 0xF0000000) == 0xF0000000) return true; // BLX
+        if ((instr & 0x0E000000) == 0x0A000000) return true; // B, BL
+        if ((instr & 0x0FFFFFD0) == 0x012FFF10) return true; // BX, BLX
+        if ((instr & 0x0F000000) == 0x0F000000) return true; // SWI
+        if ((instr & 0x0E108000) == 0x08108000) return true; // LDM with PC
+        if ((instr & 0x0C000000) == 0x04000000 && ((instr >> 12) & 0xF) == 15) return true; // LDR/STR to PC
+        if ((instr & 0x0C000000) == 0x00000000 && ((instr >> 12) & 0xF) == 15) return true; // ALU ops to PC
+
+        return false;
+    }
+}
+
+void AddBlockToPages(Block* blk)
+{
+    for (u32 p = blk->CanonStart >> kCodePageShift; p <= ((blk->CanonEnd - 1) >> kCodePageShift); p++)
+    {
+        PageBlocks[p].push_back(blk);
+        CodePageMap[p]++;
+    }
+}
+
+void RemoveBlockFromPages(Block* blk)
+{
+    for (u32 p = blk->CanonStart >> kCodePageShift; p <= ((blk->CanonEnd - 1) >> kCodePageShift); p++)
+    {
+        std::vector<Block*>& list = PageBlocks[p];
+        for (size_t i = 0; i < list.size(); i++)
+        {
+            if (list[i] == blk)
+            {
+                list[i] = list.back();
+                list.pop_back();
+                break;
+            }
+        }
+        CodePageMap[p]--;
+    }
+}
+
+Block* CompileBlock(ARM* cpu, u32 pc, bool thumb, u64 key)
+{
+    u32 size = thumb ? 2 : 4;
+
+    u32 canonstart;
+    if (!TranslateAddr(cpu, pc, &canonstart)) return NULL;
+
+    BlockInfo info;
+    info.Num = cpu->Num;
+    info.Thumb = thumb;
+    info.StartAddr = pc;
+
+    // fetch as far as the memory is contiguous
+    int numfetched = 0;
+    for (int i = 0; i < MaxBlockSize+2; i++)
+    {
+        u32 addr = pc + i*size;
+        u32 canon;
+        if (!TranslateAddr(cpu, addr, &canon)) break;
+        if (canon != canonstart + i*size) break;
+
+        info.Instr[i] = FetchInstr(cpu, addr, canon, thumb);
+        numfetched++;
+    }
+
+    // the two words after the last instruction need to be there too
+    int limit = std::min(MaxBlockSize, numfetched-2);
+    int numinstrs = 0;
+    while (numinstrs < limit)
+    {
+        numinstrs++;
+        if (IsBranch(info.Instr[numinstrs-1], thumb)) break;
+    }
+
+    if (numinstrs < 1) return NULL;
+    info.NumInstrs = numinstrs;
+
+    if (cpu->Num == 0)
+    {
+        // let CodeRead32() figure out the timings for the prefetches
+        ARMv5* arm9 = (ARMv5*)cpu;
+        s32 oldcycles = arm9->CodeCycles;
+
+        for (int i = 0; i < numinstrs; i++)
+        {
+            u32 fetchaddr = pc + (i+2)*size;
+
+            if (thumb && (fetchaddr & 0x2))
+                info.CodeCycles[i] = 0;
+            else
+            {
+                arm9->CodeRead32(fetchaddr, false);
+                info.CodeCycles[i] = arm9->CodeCycles;
+            }
+        }
+
+        arm9->CodeCycles = oldcycles;
+    }
+
+    if (Recompiling && !ARMJIT_x64::HasSpace())
+    {
+        printf("JIT: code buffer full, flushing\n");
+        InvalidateAll();
+        ARMJIT_x64::Reset();
+    }
+
+    Block* blk = new Block;
+    blk->Num = cpu->Num;
+    blk->Key = key;
+    blk->StartAddr = pc;
+    blk->CanonStart = canonstart;
+    blk->CanonEnd = canonstart + (numinstrs+2)*size;
+    blk->Pipeline[0] = info.Instr[0];
+    blk->Pipeline[1] = info.Instr[1];
+    if (Recompiling)
+    {
+        blk->Entry = ARMJIT_x64::CompileBlock(cpu, &info);
+        blk->Cached = NULL;
+    }
+    else
+    {
+        blk->Entry = ARMJIT_CachedInterp::RunBlock;
+        blk->Cached = ARMJIT_CachedInterp::CompileBlock(cpu, &info);
+        if (!blk->Cached)
+        {
+            delete blk;
+            return NULL;
+        }
+    }
+
+    BlockMap[cpu->Num][key] = blk;
+    AddBlockToPages(blk);
+
+    return blk;
+}
+
+// the words already in the pipeline might have been overwritten since they
+// were fetched. in that case the interpreter has to run the stale copies
+inline JitBlockEntry EnterBlock(ARM* cpu, Block* blk)
+{
+    if (cpu->NextInstr[0] != blk->Pipeline[0] || cpu->NextInstr[1] != blk->Pipeline[1])
+        return NULL;
+
+    ARMJIT_CachedInterp::CurBlock[cpu->Num] = blk->Cached;
+    return blk->Entry;
+}
+
+JitBlockEntry LookUpBlock(ARM* cpu)
+{
+    bool thumb = !!(cpu->CPSR & 0x20);
+    u32 pc = cpu->R[15] - (thumb ? 2 : 4);
+
+    u64 key = pc | (thumb ? 1 : 0);
+    if (cpu->Num == 0)
+        key |= ((u64)(u8)((ARMv5*)cpu)->RegionCodeCycles) << 32;
+
+    ExitRequest = 0;
+
+    FastEntry* fast = &FastTable[cpu->Num][(pc >> 1) & (kFastTableSize-1)];
+    if (fast->Blk && fast->Key == key)
+        return EnterBlock(cpu, fast->Blk);
+
+    Block* blk;
+    std::unordered_map<u64, Block*>::iterator it = BlockMap[cpu->Num].find(key);
+    if (it != BlockMap[cpu->Num].end())
+        blk = it->second;
+    else
+    {
+        blk = CompileBlock(cpu, pc, thumb, key);
+        if (!blk) return NULL;
+    }
+
+    fast->Key = key;
+    fast->Blk = blk;
+    return EnterBlock(cpu, blk);
+}
+
+
+void FreeBlock(Block* blk)
+{
+    if (blk->Cached)
+        ARMJIT_CachedInterp::FreeBlock(blk->Cached);
+
+    delete blk;
+}
+
+void InvalidateBlock(Block* blk)
+{
+    RemoveBlockFromPages(blk);
+    BlockMap[blk->Num].erase(blk->Key);
+
+    FastEntry* fast = &FastTable[blk->Num][(blk->StartAddr >> 1) & (kFastTableSize-1)];
+    if (fast->Blk == blk) fast->Blk = NULL;
+
+    FreeBlock(blk);
+
+    // the block being run might be one of those
+    ExitRequest = 1;
+}
+
+void InvalidateByCanonAddr(u32 canon)
+{
+    canon &= ~0x3;
+
+    std::vector<Block*>& list = PageBlocks[canon >> kCodePageShift];
+    for (size_t i = 0; i < list.size(); )
+    {
+        Block* blk = list[i];
+        if (canon+4 > blk->CanonStart && canon < blk->CanonEnd)
+            InvalidateBlock(blk); // removes it from the list
+        else
+            i++;
+    }
+}
+
+// ARM9 ICache line invalidation. code writes are tracked anyway, but software
+// doing this means the code there is going to change
+void InvalidateCacheLine(ARM* cpu, u32 addr)
+{
+    addr &= ~0x1F;
+
+    u32 canon;
+    if (!TranslateAddr(cpu, addr, &canon)) return;
+
+    for (u32 i = 0; i < 0x20; i += 4)
+        CheckAndInvalidate(canon + i);
+}
+
+void InvalidateVirtualRange(u32 num, u32 start, u32 end)
+{
+    std::vector<Block*> todelete;
+
+    for (std::unordered_map<u64, Block*>::iterator it = BlockMap[num].begin(); it != BlockMap[num].end(); it++)
+    {
+        Block* blk = it->second;
+        if (blk->StartAddr >= start && blk->StartAddr < end)
+            todelete.push_back(blk);
+    }
+
+    for (size_t i = 0; i < todelete.size(); i++)
+        InvalidateBlock(todelete[i]);
+}
+
+void InvalidateAll()
+{
+    for (int num = 0; num < 2; num++)
+    {
+        for (std::unordered_map<u64, Block*>::iterator it = BlockMap[num].begin(); it != BlockMap[num].end(); it++)
+            FreeBlock(it->second);
+
+        BlockMap[num].clear();
+    }
+
+    for (u32 i = 0; i < kCodePageCount; i++)
+        PageBlocks[i].clear();
+
+    memset(CodePageMap, 0, sizeof(CodePageMap));
+    memset(FastTable, 0, sizeof(FastTable));
+
+    ExitRequest = 1;
+}
+
+}
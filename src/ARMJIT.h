@@ -0,0 +1,93 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef ARMJIT_H
+#define ARMJIT_H
+
+#include "types.h"
+
+class ARM;
+
+namespace ARMJIT
+{
+
+typedef void (*JitBlockEntry)(ARM* cpu);
+
+// memory that can hold code is tracked through a flat 'canonical' address space
+// this way mirrors and the different CPU views all end up at the same place
+enum
+{
+    Canon_MainRAM  = 0x000000,
+    Canon_SWRAM    = 0x400000,
+    Canon_ARM7WRAM = 0x408000,
+    Canon_ITCM     = 0x418000,
+    Canon_ARM9BIOS = 0x420000,
+    Canon_ARM7BIOS = 0x421000,
+    Canon_End      = 0x425000
+};
+
+const u32 kCodePageShift = 9;
+const u32 kCodePageCount = Canon_End >> kCodePageShift;
+
+const int kMaxBlockSize = 64;
+
+typedef struct
+{
+    u32 Num;
+    bool Thumb;
+    u32 StartAddr;
+    int NumInstrs;
+
+    // instruction words as the interpreter would see them in CurInstr
+    // the two extra entries are what the pipeline holds after the last instruction
+    u32 Instr[kMaxBlockSize+2];
+
+    // ARM9: value of CodeCycles after the prefetch done while executing the instruction
+    s32 CodeCycles[kMaxBlockSize];
+
+} BlockInfo;
+
+extern bool Enabled;
+extern int MaxBlockSize;
+
+// nonzero for pages that are part of atleast one compiled block
+extern u32 CodePageMap[kCodePageCount];
+
+// set when blocks got invalidated, so that the running block bails out
+extern u8 ExitRequest;
+
+bool Init();
+void DeInit();
+void Reset();
+
+JitBlockEntry LookUpBlock(ARM* cpu);
+
+void InvalidateByCanonAddr(u32 canon);
+void InvalidateVirtualRange(u32 num, u32 start, u32 end);
+void InvalidateCacheLine(ARM* cpu, u32 addr);
+void InvalidateAll();
+
+inline void CheckAndInvalidate(u32 canon)
+{
+    if (CodePageMap[canon >> kCodePageShift])
+        InvalidateByCanonAddr(canon);
+}
+
+}
+
+#endif // ARMJIT_H
@@ -0,0 +1,161 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "NDS.h"
+#include "ARM.h"
+#include "ARMInterpreter.h"
+#include "ARMJIT_CachedInterp.h"
+
+
+namespace ARMJIT_CachedInterp
+{
+
+typedef struct
+{
+    void (*Handler)(ARM* cpu); // NULL: never executed, only costs a code fetch
+    u32 Instr;
+    u8 Cond;
+    s8 CodeCycles;
+
+} CachedInstr;
+
+typedef struct
+{
+    u32 StartAddr;
+    u32 Size;
+    int NumInstrs;
+
+    // the two extra entries are only there for the pipeline words
+    CachedInstr Instrs[1];
+
+} CachedBlock;
+
+void* CurBlock[2];
+
+
+void* CompileBlock(ARM* cpu, ARMJIT::BlockInfo* info)
+{
+    int n = info->NumInstrs;
+    CachedBlock* blk = (CachedBlock*)malloc(sizeof(CachedBlock) + (n+1)*sizeof(CachedInstr));
+    if (!blk) return NULL;
+
+    blk->StartAddr = info->StartAddr;
+    blk->Size = info->Thumb ? 2 : 4;
+    blk->NumInstrs = n;
+
+    for (int i = 0; i < n+2; i++)
+    {
+        CachedInstr* ci = &blk->Instrs[i];
+        u32 instr = info->Instr[i];
+
+        ci->Instr = instr;
+        ci->CodeCycles = (i < n && cpu->Num == 0) ? info->CodeCycles[i] : 0;
+        ci->Cond = 0xE;
+
+        if (i >= n)
+        {
+            ci->Handler = NULL;
+        }
+        else if (info->Thumb)
+        {
+            ci->Handler = ARMInterpreter::THUMBInstrTable[(instr >> 6) & 0x3FF];
+        }
+        else
+        {
+            u32 icode = ((instr >> 4) & 0xF) | ((instr >> 16) & 0xFF0);
+            ci->Handler = ARMInterpreter::ARMInstrTable[icode];
+            ci->Cond = instr >> 28;
+
+            // same as ARMv5/ARMv4::Execute(): condition 0xF only means something for BLX
+            if (ci->Cond == 0xF)
+            {
+                if (cpu->Num == 0 && (instr & 0xFE000000) == 0xFA000000)
+                {
+                    ci->Handler = ARMInterpreter::A_BLX_IMM;
+                    ci->Cond = 0xE;
+                }
+                else
+                    ci->Handler = NULL;
+            }
+        }
+    }
+
+    return blk;
+}
+
+void FreeBlock(void* block)
+{
+    free(block);
+}
+
+
+template <int num>
+void RunBlockCPU(ARM* cpu)
+{
+    CachedBlock* blk = (CachedBlock*)CurBlock[num];
+    u64& timestamp = num ? NDS::ARM7Timestamp : NDS::ARM9Timestamp;
+    u64& target = num ? NDS::ARM7Target : NDS::ARM9Target;
+
+    u32 size = blk->Size;
+    u32 r15 = blk->StartAddr + 2*size;
+    int last = blk->NumInstrs - 1;
+
+    for (int i = 0; i <= last; i++)
+    {
+        CachedInstr* ci = &blk->Instrs[i];
+
+        // leave everything the way the interpreter loop would have it
+        timestamp += cpu->Cycles;
+        cpu->Cycles = 0;
+
+        cpu->R[15] = r15;
+        cpu->CurInstr = ci->Instr;
+        cpu->NextInstr[0] = ci[1].Instr;
+        cpu->NextInstr[1] = ci[2].Instr;
+        if (num == 0) cpu->CodeCycles = ci->CodeCycles;
+
+        if (ci->Handler && cpu->CheckCondition(ci->Cond))
+            ci->Handler(cpu);
+        else
+            cpu->AddCycles_C();
+
+        // branched, JumpTo() took care of the pipeline
+        if (cpu->R[15] != r15)
+            return;
+
+        if (i == last)
+            return;
+
+        if (cpu->Halted || (cpu->IRQ && !(cpu->CPSR & 0x80)) || ARMJIT::ExitRequest)
+            return;
+        if (timestamp + cpu->Cycles >= target)
+            return;
+
+        r15 += size;
+    }
+}
+
+void RunBlock(ARM* cpu)
+{
+    if (cpu->Num == 0) RunBlockCPU<0>(cpu);
+    else               RunBlockCPU<1>(cpu);
+}
+
+}
@@ -0,0 +1,40 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef ARMJIT_CACHEDINTERP_H
+#define ARMJIT_CACHEDINTERP_H
+
+#include "ARMJIT.h"
+
+namespace ARMJIT_CachedInterp
+{
+
+// decodes a block once, then replays it through the interpreter handlers
+// works on any host, and is what the JIT uses when there's no recompiler
+
+void* CompileBlock(ARM* cpu, ARMJIT::BlockInfo* info);
+void FreeBlock(void* block);
+
+// the block LookUpBlock() picked for each CPU, RunBlock() executes it
+extern void* CurBlock[2];
+
+void RunBlock(ARM* cpu);
+
+}
+
+#endif // ARMJIT_CACHEDINTERP_H
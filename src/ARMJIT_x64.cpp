@@ -0,0 +1,1035 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64_HOST
+#endif
+
+#ifdef JIT_X64_HOST
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#include "NDS.h"
+#include "ARM.h"
+#include "ARMInterpreter.h"
+#include "ARMInterpreter_ALU.h"
+#include "ARMJIT_x64.h"
+
+
+// x86-64 backend for the JIT
+//
+// blocks are plain functions taking the ARM object. guest registers live in the
+// ARM object at all times, which keeps things simple: any instruction we can't
+// translate is handed to the interpreter, with CurInstr/R15/CodeCycles set up the
+// way the interpreter loop would have. only simple ALU ops are translated for now.
+//
+// cycle counting is the same as the interpreter's. Cycles gets flushed to the
+// timestamp before each interpreter call, so timers and the like see the same
+// values. the block is left after an interpreter call if something happened
+// that requires going back to NDS::RunFrame (halt, IRQ, reaching the target,
+// branching, code invalidation).
+//
+// register usage:
+// RBX: ARM object
+// RAX, RCX, RDX: scratch
+// R8-R11: flags (C, N, Z, V)
+
+namespace ARMJIT_x64
+{
+
+#ifdef JIT_X64_HOST
+
+const u32 kCodeBufferSize = 32 * 1024 * 1024;
+const u32 kMaxBlockCodeSize = 64 * 1024;
+
+u8* CodeBuffer = NULL;
+u8* CodePtr;
+
+enum
+{
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11
+};
+
+enum
+{
+    CC_O = 0, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A, CC_S, CC_NS
+};
+
+enum
+{
+    ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7
+};
+
+enum
+{
+    SH_ROR = 1, SH_SHL = 4, SH_SHR = 5, SH_SAR = 7
+};
+
+typedef struct
+{
+    int Op;         // ARM data-processing opcode
+    bool S;
+    int Rd;         // -1 for comparisons
+    int Rn;         // -1: use RnVal instead
+    u32 RnVal;
+
+    bool Op2Imm;
+    u32 Imm;
+    int Rm;         // -1: use RmVal instead
+    u32 RmVal;
+    int ShiftType;
+    int ShiftAmount;
+    bool ShiftCarry; // whether the shifter carry-out goes to the C flag
+
+} ALUOp;
+
+ARM* CurCPU;
+ARMJIT::BlockInfo* CurBlock;
+
+s32 OffR, OffCPSR, OffCycles, OffCodeCycles, OffCurInstr, OffNextInstr, OffHalted, OffIRQ;
+
+u64* Timestamp;
+u64* Target;
+
+// cycles from translated instructions that haven't been added to Cycles yet
+// ARM9: cycle count. ARM7: number of code fetches, as those depend on CodeCycles
+s32 PendingCycles;
+
+std::vector<u8*> ExitNoFillJumps;
+std::vector<std::pair<u8*, int> > ExitJumps;
+
+
+void Emit8(u8 val)
+{
+    *CodePtr++ = val;
+}
+
+void Emit32(u32 val)
+{
+    memcpy(CodePtr, &val, 4);
+    CodePtr += 4;
+}
+
+void Emit64(u64 val)
+{
+    memcpy(CodePtr, &val, 8);
+    CodePtr += 8;
+}
+
+void Rex(bool w, int reg, int rm)
+{
+    u8 rex = 0x40;
+    if (w) rex |= 0x08;
+    if (reg & 8) rex |= 0x04;
+    if (rm & 8) rex |= 0x01;
+    if (rex != 0x40) Emit8(rex);
+}
+
+void ModRMReg(int reg, int rm)
+{
+    Emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// memory operands are always relative to the ARM object
+void ModRMMem(int reg, s32 disp)
+{
+    if (disp >= -128 && disp < 128)
+    {
+        Emit8(0x40 | ((reg & 7) << 3) | RBX);
+        Emit8((u8)disp);
+    }
+    else
+    {
+        Emit8(0x80 | ((reg & 7) << 3) | RBX);
+        Emit32(disp);
+    }
+}
+
+void MOV_RegMem(int reg, s32 disp)
+{
+    Rex(false, reg, 0);
+    Emit8(0x8B);
+    ModRMMem(reg, disp);
+}
+
+void MOV_MemReg(s32 disp, int reg)
+{
+    Rex(false, reg, 0);
+    Emit8(0x89);
+    ModRMMem(reg, disp);
+}
+
+void MOV_MemImm(s32 disp, u32 imm)
+{
+    Emit8(0xC7);
+    ModRMMem(0, disp);
+    Emit32(imm);
+}
+
+void MOV_RegImm(int reg, u32 imm)
+{
+    Rex(false, 0, reg);
+    Emit8(0xB8 + (reg & 7));
+    Emit32(imm);
+}
+
+void MOV_RegImm64(int reg, u64 imm)
+{
+    Rex(true, 0, reg);
+    Emit8(0xB8 + (reg & 7));
+    Emit64(imm);
+}
+
+void MOV_RegReg(int dst, int src)
+{
+    Rex(false, src, dst);
+    Emit8(0x89);
+    ModRMReg(src, dst);
+}
+
+void ALU_RegReg(int op, int dst, int src)
+{
+    Rex(false, src, dst);
+    Emit8((op << 3) | 0x01);
+    ModRMReg(src, dst);
+}
+
+void ALU_RegImm(int op, int reg, u32 imm)
+{
+    Rex(false, 0, reg);
+    if ((s32)imm >= -128 && (s32)imm < 128)
+    {
+        Emit8(0x83);
+        ModRMReg(op, reg);
+        Emit8((u8)imm);
+    }
+    else
+    {
+        Emit8(0x81);
+        ModRMReg(op, reg);
+        Emit32(imm);
+    }
+}
+
+void ALU_MemImm(int op, s32 disp, u32 imm)
+{
+    if ((s32)imm >= -128 && (s32)imm < 128)
+    {
+        Emit8(0x83);
+        ModRMMem(op, disp);
+        Emit8((u8)imm);
+    }
+    else
+    {
+        Emit8(0x81);
+        ModRMMem(op, disp);
+        Emit32(imm);
+    }
+}
+
+void ALU_MemReg(int op, s32 disp, int reg)
+{
+    Rex(false, reg, 0);
+    Emit8((op << 3) | 0x01);
+    ModRMMem(reg, disp);
+}
+
+void SHIFT_RegImm(int op, int reg, int amount)
+{
+    Rex(false, 0, reg);
+    Emit8(0xC1);
+    ModRMReg(op, reg);
+    Emit8((u8)amount);
+}
+
+void NOT_Reg(int reg)
+{
+    Rex(false, 0, reg);
+    Emit8(0xF7);
+    ModRMReg(2, reg);
+}
+
+void TEST_RegReg(int a, int b)
+{
+    Rex(false, b, a);
+    Emit8(0x85);
+    ModRMReg(b, a);
+}
+
+void SETcc(int cc, int reg)
+{
+    Rex(false, 0, reg);
+    Emit8(0x0F);
+    Emit8(0x90 + cc);
+    ModRMReg(0, reg);
+}
+
+void MOVZX_Reg8(int dst, int src)
+{
+    Rex(false, dst, src);
+    Emit8(0x0F);
+    Emit8(0xB6);
+    ModRMReg(dst, src);
+}
+
+// jumps are always emitted with a 32-bit displacement and patched later
+u8* Jcc(int cc)
+{
+    Emit8(0x0F);
+    Emit8(0x80 + cc);
+    Emit32(0);
+    return CodePtr;
+}
+
+u8* JMP()
+{
+    Emit8(0xE9);
+    Emit32(0);
+    return CodePtr;
+}
+
+void SetJumpTarget(u8* jump, u8* target)
+{
+    s32 rel = (s32)(target - jump);
+    memcpy(jump - 4, &rel, 4);
+}
+
+void CallFunc(void* func)
+{
+#ifdef _WIN32
+    Emit8(0x48); Emit8(0x89); Emit8(0xD9); // mov rcx, rbx
+#else
+    Emit8(0x48); Emit8(0x89); Emit8(0xDF); // mov rdi, rbx
+#endif
+    MOV_RegImm64(RAX, (u64)func);
+    Emit8(0xFF); Emit8(0xD0); // call rax
+}
+
+void Prologue()
+{
+    Emit8(0x53); // push rbx
+#ifdef _WIN32
+    Emit8(0x48); Emit8(0x83); Emit8(0xEC); Emit8(0x20); // sub rsp, 32
+    Emit8(0x48); Emit8(0x89); Emit8(0xCB); // mov rbx, rcx
+#else
+    Emit8(0x48); Emit8(0x89); Emit8(0xFB); // mov rbx, rdi
+#endif
+}
+
+void Epilogue()
+{
+#ifdef _WIN32
+    Emit8(0x48); Emit8(0x83); Emit8(0xC4); Emit8(0x20); // add rsp, 32
+#endif
+    Emit8(0x5B); // pop rbx
+    Emit8(0xC3); // ret
+}
+
+
+bool Init()
+{
+#ifdef _WIN32
+    CodeBuffer = (u8*)VirtualAlloc(NULL, kCodeBufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    void* mem = mmap(NULL, kCodeBufferSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CodeBuffer = (mem == MAP_FAILED) ? NULL : (u8*)mem;
+#endif
+
+    if (!CodeBuffer)
+    {
+        printf("JIT: couldn't allocate executable memory\n");
+        return false;
+    }
+
+    CodePtr = CodeBuffer;
+    return true;
+}
+
+void DeInit()
+{
+    if (!CodeBuffer) return;
+
+#ifdef _WIN32
+    VirtualFree(CodeBuffer, 0, MEM_RELEASE);
+#else
+    munmap(CodeBuffer, kCodeBufferSize);
+#endif
+    CodeBuffer = NULL;
+}
+
+void Reset()
+{
+    CodePtr = CodeBuffer;
+}
+
+bool HasSpace()
+{
+    return (CodePtr + kMaxBlockCodeSize) <= (CodeBuffer + kCodeBufferSize);
+}
+
+
+// add 'count' code cycles the way AddCycles_C() does
+void AddCodeCycles(s32 count)
+{
+    if (!count) return;
+
+    if (CurCPU->Num == 0)
+    {
+        ALU_MemImm(ALU_ADD, OffCycles, count);
+    }
+    else
+    {
+        // movsxd rax, [rbx+CodeCycles]
+        Emit8(0x48); Emit8(0x63); ModRMMem(RAX, OffCodeCycles);
+        MOV_RegImm64(RCX, (u64)&NDS::ARM7MemTimings[0][CurBlock->Thumb ? 1 : 3]);
+        Emit8(0x0F); Emit8(0xB6); Emit8(0x04); Emit8(0x81); // movzx eax, byte [rcx+rax*4]
+        if (count > 1)
+        {
+            Emit8(0x69); Emit8(0xC0); Emit32(count); // imul eax, eax, count
+        }
+        ALU_MemReg(ALU_ADD, OffCycles, RAX);
+    }
+}
+
+void FlushCycles()
+{
+    AddCodeCycles(PendingCycles);
+    PendingCycles = 0;
+}
+
+void AddPendingCycles(int i)
+{
+    if (CurCPU->Num == 0)
+        PendingCycles += CurBlock->CodeCycles[i];
+    else
+        PendingCycles++;
+}
+
+// jump to 'skip' if the condition isn't met
+u8* CheckCondition(u32 cond)
+{
+    MOV_RegMem(RAX, OffCPSR);
+    SHIFT_RegImm(SH_SHR, RAX, 28);
+    MOV_RegImm(RCX, ARM::ConditionTable[cond]);
+    Emit8(0x0F); Emit8(0xA3); Emit8(0xC1); // bt ecx, eax
+    return Jcc(CC_AE);
+}
+
+void LoadOperand(int hostreg, int reg, u32 val)
+{
+    if (reg < 0) MOV_RegImm(hostreg, val);
+    else         MOV_RegMem(hostreg, OffR + reg*4);
+}
+
+void CompileALUOp(ALUOp* op)
+{
+    bool carry = false;
+
+    // operand 2 -> ECX, shifter carry -> R8D
+    if (op->Op2Imm)
+    {
+        MOV_RegImm(RCX, op->Imm);
+    }
+    else
+    {
+        LoadOperand(RCX, op->Rm, op->RmVal);
+
+        int s = op->ShiftAmount;
+        switch (op->ShiftType)
+        {
+        case 0: // LSL
+            if (s > 0)
+            {
+                SHIFT_RegImm(SH_SHL, RCX, s);
+                if (op->ShiftCarry) { SETcc(CC_B, R8); MOVZX_Reg8(R8, R8); carry = true; }
+            }
+            break;
+
+        case 1: // LSR
+            if (s > 0)
+            {
+                SHIFT_RegImm(SH_SHR, RCX, s);
+                if (op->ShiftCarry) { SETcc(CC_B, R8); MOVZX_Reg8(R8, R8); carry = true; }
+            }
+            else
+            {
+                if (op->ShiftCarry) { MOV_RegReg(R8, RCX); SHIFT_RegImm(SH_SHR, R8, 31); carry = true; }
+                ALU_RegReg(ALU_XOR, RCX, RCX);
+            }
+            break;
+
+        case 2: // ASR
+            if (s > 0)
+            {
+                SHIFT_RegImm(SH_SAR, RCX, s);
+                if (op->ShiftCarry) { SETcc(CC_B, R8); MOVZX_Reg8(R8, R8); carry = true; }
+            }
+            else
+            {
+                if (op->ShiftCarry) { MOV_RegReg(R8, RCX); SHIFT_RegImm(SH_SHR, R8, 31); carry = true; }
+                SHIFT_RegImm(SH_SAR, RCX, 31);
+            }
+            break;
+
+        case 3: // ROR (RRX isn't handled here)
+            SHIFT_RegImm(SH_ROR, RCX, s);
+            if (op->ShiftCarry) { SETcc(CC_B, R8); MOVZX_Reg8(R8, R8); carry = true; }
+            break;
+        }
+    }
+
+    if (op->Op != 13 && op->Op != 15)
+        LoadOperand(RAX, op->Rn, op->RnVal);
+
+    bool arith = false, sub = false;
+    switch (op->Op)
+    {
+    case 0x0: // AND
+    case 0x8: // TST
+        ALU_RegReg(ALU_AND, RAX, RCX);
+        break;
+
+    case 0x1: // EOR
+    case 0x9: // TEQ
+        ALU_RegReg(ALU_XOR, RAX, RCX);
+        break;
+
+    case 0x2: // SUB
+    case 0xA: // CMP
+        ALU_RegReg(ALU_SUB, RAX, RCX);
+        arith = true; sub = true;
+        break;
+
+    case 0x3: // RSB
+        MOV_RegReg(RDX, RCX);
+        ALU_RegReg(ALU_SUB, RDX, RAX);
+        MOV_RegReg(RAX, RDX);
+        arith = true; sub = true;
+        break;
+
+    case 0x4: // ADD
+    case 0xB: // CMN
+        ALU_RegReg(ALU_ADD, RAX, RCX);
+        arith = true;
+        break;
+
+    case 0xC: // ORR
+        ALU_RegReg(ALU_OR, RAX, RCX);
+        break;
+
+    case 0xD: // MOV
+        MOV_RegReg(RAX, RCX);
+        break;
+
+    case 0xE: // BIC
+        NOT_Reg(RCX);
+        ALU_RegReg(ALU_AND, RAX, RCX);
+        break;
+
+    case 0xF: // MVN
+        MOV_RegReg(RAX, RCX);
+        NOT_Reg(RAX);
+        break;
+    }
+
+    if (op->S)
+    {
+        u32 mask;
+        if (arith)
+        {
+            // x86 carry is a borrow for subtractions, ARM's isn't
+            SETcc(CC_O, R11);
+            SETcc(sub ? CC_AE : CC_B, R8);
+            SETcc(CC_S, R9);
+            SETcc(CC_E, R10);
+            MOVZX_Reg8(R8, R8);
+            MOVZX_Reg8(R11, R11);
+            carry = true;
+            mask = 0x0FFFFFFF;
+        }
+        else
+        {
+            TEST_RegReg(RAX, RAX);
+            SETcc(CC_S, R9);
+            SETcc(CC_E, R10);
+            mask = carry ? 0x1FFFFFFF : 0x3FFFFFFF;
+        }
+
+        MOVZX_Reg8(R9, R9);
+        MOVZX_Reg8(R10, R10);
+
+        MOV_RegMem(RDX, OffCPSR);
+        ALU_RegImm(ALU_AND, RDX, mask);
+        SHIFT_RegImm(SH_SHL, R9, 31);
+        ALU_RegReg(ALU_OR, RDX, R9);
+        SHIFT_RegImm(SH_SHL, R10, 30);
+        ALU_RegReg(ALU_OR, RDX, R10);
+        if (carry)
+        {
+            SHIFT_RegImm(SH_SHL, R8, 29);
+            ALU_RegReg(ALU_OR, RDX, R8);
+        }
+        if (arith)
+        {
+            SHIFT_RegImm(SH_SHL, R11, 28);
+            ALU_RegReg(ALU_OR, RDX, R11);
+        }
+        MOV_MemReg(OffCPSR, RDX);
+    }
+
+    if (op->Rd >= 0)
+        MOV_MemReg(OffR + op->Rd*4, RAX);
+}
+
+bool DecodeARM(u32 instr, u32 addr, ALUOp* op)
+{
+    if (instr & 0x0C000000) return false;
+
+    u32 opc = (instr >> 21) & 0xF;
+    bool s = !!(instr & (1<<20));
+
+    if (opc >= 0x8 && opc <= 0xB && !s) return false; // MRS/MSR/BX/etc
+    if (opc >= 0x5 && opc <= 0x7) return false; // ADC/SBC/RSC
+
+    if (!(instr & (1<<25)))
+    {
+        if (instr & (1<<4)) return false; // register-specified shifts, multiplies, halfword transfers
+        if (((instr >> 5) & 0x3) == 3 && !((instr >> 7) & 0x1F)) return false; // RRX
+    }
+
+    bool test = (opc >= 0x8 && opc <= 0xB);
+    bool logical = !(opc >= 0x2 && opc <= 0x4) && opc != 0xA && opc != 0xB;
+
+    int rd = (instr >> 12) & 0xF;
+    if (rd == 15 && !test) return false;
+
+    // the nocash debug hook looks at the pipeline, leave it to the interpreter
+    if (instr == 0xE1A0C00C) return false;
+
+    int rn = (instr >> 16) & 0xF;
+    int rm = instr & 0xF;
+
+    op->Op = opc;
+    op->S = s;
+    op->Rd = test ? -1 : rd;
+    op->Rn = (rn == 15) ? -1 : rn;
+    op->RnVal = addr + 8;
+
+    op->Op2Imm = !!(instr & (1<<25));
+    op->Imm = ROR(instr & 0xFF, (instr >> 7) & 0x1E);
+    op->Rm = (rm == 15) ? -1 : rm;
+    op->RmVal = addr + 8;
+    op->ShiftType = (instr >> 5) & 0x3;
+    op->ShiftAmount = (instr >> 7) & 0x1F;
+    op->ShiftCarry = s && logical;
+
+    return true;
+}
+
+void SetupThumbOp(ALUOp* op, int opc, bool s, int rd, int rn, u32 pcval)
+{
+    op->Op = opc;
+    op->S = s;
+    op->Rd = rd;
+    op->Rn = (rn == 15) ? -1 : rn;
+    op->RnVal = pcval;
+    op->Op2Imm = false;
+    op->Imm = 0;
+    op->Rm = 0;
+    op->RmVal = pcval;
+    op->ShiftType = 0;
+    op->ShiftAmount = 0;
+    op->ShiftCarry = false;
+}
+
+void SetThumbOp2Reg(ALUOp* op, int rm, u32 pcval)
+{
+    op->Op2Imm = false;
+    op->Rm = (rm == 15) ? -1 : rm;
+    op->RmVal = pcval;
+}
+
+void SetThumbOp2Imm(ALUOp* op, u32 imm)
+{
+    op->Op2Imm = true;
+    op->Imm = imm;
+}
+
+bool DecodeThumb(u32 instr, u32 addr, ALUOp* op)
+{
+    using namespace ARMInterpreter;
+
+    u32 icode = (instr >> 6) & 0x3FF;
+    void (*handler)(ARM*) = THUMBInstrTable[icode];
+    u32 pcval = addr + 4;
+
+    int r0 = instr & 0x7;
+    int r3 = (instr >> 3) & 0x7;
+    int r6 = (instr >> 6) & 0x7;
+    int r8 = (instr >> 8) & 0x7;
+    int hd = (instr & 0x7) | ((instr >> 4) & 0x8);
+    int hs = (instr >> 3) & 0xF;
+
+    if (handler == T_LSL_IMM || handler == T_LSR_IMM || handler == T_ASR_IMM)
+    {
+        SetupThumbOp(op, 0xD, true, r0, 0, pcval);
+        SetThumbOp2Reg(op, r3, pcval);
+        op->ShiftType = (handler == T_LSL_IMM) ? 0 : ((handler == T_LSR_IMM) ? 1 : 2);
+        op->ShiftAmount = (instr >> 6) & 0x1F;
+        op->ShiftCarry = true;
+    }
+    else if (handler == T_ADD_REG_ || handler == T_SUB_REG_)
+    {
+        SetupThumbOp(op, (handler == T_ADD_REG_) ? 0x4 : 0x2, true, r0, r3, pcval);
+        SetThumbOp2Reg(op, r6, pcval);
+    }
+    else if (handler == T_ADD_IMM_ || handler == T_SUB_IMM_)
+    {
+        SetupThumbOp(op, (handler == T_ADD_IMM_) ? 0x4 : 0x2, true, r0, r3, pcval);
+        SetThumbOp2Imm(op, r6);
+    }
+    else if (handler == T_MOV_IMM)
+    {
+        SetupThumbOp(op, 0xD, true, r8, 0, pcval);
+        SetThumbOp2Imm(op, instr & 0xFF);
+    }
+    else if (handler == T_CMP_IMM)
+    {
+        SetupThumbOp(op, 0xA, true, -1, r8, pcval);
+        SetThumbOp2Imm(op, instr & 0xFF);
+    }
+    else if (handler == T_ADD_IMM || handler == T_SUB_IMM)
+    {
+        SetupThumbOp(op, (handler == T_ADD_IMM) ? 0x4 : 0x2, true, r8, r8, pcval);
+        SetThumbOp2Imm(op, instr & 0xFF);
+    }
+    else if (handler == T_AND_REG || handler == T_EOR_REG || handler == T_ORR_REG || handler == T_BIC_REG)
+    {
+        int opc;
+        if      (handler == T_AND_REG) opc = 0x0;
+        else if (handler == T_EOR_REG) opc = 0x1;
+        else if (handler == T_ORR_REG) opc = 0xC;
+        else                           opc = 0xE;
+
+        SetupThumbOp(op, opc, true, r0, r0, pcval);
+        SetThumbOp2Reg(op, r3, pcval);
+    }
+    else if (handler == T_TST_REG || handler == T_CMP_REG || handler == T_CMN_REG)
+    {
+        int opc;
+        if      (handler == T_TST_REG) opc = 0x8;
+        else if (handler == T_CMP_REG) opc = 0xA;
+        else                           opc = 0xB;
+
+        SetupThumbOp(op, opc, true, -1, r0, pcval);
+        SetThumbOp2Reg(op, r3, pcval);
+    }
+    else if (handler == T_MVN_REG)
+    {
+        SetupThumbOp(op, 0xF, true, r0, 0, pcval);
+        SetThumbOp2Reg(op, r3, pcval);
+    }
+    else if (handler == T_NEG_REG)
+    {
+        SetupThumbOp(op, 0x3, true, r0, r3, pcval);
+        SetThumbOp2Imm(op, 0);
+    }
+    else if (handler == T_ADD_HIREG)
+    {
+        if (hd == 15) return false;
+        SetupThumbOp(op, 0x4, false, hd, hd, pcval);
+        SetThumbOp2Reg(op, hs, pcval);
+    }
+    else if (handler == T_CMP_HIREG)
+    {
+        SetupThumbOp(op, 0xA, true, -1, hd, pcval);
+        SetThumbOp2Reg(op, hs, pcval);
+    }
+    else if (handler == T_MOV_HIREG)
+    {
+        if (hd == 15) return false;
+        // the nocash debug hook looks at the pipeline, leave it to the interpreter
+        if ((instr & 0xFFFF) == 0x46E4) return false;
+        SetupThumbOp(op, 0xD, false, hd, 0, pcval);
+        SetThumbOp2Reg(op, hs, pcval);
+    }
+    else if (handler == T_ADD_PCREL)
+    {
+        SetupThumbOp(op, 0xD, false, r8, 0, pcval);
+        SetThumbOp2Imm(op, (pcval & ~2) + ((instr & 0xFF) << 2));
+    }
+    else if (handler == T_ADD_SPREL)
+    {
+        SetupThumbOp(op, 0x4, false, r8, 13, pcval);
+        SetThumbOp2Imm(op, (instr & 0xFF) << 2);
+    }
+    else if (handler == T_ADD_SP)
+    {
+        SetupThumbOp(op, (instr & (1<<7)) ? 0x2 : 0x4, false, 13, 13, pcval);
+        SetThumbOp2Imm(op, (instr & 0x7F) << 2);
+    }
+    else
+        return false;
+
+    return true;
+}
+
+void CompileFallback(int i, bool last)
+{
+    ARMJIT::BlockInfo* info = CurBlock;
+    u32 size = info->Thumb ? 2 : 4;
+    u32 addr = info->StartAddr + i*size;
+    u32 instr = info->Instr[i];
+
+    FlushCycles();
+
+    // keep the timestamp up to date, for timers and such
+    MOV_RegImm64(RAX, (u64)Timestamp);
+    Emit8(0x48); Emit8(0x63); ModRMMem(RCX, OffCycles); // movsxd rcx, [rbx+Cycles]
+    Emit8(0x48); Emit8(0x01); Emit8(0x08); // add [rax], rcx
+    MOV_MemImm(OffCycles, 0);
+
+    MOV_MemImm(OffR + 15*4, addr + 2*size);
+    MOV_MemImm(OffCurInstr, instr);
+    if (CurCPU->Num == 0)
+        MOV_MemImm(OffCodeCycles, info->CodeCycles[i]);
+    // some handlers look at the pipeline (nocash hooks), and some write R15
+    // without going through JumpTo(), so it has to be what the interpreter would have
+    MOV_MemImm(OffNextInstr, info->Instr[i+1]);
+    MOV_MemImm(OffNextInstr + 4, info->Instr[i+2]);
+
+    void (*handler)(ARM*);
+    u8* condfail = NULL;
+    if (info->Thumb)
+    {
+        u32 icode = (instr >> 6) & 0x3FF;
+        handler = ARMInterpreter::THUMBInstrTable[icode];
+    }
+    else
+    {
+        u32 cond = instr >> 28;
+        u32 icode = ((instr >> 4) & 0xF) | ((instr >> 16) & 0xFF0);
+        handler = ARMInterpreter::ARMInstrTable[icode];
+
+        if (cond == 0xF)
+        {
+            if (CurCPU->Num == 0 && (instr & 0xFE000000) == 0xFA000000)
+                handler = ARMInterpreter::A_BLX_IMM;
+            else
+            {
+                AddCodeCycles(CurCPU->Num == 0 ? info->CodeCycles[i] : 1);
+                return;
+            }
+        }
+        else if (cond != 0xE)
+            condfail = CheckCondition(cond);
+    }
+
+    CallFunc((void*)handler);
+
+    // the instruction branched: pipeline and all were taken care of by JumpTo()
+    ALU_MemImm(ALU_CMP, OffR + 15*4, addr + 2*size);
+    ExitNoFillJumps.push_back(Jcc(CC_NE));
+
+    if (!last)
+    {
+        ALU_MemImm(ALU_CMP, OffHalted, 0);
+        ExitJumps.push_back(std::make_pair(Jcc(CC_NE), i+1));
+
+        ALU_MemImm(ALU_CMP, OffIRQ, 0);
+        u8* noirq = Jcc(CC_E);
+        Emit8(0xF6); ModRMMem(0, OffCPSR); Emit8(0x80); // test byte [rbx+CPSR], 0x80
+        ExitJumps.push_back(std::make_pair(Jcc(CC_E), i+1));
+        SetJumpTarget(noirq, CodePtr);
+
+        MOV_RegImm64(RAX, (u64)&ARMJIT::ExitRequest);
+        Emit8(0x80); Emit8(0x38); Emit8(0x00); // cmp byte [rax], 0
+        ExitJumps.push_back(std::make_pair(Jcc(CC_NE), i+1));
+
+        MOV_RegImm64(RAX, (u64)Timestamp);
+        Emit8(0x48); Emit8(0x63); ModRMMem(RCX, OffCycles); // movsxd rcx, [rbx+Cycles]
+        Emit8(0x48); Emit8(0x03); Emit8(0x08); // add rcx, [rax]
+        MOV_RegImm64(RAX, (u64)Target);
+        Emit8(0x48); Emit8(0x3B); Emit8(0x08); // cmp rcx, [rax]
+        ExitJumps.push_back(std::make_pair(Jcc(CC_AE), i+1));
+    }
+
+    if (condfail)
+    {
+        u8* done = JMP();
+        SetJumpTarget(condfail, CodePtr);
+        AddCodeCycles(CurCPU->Num == 0 ? info->CodeCycles[i] : 1);
+        SetJumpTarget(done, CodePtr);
+    }
+}
+
+bool CompileNative(int i)
+{
+    ARMJIT::BlockInfo* info = CurBlock;
+    u32 size = info->Thumb ? 2 : 4;
+    u32 addr = info->StartAddr + i*size;
+    u32 instr = info->Instr[i];
+    ALUOp op;
+
+    if (info->Thumb)
+    {
+        if (!DecodeThumb(instr, addr, &op)) return false;
+
+        CompileALUOp(&op);
+    }
+    else
+    {
+        u32 cond = instr >> 28;
+        if (cond == 0xF)
+        {
+            // never executed (BLX is taken care of by the fallback path)
+            if (CurCPU->Num == 0 && (instr & 0xFE000000) == 0xFA000000) return false;
+            if (!DecodeARM(instr, addr, &op)) return false;
+        }
+        else
+        {
+            if (!DecodeARM(instr, addr, &op)) return false;
+
+            u8* skip = NULL;
+            if (cond != 0xE) skip = CheckCondition(cond);
+            CompileALUOp(&op);
+            if (skip) SetJumpTarget(skip, CodePtr);
+        }
+    }
+
+    // ALU ops take one code cycle whether they're executed or not
+    AddPendingCycles(i);
+    return true;
+}
+
+ARMJIT::JitBlockEntry CompileBlock(ARM* cpu, ARMJIT::BlockInfo* info)
+{
+    CurCPU = cpu;
+    CurBlock = info;
+
+    u8* base = (u8*)cpu;
+    OffR = (s32)((u8*)&cpu->R[0] - base);
+    OffCPSR = (s32)((u8*)&cpu->CPSR - base);
+    OffCycles = (s32)((u8*)&cpu->Cycles - base);
+    OffCodeCycles = (s32)((u8*)&cpu->CodeCycles - base);
+    OffCurInstr = (s32)((u8*)&cpu->CurInstr - base);
+    OffNextInstr = (s32)((u8*)&cpu->NextInstr[0] - base);
+    OffHalted = (s32)((u8*)&cpu->Halted - base);
+    OffIRQ = (s32)((u8*)&cpu->IRQ - base);
+
+    if (cpu->Num == 0)
+    {
+        Timestamp = &NDS::ARM9Timestamp;
+        Target = &NDS::ARM9Target;
+    }
+    else
+    {
+        Timestamp = &NDS::ARM7Timestamp;
+        Target = &NDS::ARM7Target;
+    }
+
+    PendingCycles = 0;
+    ExitNoFillJumps.clear();
+    ExitJumps.clear();
+
+    u8* entry = CodePtr;
+    Prologue();
+
+    for (int i = 0; i < info->NumInstrs; i++)
+    {
+        bool last = (i == info->NumInstrs-1);
+
+        if (!CompileNative(i))
+            CompileFallback(i, last);
+    }
+
+    // end of the block: sync R15 and the pipeline
+    u32 size = info->Thumb ? 2 : 4;
+    int n = info->NumInstrs;
+    FlushCycles();
+    MOV_MemImm(OffR + 15*4, info->StartAddr + (n+1)*size);
+    MOV_MemImm(OffNextInstr, info->Instr[n]);
+    MOV_MemImm(OffNextInstr + 4, info->Instr[n+1]);
+    Epilogue();
+
+    // early exits
+    for (size_t j = 0; j < ExitJumps.size(); )
+    {
+        int next = ExitJumps[j].second;
+        u8* stub = CodePtr;
+
+        MOV_MemImm(OffNextInstr, info->Instr[next]);
+        MOV_MemImm(OffNextInstr + 4, info->Instr[next+1]);
+        Epilogue();
+
+        while (j < ExitJumps.size() && ExitJumps[j].second == next)
+        {
+            SetJumpTarget(ExitJumps[j].first, stub);
+            j++;
+        }
+    }
+
+    if (!ExitNoFillJumps.empty())
+    {
+        u8* stub = CodePtr;
+        Epilogue();
+
+        for (size_t j = 0; j < ExitNoFillJumps.size(); j++)
+            SetJumpTarget(ExitNoFillJumps[j], stub);
+    }
+
+    return (ARMJIT::JitBlockEntry)entry;
+}
+
+#else // JIT_X64_HOST
+
+bool Init()
+{
+    return false;
+}
+
+void DeInit()
+{
+}
+
+void Reset()
+{
+}
+
+bool HasSpace()
+{
+    return false;
+}
+
+ARMJIT::JitBlockEntry CompileBlock(ARM* cpu, ARMJIT::BlockInfo* info)
+{
+    return NULL;
+}
+
+#endif // JIT_X64_HOST
+
+}
@@ -0,0 +1,41 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef ARMJIT_X64_H
+#define ARMJIT_X64_H
+
+#include "ARMJIT.h"
+
+namespace ARMJIT_x64
+{
+
+// false if the host isn't x86-64 or if we couldn't get executable memory
+bool Init();
+void DeInit();
+
+// throws away all the generated code
+void Reset();
+
+// whether there's still room for one more block
+bool HasSpace();
+
+ARMJIT::JitBlockEntry CompileBlock(ARM* cpu, ARMJIT::BlockInfo* info);
+
+}
+
+#endif // ARMJIT_X64_H
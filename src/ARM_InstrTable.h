@@ -39,7 +39,7 @@ INSTRFUNC_PROTO(ARMInstrTable[4096]) =
     // 0000 0011 0000
     A_EOR_REG_LSL_IMM_S, A_EOR_REG_LSL_REG_S, A_EOR_REG_LSR_IMM_S, A_EOR_REG_LSR_REG_S,
     A_EOR_REG_ASR_IMM_S, A_EOR_REG_ASR_REG_S, A_EOR_REG_ROR_IMM_S, A_EOR_REG_ROR_REG_S,
-    A_EOR_REG_LSL_IMM_S, A_MLA, A_EOR_REG_ROR_IMM_S, A_UNK,
+    A_EOR_REG_LSL_IMM_S, A_MLA, A_EOR_REG_LSR_IMM_S, A_UNK,
     A_EOR_REG_ASR_IMM_S, A_UNK, A_EOR_REG_ROR_IMM_S, A_UNK,
 
     // 0000 0100 0000
@@ -20,6 +20,7 @@
 #include <string.h>
 #include "NDS.h"
 #include "ARM.h"
+#include "ARMJIT.h"
 
 
 // access timing for cached regions
@@ -112,6 +113,8 @@ void ARMv5::UpdateDTCMSetting()
 
 void ARMv5::UpdateITCMSetting()
 {
+    u32 oldsize = ITCMSize;
+
     if (CP15Control & (1<<18))
     {
         ITCMSize = 0x200 << ((ITCMSetting >> 1) & 0x1F);
@@ -122,6 +125,10 @@ void ARMv5::UpdateITCMSetting()
         ITCMSize = 0;
         //printf("ITCM disabled\n");
     }
+
+    // code running from there may now be somewhere else
+    if (ITCMSize != oldsize)
+        ARMJIT::InvalidateVirtualRange(0, 0, std::max(oldsize, ITCMSize));
 }
 
 
@@ -370,6 +377,8 @@ void ARMv5::ICacheLookup(u32 addr)
 
 void ARMv5::ICacheInvalidateByAddr(u32 addr)
 {
+    ARMJIT::InvalidateCacheLine(this, addr);
+
     u32 tag = addr & 0xFFFFF800;
     u32 id = (addr >> 5) & 0x3F;
 
@@ -398,6 +407,8 @@ void ARMv5::ICacheInvalidateByAddr(u32 addr)
 
 void ARMv5::ICacheInvalidateAll()
 {
+    ARMJIT::InvalidateVirtualRange(0, 0, 0xFFFFFFFF);
+
     for (int i = 0; i < 64*4; i++)
         ICacheTags[i] = 1;
 }
@@ -550,6 +561,7 @@ void ARMv5::CP15Write(u32 id, u32 val)
         printf("%08X\n", (val&0xFFFFF000)+(2<<((val&0x3E)>>1)));
         // TODO: smarter region update for this?
         UpdatePURegions(true);
+        ARMJIT::InvalidateVirtualRange(0, 0, 0xFFFFFFFF);
         return;
 
 
@@ -811,6 +823,7 @@ void ARMv5::DataWrite8(u32 addr, u8 val)
     {
         DataCycles = 1;
         *(u8*)&ITCM[addr & 0x7FFF] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ITCM + (addr & 0x7FFF));
         return;
     }
     if (addr >= DTCMBase && addr < (DTCMBase + DTCMSize))
@@ -832,6 +845,7 @@ void ARMv5::DataWrite16(u32 addr, u16 val)
     {
         DataCycles = 1;
         *(u16*)&ITCM[addr & 0x7FFF] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ITCM + (addr & 0x7FFF));
         return;
     }
     if (addr >= DTCMBase && addr < (DTCMBase + DTCMSize))
@@ -853,6 +867,7 @@ void ARMv5::DataWrite32(u32 addr, u32 val)
     {
         DataCycles = 1;
         *(u32*)&ITCM[addr & 0x7FFF] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ITCM + (addr & 0x7FFF));
         return;
     }
     if (addr >= DTCMBase && addr < (DTCMBase + DTCMSize))
@@ -874,6 +889,7 @@ void ARMv5::DataWrite32S(u32 addr, u32 val)
     {
         DataCycles += 1;
         *(u32*)&ITCM[addr & 0x7FFF] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ITCM + (addr & 0x7FFF));
         return;
     }
     if (addr >= DTCMBase && addr < (DTCMBase + DTCMSize))
@@ -34,6 +34,16 @@ int Threaded3D;
 int GL_ScaleFactor;
 int GL_Antialias;
 
+int JIT_Enable;
+int JIT_MaxBlockSize;
+int JIT_CachedInterp;
+
+int IdleLoopSkip;
+
+int ThreadedARM7;
+int Threaded2D;
+int ThreadedGeometry;
+
 ConfigEntry ConfigFile[] =
 {
     {"3DRenderer", 0, &_3DRenderer, 1, NULL, 0},
@@ -42,6 +52,16 @@ ConfigEntry ConfigFile[] =
     {"GL_ScaleFactor", 0, &GL_ScaleFactor, 1, NULL, 0},
     {"GL_Antialias", 0, &GL_Antialias, 0, NULL, 0},
 
+    {"JIT_Enable", 0, &JIT_Enable, 0, NULL, 0},
+    {"JIT_MaxBlockSize", 0, &JIT_MaxBlockSize, 32, NULL, 0},
+    {"JIT_CachedInterp", 0, &JIT_CachedInterp, 0, NULL, 0},
+
+    {"IdleLoopSkip", 0, &IdleLoopSkip, 0, NULL, 0},
+
+    {"ThreadedARM7", 0, &ThreadedARM7, 0, NULL, 0},
+    {"Threaded2D", 0, &Threaded2D, 0, NULL, 0},
+    {"ThreadedGeometry", 0, &ThreadedGeometry, 0, NULL, 0},
+
     {"", -1, NULL, 0, NULL, 0}
 };
 
@@ -85,33 +105,40 @@ void Load()
         int ret = sscanf(linebuf, "%32[A-Za-z_0-9]=%[^\t\n]", entryname, entryval);
         if (ret < 2) continue;
 
-        ConfigEntry* entry = &ConfigFile[0];
-        c = 0;
-        for (;;)
+        Set(entryname, entryval);
+    }
+
+    fclose(f);
+}
+
+bool Set(const char* name, const char* val)
+{
+    ConfigEntry* entry = &ConfigFile[0];
+    int c = 0;
+    for (;;)
+    {
+        if (!entry->Value)
+        {
+            if (c > 0) break;
+            entry = &PlatformConfigFile[0];
+            if (!entry->Value) break;
+            c++;
+        }
+
+        if (!strncmp(entry->Name, name, 32))
         {
-            if (!entry->Value)
-            {
-                if (c > 0) break;
-                entry = &PlatformConfigFile[0];
-                if (!entry->Value) break;
-                c++;
-            }
-
-            if (!strncmp(entry->Name, entryname, 32))
-            {
-                if (entry->Type == 0)
-                    *(int*)entry->Value = strtol(entryval, NULL, 10);
-                else
-                    strncpy((char*)entry->Value, entryval, entry->StrLength);
-
-                break;
-            }
-
-            entry++;
+            if (entry->Type == 0)
+                *(int*)entry->Value = strtol(val, NULL, 10);
+            else
+                strncpy((char*)entry->Value, val, entry->StrLength);
+
+            return true;
         }
+
+        entry++;
     }
 
-    fclose(f);
+    return false;
 }
 
 void Save()
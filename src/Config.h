@@ -40,12 +40,25 @@ bool HasConfigFile(const char* fileName);
 void Load();
 void Save();
 
+// sets an entry from its name and text value, like a line of the config file would
+bool Set(const char* name, const char* val);
+
 extern int _3DRenderer;
 extern int Threaded3D;
 
 extern int GL_ScaleFactor;
 extern int GL_Antialias;
 
+extern int JIT_Enable;
+extern int JIT_MaxBlockSize;
+extern int JIT_CachedInterp;
+
+extern int IdleLoopSkip;
+
+extern int ThreadedARM7;
+extern int Threaded2D;
+extern int ThreadedGeometry;
+
 }
 
 #endif // CONFIG_H
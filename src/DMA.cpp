@@ -17,16 +17,18 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "NDS.h"
 #include "DMA.h"
 #include "NDSCart.h"
 #include "GPU.h"
+#include "Profiler.h"
 
 
 // NOTES ON DMA SHIT
 //
-// * could use optimized code paths for common types of DMA transfers. for example, VRAM
-//   have to profile it to see if it's actually worth doing
+// * transfers between plain memory (main RAM, WRAM, VRAM...) are done a page at a time,
+//   see RunBlock(). IO, GX FIFO and cart transfers go unit by unit
 
 
 // DMA TIMINGS
@@ -188,6 +190,88 @@ void DMA::Start()
     NDS::StopCPU(CPU, 1<<Num);
 }
 
+u32 UnitsLeftInPage(u32 addr, u32 inc, u32 size)
+{
+    if (inc == 0)
+        return 0xFFFFFFFF;
+    else if (inc == 1)
+        return (0x1000 - (addr & 0xFFF)) / size;
+    else
+        return ((addr & 0xFFF) / size) + 1;
+}
+
+// transfers as many units as it can in one go, when both the source and the
+// destination are plain memory according to the bus page maps
+// stops where the regular path would: at the end of either page, or at the
+// first unit that reaches the CPU's target
+// returns how many units were transferred, 0 meaning the regular path has to be used
+template <typename T>
+u32 DMA::RunBlock(uintptr_t* pagemap, u64* timestamp, u64 target, u32 unitcycles)
+{
+    uintptr_t srcpage = pagemap[CurSrcAddr >> 12];
+    uintptr_t dstpage = pagemap[CurDstAddr >> 12];
+    if (!(srcpage & NDS::Page_Read) || !(dstpage & NDS::Page_Write))
+        return 0;
+    if (unitcycles == 0)
+        return 0;
+
+    const u32 size = sizeof(T);
+
+    u32 num = IterCount;
+    u32 srcleft = UnitsLeftInPage(CurSrcAddr, SrcAddrInc, size);
+    u32 dstleft = UnitsLeftInPage(CurDstAddr, DstAddrInc, size);
+    if (srcleft < num) num = srcleft;
+    if (dstleft < num) num = dstleft;
+
+    u64 timeleft = ((target - *timestamp) + unitcycles - 1) / unitcycles;
+    if (timeleft < num) num = (u32)timeleft;
+
+    if (num == 0) return 0;
+
+    u8* src = NDS::PagePtr(srcpage, CurSrcAddr);
+    u8* dst = NDS::PagePtr(dstpage, CurDstAddr);
+    s32 srcinc = (s32)SrcAddrInc * size;
+    s32 dstinc = (s32)DstAddrInc * size;
+    u32 len = num * size;
+
+    if (srcinc == size && dstinc == size && (dst+len <= src || src+len <= dst))
+    {
+        memcpy(dst, src, len);
+    }
+    else if (srcinc == 0 && dstinc == size)
+    {
+        T val = *(T*)src;
+        for (u32 i = 0; i < num; i++)
+            ((T*)dst)[i] = val;
+    }
+    else
+    {
+        // overlapping or going backwards, do it in order like the hardware
+        for (u32 i = 0; i < num; i++)
+        {
+            *(T*)dst = *(T*)src;
+            src += srcinc;
+            dst += dstinc;
+        }
+    }
+
+    if (dstpage & NDS::Page_Track)
+    {
+        u8* start = NDS::PagePtr(dstpage, CurDstAddr);
+        if (dstinc < 0) start -= (len - size);
+        GPU::MarkVRAMDirtyHost(start, len);
+    }
+
+    *timestamp += (u64)num * unitcycles;
+
+    CurSrcAddr += SrcAddrInc * len;
+    CurDstAddr += DstAddrInc * len;
+    IterCount -= num;
+    RemCount -= num;
+
+    return num;
+}
+
 void DMA::Run()
 {
     if (!Running) return;
@@ -199,6 +283,8 @@ void DMA::Run9()
 {
     if (NDS::ARM9Timestamp >= NDS::ARM9Target) return;
 
+    PROFILE_SCOPE(Prof_DMA9);
+
     Executing = true;
 
     // add NS penalty for first accesses in burst
@@ -230,6 +316,12 @@ void DMA::Run9()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunBlock<u16>(NDS::ARM9PageMap, &NDS::ARM9Timestamp, NDS::ARM9Target, unitcycles << NDS::ARM9ClockShift))
+            {
+                if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
+                continue;
+            }
+
             NDS::ARM9Timestamp += (unitcycles << NDS::ARM9ClockShift);
 
             NDS::ARM9Write16(CurDstAddr, NDS::ARM9Read16(CurSrcAddr));
@@ -266,6 +358,12 @@ void DMA::Run9()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunBlock<u32>(NDS::ARM9PageMap, &NDS::ARM9Timestamp, NDS::ARM9Target, unitcycles << NDS::ARM9ClockShift))
+            {
+                if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
+                continue;
+            }
+
             NDS::ARM9Timestamp += (unitcycles << NDS::ARM9ClockShift);
 
             NDS::ARM9Write32(CurDstAddr, NDS::ARM9Read32(CurSrcAddr));
@@ -311,6 +409,8 @@ void DMA::Run7()
 {
     if (NDS::ARM7Timestamp >= NDS::ARM7Target) return;
 
+    PROFILE_SCOPE(Prof_DMA7);
+
     Executing = true;
 
     // add NS penalty for first accesses in burst
@@ -342,6 +442,12 @@ void DMA::Run7()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunBlock<u16>(NDS::ARM7PageMap, &NDS::ARM7Timestamp, NDS::ARM7Target, unitcycles))
+            {
+                if (NDS::ARM7Timestamp >= NDS::ARM7Target) break;
+                continue;
+            }
+
             NDS::ARM7Timestamp += unitcycles;
 
             NDS::ARM7Write16(CurDstAddr, NDS::ARM7Read16(CurSrcAddr));
@@ -378,6 +484,12 @@ void DMA::Run7()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunBlock<u32>(NDS::ARM7PageMap, &NDS::ARM7Timestamp, NDS::ARM7Target, unitcycles))
+            {
+                if (NDS::ARM7Timestamp >= NDS::ARM7Target) break;
+                continue;
+            }
+
             NDS::ARM7Timestamp += unitcycles;
 
             NDS::ARM7Write32(CurDstAddr, NDS::ARM7Read32(CurSrcAddr));
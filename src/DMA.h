@@ -70,6 +70,9 @@ public:
 private:
     u32 CPU, Num;
 
+    template <typename T>
+    u32 RunBlock(uintptr_t* pagemap, u64* timestamp, u64 target, u32 unitcycles);
+
     u32 StartMode;
     u32 CurSrcAddr;
     u32 CurDstAddr;
@@ -18,8 +18,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <thread>
 #include "NDS.h"
 #include "GPU.h"
+#include "Config.h"
+#include "Platform.h"
 
 namespace GPU
 {
@@ -76,6 +79,22 @@ u8* VRAMPtr_AOBJ[0x10];
 u8* VRAMPtr_BBG[0x8];
 u8* VRAMPtr_BOBJ[0x8];
 
+// pages where several banks overlap point to a flattened copy (the banks ORed together)
+// so that reading them is still a single lookup. unmapped pages point to a zero page.
+// flat pages 0x00-0x1F are ABG, 0x20-0x2F AOBJ, 0x30-0x37 BBG, 0x38-0x3F BOBJ
+u8 VRAMFlat[0x40][0x4000];
+u32 VRAMFlatMask[0x40];
+u32 VRAMFlatOffset[0x40];
+u32 VRAMFlatBanks;
+u32 VRAMMapSerial;
+u8 VRAMZero[0x4000];
+
+std::atomic<u32> DirtyGeneration;
+u32 VRAMDirty[0x290];
+u32 VRAMBankDirty[9];
+u32 PaletteDirty[4];
+u32 OAMDirty[4];
+
 int FrontBuffer;
 u32* Framebuffer[2][2];
 bool Accelerated;
@@ -83,11 +102,101 @@ bool Accelerated;
 GPU2D* GPU2D_A;
 GPU2D* GPU2D_B;
 
+bool Threaded2D;
+void* Thread2D;
+bool Thread2DRunning;
+void* Sema_2DStart;
+void* Sema_2DDone;
+u32 Thread2DLine;
+
+void Setup2DThread();
+void Stop2DThread();
+
+
+// IO handlers, hooked up in Init()
+
+template<int num> u8 Engine2DIORead8(u32 addr) { return (num ? GPU2D_B : GPU2D_A)->Read8(addr); }
+template<int num> u16 Engine2DIORead16(u32 addr) { return (num ? GPU2D_B : GPU2D_A)->Read16(addr); }
+template<int num> u32 Engine2DIORead32(u32 addr) { return (num ? GPU2D_B : GPU2D_A)->Read32(addr); }
+template<int num> void Engine2DIOWrite8(u32 addr, u8 val) { (num ? GPU2D_B : GPU2D_A)->Write8(addr, val); }
+template<int num> void Engine2DIOWrite16(u32 addr, u16 val) { (num ? GPU2D_B : GPU2D_A)->Write16(addr, val); }
+template<int num> void Engine2DIOWrite32(u32 addr, u32 val) { (num ? GPU2D_B : GPU2D_A)->Write32(addr, val); }
+
+// MASTER_BRIGHT is 16-bit, the upper half of a 32-bit write goes nowhere
+template<int num> void MasterBrightIOWrite32(u32 addr, u32 val) { (num ? GPU2D_B : GPU2D_A)->Write16(addr, val & 0xFFFF); }
+
+template<u32 cpu>
+u16 DispStatIORead16(u32 addr)
+{
+    if (addr & 0x2) return VCount;
+    return DispStat[cpu];
+}
+
+template<u32 cpu>
+u32 DispStatIORead32(u32)
+{
+    return DispStat[cpu] | (VCount << 16);
+}
+
+template<u32 cpu>
+void DispStatIOWrite16(u32 addr, u16 val)
+{
+    if (addr & 0x2) SetVCount(val);
+    else            SetDispStat(cpu, val);
+}
+
+template<u32 cpu>
+void DispStatIOWrite32(u32, u32 val)
+{
+    SetDispStat(cpu, val & 0xFFFF);
+    SetVCount(val >> 16);
+}
+
+void RegisterIO()
+{
+    NDS::IOHandlers engineA = {Engine2DIORead8<0>, Engine2DIORead16<0>, Engine2DIORead32<0>,
+                               Engine2DIOWrite8<0>, Engine2DIOWrite16<0>, Engine2DIOWrite32<0>};
+    NDS::IOHandlers engineB = {Engine2DIORead8<1>, Engine2DIORead16<1>, Engine2DIORead32<1>,
+                               Engine2DIOWrite8<1>, Engine2DIOWrite16<1>, Engine2DIOWrite32<1>};
+    NDS::RegisterIO(0, 0x04000000, 0x04000060, &engineA);
+    NDS::RegisterIO(0, 0x04001000, 0x04001060, &engineB);
+
+    // DISPCAPCNT
+    NDS::IOHandlers dispcap = {NULL, Engine2DIORead16<0>, Engine2DIORead32<0>, NULL, NULL, Engine2DIOWrite32<0>};
+    NDS::RegisterIO(0, 0x04000064, 0x04000068, &dispcap);
+
+    // DISP_MMEM_FIFO
+    NDS::IOHandlers mmemfifo = {NULL, NULL, NULL, NULL, Engine2DIOWrite16<0>, Engine2DIOWrite32<0>};
+    NDS::RegisterIO(0, 0x04000068, 0x0400006C, &mmemfifo);
+
+    NDS::IOHandlers brightA = {NULL, Engine2DIORead16<0>, Engine2DIORead32<0>,
+                               Engine2DIOWrite8<0>, Engine2DIOWrite16<0>, MasterBrightIOWrite32<0>};
+    NDS::IOHandlers brightB = {NULL, Engine2DIORead16<1>, Engine2DIORead32<1>,
+                               Engine2DIOWrite8<1>, Engine2DIOWrite16<1>, MasterBrightIOWrite32<1>};
+    NDS::RegisterIO(0, 0x0400006C, 0x04000070, &brightA);
+    NDS::RegisterIO(0, 0x0400106C, 0x04001070, &brightB);
+
+    // DISPSTAT/VCOUNT sit in the middle of engine A's registers on the ARM9
+    // 8-bit accesses there go to engine A, as they did before
+    NDS::IOHandlers dispstat9 = {Engine2DIORead8<0>, DispStatIORead16<0>, DispStatIORead32<0>,
+                                 Engine2DIOWrite8<0>, DispStatIOWrite16<0>, DispStatIOWrite32<0>};
+    NDS::IOHandlers dispstat7 = {NULL, DispStatIORead16<1>, DispStatIORead32<1>,
+                                 NULL, DispStatIOWrite16<1>, DispStatIOWrite32<1>};
+    NDS::RegisterIO(0, 0x04000004, 0x04000008, &dispstat9);
+    NDS::RegisterIO(1, 0x04000004, 0x04000008, &dispstat7);
+}
+
 
 bool Init()
 {
     GPU2D_A = new GPU2D(0);
     GPU2D_B = new GPU2D(1);
+    RegisterIO();
+
+    Sema_2DStart = Platform::Semaphore_Create();
+    Sema_2DDone = Platform::Semaphore_Create();
+    Threaded2D = false;
+    Thread2DRunning = false;
     if (!GPU3D::Init()) return false;
 
     FrontBuffer = 0;
@@ -101,6 +210,10 @@ bool Init()
 
 void DeInit()
 {
+    Stop2DThread();
+    Platform::Semaphore_Free(Sema_2DStart);
+    Platform::Semaphore_Free(Sema_2DDone);
+
     delete GPU2D_A;
     delete GPU2D_B;
     GPU3D::DeInit();
@@ -156,10 +269,11 @@ void Reset()
     VRAMMap_ARM7[0] = 0;
     VRAMMap_ARM7[1] = 0;
 
-    memset(VRAMPtr_ABG, 0, sizeof(VRAMPtr_ABG));
-    memset(VRAMPtr_AOBJ, 0, sizeof(VRAMPtr_AOBJ));
-    memset(VRAMPtr_BBG, 0, sizeof(VRAMPtr_BBG));
-    memset(VRAMPtr_BOBJ, 0, sizeof(VRAMPtr_BOBJ));
+    memset(VRAMFlatMask, 0, sizeof(VRAMFlatMask));
+    UpdateVRAMPtrs();
+
+    DirtyGeneration = 0;
+    MarkAllDirty();
 
     int fbsize;
     if (Accelerated) fbsize = (256*3 + 1) * 192;
@@ -179,6 +293,8 @@ void Reset()
     GPU2D_B->Reset();
     GPU3D::Reset();
 
+    Setup2DThread();
+
     int backbuf = FrontBuffer ? 0 : 1;
     GPU2D_A->SetFramebuffer(Framebuffer[backbuf][1]);
     GPU2D_B->SetFramebuffer(Framebuffer[backbuf][0]);
@@ -195,6 +311,16 @@ void Stop()
     memset(Framebuffer[1][1], 0, fbsize*4);
 }
 
+void PrintStats()
+{
+    u32 totalA = GPU2D_A->LinesDrawn + GPU2D_A->LinesReused;
+    u32 totalB = GPU2D_B->LinesDrawn + GPU2D_B->LinesReused;
+    if (!totalA && !totalB) return;
+
+    printf("2D scanlines reused: engine A %u/%u, engine B %u/%u\n",
+           GPU2D_A->LinesReused, totalA, GPU2D_B->LinesReused, totalB);
+}
+
 void DoSavestate(Savestate* file)
 {
     file->Section("GPUG");
@@ -244,14 +370,11 @@ void DoSavestate(Savestate* file)
 
     if (!file->Saving)
     {
-        for (int i = 0; i < 0x20; i++)
-            VRAMPtr_ABG[i] = GetUniqueBankPtr(VRAMMap_ABG[i], i << 14);
-        for (int i = 0; i < 0x10; i++)
-            VRAMPtr_AOBJ[i] = GetUniqueBankPtr(VRAMMap_AOBJ[i], i << 14);
-        for (int i = 0; i < 0x8; i++)
-            VRAMPtr_BBG[i] = GetUniqueBankPtr(VRAMMap_BBG[i], i << 14);
-        for (int i = 0; i < 0x8; i++)
-            VRAMPtr_BOBJ[i] = GetUniqueBankPtr(VRAMMap_BOBJ[i], i << 14);
+        // bank contents changed under the flattened pages, rebuild them all
+        memset(VRAMFlatMask, 0, sizeof(VRAMFlatMask));
+        UpdateVRAMPtrs();
+
+        MarkAllDirty();
     }
 
     GPU2D_A->DoSavestate(file);
@@ -259,6 +382,80 @@ void DoSavestate(Savestate* file)
     GPU3D::DoSavestate(file);
 }
 
+void MarkVRAMDirtyRange(u32 bank, u32 offset, u32 len)
+{
+    if (!len) return;
+
+    u32* dirty = &VRAMDirty[VRAMDirtyBase[bank]];
+    u32 first = offset >> 10;
+    u32 last = (offset + len - 1) >> 10;
+    for (u32 i = first; i <= last; i++)
+        dirty[i] = DirtyGeneration;
+
+    VRAMBankDirty[bank] = DirtyGeneration;
+}
+
+void MarkVRAMDirtyHost(u8* ptr, u32 len)
+{
+    for (int bank = 0; bank < 9; bank++)
+    {
+        u32 offset = (u32)(ptr - VRAM[bank]);
+        if (ptr >= VRAM[bank] && offset <= VRAMMask[bank])
+        {
+            MarkVRAMDirtyRange(bank, offset, len);
+            return;
+        }
+    }
+}
+
+void MarkAllDirty()
+{
+    // start a new generation so that this is seen as a change by everyone
+    DirtyGeneration++;
+
+    for (int i = 0; i < 0x290; i++) VRAMDirty[i] = DirtyGeneration;
+    for (int i = 0; i < 9; i++) VRAMBankDirty[i] = DirtyGeneration;
+    for (int i = 0; i < 4; i++) PaletteDirty[i] = DirtyGeneration;
+    for (int i = 0; i < 4; i++) OAMDirty[i] = DirtyGeneration;
+}
+
+u32 NextDirtyGeneration()
+{
+    return DirtyGeneration.fetch_add(1);
+}
+
+bool RangeChangedSince(u32* dirty, u32 shift, u32 offset, u32 len, u32 gen)
+{
+    if (!len) return false;
+
+    u32 first = offset >> shift;
+    u32 last = (offset + len - 1) >> shift;
+    for (u32 i = first; i <= last; i++)
+    {
+        // generations are compared the wraparound-safe way
+        if ((s32)(dirty[i] - gen) > 0) return true;
+    }
+
+    return false;
+}
+
+bool VRAMChangedSince(u32 bank, u32 offset, u32 len, u32 gen)
+{
+    if ((s32)(VRAMBankDirty[bank] - gen) <= 0) return false;
+
+    return RangeChangedSince(&VRAMDirty[VRAMDirtyBase[bank]], 10, offset, len, gen);
+}
+
+bool PaletteChangedSince(u32 offset, u32 len, u32 gen)
+{
+    return RangeChangedSince(PaletteDirty, 9, offset, len, gen);
+}
+
+bool OAMChangedSince(u32 offset, u32 len, u32 gen)
+{
+    return RangeChangedSince(OAMDirty, 9, offset, len, gen);
+}
+
 void AssignFramebuffers()
 {
     int backbuf = FrontBuffer ? 0 : 1;
@@ -350,14 +547,93 @@ u8* GetUniqueBankPtr(u32 mask, u32 offset)
     return &VRAM[num][offset & VRAMMask[num]];
 }
 
+u8* GetVRAMPagePtr(u32 flat, u32 mask, u32 offset)
+{
+    if (!mask)
+    {
+        VRAMFlatMask[flat] = 0;
+        return VRAMZero;
+    }
+
+    u8* ptr = GetUniqueBankPtr(mask, offset);
+    if (ptr)
+    {
+        VRAMFlatMask[flat] = 0;
+        return ptr;
+    }
+
+    // several banks overlap here
+    // the flat copy is kept in sync by SyncVRAMFlat() as long as the mapping stays the same
+    u8* dst = VRAMFlat[flat];
+    if (VRAMFlatMask[flat] != mask || VRAMFlatOffset[flat] != offset)
+    {
+        memset(dst, 0, 0x4000);
+        for (int bank = 0; bank < 9; bank++)
+        {
+            if (!(mask & (1<<bank))) continue;
+
+            u8* src = &VRAM[bank][offset & VRAMMask[bank]];
+            for (int i = 0; i < 0x4000; i += 8)
+                *(u64*)&dst[i] |= *(u64*)&src[i];
+        }
+
+        VRAMFlatMask[flat] = mask;
+        VRAMFlatOffset[flat] = offset;
+    }
+
+    VRAMFlatBanks |= mask;
+    return dst;
+}
+
+void UpdateVRAMPtrs()
+{
+    VRAMMapSerial++;
+    VRAMFlatBanks = 0;
+
+    for (int i = 0; i < 0x20; i++)
+        VRAMPtr_ABG[i] = GetVRAMPagePtr(0x00+i, VRAMMap_ABG[i], i << 14);
+    for (int i = 0; i < 0x10; i++)
+        VRAMPtr_AOBJ[i] = GetVRAMPagePtr(0x20+i, VRAMMap_AOBJ[i], i << 14);
+    for (int i = 0; i < 0x8; i++)
+        VRAMPtr_BBG[i] = GetVRAMPagePtr(0x30+i, VRAMMap_BBG[i], i << 14);
+    for (int i = 0; i < 0x8; i++)
+        VRAMPtr_BOBJ[i] = GetVRAMPagePtr(0x38+i, VRAMMap_BOBJ[i], i << 14);
+}
+
+void SyncVRAMFlat(u32 banks, u32 addr, u32 len)
+{
+    // a bank can show up in several flattened pages (F/G/I mirrors, or A-D in both ABG and AOBJ)
+    for (int flat = 0; flat < 0x40; flat++)
+    {
+        u32 mask = VRAMFlatMask[flat];
+        if (!(mask & banks)) continue;
+
+        u32 offset = VRAMFlatOffset[flat];
+        u32 hit = 0;
+        for (int bank = 0; bank < 9; bank++)
+        {
+            if ((banks & mask & (1<<bank)) && !((offset ^ addr) & VRAMMask[bank] & ~0x3FFF))
+                hit = 1;
+        }
+        if (!hit) continue;
+
+        u32 start = addr & 0x3FFF;
+        for (u32 i = start; i < start+len; i++)
+        {
+            u8 val = 0;
+            for (int bank = 0; bank < 9; bank++)
+            {
+                if (mask & (1<<bank))
+                    val |= VRAM[bank][(offset | i) & VRAMMask[bank]];
+            }
+            VRAMFlat[flat][i] = val;
+        }
+    }
+}
+
 #define MAP_RANGE(map, base, n)    for (int i = 0; i < n; i++) VRAMMap_##map[(base)+i] |= bankmask;
 #define UNMAP_RANGE(map, base, n)  for (int i = 0; i < n; i++) VRAMMap_##map[(base)+i] &= ~bankmask;
 
-#define MAP_RANGE_PTR(map, base, n) \
-    for (int i = 0; i < n; i++) { VRAMMap_##map[(base)+i] |= bankmask; VRAMPtr_##map[(base)+i] = GetUniqueBankPtr(VRAMMap_##map[(base)+i], ((base)+i)<<14); }
-#define UNMAP_RANGE_PTR(map, base, n) \
-    for (int i = 0; i < n; i++) { VRAMMap_##map[(base)+i] &= ~bankmask; VRAMPtr_##map[(base)+i] = GetUniqueBankPtr(VRAMMap_##map[(base)+i], ((base)+i)<<14); }
-
 void MapVRAM_AB(u32 bank, u8 cnt)
 {
     u8 oldcnt = VRAMCNT[bank];
@@ -378,12 +654,12 @@ void MapVRAM_AB(u32 bank, u8 cnt)
             break;
 
         case 1: // ABG
-            UNMAP_RANGE_PTR(ABG, oldofs<<3, 8);
+            UNMAP_RANGE(ABG, oldofs<<3, 8);
             break;
 
         case 2: // AOBJ
             oldofs &= 0x1;
-            UNMAP_RANGE_PTR(AOBJ, oldofs<<3, 8);
+            UNMAP_RANGE(AOBJ, oldofs<<3, 8);
             break;
 
         case 3: // texture
@@ -401,12 +677,12 @@ void MapVRAM_AB(u32 bank, u8 cnt)
             break;
 
         case 1: // ABG
-            MAP_RANGE_PTR(ABG, ofs<<3, 8);
+            MAP_RANGE(ABG, ofs<<3, 8);
             break;
 
         case 2: // AOBJ
             ofs &= 0x1;
-            MAP_RANGE_PTR(AOBJ, ofs<<3, 8);
+            MAP_RANGE(AOBJ, ofs<<3, 8);
             break;
 
         case 3: // texture
@@ -414,6 +690,9 @@ void MapVRAM_AB(u32 bank, u8 cnt)
             break;
         }
     }
+
+    UpdateVRAMPtrs();
+    NDS::UpdatePageMap(0x06000000, 0x07000000);
 }
 
 void MapVRAM_CD(u32 bank, u8 cnt)
@@ -438,7 +717,7 @@ void MapVRAM_CD(u32 bank, u8 cnt)
             break;
 
         case 1: // ABG
-            UNMAP_RANGE_PTR(ABG, oldofs<<3, 8);
+            UNMAP_RANGE(ABG, oldofs<<3, 8);
             break;
 
         case 2: // ARM7 VRAM
@@ -453,11 +732,11 @@ void MapVRAM_CD(u32 bank, u8 cnt)
         case 4: // BBG/BOBJ
             if (bank == 2)
             {
-                UNMAP_RANGE_PTR(BBG, 0, 8);
+                UNMAP_RANGE(BBG, 0, 8);
             }
             else
             {
-                UNMAP_RANGE_PTR(BOBJ, 0, 8);
+                UNMAP_RANGE(BOBJ, 0, 8);
             }
             break;
         }
@@ -472,7 +751,7 @@ void MapVRAM_CD(u32 bank, u8 cnt)
             break;
 
         case 1: // ABG
-            MAP_RANGE_PTR(ABG, ofs<<3, 8);
+            MAP_RANGE(ABG, ofs<<3, 8);
             break;
 
         case 2: // ARM7 VRAM
@@ -488,15 +767,18 @@ void MapVRAM_CD(u32 bank, u8 cnt)
         case 4: // BBG/BOBJ
             if (bank == 2)
             {
-                MAP_RANGE_PTR(BBG, 0, 8);
+                MAP_RANGE(BBG, 0, 8);
             }
             else
             {
-                MAP_RANGE_PTR(BOBJ, 0, 8);
+                MAP_RANGE(BOBJ, 0, 8);
             }
             break;
         }
     }
+
+    UpdateVRAMPtrs();
+    NDS::UpdatePageMap(0x06000000, 0x07000000);
 }
 
 void MapVRAM_E(u32 bank, u8 cnt)
@@ -517,11 +799,11 @@ void MapVRAM_E(u32 bank, u8 cnt)
             break;
 
         case 1: // ABG
-            UNMAP_RANGE_PTR(ABG, 0, 4);
+            UNMAP_RANGE(ABG, 0, 4);
             break;
 
         case 2: // AOBJ
-            UNMAP_RANGE_PTR(AOBJ, 0, 4);
+            UNMAP_RANGE(AOBJ, 0, 4);
             break;
 
         case 3: // texture palette
@@ -545,11 +827,11 @@ void MapVRAM_E(u32 bank, u8 cnt)
             break;
 
         case 1: // ABG
-            MAP_RANGE_PTR(ABG, 0, 4);
+            MAP_RANGE(ABG, 0, 4);
             break;
 
         case 2: // AOBJ
-            MAP_RANGE_PTR(AOBJ, 0, 4);
+            MAP_RANGE(AOBJ, 0, 4);
             break;
 
         case 3: // texture palette
@@ -563,6 +845,9 @@ void MapVRAM_E(u32 bank, u8 cnt)
             break;
         }
     }
+
+    UpdateVRAMPtrs();
+    NDS::UpdatePageMap(0x06000000, 0x07000000);
 }
 
 void MapVRAM_FG(u32 bank, u8 cnt)
@@ -589,8 +874,6 @@ void MapVRAM_FG(u32 bank, u8 cnt)
                 u32 base = (oldofs & 0x1) + ((oldofs & 0x2) << 1);
                 VRAMMap_ABG[base] &= ~bankmask;
                 VRAMMap_ABG[base + 2] &= ~bankmask;
-                VRAMPtr_ABG[base] = GetUniqueBankPtr(VRAMMap_ABG[base], base << 14);
-                VRAMPtr_ABG[base + 2] = GetUniqueBankPtr(VRAMMap_ABG[base + 2], (base + 2) << 14);
             }
             break;
 
@@ -599,8 +882,6 @@ void MapVRAM_FG(u32 bank, u8 cnt)
                 u32 base = (oldofs & 0x1) + ((oldofs & 0x2) << 1);
                 VRAMMap_AOBJ[base] &= ~bankmask;
                 VRAMMap_AOBJ[base + 2] &= ~bankmask;
-                VRAMPtr_AOBJ[base] = GetUniqueBankPtr(VRAMMap_AOBJ[base], base << 14);
-                VRAMPtr_AOBJ[base + 2] = GetUniqueBankPtr(VRAMMap_AOBJ[base + 2], (base + 2) << 14);
             }
             break;
 
@@ -634,8 +915,6 @@ void MapVRAM_FG(u32 bank, u8 cnt)
                 u32 base = (ofs & 0x1) + ((ofs & 0x2) << 1);
                 VRAMMap_ABG[base] |= bankmask;
                 VRAMMap_ABG[base + 2] |= bankmask;
-                VRAMPtr_ABG[base] = GetUniqueBankPtr(VRAMMap_ABG[base], base << 14);
-                VRAMPtr_ABG[base + 2] = GetUniqueBankPtr(VRAMMap_ABG[base + 2], (base + 2) << 14);
             }
             break;
 
@@ -644,8 +923,6 @@ void MapVRAM_FG(u32 bank, u8 cnt)
                 u32 base = (ofs & 0x1) + ((ofs & 0x2) << 1);
                 VRAMMap_AOBJ[base] |= bankmask;
                 VRAMMap_AOBJ[base + 2] |= bankmask;
-                VRAMPtr_AOBJ[base] = GetUniqueBankPtr(VRAMMap_AOBJ[base], base << 14);
-                VRAMPtr_AOBJ[base + 2] = GetUniqueBankPtr(VRAMMap_AOBJ[base + 2], (base + 2) << 14);
             }
             break;
 
@@ -665,6 +942,9 @@ void MapVRAM_FG(u32 bank, u8 cnt)
             break;
         }
     }
+
+    UpdateVRAMPtrs();
+    NDS::UpdatePageMap(0x06000000, 0x07000000);
 }
 
 void MapVRAM_H(u32 bank, u8 cnt)
@@ -689,10 +969,6 @@ void MapVRAM_H(u32 bank, u8 cnt)
             VRAMMap_BBG[1] &= ~bankmask;
             VRAMMap_BBG[4] &= ~bankmask;
             VRAMMap_BBG[5] &= ~bankmask;
-            VRAMPtr_BBG[0] = GetUniqueBankPtr(VRAMMap_BBG[0], 0 << 14);
-            VRAMPtr_BBG[1] = GetUniqueBankPtr(VRAMMap_BBG[1], 1 << 14);
-            VRAMPtr_BBG[4] = GetUniqueBankPtr(VRAMMap_BBG[4], 4 << 14);
-            VRAMPtr_BBG[5] = GetUniqueBankPtr(VRAMMap_BBG[5], 5 << 14);
             break;
 
         case 2: // BBG ext palette
@@ -716,10 +992,6 @@ void MapVRAM_H(u32 bank, u8 cnt)
             VRAMMap_BBG[1] |= bankmask;
             VRAMMap_BBG[4] |= bankmask;
             VRAMMap_BBG[5] |= bankmask;
-            VRAMPtr_BBG[0] = GetUniqueBankPtr(VRAMMap_BBG[0], 0 << 14);
-            VRAMPtr_BBG[1] = GetUniqueBankPtr(VRAMMap_BBG[1], 1 << 14);
-            VRAMPtr_BBG[4] = GetUniqueBankPtr(VRAMMap_BBG[4], 4 << 14);
-            VRAMPtr_BBG[5] = GetUniqueBankPtr(VRAMMap_BBG[5], 5 << 14);
             break;
 
         case 2: // BBG ext palette
@@ -729,6 +1001,9 @@ void MapVRAM_H(u32 bank, u8 cnt)
             break;
         }
     }
+
+    UpdateVRAMPtrs();
+    NDS::UpdatePageMap(0x06000000, 0x07000000);
 }
 
 void MapVRAM_I(u32 bank, u8 cnt)
@@ -753,14 +1028,10 @@ void MapVRAM_I(u32 bank, u8 cnt)
             VRAMMap_BBG[3] &= ~bankmask;
             VRAMMap_BBG[6] &= ~bankmask;
             VRAMMap_BBG[7] &= ~bankmask;
-            VRAMPtr_BBG[2] = GetUniqueBankPtr(VRAMMap_BBG[2], 2 << 14);
-            VRAMPtr_BBG[3] = GetUniqueBankPtr(VRAMMap_BBG[3], 3 << 14);
-            VRAMPtr_BBG[6] = GetUniqueBankPtr(VRAMMap_BBG[6], 6 << 14);
-            VRAMPtr_BBG[7] = GetUniqueBankPtr(VRAMMap_BBG[7], 7 << 14);
             break;
 
         case 2: // BOBJ
-            UNMAP_RANGE_PTR(BOBJ, 0, 8);
+            UNMAP_RANGE(BOBJ, 0, 8);
             break;
 
         case 3: // BOBJ ext palette
@@ -783,14 +1054,10 @@ void MapVRAM_I(u32 bank, u8 cnt)
             VRAMMap_BBG[3] |= bankmask;
             VRAMMap_BBG[6] |= bankmask;
             VRAMMap_BBG[7] |= bankmask;
-            VRAMPtr_BBG[2] = GetUniqueBankPtr(VRAMMap_BBG[2], 2 << 14);
-            VRAMPtr_BBG[3] = GetUniqueBankPtr(VRAMMap_BBG[3], 3 << 14);
-            VRAMPtr_BBG[6] = GetUniqueBankPtr(VRAMMap_BBG[6], 6 << 14);
-            VRAMPtr_BBG[7] = GetUniqueBankPtr(VRAMMap_BBG[7], 7 << 14);
             break;
 
         case 2: // BOBJ
-            MAP_RANGE_PTR(BOBJ, 0, 8);
+            MAP_RANGE(BOBJ, 0, 8);
             break;
 
         case 3: // BOBJ ext palette
@@ -799,6 +1066,50 @@ void MapVRAM_I(u32 bank, u8 cnt)
             break;
         }
     }
+
+    UpdateVRAMPtrs();
+    NDS::UpdatePageMap(0x06000000, 0x07000000);
+}
+
+
+u8* GetARM9VRAMPage(u32 addr)
+{
+    u32 mask;
+
+    // banks that are part of a flattened page need their writes to go through
+    // WriteVRAM_*, so the flat copy gets updated
+    switch (addr & 0x00E00000)
+    {
+    case 0x00000000: mask = VRAMMap_ABG[(addr >> 14) & 0x1F]; break;
+    case 0x00200000: mask = VRAMMap_BBG[(addr >> 14) & 0x7]; break;
+    case 0x00400000: mask = VRAMMap_AOBJ[(addr >> 14) & 0xF]; break;
+    case 0x00600000: mask = VRAMMap_BOBJ[(addr >> 14) & 0x7]; break;
+    default:
+        {
+            // where each bank starts in LCDC space
+            const u32 lcdcstart[10] = {0x00000, 0x20000, 0x40000, 0x60000, 0x80000,
+                                       0x90000, 0x94000, 0x98000, 0xA0000, 0xA4000};
+
+            u32 offset = addr & 0xFF000;
+            for (int bank = 0; bank < 9; bank++)
+            {
+                if (offset < lcdcstart[bank+1])
+                {
+                    if (!(VRAMMap_LCDC & (1<<bank))) return NULL;
+                    return &VRAM[bank][offset - lcdcstart[bank]];
+                }
+            }
+        }
+        return NULL;
+    }
+
+    if (mask & VRAMFlatBanks) return NULL;
+    return GetUniqueBankPtr(mask, addr & 0xFF000);
+}
+
+u8* GetARM7VRAMPage(u32 addr)
+{
+    return GetUniqueBankPtr(VRAMMap_ARM7[(addr >> 17) & 0x1], addr & 0x1F000);
 }
 
 
@@ -822,6 +1133,68 @@ void SetPowerCnt(u32 val)
 }
 
 
+void DrawLine(GPU2D* gpu, u32 line)
+{
+    // note: this should start 48 cycles after the scanline start
+    if (line < 192)
+        gpu->DrawScanline(line);
+
+    // sprites are pre-rendered one scanline in advance
+    if (line < 191)
+        gpu->DrawSprites(line+1);
+}
+
+void Thread2DFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_2DStart);
+        if (!Thread2DRunning) return;
+
+        DrawLine(GPU2D_B, Thread2DLine);
+
+        Platform::Semaphore_Post(Sema_2DDone);
+    }
+}
+
+void Stop2DThread()
+{
+    if (Thread2DRunning)
+    {
+        Thread2DRunning = false;
+        Platform::Semaphore_Post(Sema_2DStart);
+        Platform::Thread_Wait(Thread2D);
+        Platform::Thread_Free(Thread2D);
+    }
+}
+
+void Setup2DThread()
+{
+    // engine B gets drawn on a worker while engine A is drawn here, both are done by
+    // the end of the HBlank event. all emulated state is frozen in between, so raster
+    // effects, display capture and the display FIFO (all engine A) work as usual.
+    // the engines don't share any state besides the dirty generation counter.
+    // that's two handoffs per scanline, which only pays off with a spare host CPU
+    // (on a single one, melonDS-bench went from ~400 to ~300 fps with it)
+    Threaded2D = (Config::Threaded2D != 0) && (std::thread::hardware_concurrency() > 1);
+
+    if (Threaded2D)
+    {
+        if (!Thread2DRunning)
+        {
+            Platform::Semaphore_Reset(Sema_2DStart);
+            Platform::Semaphore_Reset(Sema_2DDone);
+
+            Thread2DRunning = true;
+            Thread2D = Platform::Thread_Create(Thread2DFunc);
+        }
+    }
+    else
+    {
+        Stop2DThread();
+    }
+}
+
 void DisplayFIFO(u32 x)
 {
     // sample the FIFO
@@ -864,18 +1237,19 @@ void StartHBlank(u32 line)
     if (VCount < 192)
     {
         // draw
-        // note: this should start 48 cycles after the scanline start
-        if (line < 192)
+        if (Threaded2D)
         {
-            GPU2D_A->DrawScanline(line);
-            GPU2D_B->DrawScanline(line);
-        }
+            Thread2DLine = line;
+            Platform::Semaphore_Post(Sema_2DStart);
+
+            DrawLine(GPU2D_A, line);
 
-        // sprites are pre-rendered one scanline in advance
-        if (line < 191)
+            Platform::Semaphore_Wait(Sema_2DDone);
+        }
+        else
         {
-            GPU2D_A->DrawSprites(line+1);
-            GPU2D_B->DrawSprites(line+1);
+            DrawLine(GPU2D_A, line);
+            DrawLine(GPU2D_B, line);
         }
 
         NDS::CheckDMAs(0, 0x02);
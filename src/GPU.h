@@ -19,6 +19,7 @@
 #ifndef GPU_H
 #define GPU_H
 
+#include <atomic>
 #include "GPU2D.h"
 #include "GPU3D.h"
 
@@ -47,6 +48,7 @@ extern u8 VRAM_H[ 32*1024];
 extern u8 VRAM_I[ 16*1024];
 
 extern u8* VRAM[9];
+extern u32 VRAMMask[9];
 
 extern u32 VRAMMap_LCDC;
 extern u32 VRAMMap_ABG[0x20];
@@ -66,12 +68,35 @@ extern u8* VRAMPtr_AOBJ[0x10];
 extern u8* VRAMPtr_BBG[0x8];
 extern u8* VRAMPtr_BOBJ[0x8];
 
+extern u32 VRAMFlatBanks;
+
+// bumped whenever the VRAM mappings change
+extern u32 VRAMMapSerial;
+
+// dirty tracking
+// VRAM is split into 1KB blocks (laid out like the banks are in LCDC space),
+// palette and OAM into 512-byte blocks. each block holds the generation it was
+// last written in. to find out what changed, a consumer keeps the value
+// NextDirtyGeneration() returned last time and passes it to *ChangedSince().
+// consumers don't clear anything, so any number of them can coexist.
+// the counter is atomic as the two 2D engines may be drawn on different threads.
+const u32 VRAMDirtyBase[9] = {0x000, 0x080, 0x100, 0x180, 0x200, 0x240, 0x250, 0x260, 0x280};
+extern std::atomic<u32> DirtyGeneration;
+extern u32 VRAMDirty[0x290];
+extern u32 VRAMBankDirty[9]; // whole bank, so that queries can skip untouched banks quickly
+extern u32 PaletteDirty[4];
+extern u32 OAMDirty[4];
+
 extern int FrontBuffer;
 extern u32* Framebuffer[2][2];
 
 extern GPU2D* GPU2D_A;
 extern GPU2D* GPU2D_B;
 
+// whether engine B is drawn on its own thread (Config::Threaded2D, applied on reset,
+// ignored with a single host CPU)
+extern bool Threaded2D;
+
 
 bool Init();
 void DeInit();
@@ -80,11 +105,40 @@ void Stop();
 
 void DoSavestate(Savestate* file);
 
+void PrintStats();
+
 void SetDisplaySettings(bool accel);
 
 
 u8* GetUniqueBankPtr(u32 mask, u32 offset);
 
+inline void MarkVRAMDirty(u32 bank, u32 offset)
+{
+    u32 gen = DirtyGeneration.load(std::memory_order_relaxed);
+    VRAMDirty[VRAMDirtyBase[bank] + (offset >> 10)] = gen;
+    VRAMBankDirty[bank] = gen;
+}
+
+inline void MarkPaletteDirty(u32 offset) { PaletteDirty[(offset >> 9) & 0x3] = DirtyGeneration.load(std::memory_order_relaxed); }
+inline void MarkOAMDirty(u32 offset) { OAMDirty[(offset >> 9) & 0x3] = DirtyGeneration.load(std::memory_order_relaxed); }
+
+void MarkVRAMDirtyRange(u32 bank, u32 offset, u32 len);
+// for writes that went straight to host memory through the page maps
+void MarkVRAMDirtyHost(u8* ptr, u32 len);
+void MarkAllDirty();
+
+// returns the generation to compare against next time
+// everything written from now on will be seen as changed since the returned value
+u32 NextDirtyGeneration();
+bool VRAMChangedSince(u32 bank, u32 offset, u32 len, u32 gen);
+bool PaletteChangedSince(u32 offset, u32 len, u32 gen);
+bool OAMChangedSince(u32 offset, u32 len, u32 gen);
+
+// rebuilds VRAMPtr_* after the mapping changed
+void UpdateVRAMPtrs();
+// updates the flattened pages after the given banks were written to
+void SyncVRAMFlat(u32 banks, u32 addr, u32 len);
+
 void MapVRAM_AB(u32 bank, u8 cnt);
 void MapVRAM_CD(u32 bank, u8 cnt);
 void MapVRAM_E(u32 bank, u8 cnt);
@@ -92,6 +146,11 @@ void MapVRAM_FG(u32 bank, u8 cnt);
 void MapVRAM_H(u32 bank, u8 cnt);
 void MapVRAM_I(u32 bank, u8 cnt);
 
+// host pointer to a 4KB page of VRAM as seen by the CPUs
+// NULL if it isn't backed by exactly one bank
+u8* GetARM9VRAMPage(u32 addr);
+u8* GetARM7VRAMPage(u32 addr);
+
 
 template<typename T>
 T ReadVRAM_LCDC(u32 addr)
@@ -218,28 +277,18 @@ void WriteVRAM_LCDC(u32 addr, T val)
     default: return;
     }
 
-    if (VRAMMap_LCDC & (1<<bank)) *(T*)&VRAM[bank][addr] = val;
+    if (VRAMMap_LCDC & (1<<bank))
+    {
+        *(T*)&VRAM[bank][addr] = val;
+        MarkVRAMDirty(bank, addr);
+    }
 }
 
 
 template<typename T>
 T ReadVRAM_ABG(u32 addr)
 {
-    u8* ptr = VRAMPtr_ABG[(addr >> 14) & 0x1F];
-    if (ptr) return *(T*)&ptr[addr & 0x3FFF];
-
-    T ret = 0;
-    u32 mask = VRAMMap_ABG[(addr >> 14) & 0x1F];
-
-    if (mask & (1<<0)) ret |= *(T*)&VRAM_A[addr & 0x1FFFF];
-    if (mask & (1<<1)) ret |= *(T*)&VRAM_B[addr & 0x1FFFF];
-    if (mask & (1<<2)) ret |= *(T*)&VRAM_C[addr & 0x1FFFF];
-    if (mask & (1<<3)) ret |= *(T*)&VRAM_D[addr & 0x1FFFF];
-    if (mask & (1<<4)) ret |= *(T*)&VRAM_E[addr & 0xFFFF];
-    if (mask & (1<<5)) ret |= *(T*)&VRAM_F[addr & 0x3FFF];
-    if (mask & (1<<6)) ret |= *(T*)&VRAM_G[addr & 0x3FFF];
-
-    return ret;
+    return *(T*)&VRAMPtr_ABG[(addr >> 14) & 0x1F][addr & 0x3FFF];
 }
 
 template<typename T>
@@ -247,32 +296,22 @@ void WriteVRAM_ABG(u32 addr, T val)
 {
     u32 mask = VRAMMap_ABG[(addr >> 14) & 0x1F];
 
-    if (mask & (1<<0)) *(T*)&VRAM_A[addr & 0x1FFFF] = val;
-    if (mask & (1<<1)) *(T*)&VRAM_B[addr & 0x1FFFF] = val;
-    if (mask & (1<<2)) *(T*)&VRAM_C[addr & 0x1FFFF] = val;
-    if (mask & (1<<3)) *(T*)&VRAM_D[addr & 0x1FFFF] = val;
-    if (mask & (1<<4)) *(T*)&VRAM_E[addr & 0xFFFF] = val;
-    if (mask & (1<<5)) *(T*)&VRAM_F[addr & 0x3FFF] = val;
-    if (mask & (1<<6)) *(T*)&VRAM_G[addr & 0x3FFF] = val;
+    if (mask & (1<<0)) { *(T*)&VRAM_A[addr & 0x1FFFF] = val; MarkVRAMDirty(0, addr & 0x1FFFF); }
+    if (mask & (1<<1)) { *(T*)&VRAM_B[addr & 0x1FFFF] = val; MarkVRAMDirty(1, addr & 0x1FFFF); }
+    if (mask & (1<<2)) { *(T*)&VRAM_C[addr & 0x1FFFF] = val; MarkVRAMDirty(2, addr & 0x1FFFF); }
+    if (mask & (1<<3)) { *(T*)&VRAM_D[addr & 0x1FFFF] = val; MarkVRAMDirty(3, addr & 0x1FFFF); }
+    if (mask & (1<<4)) { *(T*)&VRAM_E[addr & 0xFFFF] = val; MarkVRAMDirty(4, addr & 0xFFFF); }
+    if (mask & (1<<5)) { *(T*)&VRAM_F[addr & 0x3FFF] = val; MarkVRAMDirty(5, addr & 0x3FFF); }
+    if (mask & (1<<6)) { *(T*)&VRAM_G[addr & 0x3FFF] = val; MarkVRAMDirty(6, addr & 0x3FFF); }
+
+    if (mask & VRAMFlatBanks) SyncVRAMFlat(mask & VRAMFlatBanks, addr, sizeof(T));
 }
 
 
 template<typename T>
 T ReadVRAM_AOBJ(u32 addr)
 {
-    u8* ptr = VRAMPtr_AOBJ[(addr >> 14) & 0xF];
-    if (ptr) return *(T*)&ptr[addr & 0x3FFF];
-
-    T ret = 0;
-    u32 mask = VRAMMap_AOBJ[(addr >> 14) & 0xF];
-
-    if (mask & (1<<0)) ret |= *(T*)&VRAM_A[addr & 0x1FFFF];
-    if (mask & (1<<1)) ret |= *(T*)&VRAM_B[addr & 0x1FFFF];
-    if (mask & (1<<4)) ret |= *(T*)&VRAM_E[addr & 0xFFFF];
-    if (mask & (1<<5)) ret |= *(T*)&VRAM_F[addr & 0x3FFF];
-    if (mask & (1<<6)) ret |= *(T*)&VRAM_G[addr & 0x3FFF];
-
-    return ret;
+    return *(T*)&VRAMPtr_AOBJ[(addr >> 14) & 0xF][addr & 0x3FFF];
 }
 
 template<typename T>
@@ -280,28 +319,20 @@ void WriteVRAM_AOBJ(u32 addr, T val)
 {
     u32 mask = VRAMMap_AOBJ[(addr >> 14) & 0xF];
 
-    if (mask & (1<<0)) *(T*)&VRAM_A[addr & 0x1FFFF] = val;
-    if (mask & (1<<1)) *(T*)&VRAM_B[addr & 0x1FFFF] = val;
-    if (mask & (1<<4)) *(T*)&VRAM_E[addr & 0xFFFF] = val;
-    if (mask & (1<<5)) *(T*)&VRAM_F[addr & 0x3FFF] = val;
-    if (mask & (1<<6)) *(T*)&VRAM_G[addr & 0x3FFF] = val;
+    if (mask & (1<<0)) { *(T*)&VRAM_A[addr & 0x1FFFF] = val; MarkVRAMDirty(0, addr & 0x1FFFF); }
+    if (mask & (1<<1)) { *(T*)&VRAM_B[addr & 0x1FFFF] = val; MarkVRAMDirty(1, addr & 0x1FFFF); }
+    if (mask & (1<<4)) { *(T*)&VRAM_E[addr & 0xFFFF] = val; MarkVRAMDirty(4, addr & 0xFFFF); }
+    if (mask & (1<<5)) { *(T*)&VRAM_F[addr & 0x3FFF] = val; MarkVRAMDirty(5, addr & 0x3FFF); }
+    if (mask & (1<<6)) { *(T*)&VRAM_G[addr & 0x3FFF] = val; MarkVRAMDirty(6, addr & 0x3FFF); }
+
+    if (mask & VRAMFlatBanks) SyncVRAMFlat(mask & VRAMFlatBanks, addr, sizeof(T));
 }
 
 
 template<typename T>
 T ReadVRAM_BBG(u32 addr)
 {
-    u8* ptr = VRAMPtr_BBG[(addr >> 14) & 0x7];
-    if (ptr) return *(T*)&ptr[addr & 0x3FFF];
-
-    T ret = 0;
-    u32 mask = VRAMMap_BBG[(addr >> 14) & 0x7];
-
-    if (mask & (1<<2)) ret |= *(T*)&VRAM_C[addr & 0x1FFFF];
-    if (mask & (1<<7)) ret |= *(T*)&VRAM_H[addr & 0x7FFF];
-    if (mask & (1<<8)) ret |= *(T*)&VRAM_I[addr & 0x3FFF];
-
-    return ret;
+    return *(T*)&VRAMPtr_BBG[(addr >> 14) & 0x7][addr & 0x3FFF];
 }
 
 template<typename T>
@@ -309,25 +340,18 @@ void WriteVRAM_BBG(u32 addr, T val)
 {
     u32 mask = VRAMMap_BBG[(addr >> 14) & 0x7];
 
-    if (mask & (1<<2)) *(T*)&VRAM_C[addr & 0x1FFFF] = val;
-    if (mask & (1<<7)) *(T*)&VRAM_H[addr & 0x7FFF] = val;
-    if (mask & (1<<8)) *(T*)&VRAM_I[addr & 0x3FFF] = val;
+    if (mask & (1<<2)) { *(T*)&VRAM_C[addr & 0x1FFFF] = val; MarkVRAMDirty(2, addr & 0x1FFFF); }
+    if (mask & (1<<7)) { *(T*)&VRAM_H[addr & 0x7FFF] = val; MarkVRAMDirty(7, addr & 0x7FFF); }
+    if (mask & (1<<8)) { *(T*)&VRAM_I[addr & 0x3FFF] = val; MarkVRAMDirty(8, addr & 0x3FFF); }
+
+    if (mask & VRAMFlatBanks) SyncVRAMFlat(mask & VRAMFlatBanks, addr, sizeof(T));
 }
 
 
 template<typename T>
 T ReadVRAM_BOBJ(u32 addr)
 {
-    u8* ptr = VRAMPtr_BOBJ[(addr >> 14) & 0x7];
-    if (ptr) return *(T*)&ptr[addr & 0x3FFF];
-
-    T ret = 0;
-    u32 mask = VRAMMap_BOBJ[(addr >> 14) & 0x7];
-
-    if (mask & (1<<3)) ret |= *(T*)&VRAM_D[addr & 0x1FFFF];
-    if (mask & (1<<8)) ret |= *(T*)&VRAM_I[addr & 0x3FFF];
-
-    return ret;
+    return *(T*)&VRAMPtr_BOBJ[(addr >> 14) & 0x7][addr & 0x3FFF];
 }
 
 template<typename T>
@@ -335,8 +359,10 @@ void WriteVRAM_BOBJ(u32 addr, T val)
 {
     u32 mask = VRAMMap_BOBJ[(addr >> 14) & 0x7];
 
-    if (mask & (1<<3)) *(T*)&VRAM_D[addr & 0x1FFFF] = val;
-    if (mask & (1<<8)) *(T*)&VRAM_I[addr & 0x3FFF] = val;
+    if (mask & (1<<3)) { *(T*)&VRAM_D[addr & 0x1FFFF] = val; MarkVRAMDirty(3, addr & 0x1FFFF); }
+    if (mask & (1<<8)) { *(T*)&VRAM_I[addr & 0x3FFF] = val; MarkVRAMDirty(8, addr & 0x3FFF); }
+
+    if (mask & VRAMFlatBanks) SyncVRAMFlat(mask & VRAMFlatBanks, addr, sizeof(T));
 }
 
 
@@ -357,8 +383,8 @@ void WriteVRAM_ARM7(u32 addr, T val)
 {
     u32 mask = VRAMMap_ARM7[(addr >> 17) & 0x1];
 
-    if (mask & (1<<2)) *(T*)&VRAM_C[addr & 0x1FFFF] = val;
-    if (mask & (1<<3)) *(T*)&VRAM_D[addr & 0x1FFFF] = val;
+    if (mask & (1<<2)) { *(T*)&VRAM_C[addr & 0x1FFFF] = val; MarkVRAMDirty(2, addr & 0x1FFFF); }
+    if (mask & (1<<3)) { *(T*)&VRAM_D[addr & 0x1FFFF] = val; MarkVRAMDirty(3, addr & 0x1FFFF); }
 }
 
 
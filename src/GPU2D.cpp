@@ -20,6 +20,7 @@
 #include <string.h>
 #include "NDS.h"
 #include "GPU.h"
+#include "Profiler.h"
 
 
 // notes on color conversion
@@ -81,9 +82,96 @@
 // TODO: find which parts of DISPCNT are latched. for example, not possible to change video mode midframe.
 
 
+// the compositing and final color passes work on several pixels at once, using
+// GCC vector extensions. on x86 they're built twice: for SSE2 (always there on
+// x86-64) and for AVX2, picked at runtime.
+// they must give the exact same results as ColorComposite() & co.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GPU2D_X86_AVX2
+#endif
+
+typedef u32 u32x4 __attribute__((vector_size(16)));
+typedef u32 u32x8 __attribute__((vector_size(32)));
+
+#ifdef GPU2D_X86_AVX2
+static bool HostHasAVX2 = false;
+
+// the helpers below take and return AVX vectors, but they always get inlined
+// into the AVX2 functions, so the ABI warning doesn't apply
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#define VECINLINE static inline __attribute__((always_inline))
+
+template<typename V> VECINLINE V VecSplat(u32 x) { V v = {}; return v + x; }
+template<typename V> VECINLINE V VecSelect(V mask, V a, V b) { return (a & mask) | (b & ~mask); }
+template<typename V> VECINLINE V VecNonZero(V a) { return (V)(a != VecSplat<V>(0)); }
+template<typename V> VECINLINE V VecMin63(V a) { return VecSelect<V>((V)(a > VecSplat<V>(0x3F)), VecSplat<V>(0x3F), a); }
+
+template<typename V>
+VECINLINE V VecColorBlend4(V val1, V val2, V eva, V evb)
+{
+    V r = (((val1      ) & 0x3F) * eva + ((val2      ) & 0x3F) * evb) >> 4;
+    V g = (((val1 >>  8) & 0x3F) * eva + ((val2 >>  8) & 0x3F) * evb) >> 4;
+    V b = (((val1 >> 16) & 0x3F) * eva + ((val2 >> 16) & 0x3F) * evb) >> 4;
+
+    return VecMin63(r) | (VecMin63(g) << 8) | (VecMin63(b) << 16) | 0xFF000000;
+}
+
+template<typename V>
+VECINLINE V VecColorBlend5(V val1, V val2)
+{
+    V eva = ((val1 >> 24) & 0x1F) + 1;
+    V evb = VecSplat<V>(32) - eva;
+    V round = (V)(eva <= VecSplat<V>(16)) & 1;
+
+    V r = ((((val1      ) & 0x3F) * eva + ((val2      ) & 0x3F) * evb) >> 5) + round;
+    V g = ((((val1 >>  8) & 0x3F) * eva + ((val2 >>  8) & 0x3F) * evb) >> 5) + round;
+    V b = ((((val1 >> 16) & 0x3F) * eva + ((val2 >> 16) & 0x3F) * evb) >> 5) + round;
+
+    V ret = VecMin63(r) | (VecMin63(g) << 8) | (VecMin63(b) << 16) | 0xFF000000;
+    return VecSelect<V>((V)(eva == VecSplat<V>(32)), val1, ret);
+}
+
+template<typename V>
+VECINLINE V VecColorBrightnessUp(V val, u32 factor)
+{
+    V r = (val      ) & 0x3F;
+    V g = (val >>  8) & 0x3F;
+    V b = (val >> 16) & 0x3F;
+
+    r += ((0x3F - r) * factor) >> 4;
+    g += ((0x3F - g) * factor) >> 4;
+    b += ((0x3F - b) * factor) >> 4;
+
+    return r | (g << 8) | (b << 16) | 0xFF000000;
+}
+
+template<typename V>
+VECINLINE V VecColorBrightnessDown(V val, u32 factor)
+{
+    V r = (val      ) & 0x3F;
+    V g = (val >>  8) & 0x3F;
+    V b = (val >> 16) & 0x3F;
+
+    r -= (r * factor) >> 4;
+    g -= (g * factor) >> 4;
+    b -= (b * factor) >> 4;
+
+    return r | (g << 8) | (b << 16) | 0xFF000000;
+}
+
+
 GPU2D::GPU2D(u32 num)
 {
     Num = num;
+    LastReusedLine = NULL;
+    LowerLayersSerial = 0;
+
+#ifdef GPU2D_X86_AVX2
+    HostHasAVX2 = __builtin_cpu_supports("avx2");
+#endif
 
     // initialize mosaic table
     for (int m = 0; m < 16; m++)
@@ -153,6 +241,16 @@ void GPU2D::Reset()
     BGExtPalStatus[2] = 0;
     BGExtPalStatus[3] = 0;
     OBJExtPalStatus = 0;
+
+    memset(BGTileCache, 0, sizeof(BGTileCache));
+    BGTileEpoch = 0;
+    FlushBGTileCache();
+
+    OBJBinsValid = false;
+
+    FlushLineRecords();
+    LinesDrawn = 0;
+    LinesReused = 0;
 }
 
 void GPU2D::DoSavestate(Savestate* file)
@@ -221,6 +319,9 @@ void GPU2D::DoSavestate(Savestate* file)
         BGExtPalStatus[2] = 0;
         BGExtPalStatus[3] = 0;
         OBJExtPalStatus = 0;
+        FlushBGTileCache();
+        OBJBinsValid = false;
+        FlushLineRecords();
 
         CurBGXMosaicTable = MosaicTable[BGMosaicSize[0]];
         CurOBJXMosaicTable = MosaicTable[OBJMosaicSize[0]];
@@ -235,6 +336,7 @@ void GPU2D::SetFramebuffer(u32* buf)
 void GPU2D::SetDisplaySettings(bool accel)
 {
     Accelerated = accel;
+    FlushLineRecords();
 
     if (Accelerated) DrawPixel = DrawPixel_Accel;
     else             DrawPixel = DrawPixel_Normal;
@@ -731,6 +833,174 @@ u32 GPU2D::ColorComposite(int i, u32 val1, u32 val2)
 }
 
 
+// same as running ColorComposite() over BGOBJLine
+template<typename V>
+inline __attribute__((always_inline)) void GPU2D::CompositeLine()
+{
+    const int n = sizeof(V) / sizeof(u32);
+
+    u32 effect = (BlendCnt >> 6) & 0x3;
+    V blendcnt = VecSplat<V>(BlendCnt);
+    V eva = VecSplat<V>(EVA);
+    V evb = VecSplat<V>(EVB);
+
+    for (int i = 0; i < 256; i += n)
+    {
+        V val1, val2, window;
+        memcpy(&val1, &BGOBJLine[i], sizeof(V));
+        memcpy(&val2, &BGOBJLine[256+i], sizeof(V));
+        for (int j = 0; j < n; j++) window[j] = WindowMask[i+j];
+
+        V flag1 = val1 >> 24;
+        V flag2 = val2 >> 24;
+        V obj1 = VecNonZero<V>(flag1 & 0x80);
+        V _3d1 = VecNonZero<V>(flag1 & 0x40);
+        V obj2 = VecNonZero<V>(flag2 & 0x80);
+        V _3d2 = VecNonZero<V>(flag2 & 0x40);
+
+        V target1 = VecSelect<V>(obj1, VecSplat<V>(0x0010), VecSelect<V>(_3d1, VecSplat<V>(0x0001), flag1));
+        V target2 = VecSelect<V>(obj2, VecSplat<V>(0x1000), VecSelect<V>(_3d2, VecSplat<V>(0x0100), flag2 << 8));
+        V blend2 = VecNonZero<V>(blendcnt & target2);
+
+        V spriteblend = obj1 & blend2;
+        V blend3d = ~obj1 & _3d1 & blend2;
+        V regular = ~(spriteblend | blend3d) & VecNonZero<V>(blendcnt & target1) & VecNonZero<V>(window & 0x20);
+
+        V ret = val1;
+        V blend = spriteblend;
+        switch (effect)
+        {
+        case 1: blend |= (regular & blend2); break;
+        case 2: ret = VecSelect<V>(regular, VecColorBrightnessUp<V>(val1, EVY), ret); break;
+        case 3: ret = VecSelect<V>(regular, VecColorBrightnessDown<V>(val1, EVY), ret); break;
+        }
+
+        // bitmap sprites have their own alpha
+        V bitmap = obj1 & _3d1;
+        V alpha = flag1 & 0x1F;
+        V blendeva = VecSelect<V>(bitmap, alpha, eva);
+        V blendevb = VecSelect<V>(bitmap, VecSplat<V>(16) - alpha, evb);
+
+        ret = VecSelect<V>(blend, VecColorBlend4<V>(val1, val2, blendeva, blendevb), ret);
+        ret = VecSelect<V>(blend3d, VecColorBlend5<V>(val1, val2), ret);
+
+        memcpy(&BGOBJLine[i], &ret, sizeof(V));
+    }
+}
+
+// applies master brightness and converts to 32-bit BGRA
+// brightmode: 0=none 1=up 2=down
+template<typename V>
+inline __attribute__((always_inline)) void GPU2D::FinishLine(u32* dst, u32 brightmode, u32 factor)
+{
+    const int n = sizeof(V) / sizeof(u32);
+
+    for (int i = 0; i < 256; i += n)
+    {
+        V c;
+        memcpy(&c, &dst[i], sizeof(V));
+
+        if (brightmode == 1)      c = VecColorBrightnessUp<V>(c, factor);
+        else if (brightmode == 2) c = VecColorBrightnessDown<V>(c, factor);
+
+        c = ((c << 18) & 0xFC0000) | ((c << 2) & 0xFC00) | ((c >> 14) & 0xFC);
+        c = c | ((c & 0xC0C0C0) >> 6) | 0xFF000000;
+
+        memcpy(&dst[i], &c, sizeof(V));
+    }
+}
+
+// display capture: converts source A pixels to 15-bit, and blends them with source B if needed
+// mode: 0=source A, 2/3=sources A+B (hasB=false when source B isn't mapped)
+template<typename V>
+VECINLINE V VecCapturePixels(V valA, V valB, u32 mode, bool hasB, u32 eva, u32 evb)
+{
+    V rA = (valA >> 1) & 0x1F;
+    V gA = (valA >> 9) & 0x1F;
+    V bA = (valA >> 17) & 0x1F;
+    V aA = VecNonZero<V>(valA >> 24);
+
+    if (mode == 0)
+        return rA | (gA << 5) | (bA << 10) | (aA & 0x8000);
+
+    V rD = (rA * eva) & aA;
+    V gD = (gA * eva) & aA;
+    V bD = (bA * eva) & aA;
+    V aD = (eva > 0) ? aA : VecSplat<V>(0);
+
+    if (hasB)
+    {
+        V aB = (V)(VecSplat<V>(0) - (valB >> 15));
+
+        rD = (rD + ((( valB        & 0x1F) * evb) & aB)) >> 4;
+        gD = (gD + ((((valB >>  5) & 0x1F) * evb) & aB)) >> 4;
+        bD = (bD + ((((valB >> 10) & 0x1F) * evb) & aB)) >> 4;
+        if (evb > 0) aD |= aB;
+
+        rD = VecSelect<V>((V)(rD > VecSplat<V>(0x1F)), VecSplat<V>(0x1F), rD);
+        gD = VecSelect<V>((V)(gD > VecSplat<V>(0x1F)), VecSplat<V>(0x1F), gD);
+        bD = VecSelect<V>((V)(bD > VecSplat<V>(0x1F)), VecSplat<V>(0x1F), bD);
+    }
+    else
+    {
+        // can't go above 0x1F since eva is at most 16
+        rD >>= 4;
+        gD >>= 4;
+        bD >>= 4;
+    }
+
+    return rD | (gD << 5) | (bD << 10) | (aD & 0x8000);
+}
+
+template<typename V>
+static inline __attribute__((always_inline)) void CaptureRun(u16* dst, u32* srcA, u16* srcB, u32 num, u32 mode, u32 eva, u32 evb)
+{
+    const int n = sizeof(V) / sizeof(u32);
+
+    u32 i = 0;
+    for (; i + n <= num; i += n)
+    {
+        V valA, valB = {};
+        memcpy(&valA, &srcA[i], sizeof(V));
+        if (srcB) for (int j = 0; j < n; j++) valB[j] = srcB[i+j];
+
+        V res = VecCapturePixels<V>(valA, valB, mode, srcB != NULL, eva, evb);
+        for (int j = 0; j < n; j++) dst[i+j] = res[j];
+    }
+
+    if (i < num)
+    {
+        // leftover pixels at the end of the run
+        V valA = {}, valB = {};
+        for (u32 j = 0; j < num-i; j++)
+        {
+            valA[j] = srcA[i+j];
+            if (srcB) valB[j] = srcB[i+j];
+        }
+
+        V res = VecCapturePixels<V>(valA, valB, mode, srcB != NULL, eva, evb);
+        for (u32 j = 0; j < num-i; j++) dst[i+j] = res[j];
+    }
+}
+
+#ifdef GPU2D_X86_AVX2
+__attribute__((target("avx2"))) void GPU2D::CompositeLine_AVX2()
+{
+    CompositeLine<u32x8>();
+}
+
+__attribute__((target("avx2"))) void GPU2D::FinishLine_AVX2(u32* dst, u32 brightmode, u32 factor)
+{
+    FinishLine<u32x8>(dst, brightmode, factor);
+}
+
+__attribute__((target("avx2"))) static void CaptureRun_AVX2(u16* dst, u32* srcA, u16* srcB, u32 num, u32 mode, u32 eva, u32 evb)
+{
+    CaptureRun<u32x8>(dst, srcA, srcB, num, mode, eva, evb);
+}
+#endif
+
+
 void GPU2D::UpdateMosaicCounters(u32 line)
 {
     // Y mosaic uses incrementing 4-bit counters
@@ -749,14 +1019,111 @@ void GPU2D::UpdateMosaicCounters(u32 line)
 }
 
 
+void GPU2D::FlushLineRecords()
+{
+    RestoreReusedLine();
+
+    for (int i = 0; i < 192; i++)
+    {
+        LineRecords[i].Valid = false;
+        LineRecords[i].LowerLayersAfter = 0;
+    }
+    LowerLayers = 0;
+
+    FrameNum = 0;
+    OBJLineNum = 0xFFFFFFFF;
+}
+
+void GPU2D::RestoreReusedLine()
+{
+    if (!LastReusedLine) return;
+
+    memcpy(&BGOBJLine[256], LastReusedLine->BGOBJLineAfter, sizeof(LastReusedLine->BGOBJLineAfter));
+    LastReusedLine = NULL;
+}
+
+void GPU2D::GetLineState(LineState* state)
+{
+    // zero the padding too, states are compared with memcmp()
+    memset(state, 0, sizeof(LineState));
+
+    state->VCount = GPU::VCount;
+    state->DispCnt = DispCnt;
+    state->OBJDispCnt = OBJLineDispCnt;
+    state->VRAMMapSerial = GPU::VRAMMapSerial;
+    state->OBJVRAMMapSerial = OBJLineMapSerial;
+    memcpy(state->BGCnt, BGCnt, sizeof(BGCnt));
+    memcpy(state->BGXPos, BGXPos, sizeof(BGXPos));
+    memcpy(state->BGYPos, BGYPos, sizeof(BGYPos));
+    memcpy(state->BGXRef, BGXRefInternal, sizeof(BGXRefInternal));
+    memcpy(state->BGYRef, BGYRefInternal, sizeof(BGYRefInternal));
+    memcpy(state->BGRotA, BGRotA, sizeof(BGRotA));
+    memcpy(state->BGRotB, BGRotB, sizeof(BGRotB));
+    memcpy(state->BGRotC, BGRotC, sizeof(BGRotC));
+    memcpy(state->BGRotD, BGRotD, sizeof(BGRotD));
+    memcpy(state->Win0Coords, Win0Coords, 4);
+    memcpy(state->Win1Coords, Win1Coords, 4);
+    memcpy(state->WinCnt, WinCnt, 4);
+    state->Win0Active = Win0Active;
+    state->Win1Active = Win1Active;
+    memcpy(state->BGMosaicSize, BGMosaicSize, 2);
+    memcpy(state->OBJMosaicSize, OBJMosaicSize, 2);
+    state->BGMosaicY = BGMosaicY;
+    state->BGMosaicYMax = BGMosaicYMax;
+    state->OBJMosaicY = OBJLineMosaicY;
+    state->BlendCnt = BlendCnt;
+    state->BlendAlpha = BlendAlpha;
+    state->EVA = EVA;
+    state->EVB = EVB;
+    state->EVY = EVY;
+    state->MasterBrightness = MasterBrightness;
+}
+
+bool GPU2D::LineSourcesChangedSince(u32 gen)
+{
+    u32 base = Num ? 0x400 : 0;
+    if (GPU::PaletteChangedSince(base, 0x400, gen)) return true;
+    if (GPU::OAMChangedSince(base, 0x400, gen)) return true;
+
+    u32 banks = 0;
+    if (Num)
+    {
+        for (int i = 0; i < 0x8; i++) banks |= GPU::VRAMMap_BBG[i];
+        for (int i = 0; i < 0x8; i++) banks |= GPU::VRAMMap_BOBJ[i];
+        for (int i = 0; i < 4; i++) banks |= GPU::VRAMMap_BBGExtPal[i];
+        banks |= GPU::VRAMMap_BOBJExtPal;
+    }
+    else
+    {
+        for (int i = 0; i < 0x20; i++) banks |= GPU::VRAMMap_ABG[i];
+        for (int i = 0; i < 0x10; i++) banks |= GPU::VRAMMap_AOBJ[i];
+        for (int i = 0; i < 4; i++) banks |= GPU::VRAMMap_ABGExtPal[i];
+        banks |= GPU::VRAMMap_AOBJExtPal;
+    }
+
+    for (int bank = 0; bank < 9; bank++)
+    {
+        if (!(banks & (1<<bank))) continue;
+
+        if (GPU::VRAMChangedSince(bank, 0, GPU::VRAMMask[bank]+1, gen))
+            return true;
+    }
+
+    return false;
+}
+
 void GPU2D::DrawScanline(u32 line)
 {
+    PROFILE_SCOPE(Prof_GPU2D);
+
     int stride = Accelerated ? (256*3 + 1) : 256;
     u32* dst = &Framebuffer[stride * line];
 
     int n3dline = line;
     line = GPU::VCount;
 
+    LineRecord* rec = &LineRecords[n3dline];
+
     bool forceblank = false;
 
     // scanlines that end up outside of the GPU drawing range
@@ -769,6 +1136,8 @@ void GPU2D::DrawScanline(u32 line)
 
     if (forceblank)
     {
+        rec->Valid = false;
+
         for (int i = 0; i < 256; i++)
             dst[i] = 0xFFFFFFFF;
 
@@ -793,8 +1162,76 @@ void GPU2D::DrawScanline(u32 line)
         }
     }
 
+    // only regular display is looked at for reuse, and only if
+    // the sprites for this scanline were drawn at the usual time
+    bool track = !Accelerated && (dispmode <= 1) && (OBJLineNum == (u32)n3dline);
+    if (Num == 0)
+    {
+        // capture needs the composited scanline, and the 3D layer isn't tracked
+        if (CaptureCnt & (1<<31)) track = false;
+        if ((DispCnt & 0x0108) == 0x0108) track = false;
+    }
+
+    LineState state;
+    if (track)
+    {
+        GetLineState(&state);
+
+        if (rec->Valid && (rec->Frame == FrameNum-1) &&
+            !memcmp(&state, &rec->State, sizeof(LineState)) &&
+            !LineSourcesChangedSince(rec->Gen) &&
+            LowerLayers && (LowerLayers == rec->LowerLayersBefore))
+        {
+            // last frame's scanline is in the other buffer, which isn't drawn to this frame
+            if (rec->Row != dst)
+                memcpy(dst, rec->Row, 256*4);
+
+            // the affine reference points advance as if the scanline had been drawn
+            memcpy(BGXRefInternal, rec->BGXRefAfter, sizeof(BGXRefInternal));
+            memcpy(BGYRefInternal, rec->BGYRefAfter, sizeof(BGYRefInternal));
+            Win0Active = rec->Win0ActiveAfter;
+            Win1Active = rec->Win1ActiveAfter;
+            UpdateMosaicCounters(line);
+
+            // the next scanline that gets drawn starts from what this one left in BGOBJLine
+            LastReusedLine = rec;
+            LowerLayers = rec->LowerLayersAfter;
+
+            rec->Frame = FrameNum;
+            rec->Row = dst;
+            rec->Gen = OBJLineGen;
+            LinesReused++;
+            return;
+        }
+    }
+
+    rec->Valid = false;
+    LinesDrawn++;
+
+    RestoreReusedLine();
+
     // always render regular graphics
     DrawScanline_BGOBJ(line);
+
+    if (track)
+    {
+        memcpy(rec->BGXRefAfter, BGXRefInternal, sizeof(BGXRefInternal));
+        memcpy(rec->BGYRefAfter, BGYRefInternal, sizeof(BGYRefInternal));
+        rec->Win0ActiveAfter = Win0Active;
+        rec->Win1ActiveAfter = Win1Active;
+
+        // keep the serial if the lower layers came out the same, so the next scanline can still be reused
+        rec->LowerLayersBefore = LowerLayers;
+        if (!rec->LowerLayersAfter || memcmp(rec->BGOBJLineAfter, &BGOBJLine[256], sizeof(rec->BGOBJLineAfter)))
+        {
+            memcpy(rec->BGOBJLineAfter, &BGOBJLine[256], sizeof(rec->BGOBJLineAfter));
+            rec->LowerLayersAfter = ++LowerLayersSerial;
+        }
+        LowerLayers = rec->LowerLayersAfter;
+    }
+    else
+        LowerLayers = 0;
+
     UpdateMosaicCounters(line);
 
     switch (dispmode)
@@ -880,52 +1317,38 @@ void GPU2D::DrawScanline(u32 line)
         return;
     }
 
-    // master brightness
-    if (dispmode != 0)
-    {
-        if ((MasterBrightness >> 14) == 1)
-        {
-            // up
-            u32 factor = MasterBrightness & 0x1F;
-            if (factor > 16) factor = 16;
-
-            for (int i = 0; i < 256; i++)
-            {
-                dst[i] = ColorBrightnessUp(dst[i], factor);
-            }
-        }
-        else if ((MasterBrightness >> 14) == 2)
-        {
-            // down
-            u32 factor = MasterBrightness & 0x1F;
-            if (factor > 16) factor = 16;
-
-            for (int i = 0; i < 256; i++)
-            {
-                dst[i] = ColorBrightnessDown(dst[i], factor);
-            }
-        }
-    }
-
-    // convert to 32-bit BGRA
+    // master brightness, and conversion to 32-bit BGRA
     // note: 32-bit RGBA would be more straightforward, but
     // BGRA seems to be more compatible (Direct2D soft, cairo...)
-    for (int i = 0; i < 256; i+=2)
+    u32 brightmode = 0;
+    u32 factor = MasterBrightness & 0x1F;
+    if (factor > 16) factor = 16;
+    if (dispmode != 0)
     {
-        u64 c = *(u64*)&dst[i];
+        brightmode = MasterBrightness >> 14;
+        if (brightmode == 3) brightmode = 0;
+    }
 
-        u64 r = (c << 18) & 0xFC000000FC0000;
-        u64 g = (c << 2) & 0xFC000000FC00;
-        u64 b = (c >> 14) & 0xFC000000FC;
-        c = r | g | b;
+#ifdef GPU2D_X86_AVX2
+    if (HostHasAVX2) FinishLine_AVX2(dst, brightmode, factor);
+    else
+#endif
+    FinishLine<u32x4>(dst, brightmode, factor);
 
-        *(u64*)&dst[i] = c | ((c & 0x00C0C0C000C0C0C0) >> 6) | 0xFF000000FF000000;
+    if (track)
+    {
+        rec->Valid = true;
+        rec->Frame = FrameNum;
+        rec->Row = dst;
+        rec->Gen = OBJLineGen;
+        rec->State = state;
     }
 }
 
 void GPU2D::VBlank()
 {
     CaptureCnt &= ~(1<<31);
+    FrameNum++;
 
     DispFIFOReadPtr = 0;
     DispFIFOWritePtr = 0;
@@ -968,6 +1391,16 @@ void GPU2D::DoCapture(u32 line, u32 width)
     u16* dst = (u16*)GPU::VRAM[dstvram];
     u32 dstaddr = (((CaptureCnt >> 18) & 0x3) << 14) + (line * width);
 
+    // the whole line gets written below, wrapping around at the end of the bank
+    u32 dstend = (dstaddr + width - 1) & 0xFFFF;
+    if (dstend >= dstaddr)
+        GPU::MarkVRAMDirtyRange(dstvram, dstaddr << 1, width << 1);
+    else
+    {
+        GPU::MarkVRAMDirtyRange(dstvram, dstaddr << 1, (0x10000 - dstaddr) << 1);
+        GPU::MarkVRAMDirtyRange(dstvram, 0, (dstend + 1) << 1);
+    }
+
     // TODO: handle 3D in accelerated mode!!
 
     u32* srcA;
@@ -1060,117 +1493,48 @@ void GPU2D::DoCapture(u32 line, u32 width)
     dstaddr &= 0xFFFF;
     srcBaddr &= 0xFFFF;
 
-    switch ((CaptureCnt >> 29) & 0x3)
-    {
-    case 0: // source A
-        {
-            for (u32 i = 0; i < width; i++)
-            {
-                u32 val = srcA[i];
+    u32 mode = (CaptureCnt >> 29) & 0x3;
+    u32 eva = CaptureCnt & 0x1F;
+    u32 evb = (CaptureCnt >> 8) & 0x1F;
 
-                // TODO: check what happens when alpha=0
+    // checkme
+    if (eva > 16) eva = 16;
+    if (evb > 16) evb = 16;
 
-                u32 r = (val >> 1) & 0x1F;
-                u32 g = (val >> 9) & 0x1F;
-                u32 b = (val >> 17) & 0x1F;
-                u32 a = ((val >> 24) != 0) ? 0x8000 : 0;
+    if (mode == 0)
+        srcB = NULL;
+    else if (mode == 1)
+        srcA = NULL;
 
-                dst[dstaddr] = r | (g << 5) | (b << 10) | a;
-                dstaddr = (dstaddr + 1) & 0xFFFF;
-            }
-        }
-        break;
+    // work on runs that don't wrap around in either bank
+    u32 i = 0;
+    while (i < width)
+    {
+        u32 num = width - i;
+        if (num > 0x10000 - dstaddr) num = 0x10000 - dstaddr;
+        if (srcB && (num > 0x10000 - srcBaddr)) num = 0x10000 - srcBaddr;
 
-    case 1: // source B
-        {
-            if (srcB)
-            {
-                for (u32 i = 0; i < width; i++)
-                {
-                    dst[dstaddr] = srcB[srcBaddr];
-                    srcBaddr = (srcBaddr + 1) & 0xFFFF;
-                    dstaddr = (dstaddr + 1) & 0xFFFF;
-                }
-            }
-            else
-            {
-                for (u32 i = 0; i < width; i++)
-                {
-                    dst[dstaddr] = 0;
-                    dstaddr = (dstaddr + 1) & 0xFFFF;
-                }
-            }
-        }
-        break;
+        u16* rundst = &dst[dstaddr];
+        u16* runsrcB = srcB ? &srcB[srcBaddr] : NULL;
 
-    case 2: // sources A+B
-    case 3:
+        if (mode == 1)
         {
-            u32 eva = CaptureCnt & 0x1F;
-            u32 evb = (CaptureCnt >> 8) & 0x1F;
-
-            // checkme
-            if (eva > 16) eva = 16;
-            if (evb > 16) evb = 16;
-
-            if (srcB)
-            {
-                for (u32 i = 0; i < width; i++)
-                {
-                    u32 val = srcA[i];
-
-                    // TODO: check what happens when alpha=0
-
-                    u32 rA = (val >> 1) & 0x1F;
-                    u32 gA = (val >> 9) & 0x1F;
-                    u32 bA = (val >> 17) & 0x1F;
-                    u32 aA = ((val >> 24) != 0) ? 1 : 0;
-
-                    val = srcB[srcBaddr];
-
-                    u32 rB = val & 0x1F;
-                    u32 gB = (val >> 5) & 0x1F;
-                    u32 bB = (val >> 10) & 0x1F;
-                    u32 aB = val >> 15;
-
-                    u32 rD = ((rA * aA * eva) + (rB * aB * evb)) >> 4;
-                    u32 gD = ((gA * aA * eva) + (gB * aB * evb)) >> 4;
-                    u32 bD = ((bA * aA * eva) + (bB * aB * evb)) >> 4;
-                    u32 aD = (eva>0 ? aA : 0) | (evb>0 ? aB : 0);
-
-                    if (rD > 0x1F) rD = 0x1F;
-                    if (gD > 0x1F) gD = 0x1F;
-                    if (bD > 0x1F) bD = 0x1F;
-
-                    dst[dstaddr] = rD | (gD << 5) | (bD << 10) | (aD << 15);
-                    srcBaddr = (srcBaddr + 1) & 0xFFFF;
-                    dstaddr = (dstaddr + 1) & 0xFFFF;
-                }
-            }
-            else
-            {
-                for (u32 i = 0; i < width; i++)
-                {
-                    u32 val = srcA[i];
-
-                    // TODO: check what happens when alpha=0
-
-                    u32 rA = (val >> 1) & 0x1F;
-                    u32 gA = (val >> 9) & 0x1F;
-                    u32 bA = (val >> 17) & 0x1F;
-                    u32 aA = ((val >> 24) != 0) ? 1 : 0;
-
-                    u32 rD = (rA * aA * eva) >> 4;
-                    u32 gD = (gA * aA * eva) >> 4;
-                    u32 bD = (bA * aA * eva) >> 4;
-                    u32 aD = (eva>0 ? aA : 0);
-
-                    dst[dstaddr] = rD | (gD << 5) | (bD << 10) | (aD << 15);
-                    dstaddr = (dstaddr + 1) & 0xFFFF;
-                }
-            }
+            // source B
+            // it can be the bank being captured to. the read and write offsets are
+            // both multiples of 16K, so it's then either the same pixels or no overlap
+            if (!runsrcB)               memset(rundst, 0, num << 1);
+            else if (runsrcB != rundst) memcpy(rundst, runsrcB, num << 1);
         }
-        break;
+#ifdef GPU2D_X86_AVX2
+        else if (HostHasAVX2)
+            CaptureRun_AVX2(rundst, &srcA[i], runsrcB, num, mode, eva, evb);
+#endif
+        else
+            CaptureRun<u32x4>(rundst, &srcA[i], runsrcB, num, mode, eva, evb);
+
+        i += num;
+        dstaddr = (dstaddr + num) & 0xFFFF;
+        srcBaddr = (srcBaddr + num) & 0xFFFF;
     }
 }
 
@@ -1191,6 +1555,9 @@ void GPU2D::BGExtPalDirty(u32 base)
 {
     BGExtPalStatus[base] = 0;
     BGExtPalStatus[base+1] = 0;
+
+    // the tile cache has the extended palettes baked in
+    FlushBGTileCache();
 }
 
 void GPU2D::OBJExtPalDirty()
@@ -1199,6 +1566,100 @@ void GPU2D::OBJExtPalDirty()
 }
 
 
+void GPU2D::FlushBGTileCache()
+{
+    BGTileEpoch++;
+    for (int i = 0; i < 0x20; i++)
+    {
+        BGTilePageEpoch[i] = BGTileEpoch;
+        BGTilePageMask[i] = 0;
+    }
+
+    // makes UpdateBGTileCache() compare the VRAM mappings against the ones above
+    BGTileGen = 0;
+}
+
+void GPU2D::UpdateBGTileCache()
+{
+    // called before drawing each scanline, throws out the rows whose source
+    // got written to or remapped since the last time
+
+    if (GPU::PaletteChangedSince(Num ? 0x400 : 0, 0x200, BGTileGen))
+    {
+        BGTileEpoch++;
+        for (int i = 0; i < 0x20; i++)
+            BGTilePageEpoch[i] = BGTileEpoch;
+    }
+
+    u32 npages = Num ? 0x8 : 0x20;
+    u32* map = Num ? GPU::VRAMMap_BBG : GPU::VRAMMap_ABG;
+    for (u32 page = 0; page < npages; page++)
+    {
+        u32 mask = map[page];
+        bool dirty = (mask != BGTilePageMask[page]);
+
+        for (int bank = 0; bank < 9 && !dirty; bank++)
+        {
+            if (!(mask & (1<<bank))) continue;
+
+            if (GPU::VRAMChangedSince(bank, (page << 14) & GPU::VRAMMask[bank], 0x4000, BGTileGen))
+                dirty = true;
+        }
+
+        if (dirty)
+        {
+            BGTilePageEpoch[page] = ++BGTileEpoch;
+            BGTilePageMask[page] = mask;
+        }
+    }
+
+    BGTileGen = GPU::NextDirtyGeneration();
+}
+
+// rowaddr: address of the tile row in BG VRAM
+// palkey: identifies the palette pal points to, for the cache key
+GPU2D::BGTileRow* GPU2D::GetBGTileRow(u32 rowaddr, bool bpp8, u32 palkey, u16* pal)
+{
+    u32 ofs = rowaddr & (Num ? 0x1FFFF : 0x7FFFF);
+    u32 key = 0x80000000 | (palkey << 20) | (bpp8 << 19) | ofs;
+    u32 page = ofs >> 14;
+
+    BGTileRow* row = &BGTileCache[(key ^ (key >> 11) ^ (key >> 22)) & 0x7FF];
+    if (row->Key == key && row->Epoch == BGTilePageEpoch[page])
+        return row;
+
+    row->Key = key;
+    row->Epoch = BGTilePageEpoch[page];
+    row->Opaque = 0;
+
+    if (bpp8)
+    {
+        u32 pixels[2];
+        pixels[0] = GPU::ReadVRAM_BG<u32>(rowaddr);
+        pixels[1] = GPU::ReadVRAM_BG<u32>(rowaddr + 4);
+
+        for (int x = 0; x < 8; x++)
+        {
+            u8 color = (pixels[x >> 2] >> ((x & 0x3) << 3)) & 0xFF;
+            row->Color[x] = pal[color];
+            if (color) row->Opaque |= (1<<x);
+        }
+    }
+    else
+    {
+        u32 pixels = GPU::ReadVRAM_BG<u32>(rowaddr);
+
+        for (int x = 0; x < 8; x++)
+        {
+            u8 color = (pixels >> (x << 2)) & 0xF;
+            row->Color[x] = pal[color];
+            if (color) row->Opaque |= (1<<x);
+        }
+    }
+
+    return row;
+}
+
 u16* GPU2D::GetBGExtPal(u32 slot, u32 pal)
 {
     u16* dst = &BGExtPalCache[slot][pal << 8];
@@ -1444,6 +1905,9 @@ void GPU2D::DrawScanline_BGOBJ(u32 line)
         return;
     }
 
+    if (DispCnt & 0x0F00)
+        UpdateBGTileCache();
+
     u64 backdrop;
     if (Num) backdrop = *(u16*)&GPU::Palette[0x400];
     else     backdrop = *(u16*)&GPU::Palette[0];
@@ -1480,17 +1944,14 @@ void GPU2D::DrawScanline_BGOBJ(u32 line)
     }
 
     // color special effects
-    // can likely be optimized
 
     if (!Accelerated)
     {
-        for (int i = 0; i < 256; i++)
-        {
-            u32 val1 = BGOBJLine[i];
-            u32 val2 = BGOBJLine[256+i];
-
-            BGOBJLine[i] = ColorComposite(i, val1, val2);
-        }
+#ifdef GPU2D_X86_AVX2
+        if (HostHasAVX2) CompositeLine_AVX2();
+        else
+#endif
+        CompositeLine<u32x4>();
     }
     else
     {
@@ -1676,7 +2137,7 @@ void GPU2D::DrawBG_Text(u32 line, u32 bgnum)
 
     u32 tilesetaddr, tilemapaddr;
     u16* pal;
-    u32 extpal, extpalslot;
+    u32 extpal, extpalslot = 0;
 
     u16 xoff = BGXPos[bgnum];
     u16 yoff = BGYPos[bgnum] + line;
@@ -1717,6 +2178,40 @@ void GPU2D::DrawBG_Text(u32 line, u32 bgnum)
     else
         tilemapaddr += ((yoff & 0xF8) << 3);
 
+    if (!mosaic)
+    {
+        // go through the tile cache, one tile row at a time
+        u32 tiley = yoff & 0x7;
+
+        for (int i = 0; i < 256; )
+        {
+            u16 tile = GPU::ReadVRAM_BG<u16>(tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3));
+            u32 rowy = (tile & 0x0800) ? (7-tiley) : tiley;
+
+            BGTileRow* row;
+            if (!(bgcnt & 0x0080))
+                row = GetBGTileRow(tilesetaddr + ((tile & 0x03FF) << 5) + (rowy << 2), false, tile >> 12, pal + ((tile & 0xF000) >> 8));
+            else if (extpal)
+                row = GetBGTileRow(tilesetaddr + ((tile & 0x03FF) << 6) + (rowy << 3), true,
+                                   0x100 | (extpalslot << 4) | (tile >> 12), GetBGExtPal(extpalslot, tile >> 12));
+            else
+                row = GetBGTileRow(tilesetaddr + ((tile & 0x03FF) << 6) + (rowy << 3), true, 0, pal);
+
+            u32 xflip = (tile & 0x0400) ? 7 : 0;
+            for (u32 x = xoff & 0x7; x < 8 && i < 256; x++)
+            {
+                u32 tilex = x ^ xflip;
+                if ((row->Opaque & (1<<tilex)) && (WindowMask[i] & (1<<bgnum)))
+                    DrawPixel(&BGOBJLine[i], row->Color[tilex], 0x01000000<<bgnum);
+
+                i++;
+                xoff++;
+            }
+        }
+
+        return;
+    }
+
     u16 curtile;
     u16* curpal;
     u32 pixelsaddr;
@@ -2091,9 +2586,10 @@ void GPU2D::DrawBG_Extended(u32 line, u32 bgnum)
             pal = (u16*)&GPU::Palette[0];
         }
 
-        u16 curtile;
-        u16* curpal;
-        u8 color;
+        u16 curtile = 0;
+        u32 lastmapaddr = 0xFFFFFFFF;
+        BGTileRow* row = NULL;
+        u32 lastrowaddr = 0xFFFFFFFF, lastpalkey = 0;
 
         yshift -= 3;
 
@@ -2116,10 +2612,12 @@ void GPU2D::DrawBG_Extended(u32 line, u32 bgnum)
 
                 if ((!((finalX|finalY) & overflowmask)))
                 {
-                    curtile = GPU::ReadVRAM_BG<u16>(tilemapaddr + (((((finalY & coordmask) >> 11) << yshift) + ((finalX & coordmask) >> 11)) << 1));
-
-                    if (extpal) curpal = GetBGExtPal(bgnum, curtile>>12);
-                    else        curpal = pal;
+                    u32 mapaddr = tilemapaddr + (((((finalY & coordmask) >> 11) << yshift) + ((finalX & coordmask) >> 11)) << 1);
+                    if (mapaddr != lastmapaddr)
+                    {
+                        curtile = GPU::ReadVRAM_BG<u16>(mapaddr);
+                        lastmapaddr = mapaddr;
+                    }
 
                     // draw pixel
                     u32 tilexoff = (finalX >> 8) & 0x7;
@@ -2128,10 +2626,18 @@ void GPU2D::DrawBG_Extended(u32 line, u32 bgnum)
                     if (curtile & 0x0400) tilexoff = 7-tilexoff;
                     if (curtile & 0x0800) tileyoff = 7-tileyoff;
 
-                    color = GPU::ReadVRAM_BG<u8>(tilesetaddr + ((curtile & 0x03FF) << 6) + (tileyoff << 3) + tilexoff);
+                    // neighbouring pixels usually come from the same tile row
+                    u32 rowaddr = tilesetaddr + ((curtile & 0x03FF) << 6) + (tileyoff << 3);
+                    u32 palkey = extpal ? (0x100 | (bgnum << 4) | (curtile >> 12)) : 0;
+                    if (rowaddr != lastrowaddr || palkey != lastpalkey)
+                    {
+                        row = GetBGTileRow(rowaddr, true, palkey, extpal ? GetBGExtPal(bgnum, curtile>>12) : pal);
+                        lastrowaddr = rowaddr;
+                        lastpalkey = palkey;
+                    }
 
-                    if (color)
-                        DrawPixel(&BGOBJLine[i], curpal[color], 0x01000000<<bgnum);
+                    if (row->Opaque & (1<<tilexoff))
+                        DrawPixel(&BGOBJLine[i], row->Color[tilexoff], 0x01000000<<bgnum);
                 }
             }
 
@@ -2327,27 +2833,8 @@ void GPU2D::InterleaveSprites(u32 prio)
         DrawSprite_##type<false>(__VA_ARGS__); \
     }
 
-void GPU2D::DrawSprites(u32 line)
+void GPU2D::BinSprites()
 {
-    if (line == 0)
-    {
-        // reset those counters here
-        // TODO: find out when those are supposed to be reset
-        // it would make sense to reset them at the end of VBlank
-        // however, sprites are rendered one scanline in advance
-        // so they need to be reset a bit earlier
-
-        OBJMosaicY = 0;
-        OBJMosaicYCount = 0;
-    }
-
-    NumSprites = 0;
-    memset(OBJLine, 0, 256*4);
-    memset(OBJWindow, 0, 256);
-    if (!(DispCnt & 0x1000)) return;
-
-    memset(OBJIndex, 0xFF, 256);
-
     u16* oam = (u16*)&GPU::OAM[Num ? 0x400 : 0];
 
     const s32 spritewidth[16] =
@@ -2365,6 +2852,10 @@ void GPU2D::DrawSprites(u32 line)
         64, 32, 64, 8
     };
 
+    memset(OBJBinCount, 0, 256);
+    NumMosaicOBJs = 0;
+
+    u32 n = 0;
     for (int bgnum = 0x0C00; bgnum >= 0x0000; bgnum -= 0x0400)
     {
         for (int sprnum = 127; sprnum >= 0; sprnum--)
@@ -2374,69 +2865,127 @@ void GPU2D::DrawSprites(u32 line)
             if ((attrib[2] & 0x0C00) != bgnum)
                 continue;
 
-            bool iswin = (((attrib[0] >> 10) & 0x3) == 2);
+            // disabled sprite
+            if ((attrib[0] & 0x0300) == 0x0200)
+                continue;
 
-            u32 sprline;
-            if ((attrib[0] & 0x1000) && !iswin)
+            OBJInfo* obj = &OBJList[n];
+
+            u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
+            obj->Num = sprnum;
+            obj->Rotscale = (attrib[0] & 0x0100) != 0;
+            obj->Window = (((attrib[0] >> 10) & 0x3) == 2);
+            obj->Mosaic = (attrib[0] & 0x1000) && !obj->Window;
+            obj->XPos = (s32)(attrib[1] << 23) >> 23;
+            obj->YPos = attrib[0] & 0xFF;
+            obj->Width = spritewidth[sizeparam];
+            obj->Height = spriteheight[sizeparam];
+            obj->BoundWidth = obj->Width;
+            obj->BoundHeight = obj->Height;
+
+            if (obj->Rotscale && (attrib[0] & 0x0200))
             {
-                // apply Y mosaic
-                sprline = OBJMosaicY;
+                obj->BoundWidth <<= 1;
+                obj->BoundHeight <<= 1;
             }
-            else
-                sprline = line;
 
-            if (attrib[0] & 0x0100)
+            if (obj->XPos <= -(s32)obj->BoundWidth)
+                continue;
+
+            for (u32 y = 0; y < obj->BoundHeight; y++)
             {
-                u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
-                s32 width = spritewidth[sizeparam];
-                s32 height = spriteheight[sizeparam];
-                s32 boundwidth = width;
-                s32 boundheight = height;
+                u32 sprline = (obj->YPos + y) & 0xFF;
+                OBJBin[sprline][OBJBinCount[sprline]++] = n;
+            }
 
-                if (attrib[0] & 0x0200)
-                {
-                    boundwidth <<= 1;
-                    boundheight <<= 1;
-                }
+            if (obj->Mosaic) NumMosaicOBJs++;
+            n++;
+        }
+    }
 
-                u32 ypos = attrib[0] & 0xFF;
-                ypos = (sprline - ypos) & 0xFF;
-                if (ypos >= (u32)boundheight)
-                    continue;
+    OBJBinsValid = true;
+    OBJBinGen = GPU::NextDirtyGeneration();
+}
 
-                s32 xpos = (s32)(attrib[1] << 23) >> 23;
-                if (xpos <= -boundwidth)
-                    continue;
+void GPU2D::DrawSprites(u32 line)
+{
+    if (line == 0)
+    {
+        // reset those counters here
+        // TODO: find out when those are supposed to be reset
+        // it would make sense to reset them at the end of VBlank
+        // however, sprites are rendered one scanline in advance
+        // so they need to be reset a bit earlier
 
-                u32 rotparamgroup = (attrib[1] >> 9) & 0x1F;
+        OBJMosaicY = 0;
+        OBJMosaicYCount = 0;
+    }
 
-                DoDrawSprite(Rotscale, sprnum, boundwidth, boundheight, width, height, xpos, ypos);
+    // remembered so DrawScanline() can tell what the sprites were drawn from
+    OBJLineNum = line;
+    OBJLineGen = GPU::NextDirtyGeneration();
+    OBJLineDispCnt = DispCnt;
+    OBJLineMapSerial = GPU::VRAMMapSerial;
+    OBJLineMosaicY = OBJMosaicY;
 
-                NumSprites++;
-            }
-            else
-            {
-                if (attrib[0] & 0x0200)
-                    continue;
+    NumSprites = 0;
+    memset(OBJLine, 0, 256*4);
+    memset(OBJWindow, 0, 256);
+    if (!(DispCnt & 0x1000)) return;
 
-                u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
-                s32 width = spritewidth[sizeparam];
-                s32 height = spriteheight[sizeparam];
+    memset(OBJIndex, 0xFF, 256);
 
-                u32 ypos = attrib[0] & 0xFF;
-                ypos = (sprline - ypos) & 0xFF;
-                if (ypos >= (u32)height)
-                    continue;
+    if (!OBJBinsValid || GPU::OAMChangedSince(Num ? 0x400 : 0, 0x400, OBJBinGen))
+        BinSprites();
 
-                s32 xpos = (s32)(attrib[1] << 23) >> 23;
-                if (xpos <= -width)
-                    continue;
+    // sprites with Y mosaic are looked up at the mosaic line, the others at the current line
+    // both bins are in draw order, so merging them keeps the original order
+    u32 line1 = line & 0xFF;
+    u32 line2 = OBJMosaicY;
+    bool split = (line1 != line2) && NumMosaicOBJs;
 
-                DoDrawSprite(Normal, sprnum, width, height, xpos, ypos);
+    u8* bin1 = OBJBin[line1];
+    u8* bin2 = OBJBin[line2];
+    u32 n1 = OBJBinCount[line1];
+    u32 n2 = split ? OBJBinCount[line2] : 0;
+    u32 i1 = 0, i2 = 0;
 
-                NumSprites++;
-            }
+    for (;;)
+    {
+        if (split)
+        {
+            while (i1 < n1 && OBJList[bin1[i1]].Mosaic) i1++;
+            while (i2 < n2 && !OBJList[bin2[i2]].Mosaic) i2++;
+        }
+
+        OBJInfo* obj;
+        u32 sprline;
+        if (i1 < n1 && (i2 >= n2 || bin1[i1] < bin2[i2]))
+        {
+            obj = &OBJList[bin1[i1++]];
+            sprline = line1;
         }
+        else if (i2 < n2)
+        {
+            obj = &OBJList[bin2[i2++]];
+            sprline = line2;
+        }
+        else
+            break;
+
+        bool iswin = obj->Window;
+        s32 ypos = (sprline - obj->YPos) & 0xFF;
+
+        if (obj->Rotscale)
+        {
+            DoDrawSprite(Rotscale, obj->Num, obj->BoundWidth, obj->BoundHeight, obj->Width, obj->Height, obj->XPos, ypos);
+        }
+        else
+        {
+            DoDrawSprite(Normal, obj->Num, obj->Width, obj->Height, obj->XPos, ypos);
+        }
+
+        NumSprites++;
     }
 }
 
@@ -59,6 +59,10 @@ public:
 
     void CheckWindows(u32 line);
 
+    // scanline reuse stats for the current title, cleared on reset
+    u32 LinesDrawn;
+    u32 LinesReused;
+
     void BGExtPalDirty(u32 base);
     void OBJExtPalDirty();
 
@@ -132,14 +136,124 @@ private:
     u32 BGExtPalStatus[4];
     u32 OBJExtPalStatus;
 
+    // decoded tile rows for text and extended BGs, with the palette already applied
+    // entries are tagged with the epoch of the 16K page they were read from,
+    // bumping a page's epoch throws out everything that came from it
+    typedef struct
+    {
+        u32 Key;
+        u32 Epoch;
+        u16 Color[8];
+        u8 Opaque;
+
+    } BGTileRow;
+
+    BGTileRow BGTileCache[2048];
+    u32 BGTileEpoch;
+    u32 BGTilePageEpoch[0x20];
+    u32 BGTilePageMask[0x20];
+    u32 BGTileGen;
+
+    // OAM parsed into draw order, and binned by the sprite line each entry covers
+    // rebuilt whenever this engine's OAM is written to
+    typedef struct
+    {
+        u8 Num;
+        bool Rotscale;
+        bool Window;
+        bool Mosaic;
+        s16 XPos;
+        u8 YPos;
+        u8 Width, Height;
+        u8 BoundWidth, BoundHeight;
+
+    } OBJInfo;
+
+    OBJInfo OBJList[128];
+    u8 OBJBin[256][128];
+    u8 OBJBinCount[256];
+    u32 NumMosaicOBJs;
+    bool OBJBinsValid;
+    u32 OBJBinGen;
+
+    // what a scanline's output depends on, besides the contents of VRAM/palette/OAM
+    // if it's the same as last frame and nothing the engine can see got written to,
+    // the scanline is copied over from the previous frame instead of being drawn
+    typedef struct
+    {
+        u32 VCount;
+        u32 DispCnt;
+        u32 OBJDispCnt; // when the sprites were drawn
+        u32 VRAMMapSerial;
+        u32 OBJVRAMMapSerial;
+        u16 BGCnt[4];
+        u16 BGXPos[4];
+        u16 BGYPos[4];
+        s32 BGXRef[2];
+        s32 BGYRef[2];
+        s16 BGRotA[2], BGRotB[2], BGRotC[2], BGRotD[2];
+        u8 Win0Coords[4], Win1Coords[4], WinCnt[4];
+        u32 Win0Active, Win1Active;
+        u8 BGMosaicSize[2], OBJMosaicSize[2];
+        u8 BGMosaicY, BGMosaicYMax, OBJMosaicY;
+        u16 BlendCnt, BlendAlpha;
+        u8 EVA, EVB, EVY;
+        u16 MasterBrightness;
+
+    } LineState;
+
+    typedef struct
+    {
+        bool Valid;
+        u32 Frame;
+        u32* Row;
+        u32 Gen;
+        s32 BGXRefAfter[2], BGYRefAfter[2];
+        u32 Win0ActiveAfter, Win1ActiveAfter;
+        LineState State;
+
+        // the second layer of BGOBJLine isn't all overwritten when drawing a scanline,
+        // so it's an input to the next one as much as an output of this one
+        // (the third layer is only used by the accelerated renderer, which isn't tracked)
+        // Before/After are serials standing for its contents, 0 being unknown
+        u64 LowerLayersBefore, LowerLayersAfter;
+        u32 BGOBJLineAfter[256];
+
+    } LineRecord;
+
+    LineRecord LineRecords[192];
+    LineRecord* LastReusedLine; // its BGOBJLineAfter is yet to be put back
+    u64 LowerLayers, LowerLayersSerial;
+    u32 FrameNum;
+
+    u32 OBJLineNum;
+    u32 OBJLineGen;
+    u32 OBJLineDispCnt;
+    u32 OBJLineMapSerial;
+    u8 OBJLineMosaicY;
+
     u32 ColorBlend4(u32 val1, u32 val2, u32 eva, u32 evb);
     u32 ColorBlend5(u32 val1, u32 val2);
     u32 ColorBrightnessUp(u32 val, u32 factor);
     u32 ColorBrightnessDown(u32 val, u32 factor);
     u32 ColorComposite(int i, u32 val1, u32 val2);
 
+    template<typename V> void CompositeLine();
+    template<typename V> void FinishLine(u32* dst, u32 brightmode, u32 factor);
+    void CompositeLine_AVX2();
+    void FinishLine_AVX2(u32* dst, u32 brightmode, u32 factor);
+
     void UpdateMosaicCounters(u32 line);
 
+    void FlushLineRecords();
+    void RestoreReusedLine();
+    void GetLineState(LineState* state);
+    bool LineSourcesChangedSince(u32 gen);
+
+    void FlushBGTileCache();
+    void UpdateBGTileCache();
+    BGTileRow* GetBGTileRow(u32 rowaddr, bool bpp8, u32 palkey, u16* pal);
+
     template<u32 bgmode> void DrawScanlineBGMode(u32 line);
     void DrawScanlineBGMode6(u32 line);
     void DrawScanlineBGMode7(u32 line);
@@ -155,6 +269,7 @@ private:
     template<bool mosaic> void DrawBG_Extended(u32 line, u32 bgnum);
     template<bool mosaic> void DrawBG_Large(u32 line);
 
+    void BinSprites();
     void ApplySpriteMosaicX();
     void InterleaveSprites(u32 prio);
     template<bool window> void DrawSprite_Rotscale(u32 num, u32 boundwidth, u32 boundheight, u32 width, u32 height, s32 xpos, s32 ypos);
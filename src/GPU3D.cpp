@@ -19,10 +19,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include "NDS.h"
 #include "GPU.h"
 #include "FIFO.h"
 #include "Config.h"
+#include "Platform.h"
+#include "Profiler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GPU3D_X86_SIMD
+#include <immintrin.h>
+#endif
 
 
 // 3D engine notes
@@ -208,6 +217,12 @@ s32 TexMatrix[16];
 s32 ClipMatrix[16];
 bool ClipMatrixDirty;
 
+#ifdef GPU3D_X86_SIMD
+// which matrix math kernels can be used
+static bool HostHasSSE41 = false;
+static bool HostHasAVX2 = false;
+#endif
+
 u32 Viewport[6];
 
 s32 ProjMatrixStack[16];
@@ -255,10 +270,10 @@ u32 NumConsecutivePolygons;
 Polygon* LastStripPolygon;
 u32 NumOpaquePolygons;
 
-Vertex VertexRAM[6144 * 2];
+VertexArrays VertexRAM;
 Polygon PolygonRAM[2048 * 2];
 
-Vertex* CurVertexRAM;
+u32 CurVertexBase; // index of the current bank's first vertex
 Polygon* CurPolygonRAM;
 u32 NumVertices, NumPolygons;
 u32 CurRAMBank;
@@ -269,23 +284,90 @@ u32 RenderNumPolygons;
 u32 FlushRequest;
 u32 FlushAttributes;
 
+u32 PolygonsAccepted, PolygonsClipped, PolygonsRejected;
+
+// geometry thread
+//
+// when enabled, commands are still timed on the emu thread (FIFO levels, GXSTAT,
+// pipelines, IRQs), but the geometry work itself (matrices, lighting, transforms,
+// clipping, polygon setup) is queued to a worker which fills the current
+// vertex/polygon RAM. the timing side keeps its own copy of the few bits of
+// geometry state the cycle counts depend on.
+// the emu thread only waits on the worker when it needs something back from it:
+// test results, matrix reads, RAM counters, the flush at VBlank and savestates.
+bool ThreadedGeometry;
+void* GeometryThread;
+std::atomic<bool> GeometryThreadRunning;
+void* Sema_GeometryStart;
+
+// command queue to the worker, in words: command|(numparams<<8), then the parameters
+// read/write positions are free-running, wrapped when indexing
+const u32 kGeometryQueueSize = 0x4000;
+u32 GeometryQueue[kGeometryQueueSize];
+std::atomic<u32> GeometryQueueRead;
+std::atomic<u32> GeometryQueueWrite;
+bool GeometryQueuePosted;
+
+// what the command timing needs to know of the geometry state
+u32 TimingMatrixMode;
+s32 TimingProjStackPointer;
+s32 TimingPosStackPointer;
+s32 TimingTexStackPointer;
+u32 TimingPolygonAttr;
+u32 TimingCurPolygonAttr;
+u32 TimingPolygonMode;
+u32 TimingVertexNumInPoly;
+u32 TimingNumConsecutivePolygons;
+
+// results going back to the timing side
+// LastPolygonVerts: vertex count of the last submitted polygon, 0 if it was culled or clipped out
+u32 LastPolygonVerts;
+bool BoxTestResult;
+bool BoxTestPending;
+std::atomic<bool> PolygonRAMOverflow;
+
+void GeometryThreadFunc();
+void StopGeometryThread();
+void SetupGeometryThread();
+void SyncGeometry();
+void CopyTimingState();
+
 
 
 bool Init()
 {
+    NDS::IOHandlers io = {Read8, Read16, Read32, Write8, Write16, Write32};
+    NDS::RegisterIO(0, 0x04000320, 0x040006A4, &io);
+
+    // DISP3DCNT, only 16/32-bit
+    NDS::IOHandlers disp3dcnt = {NULL, Read16, Read32, NULL, Write16, Write32};
+    NDS::RegisterIO(0, 0x04000060, 0x04000064, &disp3dcnt);
+
     CmdFIFO = new FIFO<CmdFIFOEntry>(256);
     CmdPIPE = new FIFO<CmdFIFOEntry>(4);
 
     CmdStallQueue = new FIFO<CmdFIFOEntry>(64);
 
+    Sema_GeometryStart = Platform::Semaphore_Create();
+    ThreadedGeometry = false;
+    GeometryThreadRunning = false;
+
     Renderer = -1;
     // SetRenderer() will be called to set it up later
 
+#ifdef GPU3D_X86_SIMD
+    HostHasSSE41 = __builtin_cpu_supports("sse4.1");
+    HostHasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+
     return true;
 }
 
 void DeInit()
 {
+    StopGeometryThread();
+    Platform::Semaphore_Free(Sema_GeometryStart);
+
     if (Renderer == 0) SoftRenderer::DeInit();
     else               GLRenderer::DeInit();
 
@@ -316,6 +398,8 @@ void ResetRenderingState()
 
 void Reset()
 {
+    SyncGeometry();
+
     CmdFIFO->Clear();
     CmdPIPE->Clear();
 
@@ -373,7 +457,7 @@ void Reset()
     VertexNumInPoly = 0;
 
     CurRAMBank = 0;
-    CurVertexRAM = &VertexRAM[0];
+    CurVertexBase = 0;
     CurPolygonRAM = &PolygonRAM[0];
     NumVertices = 0;
     NumPolygons = 0;
@@ -386,6 +470,17 @@ void Reset()
     FlushRequest = 0;
     FlushAttributes = 0;
 
+    PolygonsAccepted = 0;
+    PolygonsClipped = 0;
+    PolygonsRejected = 0;
+
+    LastPolygonVerts = 0;
+    BoxTestResult = false;
+    BoxTestPending = false;
+    PolygonRAMOverflow = false;
+    CopyTimingState();
+    SetupGeometryThread();
+
     ResetRenderingState();
     if (Renderer == 0) SoftRenderer::Reset();
     else               GLRenderer::Reset();
@@ -393,6 +488,8 @@ void Reset()
 
 void DoSavestate(Savestate* file)
 {
+    SyncGeometry();
+
     file->Section("GP3D");
 
     CmdFIFO->DoSavestate(file);
@@ -458,7 +555,7 @@ void DoSavestate(Savestate* file)
     if (file->Saving)
     {
         u32 id;
-        if (LastStripPolygon) id = (u32)((LastStripPolygon - (&PolygonRAM[0])) / sizeof(Polygon));
+        if (LastStripPolygon) id = (u32)(LastStripPolygon - (&PolygonRAM[0]));
         else                  id = -1;
         file->Var32(&id);
     }
@@ -466,8 +563,8 @@ void DoSavestate(Savestate* file)
     {
         u32 id;
         file->Var32(&id);
-        if (id == -1) LastStripPolygon = NULL;
-        else          LastStripPolygon = &PolygonRAM[id];
+        if (id >= 2048*2) LastStripPolygon = NULL;
+        else              LastStripPolygon = &PolygonRAM[id];
     }
 
     file->Var32(&CurRAMBank);
@@ -481,34 +578,34 @@ void DoSavestate(Savestate* file)
     file->Var32(&FlushRequest);
     file->Var32(&FlushAttributes);
 
+    // vertex RAM is stored one vertex after another, like it was back when
+    // it was an array of Vertex
     for (int i = 0; i < 6144*2; i++)
     {
-        Vertex* vtx = &VertexRAM[i];
-
-        file->VarArray(vtx->Position, sizeof(s32)*4);
-        file->VarArray(vtx->Color, sizeof(s32)*3);
-        file->VarArray(vtx->TexCoords, sizeof(s16)*2);
+        file->VarArray(VertexRAM.Position[i], sizeof(s32)*4);
+        file->VarArray(VertexRAM.Color[i], sizeof(s32)*3);
+        file->VarArray(VertexRAM.TexCoords[i], sizeof(s16)*2);
 
-        file->Var32((u32*)&vtx->Clipped);
+        u32 clipped = VertexRAM.Clipped[i];
+        file->Var32(&clipped);
+        VertexRAM.Clipped[i] = clipped != 0;
 
-        file->VarArray(vtx->FinalPosition, sizeof(s32)*2);
-        file->VarArray(vtx->FinalColor, sizeof(s32)*3);
+        file->VarArray(VertexRAM.FinalPosition[i], sizeof(s32)*2);
+        file->VarArray(VertexRAM.FinalColor[i], sizeof(s32)*3);
     }
 
     for(int i = 0; i < 2048*2; i++)
     {
         Polygon* poly = &PolygonRAM[i];
 
-        // this is a bit ugly, but eh
-        // we can't save the pointers as-is, that's a bad idea
+        // vertex indices are stored as 32-bit, with -1 for unused entries
         if (file->Saving)
         {
             for (int j = 0; j < 10; j++)
             {
-                Vertex* ptr = poly->Vertices[j];
                 u32 id;
-                if (ptr) id = (u32)((ptr - (&VertexRAM[0])) / sizeof(Vertex));
-                else     id = -1;
+                if (j < poly->NumVertices) id = poly->Vertices[j];
+                else                       id = -1;
                 file->Var32(&id);
             }
         }
@@ -518,8 +615,8 @@ void DoSavestate(Savestate* file)
             {
                 u32 id = -1;
                 file->Var32(&id);
-                if (id == -1) poly->Vertices[j] = NULL;
-                else          poly->Vertices[j] = &VertexRAM[id];
+                if (id >= 6144*2) id = 0;
+                poly->Vertices[j] = id;
             }
         }
 
@@ -557,9 +654,11 @@ void DoSavestate(Savestate* file)
         {
             poly->Degenerate = false;
 
+            if (poly->NumVertices > 10) poly->NumVertices = 0;
+
             for (int j = 0; j < poly->NumVertices; j++)
             {
-                if (poly->Vertices[j]->Position[3] == 0)
+                if (VertexRAM.Position[poly->Vertices[j]][3] == 0)
                     poly->Degenerate = true;
             }
 
@@ -596,7 +695,9 @@ void DoSavestate(Savestate* file)
         ClipMatrixDirty = true;
         UpdateClipMatrix();
 
-        CurVertexRAM = &VertexRAM[CurRAMBank ? 6144 : 0];
+        CopyTimingState();
+
+        CurVertexBase = CurRAMBank ? 6144 : 0;
         CurPolygonRAM = &PolygonRAM[CurRAMBank ? 2048 : 0];
 
         // better safe than sorry, I guess
@@ -675,7 +776,7 @@ void MatrixLoad4x3(s32* m, s32* s)
     m[12] = s[9]; m[13] = s[10]; m[14] = s[11]; m[15] = 0x1000;
 }
 
-void MatrixMult4x4(s32* m, s32* s)
+static void MatrixMult4x4_Scalar(s32* m, s32* s)
 {
     s32 tmp[16];
     memcpy(tmp, m, 16*4);
@@ -702,7 +803,7 @@ void MatrixMult4x4(s32* m, s32* s)
     m[15] = ((s64)s[12]*tmp[3] + (s64)s[13]*tmp[7] + (s64)s[14]*tmp[11] + (s64)s[15]*tmp[15]) >> 12;
 }
 
-void MatrixMult4x3(s32* m, s32* s)
+static void MatrixMult4x3_Scalar(s32* m, s32* s)
 {
     s32 tmp[16];
     memcpy(tmp, m, 16*4);
@@ -729,7 +830,7 @@ void MatrixMult4x3(s32* m, s32* s)
     m[15] = ((s64)s[9]*tmp[3] + (s64)s[10]*tmp[7] + (s64)s[11]*tmp[11] + (s64)0x1000*tmp[15]) >> 12;
 }
 
-void MatrixMult3x3(s32* m, s32* s)
+static void MatrixMult3x3_Scalar(s32* m, s32* s)
 {
     s32 tmp[12];
     memcpy(tmp, m, 12*4);
@@ -751,7 +852,7 @@ void MatrixMult3x3(s32* m, s32* s)
     m[11] = ((s64)s[6]*tmp[3] + (s64)s[7]*tmp[7] + (s64)s[8]*tmp[11]) >> 12;
 }
 
-void MatrixScale(s32* m, s32* s)
+static void MatrixScale_Scalar(s32* m, s32* s)
 {
     m[0] = ((s64)s[0]*m[0]) >> 12;
     m[1] = ((s64)s[0]*m[1]) >> 12;
@@ -769,7 +870,7 @@ void MatrixScale(s32* m, s32* s)
     m[11] = ((s64)s[2]*m[11]) >> 12;
 }
 
-void MatrixTranslate(s32* m, s32* s)
+static void MatrixTranslate_Scalar(s32* m, s32* s)
 {
     m[12] += ((s64)s[0]*m[0] + (s64)s[1]*m[4] + (s64)s[2]*m[8]) >> 12;
     m[13] += ((s64)s[0]*m[1] + (s64)s[1]*m[5] + (s64)s[2]*m[9]) >> 12;
@@ -777,6 +878,251 @@ void MatrixTranslate(s32* m, s32* s)
     m[15] += ((s64)s[0]*m[3] + (s64)s[1]*m[7] + (s64)s[2]*m[11]) >> 12;
 }
 
+static void TransformPosition_Scalar(s32* pos, s16* vtx, s32* m)
+{
+    s64 vertex[4] = {(s64)vtx[0], (s64)vtx[1], (s64)vtx[2], 0x1000};
+
+    pos[0] = (vertex[0]*m[0] + vertex[1]*m[4] + vertex[2]*m[8] + vertex[3]*m[12]) >> 12;
+    pos[1] = (vertex[0]*m[1] + vertex[1]*m[5] + vertex[2]*m[9] + vertex[3]*m[13]) >> 12;
+    pos[2] = (vertex[0]*m[2] + vertex[1]*m[6] + vertex[2]*m[10] + vertex[3]*m[14]) >> 12;
+    pos[3] = (vertex[0]*m[3] + vertex[1]*m[7] + vertex[2]*m[11] + vertex[3]*m[15]) >> 12;
+}
+
+#ifdef GPU3D_X86_SIMD
+
+// SIMD versions of the matrix math above
+//
+// everything is done by one kernel: dst row r = (coef row r * m) >> 12, for 4x4 m
+// the other operations are turned into that by padding the coefficients with
+// zeroes, or with 0x1000 where a row of m gets added as is (0x1000*x >> 12 adds x
+// exactly, since the low 12 bits of the sum don't change)
+//
+// products and sums are done on 64 bits like the scalar code. only the low 32 bits
+// of the shifted sum are kept, so logical shifts give the same result as arithmetic ones
+
+__attribute__((target("sse4.1"))) static inline __m128i MultRow_SSE41(__m128i* even, __m128i* odd, s32* coef)
+{
+    __m128i sumeven = _mm_setzero_si128();
+    __m128i sumodd = _mm_setzero_si128();
+
+    // _mm_mul_epi32 multiplies the even 32-bit lanes into 64-bit results
+    for (int k = 0; k < 4; k++)
+    {
+        __m128i c = _mm_set1_epi32(coef[k]);
+        sumeven = _mm_add_epi64(sumeven, _mm_mul_epi32(even[k], c));
+        sumodd = _mm_add_epi64(sumodd, _mm_mul_epi32(odd[k], c));
+    }
+
+    sumeven = _mm_srli_epi64(sumeven, 12);
+    sumodd = _mm_slli_epi64(_mm_srli_epi64(sumodd, 12), 32);
+    return _mm_blend_epi16(sumeven, sumodd, 0xCC);
+}
+
+__attribute__((target("sse4.1"))) static void MultRows_SSE41(s32* dst, s32* coef, s32* m, int numrows)
+{
+    __m128i even[4], odd[4];
+    for (int k = 0; k < 4; k++)
+    {
+        even[k] = _mm_loadu_si128((__m128i*)&m[k*4]);
+        odd[k] = _mm_srli_epi64(even[k], 32);
+    }
+
+    for (int r = 0; r < numrows; r++)
+        _mm_storeu_si128((__m128i*)&dst[r*4], MultRow_SSE41(even, odd, &coef[r*4]));
+}
+
+__attribute__((target("avx2"))) static void MultRows_AVX2(s32* dst, s32* coef, s32* m, int numrows)
+{
+    // two rows at once, one in each 128-bit half
+
+    __m256i even[4], odd[4];
+    for (int k = 0; k < 4; k++)
+    {
+        even[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)&m[k*4]));
+        odd[k] = _mm256_srli_epi64(even[k], 32);
+    }
+
+    int r = 0;
+    for (; r+2 <= numrows; r += 2)
+    {
+        __m256i sumeven = _mm256_setzero_si256();
+        __m256i sumodd = _mm256_setzero_si256();
+
+        for (int k = 0; k < 4; k++)
+        {
+            __m256i c = _mm256_setr_epi32(coef[r*4+k], 0, coef[r*4+k], 0, coef[r*4+4+k], 0, coef[r*4+4+k], 0);
+            sumeven = _mm256_add_epi64(sumeven, _mm256_mul_epi32(even[k], c));
+            sumodd = _mm256_add_epi64(sumodd, _mm256_mul_epi32(odd[k], c));
+        }
+
+        sumeven = _mm256_srli_epi64(sumeven, 12);
+        sumodd = _mm256_slli_epi64(_mm256_srli_epi64(sumodd, 12), 32);
+        _mm256_storeu_si256((__m256i*)&dst[r*4], _mm256_blend_epi32(sumeven, sumodd, 0xAA));
+    }
+
+    if (r < numrows)
+    {
+        __m128i even128[4], odd128[4];
+        for (int k = 0; k < 4; k++)
+        {
+            even128[k] = _mm256_castsi256_si128(even[k]);
+            odd128[k] = _mm256_castsi256_si128(odd[k]);
+        }
+
+        _mm_storeu_si128((__m128i*)&dst[r*4], MultRow_SSE41(even128, odd128, &coef[r*4]));
+    }
+}
+
+// returns false if there's no SIMD path, the caller uses the scalar code then
+static inline bool MultRows(s32* dst, s32* coef, s32* m, int numrows)
+{
+    if (HostHasAVX2)       MultRows_AVX2(dst, coef, m, numrows);
+    else if (HostHasSSE41) MultRows_SSE41(dst, coef, m, numrows);
+    else                   return false;
+
+    return true;
+}
+
+void MatrixMult4x4(s32* m, s32* s)
+{
+    if (!MultRows(m, s, m, 4))
+        MatrixMult4x4_Scalar(m, s);
+}
+
+void MatrixMult4x3(s32* m, s32* s)
+{
+    s32 coef[16] = {s[0], s[1], s[2],  0,
+                    s[3], s[4], s[5],  0,
+                    s[6], s[7], s[8],  0,
+                    s[9], s[10], s[11], 0x1000};
+
+    if (!MultRows(m, coef, m, 4))
+        MatrixMult4x3_Scalar(m, s);
+}
+
+void MatrixMult3x3(s32* m, s32* s)
+{
+    s32 coef[12] = {s[0], s[1], s[2], 0,
+                    s[3], s[4], s[5], 0,
+                    s[6], s[7], s[8], 0};
+
+    if (!MultRows(m, coef, m, 3))
+        MatrixMult3x3_Scalar(m, s);
+}
+
+void MatrixScale(s32* m, s32* s)
+{
+    s32 coef[12] = {s[0], 0,    0,    0,
+                    0,    s[1], 0,    0,
+                    0,    0,    s[2], 0};
+
+    if (!MultRows(m, coef, m, 3))
+        MatrixScale_Scalar(m, s);
+}
+
+void MatrixTranslate(s32* m, s32* s)
+{
+    s32 coef[4] = {s[0], s[1], s[2], 0x1000};
+
+    if (!MultRows(&m[12], coef, m, 1))
+        MatrixTranslate_Scalar(m, s);
+}
+
+void TransformPosition(s32* pos, s16* vtx, s32* m)
+{
+    s32 coef[4] = {vtx[0], vtx[1], vtx[2], 0x1000};
+
+    if (!MultRows(pos, coef, m, 1))
+        TransformPosition_Scalar(pos, vtx, m);
+}
+
+#else
+
+void MatrixMult4x4(s32* m, s32* s)   { MatrixMult4x4_Scalar(m, s); }
+void MatrixMult4x3(s32* m, s32* s)   { MatrixMult4x3_Scalar(m, s); }
+void MatrixMult3x3(s32* m, s32* s)   { MatrixMult3x3_Scalar(m, s); }
+void MatrixScale(s32* m, s32* s)     { MatrixScale_Scalar(m, s); }
+void MatrixTranslate(s32* m, s32* s) { MatrixTranslate_Scalar(m, s); }
+void TransformPosition(s32* pos, s16* vtx, s32* m) { TransformPosition_Scalar(pos, vtx, m); }
+
+#endif
+
+static bool CheckMatrixKernelsPass(int iterations)
+{
+    // random matrices and vertices, run through both the current and the scalar code
+    // values are either small (typical fixed-point) or anything, to cover overflows
+
+    typedef void (*MatrixFunc)(s32* m, s32* s);
+    static const struct { const char* name; MatrixFunc func, ref; } ops[] =
+    {
+        {"MatrixMult4x4",   MatrixMult4x4,   MatrixMult4x4_Scalar},
+        {"MatrixMult4x3",   MatrixMult4x3,   MatrixMult4x3_Scalar},
+        {"MatrixMult3x3",   MatrixMult3x3,   MatrixMult3x3_Scalar},
+        {"MatrixScale",     MatrixScale,     MatrixScale_Scalar},
+        {"MatrixTranslate", MatrixTranslate, MatrixTranslate_Scalar},
+    };
+
+    u32 seed = 0x3D3D3D3D;
+    auto rand32 = [&seed]() -> s32
+    {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        return (s32)seed;
+    };
+    auto randval = [&rand32]() -> s32
+    {
+        s32 v = rand32();
+        return (rand32() & 3) ? (v >> 12) : v;
+    };
+
+    for (int i = 0; i < iterations; i++)
+    {
+        s32 m[16], s[16], a[16], b[16];
+        for (int j = 0; j < 16; j++) { m[j] = randval(); s[j] = randval(); }
+
+        for (int op = 0; op < 5; op++)
+        {
+            memcpy(a, m, 16*4);
+            memcpy(b, m, 16*4);
+            ops[op].func(a, s);
+            ops[op].ref(b, s);
+
+            if (memcmp(a, b, 16*4))
+            {
+                printf("%s: mismatch at iteration %d\n", ops[op].name, i);
+                return false;
+            }
+        }
+
+        s16 vtx[3] = {(s16)s[0], (s16)s[1], (s16)s[2]};
+        TransformPosition(a, vtx, m);
+        TransformPosition_Scalar(b, vtx, m);
+        if (memcmp(a, b, 4*4))
+        {
+            printf("TransformPosition: mismatch at iteration %d\n", i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CheckMatrixKernels(int iterations)
+{
+    bool ok = CheckMatrixKernelsPass(iterations);
+
+#ifdef GPU3D_X86_SIMD
+    // also check the SSE4.1 kernels on hosts that would use AVX2
+    if (HostHasAVX2 && HostHasSSE41)
+    {
+        HostHasAVX2 = false;
+        ok = CheckMatrixKernelsPass(iterations) && ok;
+        HostHasAVX2 = true;
+    }
+#endif
+
+    return ok;
+}
+
 void UpdateClipMatrix()
 {
     if (!ClipMatrixDirty) return;
@@ -1022,6 +1368,23 @@ int ClipPolygon(Vertex* vertices, int nverts, int clipstart)
     return nverts;
 }
 
+u32 ClipOutcode(Vertex* vtx)
+{
+    // one bit per clip plane the vertex is outside of, same comparisons as ClipAgainstPlane()
+    // the bits are in the order ClipPolygon() goes through the planes
+    s32 w = vtx->Position[3];
+    u32 code = 0;
+
+    if (vtx->Position[2] >  w) code |= (1<<0);
+    if (vtx->Position[2] < -w) code |= (1<<1);
+    if (vtx->Position[1] >  w) code |= (1<<2);
+    if (vtx->Position[1] < -w) code |= (1<<3);
+    if (vtx->Position[0] >  w) code |= (1<<4);
+    if (vtx->Position[0] < -w) code |= (1<<5);
+
+    return code;
+}
+
 bool ClipCoordsEqual(Vertex* a, Vertex* b)
 {
     return a->Position[0] == b->Position[0] &&
@@ -1030,22 +1393,40 @@ bool ClipCoordsEqual(Vertex* a, Vertex* b)
            a->Position[3] == b->Position[3];
 }
 
+void LoadVertex(Vertex* vtx, u32 id)
+{
+    memcpy(vtx->Position, VertexRAM.Position[id], sizeof(vtx->Position));
+    memcpy(vtx->Color, VertexRAM.Color[id], sizeof(vtx->Color));
+    memcpy(vtx->TexCoords, VertexRAM.TexCoords[id], sizeof(vtx->TexCoords));
+    vtx->Clipped = VertexRAM.Clipped[id];
+    memcpy(vtx->FinalPosition, VertexRAM.FinalPosition[id], sizeof(vtx->FinalPosition));
+    memcpy(vtx->FinalColor, VertexRAM.FinalColor[id], sizeof(vtx->FinalColor));
+    memcpy(vtx->HiresPosition, VertexRAM.HiresPosition[id], sizeof(vtx->HiresPosition));
+}
+
+void StoreVertex(u32 id, Vertex* vtx)
+{
+    memcpy(VertexRAM.Position[id], vtx->Position, sizeof(vtx->Position));
+    memcpy(VertexRAM.Color[id], vtx->Color, sizeof(vtx->Color));
+    memcpy(VertexRAM.TexCoords[id], vtx->TexCoords, sizeof(vtx->TexCoords));
+    VertexRAM.Clipped[id] = vtx->Clipped;
+    memcpy(VertexRAM.FinalPosition[id], vtx->FinalPosition, sizeof(vtx->FinalPosition));
+    memcpy(VertexRAM.FinalColor[id], vtx->FinalColor, sizeof(vtx->FinalColor));
+    memcpy(VertexRAM.HiresPosition[id], vtx->HiresPosition, sizeof(vtx->HiresPosition));
+}
+
 void SubmitPolygon()
 {
     Vertex clippedvertices[10];
-    Vertex* reusedvertices[2];
+    u32 reusedvertices[2] = {0, 0};
     int clipstart = 0;
     int lastpolyverts = 0;
 
     int nverts = PolygonMode & 0x1 ? 4:3;
     int prev, next;
 
-    // submitting a polygon starts the polygon pipeline
-    // noting that for now we are only reserving one vertex slot
-    // further slots only get reserved if the polygon makes it through culling/clipping
-    PolygonPipeline = 8;
-    VertexSlotCounter = 1;
-    VertexSlotsFree = 0b11110;
+    // the polygon pipeline timing depends on how this goes, see StartPolygonPipeline()
+    LastPolygonVerts = 0;
 
     // culling
     // TODO: work out how it works on the real thing
@@ -1128,14 +1509,14 @@ void SubmitPolygon()
         }
 
         if (LastStripPolygon->NumVertices == lastpolyverts &&
-            !LastStripPolygon->Vertices[id0]->Clipped &&
-            !LastStripPolygon->Vertices[id1]->Clipped)
+            !VertexRAM.Clipped[LastStripPolygon->Vertices[id0]] &&
+            !VertexRAM.Clipped[LastStripPolygon->Vertices[id1]])
         {
             reusedvertices[0] = LastStripPolygon->Vertices[id0];
             reusedvertices[1] = LastStripPolygon->Vertices[id1];
 
-            clippedvertices[0] = *reusedvertices[0];
-            clippedvertices[1] = *reusedvertices[1];
+            LoadVertex(&clippedvertices[0], reusedvertices[0]);
+            LoadVertex(&clippedvertices[1], reusedvertices[1]);
 
             clipstart = 2;
         }
@@ -1162,35 +1543,51 @@ void SubmitPolygon()
     }
 
     // clipping
+    // most polygons are either entirely inside the view volume, which the clipper
+    // would leave untouched, or entirely outside one of its planes
+    // vertices reused from the previous strip polygon are known to be inside, and are
+    // kept by the clipper no matter what, so they don't count towards rejecting
+    // rejecting only works for the first plane the clipper finds any vertex outside of.
+    // clipping against an earlier plane can make vertices that aren't outside the
+    // common plane anymore (rounding, overflows, W <= 0), and the clipper keeps those
+
+    u32 andcode = 0x3F, orcode = 0;
+    for (int i = 0; i < nverts; i++)
+    {
+        u32 code = ClipOutcode(&clippedvertices[i]);
+        andcode &= code;
+        if (i >= clipstart) orcode |= code;
+    }
 
-    nverts = ClipPolygon<true>(clippedvertices, nverts, clipstart);
-    if (nverts == 0)
+    if (clipstart == 0 && (andcode & orcode & -orcode))
     {
+        PolygonsRejected++;
         LastStripPolygon = NULL;
         return;
     }
 
-    // build the actual polygon
-
-    if (nverts == 4)
+    if (orcode)
     {
-        PolygonPipeline = 35;
-        VertexSlotCounter = 1;
-        if (PolygonMode & 0x2) VertexSlotsFree = 0b11100;
-        else                   VertexSlotsFree = 0b11110;
+        PolygonsClipped++;
+        nverts = ClipPolygon<true>(clippedvertices, nverts, clipstart);
+        if (nverts == 0)
+        {
+            LastStripPolygon = NULL;
+            return;
+        }
     }
     else
-    {
-        PolygonPipeline = 26;
-        VertexSlotCounter = 1;
-        if (PolygonMode & 0x2) VertexSlotsFree = 0b1000;
-        else                   VertexSlotsFree = 0b1110;
-    }
+        PolygonsAccepted++;
+
+    // build the actual polygon
+
+    LastPolygonVerts = nverts;
 
     if (NumPolygons >= 2048 || NumVertices+nverts > 6144)
     {
+        // DISP3DCNT belongs to the emu thread, the overflow flag gets merged there
         LastStripPolygon = NULL;
-        DispCnt |= (1<<13);
+        PolygonRAMOverflow = true;
         return;
     }
 
@@ -1226,13 +1623,15 @@ void SubmitPolygon()
         }
         else
         {
-            Vertex v0 = *reusedvertices[0];
-            Vertex v1 = *reusedvertices[1];
-
-            CurVertexRAM[NumVertices] = v0;
-            poly->Vertices[0] = &CurVertexRAM[NumVertices];
-            CurVertexRAM[NumVertices+1] = v1;
-            poly->Vertices[1] = &CurVertexRAM[NumVertices+1];
+            // the clipper may have altered our copies, so these come from vertex RAM
+            Vertex v0, v1;
+            LoadVertex(&v0, reusedvertices[0]);
+            LoadVertex(&v1, reusedvertices[1]);
+
+            StoreVertex(CurVertexBase + NumVertices, &v0);
+            poly->Vertices[0] = CurVertexBase + NumVertices;
+            StoreVertex(CurVertexBase + NumVertices+1, &v1);
+            poly->Vertices[1] = CurVertexBase + NumVertices+1;
             NumVertices += 2;
         }
 
@@ -1241,9 +1640,8 @@ void SubmitPolygon()
 
     for (int i = clipstart; i < nverts; i++)
     {
-        Vertex* vtx = &CurVertexRAM[NumVertices];
-        *vtx = clippedvertices[i];
-        poly->Vertices[i] = vtx;
+        Vertex* vtx = &clippedvertices[i];
+        poly->Vertices[i] = CurVertexBase + NumVertices;
 
         NumVertices++;
         poly->NumVertices++;
@@ -1285,6 +1683,8 @@ void SubmitPolygon()
         if (vtx->FinalColor[1]) vtx->FinalColor[1] = ((vtx->FinalColor[1] << 4) + 0xF);
         vtx->FinalColor[2] = vtx->Color[2] >> 12;
         if (vtx->FinalColor[2]) vtx->FinalColor[2] = ((vtx->FinalColor[2] << 4) + 0xF);
+
+        StoreVertex(poly->Vertices[i], vtx);
     }
 
     // determine bounds of the polygon
@@ -1299,22 +1699,22 @@ void SubmitPolygon()
 
     for (int i = 0; i < nverts; i++)
     {
-        Vertex* vtx = poly->Vertices[i];
+        s32* pos = VertexRAM.FinalPosition[poly->Vertices[i]];
 
-        if (vtx->FinalPosition[1] < ytop || (vtx->FinalPosition[1] == ytop && vtx->FinalPosition[0] < xtop))
+        if (pos[1] < ytop || (pos[1] == ytop && pos[0] < xtop))
         {
-            xtop = vtx->FinalPosition[0];
-            ytop = vtx->FinalPosition[1];
+            xtop = pos[0];
+            ytop = pos[1];
             vtop = i;
         }
-        if (vtx->FinalPosition[1] > ybot || (vtx->FinalPosition[1] == ybot && vtx->FinalPosition[0] > xbot))
+        if (pos[1] > ybot || (pos[1] == ybot && pos[0] > xbot))
         {
-            xbot = vtx->FinalPosition[0];
-            ybot = vtx->FinalPosition[1];
+            xbot = pos[0];
+            ybot = pos[1];
             vbot = i;
         }
 
-        u32 w = (u32)vtx->Position[3];
+        u32 w = (u32)VertexRAM.Position[poly->Vertices[i]][3];
         if (w == 0) poly->Degenerate = true;
 
         while ((w >> wsize) && (wsize < 32))
@@ -1334,7 +1734,7 @@ void SubmitPolygon()
 
     for (int i = 0; i < nverts; i++)
     {
-        Vertex* vtx = poly->Vertices[i];
+        s32* pos = VertexRAM.Position[poly->Vertices[i]];
         s32 w, wshifted;
 
         // W is normalized, such that all the polygon's W values fit within 16 bits
@@ -1344,20 +1744,20 @@ void SubmitPolygon()
 
         if (wsize < 16)
         {
-            w = vtx->Position[3] << (16 - wsize);
+            w = pos[3] << (16 - wsize);
             wshifted = w >> (16 - wsize);
         }
         else
         {
-            w = vtx->Position[3] >> (wsize - 16);
+            w = pos[3] >> (wsize - 16);
             wshifted = w << (wsize - 16);
         }
 
         s32 z;
         if (FlushAttributes & 0x2)
             z = wshifted;
-        else if (vtx->Position[3])
-            z = ((((s64)vtx->Position[2] * 0x4000) / vtx->Position[3]) + 0x3FFF) * 0x200;
+        else if (pos[3])
+            z = ((((s64)pos[2] * 0x4000) / pos[3]) + 0x3FFF) * 0x200;
         else
             z = 0x7FFE00;
 
@@ -1381,10 +1781,7 @@ void SubmitVertex()
     Vertex* vertextrans = &TempVertexBuffer[VertexNumInPoly];
 
     UpdateClipMatrix();
-    vertextrans->Position[0] = (vertex[0]*ClipMatrix[0] + vertex[1]*ClipMatrix[4] + vertex[2]*ClipMatrix[8] + vertex[3]*ClipMatrix[12]) >> 12;
-    vertextrans->Position[1] = (vertex[0]*ClipMatrix[1] + vertex[1]*ClipMatrix[5] + vertex[2]*ClipMatrix[9] + vertex[3]*ClipMatrix[13]) >> 12;
-    vertextrans->Position[2] = (vertex[0]*ClipMatrix[2] + vertex[1]*ClipMatrix[6] + vertex[2]*ClipMatrix[10] + vertex[3]*ClipMatrix[14]) >> 12;
-    vertextrans->Position[3] = (vertex[0]*ClipMatrix[3] + vertex[1]*ClipMatrix[7] + vertex[2]*ClipMatrix[11] + vertex[3]*ClipMatrix[15]) >> 12;
+    TransformPosition(vertextrans->Position, CurVertex, ClipMatrix);
 
     // this probably shouldn't be.
     // the way color is handled during clipping needs investigation. TODO
@@ -1468,9 +1865,6 @@ void SubmitVertex()
         }
         break;
     }
-
-    VertexPipeline = 7;
-    AddCycles(3);
 }
 
 void CalculateLighting()
@@ -1490,7 +1884,6 @@ void CalculateLighting()
     VertexColor[1] = MatEmission[1];
     VertexColor[2] = MatEmission[2];
 
-    s32 c = 0;
     for (int i = 0; i < 4; i++)
     {
         if (!(CurPolygonAttr & (1<<i)))
@@ -1538,13 +1931,7 @@ void CalculateLighting()
         if (VertexColor[0] > 31) VertexColor[0] = 31;
         if (VertexColor[1] > 31) VertexColor[1] = 31;
         if (VertexColor[2] > 31) VertexColor[2] = 31;
-
-        c++;
     }
-
-    if (c < 1) c = 1;
-    NormalPipeline = 7;
-    AddCycles(c);
 }
 
 
@@ -1554,8 +1941,7 @@ void BoxTest(u32* params)
     Vertex face[10];
     int res;
 
-    AddCycles(254);
-    GXStat &= ~(1<<1);
+    BoxTestResult = false;
 
     s16 x0 = (s16)(params[0] & 0xFFFF);
     s16 y0 = ((s32)params[0]) >> 16;
@@ -1595,7 +1981,7 @@ void BoxTest(u32* params)
     res = ClipPolygon<false>(face, 4, 0);
     if (res > 0)
     {
-        GXStat |= (1<<1);
+        BoxTestResult = true;
         return;
     }
 
@@ -1604,7 +1990,7 @@ void BoxTest(u32* params)
     res = ClipPolygon<false>(face, 4, 0);
     if (res > 0)
     {
-        GXStat |= (1<<1);
+        BoxTestResult = true;
         return;
     }
 
@@ -1613,7 +1999,7 @@ void BoxTest(u32* params)
     res = ClipPolygon<false>(face, 4, 0);
     if (res > 0)
     {
-        GXStat |= (1<<1);
+        BoxTestResult = true;
         return;
     }
 
@@ -1622,7 +2008,7 @@ void BoxTest(u32* params)
     res = ClipPolygon<false>(face, 4, 0);
     if (res > 0)
     {
-        GXStat |= (1<<1);
+        BoxTestResult = true;
         return;
     }
 
@@ -1631,7 +2017,7 @@ void BoxTest(u32* params)
     res = ClipPolygon<false>(face, 4, 0);
     if (res > 0)
     {
-        GXStat |= (1<<1);
+        BoxTestResult = true;
         return;
     }
 
@@ -1640,7 +2026,7 @@ void BoxTest(u32* params)
     res = ClipPolygon<false>(face, 4, 0);
     if (res > 0)
     {
-        GXStat |= (1<<1);
+        BoxTestResult = true;
         return;
     }
 }
@@ -1654,8 +2040,6 @@ void PosTest()
     PosTestResult[1] = (vertex[0]*ClipMatrix[1] + vertex[1]*ClipMatrix[5] + vertex[2]*ClipMatrix[9] + vertex[3]*ClipMatrix[13]) >> 12;
     PosTestResult[2] = (vertex[0]*ClipMatrix[2] + vertex[1]*ClipMatrix[6] + vertex[2]*ClipMatrix[10] + vertex[3]*ClipMatrix[14]) >> 12;
     PosTestResult[3] = (vertex[0]*ClipMatrix[3] + vertex[1]*ClipMatrix[7] + vertex[2]*ClipMatrix[11] + vertex[3]*ClipMatrix[15]) >> 12;
-
-    AddCycles(5);
 }
 
 void VecTest(u32* params)
@@ -1675,8 +2059,6 @@ void VecTest(u32* params)
     if (VecTestResult[0] & 0x1000) VecTestResult[0] |= 0xF000;
     if (VecTestResult[1] & 0x1000) VecTestResult[1] |= 0xF000;
     if (VecTestResult[2] & 0x1000) VecTestResult[2] |= 0xF000;
-
-    AddCycles(4);
 }
 
 
@@ -1752,594 +2134,927 @@ CmdFIFOEntry CmdFIFORead()
 
 
 
-void ExecuteCommand()
+void ExecuteGeometryCommand(u32 cmd, u32* params)
 {
-    CmdFIFOEntry entry = CmdFIFORead();
-
-    //printf("FIFO: processing %02X %08X. Levels: FIFO=%d, PIPE=%d\n", entry.Command, entry.Param, CmdFIFO->Level(), CmdPIPE->Level());
-
-    // each FIFO entry takes 1 cycle to be processed
-    // commands (presumably) run when all the needed parameters have been read
-    // which is where we add the remaining cycles if any
-    if (ExecParamCount == 0)
+    switch (cmd)
     {
-        // delay the first command entry as needed
-        switch (entry.Command)
-        {
-        // commands that stall the polygon pipeline
-        case 0x32: StallPolygonPipeline(8 + 1,  2); break; // 32 can run 6 cycles after a vertex
-        case 0x40: StallPolygonPipeline(1,      0); break;
-        case 0x70: StallPolygonPipeline(10 + 1, 0); break;
-
-        case 0x23:
-        case 0x24:
-        case 0x25:
-        case 0x26:
-        case 0x27:
-        case 0x28:
-            // vertex
-            if (!(VertexSlotsFree & 0x1)) NextVertexSlot();
-            else                          AddCycles(1);
-            NormalPipeline = 0;
-            break;
-
-        case 0x20:
-        case 0x30:
-        case 0x31:
-        case 0x72:
-            // commands that can run 6 cycles after a vertex
-            if (VertexPipeline > 2) AddCycles((VertexPipeline - 2) + 1);
-            else                    AddCycles(NormalPipeline + 1);
-            NormalPipeline = 0;
-            break;
+    case 0x10: // matrix mode
+        MatrixMode = params[0] & 0x3;
+        break;
 
-        case 0x29:
-        case 0x2A:
-        case 0x2B:
-        case 0x33:
-        case 0x34:
-        case 0x41:
-        case 0x60:
-        case 0x71:
-            // command that can run 8 cycles after a vertex
-            if (VertexPipeline > 0) AddCycles(VertexPipeline + 1);
-            else                    AddCycles(NormalPipeline + 1);
-            NormalPipeline = 0;
-            break;
+    case 0x11: // push matrix
+        if (MatrixMode == 0)
+        {
+            memcpy(ProjMatrixStack, ProjMatrix, 16*4);
+            ProjMatrixStackPointer++;
+            ProjMatrixStackPointer &= 0x1;
+        }
+        else if (MatrixMode == 3)
+        {
+            memcpy(TexMatrixStack, TexMatrix, 16*4);
+            TexMatrixStackPointer++;
+            TexMatrixStackPointer &= 0x1;
+        }
+        else
+        {
+            memcpy(PosMatrixStack[PosMatrixStackPointer & 0x1F], PosMatrix, 16*4);
+            memcpy(VecMatrixStack[PosMatrixStackPointer & 0x1F], VecMatrix, 16*4);
+            PosMatrixStackPointer++;
+            PosMatrixStackPointer &= 0x3F;
+        }
+        break;
 
-        default:
-            // all other commands can run 4 cycles after a vertex
-            // no need to do much here since that is the minimum
-            AddCycles(NormalPipeline + 1);
-            NormalPipeline = 0;
-            break;
+    case 0x12: // pop matrix
+        if (MatrixMode == 0)
+        {
+            ProjMatrixStackPointer--;
+            ProjMatrixStackPointer &= 0x1;
+            memcpy(ProjMatrix, ProjMatrixStack, 16*4);
+            ClipMatrixDirty = true;
         }
-    }
-    else
-        AddCycles(1);
+        else if (MatrixMode == 3)
+        {
+            TexMatrixStackPointer--;
+            TexMatrixStackPointer &= 0x1;
+            memcpy(TexMatrix, TexMatrixStack, 16*4);
+        }
+        else
+        {
+            s32 offset = (s32)(params[0] << 26) >> 26;
+            PosMatrixStackPointer -= offset;
+            PosMatrixStackPointer &= 0x3F;
 
-    ExecParams[ExecParamCount] = entry.Param;
-    ExecParamCount++;
+            memcpy(PosMatrix, PosMatrixStack[PosMatrixStackPointer & 0x1F], 16*4);
+            memcpy(VecMatrix, VecMatrixStack[PosMatrixStackPointer & 0x1F], 16*4);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-    if (ExecParamCount >= CmdNumParams[entry.Command])
-    {
-        /*printf("[GXS:%08X] 0x%02X,  ", GXStat, entry.Command);
-        for (int k = 0; k < ExecParamCount; k++) printf("0x%08X, ", ExecParams[k]);
-        printf("\n");*/
+    case 0x13: // store matrix
+        if (MatrixMode == 0)
+        {
+            memcpy(ProjMatrixStack, ProjMatrix, 16*4);
+        }
+        else if (MatrixMode == 3)
+        {
+            memcpy(TexMatrixStack, TexMatrix, 16*4);
+        }
+        else
+        {
+            u32 addr = params[0] & 0x1F;
+            memcpy(PosMatrixStack[addr], PosMatrix, 16*4);
+            memcpy(VecMatrixStack[addr], VecMatrix, 16*4);
+        }
+        break;
 
-        ExecParamCount = 0;
+    case 0x14: // restore matrix
+        if (MatrixMode == 0)
+        {
+            memcpy(ProjMatrix, ProjMatrixStack, 16*4);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            memcpy(TexMatrix, TexMatrixStack, 16*4);
+        }
+        else
+        {
+            u32 addr = params[0] & 0x1F;
+            memcpy(PosMatrix, PosMatrixStack[addr], 16*4);
+            memcpy(VecMatrix, VecMatrixStack[addr], 16*4);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-        switch (entry.Command)
+    case 0x15: // identity
+        if (MatrixMode == 0)
         {
-        case 0x10: // matrix mode
-            MatrixMode = ExecParams[0] & 0x3;
-            break;
+            MatrixLoadIdentity(ProjMatrix);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+            MatrixLoadIdentity(TexMatrix);
+        else
+        {
+            MatrixLoadIdentity(PosMatrix);
+            if (MatrixMode == 2)
+                MatrixLoadIdentity(VecMatrix);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-        case 0x11: // push matrix
-            NumPushPopCommands--;
-            if (MatrixMode == 0)
-            {
-                if (ProjMatrixStackPointer > 0) GXStat |= (1<<15);
+    case 0x16: // load 4x4
+        if (MatrixMode == 0)
+        {
+            MatrixLoad4x4(ProjMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            MatrixLoad4x4(TexMatrix, (s32*)params);
+        }
+        else
+        {
+            MatrixLoad4x4(PosMatrix, (s32*)params);
+            if (MatrixMode == 2)
+                MatrixLoad4x4(VecMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-                memcpy(ProjMatrixStack, ProjMatrix, 16*4);
-                ProjMatrixStackPointer++;
-                ProjMatrixStackPointer &= 0x1;
-            }
-            else if (MatrixMode == 3)
-            {
-                if (TexMatrixStackPointer > 0) GXStat |= (1<<15);
+    case 0x17: // load 4x3
+        if (MatrixMode == 0)
+        {
+            MatrixLoad4x3(ProjMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            MatrixLoad4x3(TexMatrix, (s32*)params);
+        }
+        else
+        {
+            MatrixLoad4x3(PosMatrix, (s32*)params);
+            if (MatrixMode == 2)
+                MatrixLoad4x3(VecMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-                memcpy(TexMatrixStack, TexMatrix, 16*4);
-                TexMatrixStackPointer++;
-                TexMatrixStackPointer &= 0x1;
-            }
-            else
-            {
-                if (PosMatrixStackPointer > 30) GXStat |= (1<<15);
+    case 0x18: // mult 4x4
+        if (MatrixMode == 0)
+        {
+            MatrixMult4x4(ProjMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            MatrixMult4x4(TexMatrix, (s32*)params);
+        }
+        else
+        {
+            MatrixMult4x4(PosMatrix, (s32*)params);
+            if (MatrixMode == 2)
+                MatrixMult4x4(VecMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-                memcpy(PosMatrixStack[PosMatrixStackPointer & 0x1F], PosMatrix, 16*4);
-                memcpy(VecMatrixStack[PosMatrixStackPointer & 0x1F], VecMatrix, 16*4);
-                PosMatrixStackPointer++;
-                PosMatrixStackPointer &= 0x3F;
-            }
-            AddCycles(16);
-            break;
+    case 0x19: // mult 4x3
+        if (MatrixMode == 0)
+        {
+            MatrixMult4x3(ProjMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            MatrixMult4x3(TexMatrix, (s32*)params);
+        }
+        else
+        {
+            MatrixMult4x3(PosMatrix, (s32*)params);
+            if (MatrixMode == 2)
+                MatrixMult4x3(VecMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-        case 0x12: // pop matrix
-            NumPushPopCommands--;
-            if (MatrixMode == 0)
-            {
-                if (ProjMatrixStackPointer == 0) GXStat |= (1<<15);
+    case 0x1A: // mult 3x3
+        if (MatrixMode == 0)
+        {
+            MatrixMult3x3(ProjMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            MatrixMult3x3(TexMatrix, (s32*)params);
+        }
+        else
+        {
+            MatrixMult3x3(PosMatrix, (s32*)params);
+            if (MatrixMode == 2)
+                MatrixMult3x3(VecMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-                ProjMatrixStackPointer--;
-                ProjMatrixStackPointer &= 0x1;
-                memcpy(ProjMatrix, ProjMatrixStack, 16*4);
-                ClipMatrixDirty = true;
-                AddCycles(35);
-            }
-            else if (MatrixMode == 3)
-            {
-                if (TexMatrixStackPointer == 0) GXStat |= (1<<15);
+    case 0x1B: // scale
+        if (MatrixMode == 0)
+        {
+            MatrixScale(ProjMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            MatrixScale(TexMatrix, (s32*)params);
+        }
+        else
+        {
+            MatrixScale(PosMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-                TexMatrixStackPointer--;
-                TexMatrixStackPointer &= 0x1;
-                memcpy(TexMatrix, TexMatrixStack, 16*4);
-                AddCycles(17);
-            }
-            else
-            {
-                s32 offset = (s32)(ExecParams[0] << 26) >> 26;
-                PosMatrixStackPointer -= offset;
-                PosMatrixStackPointer &= 0x3F;
+    case 0x1C: // translate
+        if (MatrixMode == 0)
+        {
+            MatrixTranslate(ProjMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        else if (MatrixMode == 3)
+        {
+            MatrixTranslate(TexMatrix, (s32*)params);
+        }
+        else
+        {
+            MatrixTranslate(PosMatrix, (s32*)params);
+            if (MatrixMode == 2)
+                MatrixTranslate(VecMatrix, (s32*)params);
+            ClipMatrixDirty = true;
+        }
+        break;
 
-                if (PosMatrixStackPointer > 30) GXStat |= (1<<15);
+    case 0x20: // vertex color
+        {
+            u32 c = params[0];
+            u32 r = c & 0x1F;
+            u32 g = (c >> 5) & 0x1F;
+            u32 b = (c >> 10) & 0x1F;
+            VertexColor[0] = r;
+            VertexColor[1] = g;
+            VertexColor[2] = b;
+        }
+        break;
 
-                memcpy(PosMatrix, PosMatrixStack[PosMatrixStackPointer & 0x1F], 16*4);
-                memcpy(VecMatrix, VecMatrixStack[PosMatrixStackPointer & 0x1F], 16*4);
-                ClipMatrixDirty = true;
-                AddCycles(35);
-            }
-            break;
+    case 0x21: // normal
+        Normal[0] = (s16)((params[0] & 0x000003FF) << 6) >> 6;
+        Normal[1] = (s16)((params[0] & 0x000FFC00) >> 4) >> 6;
+        Normal[2] = (s16)((params[0] & 0x3FF00000) >> 14) >> 6;
+        CalculateLighting();
+        break;
 
-        case 0x13: // store matrix
-            if (MatrixMode == 0)
-            {
-                memcpy(ProjMatrixStack, ProjMatrix, 16*4);
-            }
-            else if (MatrixMode == 3)
-            {
-                memcpy(TexMatrixStack, TexMatrix, 16*4);
-            }
-            else
-            {
-                u32 addr = ExecParams[0] & 0x1F;
-                if (addr > 30) GXStat |= (1<<15);
+    case 0x22: // texcoord
+        RawTexCoords[0] = params[0] & 0xFFFF;
+        RawTexCoords[1] = params[0] >> 16;
+        if ((TexParam >> 30) == 1)
+        {
+            TexCoords[0] = (RawTexCoords[0]*TexMatrix[0] + RawTexCoords[1]*TexMatrix[4] + TexMatrix[8] + TexMatrix[12]) >> 12;
+            TexCoords[1] = (RawTexCoords[0]*TexMatrix[1] + RawTexCoords[1]*TexMatrix[5] + TexMatrix[9] + TexMatrix[13]) >> 12;
+        }
+        else
+        {
+            TexCoords[0] = RawTexCoords[0];
+            TexCoords[1] = RawTexCoords[1];
+        }
+        break;
 
-                memcpy(PosMatrixStack[addr], PosMatrix, 16*4);
-                memcpy(VecMatrixStack[addr], VecMatrix, 16*4);
-            }
-            AddCycles(16);
-            break;
+    case 0x23: // full vertex
+        CurVertex[0] = params[0] & 0xFFFF;
+        CurVertex[1] = params[0] >> 16;
+        CurVertex[2] = params[1] & 0xFFFF;
+        SubmitVertex();
+        break;
 
-        case 0x14: // restore matrix
-            if (MatrixMode == 0)
-            {
-                memcpy(ProjMatrix, ProjMatrixStack, 16*4);
-                ClipMatrixDirty = true;
-                AddCycles(35);
-            }
-            else if (MatrixMode == 3)
-            {
-                memcpy(TexMatrix, TexMatrixStack, 16*4);
-                AddCycles(17);
-            }
-            else
-            {
-                u32 addr = ExecParams[0] & 0x1F;
-                if (addr > 30) GXStat |= (1<<15);
+    case 0x24: // 10-bit vertex
+        CurVertex[0] = (params[0] & 0x000003FF) << 6;
+        CurVertex[1] = (params[0] & 0x000FFC00) >> 4;
+        CurVertex[2] = (params[0] & 0x3FF00000) >> 14;
+        SubmitVertex();
+        break;
 
-                memcpy(PosMatrix, PosMatrixStack[addr], 16*4);
-                memcpy(VecMatrix, VecMatrixStack[addr], 16*4);
-                ClipMatrixDirty = true;
-                AddCycles(35);
-            }
-            break;
+    case 0x25: // vertex XY
+        CurVertex[0] = params[0] & 0xFFFF;
+        CurVertex[1] = params[0] >> 16;
+        SubmitVertex();
+        break;
 
-        case 0x15: // identity
-            if (MatrixMode == 0)
-            {
-                MatrixLoadIdentity(ProjMatrix);
-                ClipMatrixDirty = true;
-                AddCycles(18);
-            }
-            else if (MatrixMode == 3)
-                MatrixLoadIdentity(TexMatrix);
-            else
-            {
-                MatrixLoadIdentity(PosMatrix);
-                if (MatrixMode == 2)
-                    MatrixLoadIdentity(VecMatrix);
-                ClipMatrixDirty = true;
-                AddCycles(18);
-            }
-            break;
+    case 0x26: // vertex XZ
+        CurVertex[0] = params[0] & 0xFFFF;
+        CurVertex[2] = params[0] >> 16;
+        SubmitVertex();
+        break;
 
-        case 0x16: // load 4x4
-            if (MatrixMode == 0)
-            {
-                MatrixLoad4x4(ProjMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(18);
-            }
-            else if (MatrixMode == 3)
+    case 0x27: // vertex YZ
+        CurVertex[1] = params[0] & 0xFFFF;
+        CurVertex[2] = params[0] >> 16;
+        SubmitVertex();
+        break;
+
+    case 0x28: // 10-bit delta vertex
+        CurVertex[0] += (s16)((params[0] & 0x000003FF) << 6) >> 6;
+        CurVertex[1] += (s16)((params[0] & 0x000FFC00) >> 4) >> 6;
+        CurVertex[2] += (s16)((params[0] & 0x3FF00000) >> 14) >> 6;
+        SubmitVertex();
+        break;
+
+    case 0x29: // polygon attributes
+        PolygonAttr = params[0];
+        break;
+
+    case 0x2A: // texture param
+        TexParam = params[0];
+        break;
+
+    case 0x2B: // texture palette
+        TexPalette = params[0] & 0x1FFF;
+        break;
+
+    case 0x30: // diffuse/ambient material
+        MatDiffuse[0] = params[0] & 0x1F;
+        MatDiffuse[1] = (params[0] >> 5) & 0x1F;
+        MatDiffuse[2] = (params[0] >> 10) & 0x1F;
+        MatAmbient[0] = (params[0] >> 16) & 0x1F;
+        MatAmbient[1] = (params[0] >> 21) & 0x1F;
+        MatAmbient[2] = (params[0] >> 26) & 0x1F;
+        if (params[0] & 0x8000)
+        {
+            VertexColor[0] = MatDiffuse[0];
+            VertexColor[1] = MatDiffuse[1];
+            VertexColor[2] = MatDiffuse[2];
+        }
+        break;
+
+    case 0x31: // specular/emission material
+        MatSpecular[0] = params[0] & 0x1F;
+        MatSpecular[1] = (params[0] >> 5) & 0x1F;
+        MatSpecular[2] = (params[0] >> 10) & 0x1F;
+        MatEmission[0] = (params[0] >> 16) & 0x1F;
+        MatEmission[1] = (params[0] >> 21) & 0x1F;
+        MatEmission[2] = (params[0] >> 26) & 0x1F;
+        UseShininessTable = (params[0] & 0x8000) != 0;
+        break;
+
+    case 0x32: // light direction
+        {
+            u32 l = params[0] >> 30;
+            s16 dir[3];
+            dir[0] = (s16)((params[0] & 0x000003FF) << 6) >> 6;
+            dir[1] = (s16)((params[0] & 0x000FFC00) >> 4) >> 6;
+            dir[2] = (s16)((params[0] & 0x3FF00000) >> 14) >> 6;
+            LightDirection[l][0] = (dir[0]*VecMatrix[0] + dir[1]*VecMatrix[4] + dir[2]*VecMatrix[8]) >> 12;
+            LightDirection[l][1] = (dir[0]*VecMatrix[1] + dir[1]*VecMatrix[5] + dir[2]*VecMatrix[9]) >> 12;
+            LightDirection[l][2] = (dir[0]*VecMatrix[2] + dir[1]*VecMatrix[6] + dir[2]*VecMatrix[10]) >> 12;
+        }
+        break;
+
+    case 0x33: // light color
+        {
+            u32 l = params[0] >> 30;
+            LightColor[l][0] = params[0] & 0x1F;
+            LightColor[l][1] = (params[0] >> 5) & 0x1F;
+            LightColor[l][2] = (params[0] >> 10) & 0x1F;
+        }
+        break;
+
+    case 0x34: // shininess table
+        {
+            for (int i = 0; i < 128; i += 4)
             {
-                MatrixLoad4x4(TexMatrix, (s32*)ExecParams);
-                AddCycles(10);
+                u32 val = params[i >> 2];
+                ShininessTable[i + 0] = val & 0xFF;
+                ShininessTable[i + 1] = (val >> 8) & 0xFF;
+                ShininessTable[i + 2] = (val >> 16) & 0xFF;
+                ShininessTable[i + 3] = val >> 24;
             }
+        }
+        break;
+
+    case 0x40: // begin polygons
+        // TODO: check if there was a polygon being defined but incomplete
+        // such cases seem to freeze the GPU
+        PolygonMode = params[0] & 0x3;
+        VertexNum = 0;
+        VertexNumInPoly = 0;
+        NumConsecutivePolygons = 0;
+        LastStripPolygon = NULL;
+        CurPolygonAttr = PolygonAttr;
+        break;
+
+    case 0x41: // end polygons
+        // TODO: research this?
+        // it doesn't seem to have any effect whatsoever, but
+        // its timing characteristics are different from those of other
+        // no-op commands
+        break;
+
+    case 0x50: // flush
+        FlushAttributes = params[0] & 0x3;
+        break;
+
+    case 0x60: // viewport x1,y1,x2,y2
+        // note: viewport Y coordinates are upside-down
+        Viewport[0] = params[0] & 0xFF;                         // x0
+        Viewport[1] = (191 - ((params[0] >> 8) & 0xFF)) & 0xFF; // y0
+        Viewport[2] = (params[0] >> 16) & 0xFF;                 // x1
+        Viewport[3] = (191 - (params[0] >> 24)) & 0xFF;         // y1
+        Viewport[4] = (Viewport[2] - Viewport[0] + 1) & 0x1FF;  // width
+        Viewport[5] = (Viewport[1] - Viewport[3] + 1) & 0xFF;   // height
+        break;
+
+    case 0x70: // box test
+        BoxTest(params);
+        break;
+
+    case 0x71: // pos test
+        CurVertex[0] = params[0] & 0xFFFF;
+        CurVertex[1] = params[0] >> 16;
+        CurVertex[2] = params[1] & 0xFFFF;
+        PosTest();
+        break;
+
+    case 0x72: // vec test
+        VecTest(params);
+        break;
+
+
+    default:
+        //printf("!! UNKNOWN GX COMMAND %02X %08X\n", cmd, params[0]);
+        break;
+    }
+}
+
+void StartPolygonPipeline(u32 nverts)
+{
+    // submitting a polygon starts the polygon pipeline
+    // noting that for now we are only reserving one vertex slot
+    // further slots only get reserved if the polygon makes it through culling/clipping
+    PolygonPipeline = 8;
+    VertexSlotCounter = 1;
+    VertexSlotsFree = 0b11110;
+
+    if (nverts == 4)
+    {
+        PolygonPipeline = 35;
+        VertexSlotCounter = 1;
+        if (TimingPolygonMode & 0x2) VertexSlotsFree = 0b11100;
+        else                         VertexSlotsFree = 0b11110;
+    }
+    else if (nverts > 0)
+    {
+        PolygonPipeline = 26;
+        VertexSlotCounter = 1;
+        if (TimingPolygonMode & 0x2) VertexSlotsFree = 0b1000;
+        else                         VertexSlotsFree = 0b1110;
+    }
+}
+
+bool TimingVertexCompletesPolygon()
+{
+    // same polygon assembly rules as SubmitVertex()
+    TimingVertexNumInPoly++;
+
+    switch (TimingPolygonMode)
+    {
+    case 0: // triangle
+        if (TimingVertexNumInPoly < 3) return false;
+        TimingVertexNumInPoly = 0;
+        break;
+
+    case 1: // quad
+        if (TimingVertexNumInPoly < 4) return false;
+        TimingVertexNumInPoly = 0;
+        break;
+
+    case 2: // triangle strip
+        if (!(TimingNumConsecutivePolygons & 1) && TimingVertexNumInPoly < 3) return false;
+        TimingVertexNumInPoly = 2;
+        break;
+
+    case 3: // quad strip
+        if (TimingVertexNumInPoly < 4) return false;
+        TimingVertexNumInPoly = 2;
+        break;
+    }
+
+    TimingNumConsecutivePolygons++;
+    return true;
+}
+
+void ExecuteCommandTiming(u32 cmd, u32* params)
+{
+    switch (cmd)
+    {
+    case 0x10: // matrix mode
+        TimingMatrixMode = params[0] & 0x3;
+        break;
+
+    case 0x11: // push matrix
+        NumPushPopCommands--;
+        if (TimingMatrixMode == 0)
+        {
+            if (TimingProjStackPointer > 0) GXStat |= (1<<15);
+            TimingProjStackPointer = (TimingProjStackPointer + 1) & 0x1;
+        }
+        else if (TimingMatrixMode == 3)
+        {
+            if (TimingTexStackPointer > 0) GXStat |= (1<<15);
+            TimingTexStackPointer = (TimingTexStackPointer + 1) & 0x1;
+        }
+        else
+        {
+            if (TimingPosStackPointer > 30) GXStat |= (1<<15);
+            TimingPosStackPointer = (TimingPosStackPointer + 1) & 0x3F;
+        }
+        AddCycles(16);
+        break;
+
+    case 0x12: // pop matrix
+        NumPushPopCommands--;
+        if (TimingMatrixMode == 0)
+        {
+            if (TimingProjStackPointer == 0) GXStat |= (1<<15);
+            TimingProjStackPointer = (TimingProjStackPointer - 1) & 0x1;
+            AddCycles(35);
+        }
+        else if (TimingMatrixMode == 3)
+        {
+            if (TimingTexStackPointer == 0) GXStat |= (1<<15);
+            TimingTexStackPointer = (TimingTexStackPointer - 1) & 0x1;
+            AddCycles(17);
+        }
+        else
+        {
+            s32 offset = (s32)(params[0] << 26) >> 26;
+            TimingPosStackPointer = (TimingPosStackPointer - offset) & 0x3F;
+            if (TimingPosStackPointer > 30) GXStat |= (1<<15);
+            AddCycles(35);
+        }
+        break;
+
+    case 0x13: // store matrix
+        if (TimingMatrixMode == 1 || TimingMatrixMode == 2)
+        {
+            if ((params[0] & 0x1F) > 30) GXStat |= (1<<15);
+        }
+        AddCycles(16);
+        break;
+
+    case 0x14: // restore matrix
+        if (TimingMatrixMode == 0)
+            AddCycles(35);
+        else if (TimingMatrixMode == 3)
+            AddCycles(17);
+        else
+        {
+            if ((params[0] & 0x1F) > 30) GXStat |= (1<<15);
+            AddCycles(35);
+        }
+        break;
+
+    case 0x15: // identity
+        if (TimingMatrixMode != 3) AddCycles(18);
+        break;
+
+    case 0x16: // load 4x4
+        if (TimingMatrixMode == 3) AddCycles(10);
+        else                       AddCycles(18);
+        break;
+
+    case 0x17: // load 4x3
+        if (TimingMatrixMode == 3) AddCycles(7);
+        else                       AddCycles(18);
+        break;
+
+    case 0x18: // mult 4x4
+    case 0x19: // mult 4x3
+    case 0x1A: // mult 3x3
+    case 0x1B: // scale
+    case 0x1C: // translate
+        {
+            // fewer cycles the fewer parameters there are
+            // scale doesn't apply to the vector matrix, the others take longer when they do
+            s32 nparams = CmdNumParams[cmd];
+            if (TimingMatrixMode == 3)
+                AddCycles(33 - nparams);
+            else if (TimingMatrixMode == 2 && cmd != 0x1B)
+                AddCycles(35 + 30 - nparams);
             else
+                AddCycles(35 - nparams);
+        }
+        break;
+
+    case 0x21: // normal
+        {
+            // one cycle per enabled light, atleast one
+            s32 c = 0;
+            for (int i = 0; i < 4; i++)
             {
-                MatrixLoad4x4(PosMatrix, (s32*)ExecParams);
-                if (MatrixMode == 2)
-                    MatrixLoad4x4(VecMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(18);
+                if (TimingCurPolygonAttr & (1<<i))
+                    c++;
             }
-            break;
 
-        case 0x17: // load 4x3
-            if (MatrixMode == 0)
-            {
-                MatrixLoad4x3(ProjMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(18);
-            }
-            else if (MatrixMode == 3)
-            {
-                MatrixLoad4x3(TexMatrix, (s32*)ExecParams);
-                AddCycles(7);
-            }
-            else
-            {
-                MatrixLoad4x3(PosMatrix, (s32*)ExecParams);
-                if (MatrixMode == 2)
-                    MatrixLoad4x3(VecMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(18);
-            }
-            break;
+            if (c < 1) c = 1;
+            NormalPipeline = 7;
+            AddCycles(c);
+        }
+        break;
+
+    case 0x23: // full vertex
+    case 0x24: // 10-bit vertex
+    case 0x25: // vertex XY
+    case 0x26: // vertex XZ
+    case 0x27: // vertex YZ
+    case 0x28: // 10-bit delta vertex
+        if (TimingVertexCompletesPolygon())
+        {
+            // the geometry thread hasn't clipped this polygon yet, assume it went through whole
+            if (ThreadedGeometry) StartPolygonPipeline(TimingPolygonMode & 0x1 ? 4:3);
+            else                  StartPolygonPipeline(LastPolygonVerts);
+        }
+        VertexPipeline = 7;
+        AddCycles(3);
+        break;
+
+    case 0x29: // polygon attributes
+        TimingPolygonAttr = params[0];
+        break;
+
+    case 0x30: // diffuse/ambient material
+    case 0x31: // specular/emission material
+        AddCycles(3);
+        break;
+
+    case 0x32: // light direction
+        AddCycles(5);
+        break;
+
+    case 0x33: // light color
+        AddCycles(1);
+        break;
+
+    case 0x40: // begin polygons
+        TimingPolygonMode = params[0] & 0x3;
+        TimingVertexNumInPoly = 0;
+        TimingNumConsecutivePolygons = 0;
+        TimingCurPolygonAttr = TimingPolygonAttr;
+        break;
+
+    case 0x50: // flush
+        FlushRequest = 1;
+        CycleCount = 325;
+        // probably safe to just reset all pipelines
+        // but needs checked
+        VertexPipeline = 0;
+        NormalPipeline = 0;
+        PolygonPipeline = 0;
+        VertexSlotCounter = 0;
+        VertexSlotsFree = 1;
+        break;
+
+    case 0x70: // box test
+        NumTestCommands -= 3;
+        AddCycles(254);
+        GXStat &= ~(1<<1);
+        if (ThreadedGeometry)   BoxTestPending = true;
+        else if (BoxTestResult) GXStat |= (1<<1);
+        break;
+
+    case 0x71: // pos test
+        NumTestCommands -= 2;
+        AddCycles(5);
+        break;
+
+    case 0x72: // vec test
+        NumTestCommands--;
+        AddCycles(4);
+        break;
+    }
+}
+
+void MergeRAMOverflow()
+{
+    if (PolygonRAMOverflow)
+    {
+        PolygonRAMOverflow = false;
+        DispCnt |= (1<<13);
+    }
+}
+
+void QueueGeometryCommand(u32 cmd, u32* params)
+{
+    u32 num = CmdNumParams[cmd];
+    if (num == 0) num = 1;
 
-        case 0x18: // mult 4x4
-            if (MatrixMode == 0)
-            {
-                MatrixMult4x4(ProjMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(35 - 16);
-            }
-            else if (MatrixMode == 3)
-            {
-                MatrixMult4x4(TexMatrix, (s32*)ExecParams);
-                AddCycles(33 - 16);
-            }
-            else
-            {
-                MatrixMult4x4(PosMatrix, (s32*)ExecParams);
-                if (MatrixMode == 2)
-                {
-                    MatrixMult4x4(VecMatrix, (s32*)ExecParams);
-                    AddCycles(35 + 30 - 16);
-                }
-                else AddCycles(35 - 16);
-                ClipMatrixDirty = true;
-            }
-            break;
+    u32 wr = GeometryQueueWrite.load(std::memory_order_relaxed);
+    if ((wr - GeometryQueueRead.load(std::memory_order_acquire)) > (kGeometryQueueSize - 1 - num))
+    {
+        // queue full, let the worker catch up
+        Platform::Semaphore_Post(Sema_GeometryStart);
+        while ((wr - GeometryQueueRead.load(std::memory_order_acquire)) > (kGeometryQueueSize - 1 - num))
+            std::this_thread::yield();
+    }
 
-        case 0x19: // mult 4x3
-            if (MatrixMode == 0)
-            {
-                MatrixMult4x3(ProjMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(35 - 12);
-            }
-            else if (MatrixMode == 3)
-            {
-                MatrixMult4x3(TexMatrix, (s32*)ExecParams);
-                AddCycles(33 - 12);
-            }
-            else
-            {
-                MatrixMult4x3(PosMatrix, (s32*)ExecParams);
-                if (MatrixMode == 2)
-                {
-                    MatrixMult4x3(VecMatrix, (s32*)ExecParams);
-                    AddCycles(35 + 30 - 12);
-                }
-                else AddCycles(35 - 12);
-                ClipMatrixDirty = true;
-            }
-            break;
+    GeometryQueue[wr & (kGeometryQueueSize-1)] = cmd | (num << 8);
+    for (u32 i = 0; i < num; i++)
+        GeometryQueue[(wr + 1 + i) & (kGeometryQueueSize-1)] = params[i];
 
-        case 0x1A: // mult 3x3
-            if (MatrixMode == 0)
-            {
-                MatrixMult3x3(ProjMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(35 - 9);
-            }
-            else if (MatrixMode == 3)
-            {
-                MatrixMult3x3(TexMatrix, (s32*)ExecParams);
-                AddCycles(33 - 9);
-            }
-            else
-            {
-                MatrixMult3x3(PosMatrix, (s32*)ExecParams);
-                if (MatrixMode == 2)
-                {
-                    MatrixMult3x3(VecMatrix, (s32*)ExecParams);
-                    AddCycles(35 + 30 - 9);
-                }
-                else AddCycles(35 - 9);
-                ClipMatrixDirty = true;
-            }
-            break;
+    GeometryQueueWrite.store(wr + 1 + num, std::memory_order_release);
+    GeometryQueuePosted = false;
+}
 
-        case 0x1B: // scale
-            if (MatrixMode == 0)
-            {
-                MatrixScale(ProjMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(35 - 3);
-            }
-            else if (MatrixMode == 3)
-            {
-                MatrixScale(TexMatrix, (s32*)ExecParams);
-                AddCycles(33 - 3);
-            }
-            else
-            {
-                MatrixScale(PosMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(35 - 3);
-            }
-            break;
+void KickGeometryThread()
+{
+    if (!GeometryQueuePosted)
+    {
+        Platform::Semaphore_Post(Sema_GeometryStart);
+        GeometryQueuePosted = true;
+    }
+}
 
-        case 0x1C: // translate
-            if (MatrixMode == 0)
-            {
-                MatrixTranslate(ProjMatrix, (s32*)ExecParams);
-                ClipMatrixDirty = true;
-                AddCycles(35 - 3);
-            }
-            else if (MatrixMode == 3)
-            {
-                MatrixTranslate(TexMatrix, (s32*)ExecParams);
-                AddCycles(33 - 3);
-            }
-            else
-            {
-                MatrixTranslate(PosMatrix, (s32*)ExecParams);
-                if (MatrixMode == 2)
-                {
-                    MatrixTranslate(VecMatrix, (s32*)ExecParams);
-                    AddCycles(35 + 30 - 3);
-                }
-                else AddCycles(35 - 3);
-                ClipMatrixDirty = true;
-            }
-            break;
+void SyncGeometry()
+{
+    if (!ThreadedGeometry) return;
 
-        case 0x20: // vertex color
-            {
-                u32 c = ExecParams[0];
-                u32 r = c & 0x1F;
-                u32 g = (c >> 5) & 0x1F;
-                u32 b = (c >> 10) & 0x1F;
-                VertexColor[0] = r;
-                VertexColor[1] = g;
-                VertexColor[2] = b;
-            }
-            break;
+    if (GeometryQueueRead.load(std::memory_order_acquire) != GeometryQueueWrite.load(std::memory_order_relaxed))
+    {
+        KickGeometryThread();
+        while (GeometryQueueRead.load(std::memory_order_acquire) != GeometryQueueWrite.load(std::memory_order_relaxed))
+            std::this_thread::yield();
+    }
 
-        case 0x21: // normal
-            Normal[0] = (s16)((ExecParams[0] & 0x000003FF) << 6) >> 6;
-            Normal[1] = (s16)((ExecParams[0] & 0x000FFC00) >> 4) >> 6;
-            Normal[2] = (s16)((ExecParams[0] & 0x3FF00000) >> 14) >> 6;
-            CalculateLighting();
-            break;
+    if (BoxTestPending)
+    {
+        if (BoxTestResult) GXStat |= (1<<1);
+        BoxTestPending = false;
+    }
 
-        case 0x22: // texcoord
-            RawTexCoords[0] = ExecParams[0] & 0xFFFF;
-            RawTexCoords[1] = ExecParams[0] >> 16;
-            if ((TexParam >> 30) == 1)
-            {
-                TexCoords[0] = (RawTexCoords[0]*TexMatrix[0] + RawTexCoords[1]*TexMatrix[4] + TexMatrix[8] + TexMatrix[12]) >> 12;
-                TexCoords[1] = (RawTexCoords[0]*TexMatrix[1] + RawTexCoords[1]*TexMatrix[5] + TexMatrix[9] + TexMatrix[13]) >> 12;
-            }
-            else
-            {
-                TexCoords[0] = RawTexCoords[0];
-                TexCoords[1] = RawTexCoords[1];
-            }
-            break;
+    MergeRAMOverflow();
+}
 
-        case 0x23: // full vertex
-            CurVertex[0] = ExecParams[0] & 0xFFFF;
-            CurVertex[1] = ExecParams[0] >> 16;
-            CurVertex[2] = ExecParams[1] & 0xFFFF;
-            SubmitVertex();
-            break;
+void GeometryThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_GeometryStart);
+        if (!GeometryThreadRunning) return;
 
-        case 0x24: // 10-bit vertex
-            CurVertex[0] = (ExecParams[0] & 0x000003FF) << 6;
-            CurVertex[1] = (ExecParams[0] & 0x000FFC00) >> 4;
-            CurVertex[2] = (ExecParams[0] & 0x3FF00000) >> 14;
-            SubmitVertex();
-            break;
+        u32 rd = GeometryQueueRead.load(std::memory_order_relaxed);
+        while (rd != GeometryQueueWrite.load(std::memory_order_acquire))
+        {
+            u32 params[32];
+            u32 header = GeometryQueue[rd & (kGeometryQueueSize-1)];
+            u32 num = header >> 8;
+            for (u32 i = 0; i < num; i++)
+                params[i] = GeometryQueue[(rd + 1 + i) & (kGeometryQueueSize-1)];
 
-        case 0x25: // vertex XY
-            CurVertex[0] = ExecParams[0] & 0xFFFF;
-            CurVertex[1] = ExecParams[0] >> 16;
-            SubmitVertex();
-            break;
+            ExecuteGeometryCommand(header & 0xFF, params);
 
-        case 0x26: // vertex XZ
-            CurVertex[0] = ExecParams[0] & 0xFFFF;
-            CurVertex[2] = ExecParams[0] >> 16;
-            SubmitVertex();
-            break;
+            rd += 1 + num;
+            GeometryQueueRead.store(rd, std::memory_order_release);
+        }
+    }
+}
 
-        case 0x27: // vertex YZ
-            CurVertex[1] = ExecParams[0] & 0xFFFF;
-            CurVertex[2] = ExecParams[0] >> 16;
-            SubmitVertex();
-            break;
+void StopGeometryThread()
+{
+    if (GeometryThreadRunning)
+    {
+        GeometryThreadRunning = false;
+        Platform::Semaphore_Post(Sema_GeometryStart);
+        Platform::Thread_Wait(GeometryThread);
+        Platform::Thread_Free(GeometryThread);
+    }
+}
 
-        case 0x28: // 10-bit delta vertex
-            CurVertex[0] += (s16)((ExecParams[0] & 0x000003FF) << 6) >> 6;
-            CurVertex[1] += (s16)((ExecParams[0] & 0x000FFC00) >> 4) >> 6;
-            CurVertex[2] += (s16)((ExecParams[0] & 0x3FF00000) >> 14) >> 6;
-            SubmitVertex();
-            break;
+void SetupGeometryThread()
+{
+    // only called once the queue is empty
+    ThreadedGeometry = (Config::ThreadedGeometry != 0);
 
-        case 0x29: // polygon attributes
-            PolygonAttr = ExecParams[0];
-            break;
+    if (ThreadedGeometry)
+    {
+        if (!GeometryThreadRunning)
+        {
+            Platform::Semaphore_Reset(Sema_GeometryStart);
+            GeometryQueueRead = 0;
+            GeometryQueueWrite = 0;
+            GeometryQueuePosted = true;
 
-        case 0x2A: // texture param
-            TexParam = ExecParams[0];
-            break;
+            GeometryThreadRunning = true;
+            GeometryThread = Platform::Thread_Create(GeometryThreadFunc);
+        }
+    }
+    else
+    {
+        StopGeometryThread();
+    }
+}
 
-        case 0x2B: // texture palette
-            TexPalette = ExecParams[0] & 0x1FFF;
-            break;
+void CopyTimingState()
+{
+    TimingMatrixMode = MatrixMode;
+    TimingProjStackPointer = ProjMatrixStackPointer;
+    TimingPosStackPointer = PosMatrixStackPointer;
+    TimingTexStackPointer = TexMatrixStackPointer;
+    TimingPolygonAttr = PolygonAttr;
+    TimingCurPolygonAttr = CurPolygonAttr;
+    TimingPolygonMode = PolygonMode;
+    TimingVertexNumInPoly = VertexNumInPoly;
+    TimingNumConsecutivePolygons = NumConsecutivePolygons;
+}
 
-        case 0x30: // diffuse/ambient material
-            MatDiffuse[0] = ExecParams[0] & 0x1F;
-            MatDiffuse[1] = (ExecParams[0] >> 5) & 0x1F;
-            MatDiffuse[2] = (ExecParams[0] >> 10) & 0x1F;
-            MatAmbient[0] = (ExecParams[0] >> 16) & 0x1F;
-            MatAmbient[1] = (ExecParams[0] >> 21) & 0x1F;
-            MatAmbient[2] = (ExecParams[0] >> 26) & 0x1F;
-            if (ExecParams[0] & 0x8000)
-            {
-                VertexColor[0] = MatDiffuse[0];
-                VertexColor[1] = MatDiffuse[1];
-                VertexColor[2] = MatDiffuse[2];
-            }
-            AddCycles(3);
-            break;
+void ClearMatrixStackError()
+{
+    // the stack pointers belong to the geometry side, so it has to be done first
+    SyncGeometry();
 
-        case 0x31: // specular/emission material
-            MatSpecular[0] = ExecParams[0] & 0x1F;
-            MatSpecular[1] = (ExecParams[0] >> 5) & 0x1F;
-            MatSpecular[2] = (ExecParams[0] >> 10) & 0x1F;
-            MatEmission[0] = (ExecParams[0] >> 16) & 0x1F;
-            MatEmission[1] = (ExecParams[0] >> 21) & 0x1F;
-            MatEmission[2] = (ExecParams[0] >> 26) & 0x1F;
-            UseShininessTable = (ExecParams[0] & 0x8000) != 0;
-            AddCycles(3);
-            break;
+    GXStat &= ~0x8000;
+    ProjMatrixStackPointer = 0;
+    //PosMatrixStackPointer = 0;
+    TexMatrixStackPointer = 0; // CHECKME
+    TimingProjStackPointer = 0;
+    TimingTexStackPointer = 0;
+}
 
-        case 0x32: // light direction
-            {
-                u32 l = ExecParams[0] >> 30;
-                s16 dir[3];
-                dir[0] = (s16)((ExecParams[0] & 0x000003FF) << 6) >> 6;
-                dir[1] = (s16)((ExecParams[0] & 0x000FFC00) >> 4) >> 6;
-                dir[2] = (s16)((ExecParams[0] & 0x3FF00000) >> 14) >> 6;
-                LightDirection[l][0] = (dir[0]*VecMatrix[0] + dir[1]*VecMatrix[4] + dir[2]*VecMatrix[8]) >> 12;
-                LightDirection[l][1] = (dir[0]*VecMatrix[1] + dir[1]*VecMatrix[5] + dir[2]*VecMatrix[9]) >> 12;
-                LightDirection[l][2] = (dir[0]*VecMatrix[2] + dir[1]*VecMatrix[6] + dir[2]*VecMatrix[10]) >> 12;
-            }
-            AddCycles(5);
-            break;
 
-        case 0x33: // light color
-            {
-                u32 l = ExecParams[0] >> 30;
-                LightColor[l][0] = ExecParams[0] & 0x1F;
-                LightColor[l][1] = (ExecParams[0] >> 5) & 0x1F;
-                LightColor[l][2] = (ExecParams[0] >> 10) & 0x1F;
-            }
-            AddCycles(1);
-            break;
+void ExecuteCommand()
+{
+    PROFILE_SCOPE(Prof_GPU3DCmd);
 
-        case 0x34: // shininess table
-            {
-                for (int i = 0; i < 128; i += 4)
-                {
-                    u32 val = ExecParams[i >> 2];
-                    ShininessTable[i + 0] = val & 0xFF;
-                    ShininessTable[i + 1] = (val >> 8) & 0xFF;
-                    ShininessTable[i + 2] = (val >> 16) & 0xFF;
-                    ShininessTable[i + 3] = val >> 24;
-                }
-            }
-            break;
+    CmdFIFOEntry entry = CmdFIFORead();
 
-        case 0x40: // begin polygons
-            // TODO: check if there was a polygon being defined but incomplete
-            // such cases seem to freeze the GPU
-            PolygonMode = ExecParams[0] & 0x3;
-            VertexNum = 0;
-            VertexNumInPoly = 0;
-            NumConsecutivePolygons = 0;
-            LastStripPolygon = NULL;
-            CurPolygonAttr = PolygonAttr;
-            break;
+    //printf("FIFO: processing %02X %08X. Levels: FIFO=%d, PIPE=%d\n", entry.Command, entry.Param, CmdFIFO->Level(), CmdPIPE->Level());
 
-        case 0x41: // end polygons
-            // TODO: research this?
-            // it doesn't seem to have any effect whatsoever, but
-            // its timing characteristics are different from those of other
-            // no-op commands
-            break;
+    // each FIFO entry takes 1 cycle to be processed
+    // commands (presumably) run when all the needed parameters have been read
+    // which is where we add the remaining cycles if any
+    if (ExecParamCount == 0)
+    {
+        // delay the first command entry as needed
+        switch (entry.Command)
+        {
+        // commands that stall the polygon pipeline
+        case 0x32: StallPolygonPipeline(8 + 1,  2); break; // 32 can run 6 cycles after a vertex
+        case 0x40: StallPolygonPipeline(1,      0); break;
+        case 0x70: StallPolygonPipeline(10 + 1, 0); break;
 
-        case 0x50: // flush
-            FlushRequest = 1;
-            FlushAttributes = ExecParams[0] & 0x3;
-            CycleCount = 325;
-            // probably safe to just reset all pipelines
-            // but needs checked
-            VertexPipeline = 0;
+        case 0x23:
+        case 0x24:
+        case 0x25:
+        case 0x26:
+        case 0x27:
+        case 0x28:
+            // vertex
+            if (!(VertexSlotsFree & 0x1)) NextVertexSlot();
+            else                          AddCycles(1);
             NormalPipeline = 0;
-            PolygonPipeline = 0;
-            VertexSlotCounter = 0;
-            VertexSlotsFree = 1;
             break;
 
-        case 0x60: // viewport x1,y1,x2,y2
-            // note: viewport Y coordinates are upside-down
-            Viewport[0] = ExecParams[0] & 0xFF;                             // x0
-            Viewport[1] = (191 - ((ExecParams[0] >> 8) & 0xFF)) & 0xFF;     // y0
-            Viewport[2] = (ExecParams[0] >> 16) & 0xFF;                     // x1
-            Viewport[3] = (191 - (ExecParams[0] >> 24)) & 0xFF;             // y1
-            Viewport[4] = (Viewport[2] - Viewport[0] + 1) & 0x1FF;          // width
-            Viewport[5] = (Viewport[1] - Viewport[3] + 1) & 0xFF;           // height
+        case 0x20:
+        case 0x30:
+        case 0x31:
+        case 0x72:
+            // commands that can run 6 cycles after a vertex
+            if (VertexPipeline > 2) AddCycles((VertexPipeline - 2) + 1);
+            else                    AddCycles(NormalPipeline + 1);
+            NormalPipeline = 0;
             break;
 
-        case 0x70: // box test
-            NumTestCommands -= 3;
-            BoxTest(ExecParams);
+        case 0x29:
+        case 0x2A:
+        case 0x2B:
+        case 0x33:
+        case 0x34:
+        case 0x41:
+        case 0x60:
+        case 0x71:
+            // command that can run 8 cycles after a vertex
+            if (VertexPipeline > 0) AddCycles(VertexPipeline + 1);
+            else                    AddCycles(NormalPipeline + 1);
+            NormalPipeline = 0;
             break;
 
-        case 0x71: // pos test
-            NumTestCommands -= 2;
-            CurVertex[0] = ExecParams[0] & 0xFFFF;
-            CurVertex[1] = ExecParams[0] >> 16;
-            CurVertex[2] = ExecParams[1] & 0xFFFF;
-            PosTest();
+        default:
+            // all other commands can run 4 cycles after a vertex
+            // no need to do much here since that is the minimum
+            AddCycles(NormalPipeline + 1);
+            NormalPipeline = 0;
             break;
+        }
+    }
+    else
+        AddCycles(1);
 
-        case 0x72: // vec test
-            NumTestCommands--;
-            VecTest(ExecParams);
-            break;
+    ExecParams[ExecParamCount] = entry.Param;
+    ExecParamCount++;
 
-        default:
-            //printf("!! UNKNOWN GX COMMAND %02X %08X\n", entry.Command, entry.Param);
-            break;
+    if (ExecParamCount >= CmdNumParams[entry.Command])
+    {
+        /*printf("[GXS:%08X] 0x%02X,  ", GXStat, entry.Command);
+        for (int k = 0; k < ExecParamCount; k++) printf("0x%08X, ", ExecParams[k]);
+        printf("\n");*/
+
+        ExecParamCount = 0;
+
+        if (ThreadedGeometry)
+            QueueGeometryCommand(entry.Command, ExecParams);
+        else
+        {
+            ExecuteGeometryCommand(entry.Command, ExecParams);
+            MergeRAMOverflow();
         }
+
+        ExecuteCommandTiming(entry.Command, ExecParams);
     }
 }
 
@@ -2385,6 +3100,8 @@ void Run()
 
             ExecuteCommand();
         }
+
+        if (ThreadedGeometry) KickGeometryThread();
     }
 
     if (CycleCount <= 0 && CmdPIPE->IsEmpty())
@@ -2435,34 +3152,99 @@ bool YSort(Polygon* a, Polygon* b)
     return a->SortKey < b->SortKey;
 }
 
+void SortPolygonsReference(Polygon** out, Polygon* polys, u32 num, bool manualsort)
+{
+    // separate translucent polygons from opaque ones
+
+    u32 numopaque = 0;
+    for (u32 i = 0; i < num; i++)
+    {
+        if (!polys[i].Translucent) numopaque++;
+    }
+
+    u32 io = 0, it = numopaque;
+    for (u32 i = 0; i < num; i++)
+    {
+        Polygon* poly = &polys[i];
+        if (poly->Translucent)
+            out[it++] = poly;
+        else
+            out[io++] = poly;
+    }
+
+    // apply Y-sorting
+
+    std::stable_sort(out, out + (manualsort ? numopaque : num), YSort);
+}
+
+// the SortKey is 17 bits at most (translucent flag, bottom Y, top Y), so the
+// above is done as a two-pass LSD radix sort instead: by top Y, then by bottom Y
+// and translucency. both passes are stable, so polygons with equal keys stay in
+// order, and opaque polygons end up in front like they would after separating them.
+// with manual sorting, translucent polygons all get the same key so their order is kept.
+// the histograms for both passes are built in one go over the polygon list.
+Polygon* SortTemp[2048];
+u32 SortTempKey[2048];
+u32 SortKeys[2048];
+
+void SortPolygons(Polygon** out, Polygon* polys, u32 num, bool manualsort)
+{
+    u32 count0[256];
+    u32 count1[512];
+    memset(count0, 0, sizeof(count0));
+    memset(count1, 0, sizeof(count1));
+
+    for (u32 i = 0; i < num; i++)
+    {
+        u32 key = polys[i].SortKey & 0x1FFFF;
+        if (manualsort && polys[i].Translucent) key = 0x10000;
+
+        SortKeys[i] = key;
+        count0[key & 0xFF]++;
+        count1[key >> 8]++;
+    }
+
+    u32 pos0 = 0, pos1 = 0;
+    for (int i = 0; i < 512; i++)
+    {
+        if (i < 256)
+        {
+            u32 c0 = count0[i];
+            count0[i] = pos0;
+            pos0 += c0;
+        }
+
+        u32 c1 = count1[i];
+        count1[i] = pos1;
+        pos1 += c1;
+    }
+
+    for (u32 i = 0; i < num; i++)
+    {
+        u32 key = SortKeys[i];
+        u32 dst = count0[key & 0xFF]++;
+        SortTemp[dst] = &polys[i];
+        SortTempKey[dst] = key;
+    }
+
+    for (u32 i = 0; i < num; i++)
+    {
+        out[count1[SortTempKey[i] >> 8]++] = SortTemp[i];
+    }
+}
+
 void VBlank()
 {
     if (GeometryEnabled)
     {
+        if (FlushRequest) SyncGeometry();
+
         if (RenderingEnabled)
         {
             if (FlushRequest)
             {
                 if (NumPolygons)
-                {
-                    // separate translucent polygons from opaque ones
-
-                    u32 io = 0, it = NumOpaquePolygons;
-                    for (u32 i = 0; i < NumPolygons; i++)
-                    {
-                        Polygon* poly = &CurPolygonRAM[i];
-                        if (poly->Translucent)
-                            RenderPolygonRAM[it++] = poly;
-                        else
-                            RenderPolygonRAM[io++] = poly;
-                    }
-
-                    // apply Y-sorting
-
-                    std::stable_sort(RenderPolygonRAM.begin(),
-                        RenderPolygonRAM.begin() + ((FlushAttributes & 0x1) ? NumOpaquePolygons : NumPolygons),
-                        YSort);
-                }
+                    SortPolygons(RenderPolygonRAM.data(), CurPolygonRAM, NumPolygons, FlushAttributes & 0x1);
 
                 RenderNumPolygons = NumPolygons;
             }
@@ -2487,7 +3269,7 @@ void VBlank()
         if (FlushRequest)
         {
             CurRAMBank = CurRAMBank?0:1;
-            CurVertexRAM = &VertexRAM[CurRAMBank ? 6144 : 0];
+            CurVertexBase = CurRAMBank ? 6144 : 0;
             CurPolygonRAM = &PolygonRAM[CurRAMBank ? 2048 : 0];
 
             NumVertices = 0;
@@ -2505,6 +3287,14 @@ void VCount215()
     else               GLRenderer::RenderFrame();
 }
 
+void PrintStats()
+{
+    if (!PolygonsAccepted && !PolygonsClipped && !PolygonsRejected) return;
+
+    printf("3D clipping: %u polygons inside, %u clipped, %u rejected\n",
+           PolygonsAccepted, PolygonsClipped, PolygonsRejected);
+}
+
 u32* GetLine(int line)
 {
     if (Renderer == 0) return SoftRenderer::GetLine(line);
@@ -2557,13 +3347,14 @@ u8 Read8(u32 addr)
     {
     case 0x04000600:
         Run();
+        if (BoxTestPending) SyncGeometry();
         return GXStat & 0xFF;
     case 0x04000601:
         {
             Run();
             return ((GXStat >> 8) & 0xFF) |
-                   (PosMatrixStackPointer & 0x1F) |
-                   ((ProjMatrixStackPointer & 0x1) << 5);
+                   (TimingPosStackPointer & 0x1F) |
+                   ((TimingProjStackPointer & 0x1) << 5);
         }
     case 0x04000602:
         {
@@ -2592,9 +3383,13 @@ u8 Read8(u32 addr)
 
 u16 Read16(u32 addr)
 {
+    // test results, RAM counters and matrices come from the geometry side
+    if (addr >= 0x04000604) SyncGeometry();
+
     switch (addr)
     {
     case 0x04000060:
+        MergeRAMOverflow();
         return DispCnt;
 
     case 0x04000320:
@@ -2603,10 +3398,11 @@ u16 Read16(u32 addr)
     case 0x04000600:
         {
             Run();
+            if (BoxTestPending) SyncGeometry();
 
             return (GXStat & 0xFFFF) |
-                   ((PosMatrixStackPointer & 0x1F) << 8) |
-                   ((ProjMatrixStackPointer & 0x1) << 13);
+                   ((TimingPosStackPointer & 0x1F) << 8) |
+                   ((TimingProjStackPointer & 0x1) << 13);
         }
     case 0x04000602:
         {
@@ -2636,9 +3432,13 @@ u16 Read16(u32 addr)
 
 u32 Read32(u32 addr)
 {
+    // test results, RAM counters and matrices come from the geometry side
+    if (addr >= 0x04000604) SyncGeometry();
+
     switch (addr)
     {
     case 0x04000060:
+        MergeRAMOverflow();
         return DispCnt;
 
     case 0x04000320:
@@ -2647,12 +3447,13 @@ u32 Read32(u32 addr)
     case 0x04000600:
         {
             Run();
+            if (BoxTestPending) SyncGeometry();
 
             u32 fifolevel = CmdFIFO->Level();
 
             return GXStat |
-                   ((PosMatrixStackPointer & 0x1F) << 8) |
-                   ((ProjMatrixStackPointer & 0x1) << 13) |
+                   ((TimingPosStackPointer & 0x1F) << 8) |
+                   ((TimingProjStackPointer & 0x1) << 13) |
                    (fifolevel << 16) |
                    (fifolevel < 128 ? (1<<25) : 0) |
                    (fifolevel == 0  ? (1<<26) : 0);
@@ -2701,12 +3502,7 @@ void Write8(u32 addr, u8 val)
 
     case 0x04000601:
         if (val & 0x80)
-        {
-            GXStat &= ~0x8000;
-            ProjMatrixStackPointer = 0;
-            //PosMatrixStackPointer = 0;
-            TexMatrixStackPointer = 0; // CHECKME
-        }
+            ClearMatrixStackError();
         return;
     case 0x04000603:
         val &= 0xC0;
@@ -2769,12 +3565,7 @@ void Write16(u32 addr, u16 val)
 
     case 0x04000600:
         if (val & 0x8000)
-        {
-            GXStat &= ~0x8000;
-            ProjMatrixStackPointer = 0;
-            //PosMatrixStackPointer = 0;
-            TexMatrixStackPointer = 0; // CHECKME
-        }
+            ClearMatrixStackError();
         return;
     case 0x04000602:
         val &= 0xC000;
@@ -2842,12 +3633,7 @@ void Write32(u32 addr, u32 val)
 
     case 0x04000600:
         if (val & 0x8000)
-        {
-            GXStat &= ~0x8000;
-            ProjMatrixStackPointer = 0;
-            //PosMatrixStackPointer = 0;
-            TexMatrixStackPointer = 0; // CHECKME
-        }
+            ClearMatrixStackError();
         val &= 0xC0000000;
         GXStat &= 0x3FFFFFFF;
         GXStat |= val;
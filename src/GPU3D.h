@@ -45,9 +45,27 @@ typedef struct
 
 } Vertex;
 
+// vertex RAM, both banks
+// this is kept as one array per vertex attribute, rather than an array of Vertex,
+// so that polygon setup in the renderers goes through contiguous memory.
+// the geometry engine works on Vertex structs and copies them in and out.
 typedef struct
 {
-    Vertex* Vertices[10];
+    s32 Position[6144*2][4];
+    s32 Color[6144*2][3];
+    s16 TexCoords[6144*2][2];
+
+    bool Clipped[6144*2];
+
+    s32 FinalPosition[6144*2][2];
+    s32 FinalColor[6144*2][3];
+    s32 HiresPosition[6144*2][2];
+
+} VertexArrays;
+
+typedef struct
+{
+    u16 Vertices[10]; // indices into VertexRAM
     u32 NumVertices;
 
     s32 FinalZ[10];
@@ -87,11 +105,19 @@ extern u8 RenderFogDensityTable[34];
 
 extern u32 RenderClearAttr1, RenderClearAttr2;
 
+extern VertexArrays VertexRAM;
+
 extern std::array<Polygon*,2048> RenderPolygonRAM;
 extern u32 RenderNumPolygons;
 
 extern u64 Timestamp;
 
+// clipping stats, cleared on reset: polygons entirely inside the view volume,
+// polygons that went through the clipper, and polygons entirely outside one of
+// its planes. culled polygons aren't counted. updated by the geometry thread if
+// it's enabled, so only meant to be looked at once emulation is paused
+extern u32 PolygonsAccepted, PolygonsClipped, PolygonsRejected;
+
 extern int Renderer;
 
 bool Init();
@@ -118,8 +144,19 @@ void VBlank();
 void VCount215();
 u32* GetLine(int line);
 
+void PrintStats();
+
 void WriteToGXFIFO(u32 val);
 
+// checks the SIMD matrix code against the scalar code, returns false if they differ
+bool CheckMatrixKernels(int iterations);
+
+// Y-sorts a polygon list into the order it gets rendered in
+// manualsort: translucent polygons are left in the order they were submitted in
+void SortPolygons(Polygon** out, Polygon* polys, u32 num, bool manualsort);
+// same thing with std::stable_sort, which is what SortPolygons() replaced
+void SortPolygonsReference(Polygon** out, Polygon* polys, u32 num, bool manualsort);
+
 u8 Read8(u32 addr);
 u16 Read16(u32 addr);
 u32 Read32(u32 addr);
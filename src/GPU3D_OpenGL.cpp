@@ -561,7 +561,7 @@ void BuildPolygons(RendererPolygon* polygons, int npolys)
             int nout = 0;
             for (int j = 0; j < poly->NumVertices; j++)
             {
-                Vertex* vtx = poly->Vertices[j];
+                u32 vtx = poly->Vertices[j];
 
                 u32 z = poly->FinalZ[j];
                 u32 w = poly->FinalW[j];
@@ -573,13 +573,13 @@ void BuildPolygons(RendererPolygon* polygons, int npolys)
                 u32 x, y;
                 if (ScaleFactor > 1)
                 {
-                    x = (vtx->HiresPosition[0] * ScaleFactor) >> 4;
-                    y = (vtx->HiresPosition[1] * ScaleFactor) >> 4;
+                    x = (VertexRAM.HiresPosition[vtx][0] * ScaleFactor) >> 4;
+                    y = (VertexRAM.HiresPosition[vtx][1] * ScaleFactor) >> 4;
                 }
                 else
                 {
-                    x = vtx->FinalPosition[0];
-                    y = vtx->FinalPosition[1];
+                    x = VertexRAM.FinalPosition[vtx][0];
+                    y = VertexRAM.FinalPosition[vtx][1];
                 }
 
                 if (j > 0)
@@ -590,12 +590,12 @@ void BuildPolygons(RendererPolygon* polygons, int npolys)
                 *vptr++ = x | (y << 16);
                 *vptr++ = z | (w << 16);
 
-                *vptr++ =  (vtx->FinalColor[0] >> 1) |
-                          ((vtx->FinalColor[1] >> 1) << 8) |
-                          ((vtx->FinalColor[2] >> 1) << 16) |
+                *vptr++ =  (VertexRAM.FinalColor[vtx][0] >> 1) |
+                          ((VertexRAM.FinalColor[vtx][1] >> 1) << 8) |
+                          ((VertexRAM.FinalColor[vtx][2] >> 1) << 16) |
                           (alpha << 24);
 
-                *vptr++ = (u16)vtx->TexCoords[0] | ((u16)vtx->TexCoords[1] << 16);
+                *vptr++ = (u16)VertexRAM.TexCoords[vtx][0] | ((u16)VertexRAM.TexCoords[vtx][1] << 16);
 
                 *vptr++ = vtxattr | (zshift << 16);
                 *vptr++ = poly->TexParam;
@@ -615,7 +615,7 @@ void BuildPolygons(RendererPolygon* polygons, int npolys)
 
             for (int j = 0; j < poly->NumVertices; j++)
             {
-                Vertex* vtx = poly->Vertices[j];
+                u32 vtx = poly->Vertices[j];
 
                 u32 z = poly->FinalZ[j];
                 u32 w = poly->FinalW[j];
@@ -627,24 +627,24 @@ void BuildPolygons(RendererPolygon* polygons, int npolys)
                 u32 x, y;
                 if (ScaleFactor > 1)
                 {
-                    x = (vtx->HiresPosition[0] * ScaleFactor) >> 4;
-                    y = (vtx->HiresPosition[1] * ScaleFactor) >> 4;
+                    x = (VertexRAM.HiresPosition[vtx][0] * ScaleFactor) >> 4;
+                    y = (VertexRAM.HiresPosition[vtx][1] * ScaleFactor) >> 4;
                 }
                 else
                 {
-                    x = vtx->FinalPosition[0];
-                    y = vtx->FinalPosition[1];
+                    x = VertexRAM.FinalPosition[vtx][0];
+                    y = VertexRAM.FinalPosition[vtx][1];
                 }
 
                 *vptr++ = x | (y << 16);
                 *vptr++ = z | (w << 16);
 
-                *vptr++ =  (vtx->FinalColor[0] >> 1) |
-                          ((vtx->FinalColor[1] >> 1) << 8) |
-                          ((vtx->FinalColor[2] >> 1) << 16) |
+                *vptr++ =  (VertexRAM.FinalColor[vtx][0] >> 1) |
+                          ((VertexRAM.FinalColor[vtx][1] >> 1) << 8) |
+                          ((VertexRAM.FinalColor[vtx][2] >> 1) << 16) |
                           (alpha << 24);
 
-                *vptr++ = (u16)vtx->TexCoords[0] | ((u16)vtx->TexCoords[1] << 16);
+                *vptr++ = (u16)VertexRAM.TexCoords[vtx][0] | ((u16)VertexRAM.TexCoords[vtx][1] << 16);
 
                 *vptr++ = vtxattr | (zshift << 16);
                 *vptr++ = poly->TexParam;
@@ -22,6 +22,7 @@
 #include "GPU.h"
 #include "Config.h"
 #include "Platform.h"
+#include "Profiler.h"
 
 
 namespace GPU3D
@@ -1000,7 +1001,7 @@ void SetupPolygonLeftEdge(RendererPolygon* rp, s32 y)
 {
     Polygon* polygon = rp->PolyData;
 
-    while (y >= polygon->Vertices[rp->NextVL]->FinalPosition[1] && rp->CurVL != polygon->VBottom)
+    while (y >= VertexRAM.FinalPosition[polygon->Vertices[rp->NextVL]][1] && rp->CurVL != polygon->VBottom)
     {
         rp->CurVL = rp->NextVL;
 
@@ -1018,8 +1019,10 @@ void SetupPolygonLeftEdge(RendererPolygon* rp, s32 y)
         }
     }
 
-    rp->XL = rp->SlopeL.Setup(polygon->Vertices[rp->CurVL]->FinalPosition[0], polygon->Vertices[rp->NextVL]->FinalPosition[0],
-                              polygon->Vertices[rp->CurVL]->FinalPosition[1], polygon->Vertices[rp->NextVL]->FinalPosition[1],
+    s32* cur = VertexRAM.FinalPosition[polygon->Vertices[rp->CurVL]];
+    s32* next = VertexRAM.FinalPosition[polygon->Vertices[rp->NextVL]];
+
+    rp->XL = rp->SlopeL.Setup(cur[0], next[0], cur[1], next[1],
                               polygon->FinalW[rp->CurVL], polygon->FinalW[rp->NextVL], y);
 }
 
@@ -1027,7 +1030,7 @@ void SetupPolygonRightEdge(RendererPolygon* rp, s32 y)
 {
     Polygon* polygon = rp->PolyData;
 
-    while (y >= polygon->Vertices[rp->NextVR]->FinalPosition[1] && rp->CurVR != polygon->VBottom)
+    while (y >= VertexRAM.FinalPosition[polygon->Vertices[rp->NextVR]][1] && rp->CurVR != polygon->VBottom)
     {
         rp->CurVR = rp->NextVR;
 
@@ -1045,8 +1048,10 @@ void SetupPolygonRightEdge(RendererPolygon* rp, s32 y)
         }
     }
 
-    rp->XR = rp->SlopeR.Setup(polygon->Vertices[rp->CurVR]->FinalPosition[0], polygon->Vertices[rp->NextVR]->FinalPosition[0],
-                              polygon->Vertices[rp->CurVR]->FinalPosition[1], polygon->Vertices[rp->NextVR]->FinalPosition[1],
+    s32* cur = VertexRAM.FinalPosition[polygon->Vertices[rp->CurVR]];
+    s32* next = VertexRAM.FinalPosition[polygon->Vertices[rp->NextVR]];
+
+    rp->XR = rp->SlopeR.Setup(cur[0], next[0], cur[1], next[1],
                               polygon->FinalW[rp->CurVR], polygon->FinalW[rp->NextVR], y);
 }
 
@@ -1079,22 +1084,25 @@ void SetupPolygon(RendererPolygon* rp, Polygon* polygon)
 
     if (ybot == ytop)
     {
+        s32 (*pos)[2] = VertexRAM.FinalPosition;
+        u16* vtx = polygon->Vertices;
+
         vtop = 0; vbot = 0;
         int i;
 
         i = 1;
-        if (polygon->Vertices[i]->FinalPosition[0] < polygon->Vertices[vtop]->FinalPosition[0]) vtop = i;
-        if (polygon->Vertices[i]->FinalPosition[0] > polygon->Vertices[vbot]->FinalPosition[0]) vbot = i;
+        if (pos[vtx[i]][0] < pos[vtx[vtop]][0]) vtop = i;
+        if (pos[vtx[i]][0] > pos[vtx[vbot]][0]) vbot = i;
 
         i = nverts - 1;
-        if (polygon->Vertices[i]->FinalPosition[0] < polygon->Vertices[vtop]->FinalPosition[0]) vtop = i;
-        if (polygon->Vertices[i]->FinalPosition[0] > polygon->Vertices[vbot]->FinalPosition[0]) vbot = i;
+        if (pos[vtx[i]][0] < pos[vtx[vtop]][0]) vtop = i;
+        if (pos[vtx[i]][0] > pos[vtx[vbot]][0]) vbot = i;
 
         rp->CurVL = vtop; rp->NextVL = vtop;
         rp->CurVR = vbot; rp->NextVR = vbot;
 
-        rp->XL = rp->SlopeL.SetupDummy(polygon->Vertices[rp->CurVL]->FinalPosition[0]);
-        rp->XR = rp->SlopeR.SetupDummy(polygon->Vertices[rp->CurVR]->FinalPosition[0]);
+        rp->XL = rp->SlopeL.SetupDummy(pos[vtx[rp->CurVL]][0]);
+        rp->XR = rp->SlopeR.SetupDummy(pos[vtx[rp->CurVR]][0]);
     }
     else
     {
@@ -1128,18 +1136,18 @@ void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
 
     if (polygon->YTop != polygon->YBottom)
     {
-        if (y >= polygon->Vertices[rp->NextVL]->FinalPosition[1] && rp->CurVL != polygon->VBottom)
+        if (y >= VertexRAM.FinalPosition[polygon->Vertices[rp->NextVL]][1] && rp->CurVL != polygon->VBottom)
         {
             SetupPolygonLeftEdge(rp, y);
         }
 
-        if (y >= polygon->Vertices[rp->NextVR]->FinalPosition[1] && rp->CurVR != polygon->VBottom)
+        if (y >= VertexRAM.FinalPosition[polygon->Vertices[rp->NextVR]][1] && rp->CurVR != polygon->VBottom)
         {
             SetupPolygonRightEdge(rp, y);
         }
     }
 
-    Vertex *vlcur, *vlnext, *vrcur, *vrnext;
+    u32 vlcur, vlnext, vrcur, vrnext;
     s32 xstart, xend;
     bool l_filledge, r_filledge;
     s32 l_edgelen, r_edgelen;
@@ -1338,18 +1346,18 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
 
     if (polygon->YTop != polygon->YBottom)
     {
-        if (y >= polygon->Vertices[rp->NextVL]->FinalPosition[1] && rp->CurVL != polygon->VBottom)
+        if (y >= VertexRAM.FinalPosition[polygon->Vertices[rp->NextVL]][1] && rp->CurVL != polygon->VBottom)
         {
             SetupPolygonLeftEdge(rp, y);
         }
 
-        if (y >= polygon->Vertices[rp->NextVR]->FinalPosition[1] && rp->CurVR != polygon->VBottom)
+        if (y >= VertexRAM.FinalPosition[polygon->Vertices[rp->NextVR]][1] && rp->CurVR != polygon->VBottom)
         {
             SetupPolygonRightEdge(rp, y);
         }
     }
 
-    Vertex *vlcur, *vlnext, *vrcur, *vrnext;
+    u32 vlcur, vlnext, vrcur, vrnext;
     s32 xstart, xend;
     bool l_filledge, r_filledge;
     s32 l_edgelen, r_edgelen;
@@ -1426,19 +1434,19 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
 
     // interpolate attributes along Y
 
-    s32 rl = interp_start->Interpolate(vlcur->FinalColor[0], vlnext->FinalColor[0]);
-    s32 gl = interp_start->Interpolate(vlcur->FinalColor[1], vlnext->FinalColor[1]);
-    s32 bl = interp_start->Interpolate(vlcur->FinalColor[2], vlnext->FinalColor[2]);
+    s32 rl = interp_start->Interpolate(VertexRAM.FinalColor[vlcur][0], VertexRAM.FinalColor[vlnext][0]);
+    s32 gl = interp_start->Interpolate(VertexRAM.FinalColor[vlcur][1], VertexRAM.FinalColor[vlnext][1]);
+    s32 bl = interp_start->Interpolate(VertexRAM.FinalColor[vlcur][2], VertexRAM.FinalColor[vlnext][2]);
 
-    s32 sl = interp_start->Interpolate(vlcur->TexCoords[0], vlnext->TexCoords[0]);
-    s32 tl = interp_start->Interpolate(vlcur->TexCoords[1], vlnext->TexCoords[1]);
+    s32 sl = interp_start->Interpolate(VertexRAM.TexCoords[vlcur][0], VertexRAM.TexCoords[vlnext][0]);
+    s32 tl = interp_start->Interpolate(VertexRAM.TexCoords[vlcur][1], VertexRAM.TexCoords[vlnext][1]);
 
-    s32 rr = interp_end->Interpolate(vrcur->FinalColor[0], vrnext->FinalColor[0]);
-    s32 gr = interp_end->Interpolate(vrcur->FinalColor[1], vrnext->FinalColor[1]);
-    s32 br = interp_end->Interpolate(vrcur->FinalColor[2], vrnext->FinalColor[2]);
+    s32 rr = interp_end->Interpolate(VertexRAM.FinalColor[vrcur][0], VertexRAM.FinalColor[vrnext][0]);
+    s32 gr = interp_end->Interpolate(VertexRAM.FinalColor[vrcur][1], VertexRAM.FinalColor[vrnext][1]);
+    s32 br = interp_end->Interpolate(VertexRAM.FinalColor[vrcur][2], VertexRAM.FinalColor[vrnext][2]);
 
-    s32 sr = interp_end->Interpolate(vrcur->TexCoords[0], vrnext->TexCoords[0]);
-    s32 tr = interp_end->Interpolate(vrcur->TexCoords[1], vrnext->TexCoords[1]);
+    s32 sr = interp_end->Interpolate(VertexRAM.TexCoords[vrcur][0], VertexRAM.TexCoords[vrnext][0]);
+    s32 tr = interp_end->Interpolate(VertexRAM.TexCoords[vrcur][1], VertexRAM.TexCoords[vrnext][1]);
 
     // in wireframe mode, there are special rules for equal Z (TODO)
 
@@ -2048,6 +2056,8 @@ void ClearBuffers()
 
 void RenderPolygons(bool threaded, Polygon** polygons, int npolys)
 {
+    PROFILE_SCOPE(Prof_Raster);
+
     int j = 0;
     for (int i = 0; i < npolys; i++)
     {
@@ -18,9 +18,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
+#include <thread>
 #include "Config.h"
 #include "NDS.h"
 #include "ARM.h"
+#include "ARMJIT.h"
+#include "ARMIdleLoop.h"
 #include "NDSCart.h"
 #include "GBACart.h"
 #include "DMA.h"
@@ -32,6 +36,7 @@
 #include "Wifi.h"
 #include "AREngine.h"
 #include "Platform.h"
+#include "Profiler.h"
 
 
 namespace NDS
@@ -69,10 +74,78 @@ u32 NumFrames;
 u64 LastSysClockCycles;
 u64 FrameStartTimestamp;
 
-int CurCPU;
+thread_local int CurCPU;
 
 const s32 kMaxIterationCycles = 64;
 
+// ARM7 thread
+//
+// when enabled, the ARM7 runs each slice on a thread of its own while the ARM9
+// runs it on the emu thread, so they can get up to kMaxThreadLagCycles apart.
+// anything the other CPU or the scheduler can see (IO, IRQs, CPUStop, ...) is
+// only touched with the bus lock held. plain memory isn't locked, the other
+// CPU sees those writes whenever it gets to them
+const s32 kMaxThreadLagCycles = 256;
+
+bool ARM7Threaded;
+void* ARM7Thread;
+bool ARM7ThreadRunning;
+void* Sema_ARM7Start;
+
+// the emu thread bumps SliceReq to have the ARM7 run to SliceTarget,
+// the ARM7 thread sets SliceAck to the same value once done
+// a target of 0 sends it back to sleep until the next frame
+std::atomic<u32> ARM7SliceReq;
+std::atomic<u32> ARM7SliceAck;
+u64 ARM7SliceTarget;
+
+std::atomic_flag BusLockFlag = ATOMIC_FLAG_INIT;
+thread_local int BusLockDepth;
+
+// how long to busy-wait on the other thread before giving up the host CPU
+// no point in doing that when there's only one
+int SpinCount;
+
+u32 SliceStalls[2];
+u32 BusLockStalls[2];
+
+void SpinWait(int& spin)
+{
+    if (++spin >= SpinCount) std::this_thread::yield();
+}
+
+void LockBus()
+{
+    if (BusLockDepth++) return;
+
+    if (BusLockFlag.test_and_set(std::memory_order_acquire))
+    {
+        BusLockStalls[CurCPU]++;
+        int spin = 0;
+        while (BusLockFlag.test_and_set(std::memory_order_acquire))
+            SpinWait(spin);
+    }
+}
+
+void UnlockBus()
+{
+    if (--BusLockDepth) return;
+
+    BusLockFlag.clear(std::memory_order_release);
+}
+
+class BusLock
+{
+public:
+    BusLock()  { if (ARM7Threaded) LockBus(); }
+    ~BusLock() { if (ARM7Threaded) UnlockBus(); }
+};
+
+void InitIOMap();
+void SetupARM7Thread();
+void StopARM7Thread();
+void PrintThreadStats();
+
 u32 ARM9ClockShift;
 
 // no need to worry about those overflowing, they can keep going for atleast 4350 years
@@ -83,6 +156,12 @@ u64 SysTimestamp;
 SchedEvent SchedList[Event_MAX];
 u32 SchedListMask;
 
+// scheduled events, as a binary heap ordered by timestamp
+// SchedHeapPos tells where each of them currently sits in it
+u32 SchedHeap[Event_MAX];
+u32 SchedHeapPos[Event_MAX];
+u32 SchedHeapSize;
+
 u32 CPUStop;
 
 u8 ARM9BIOS[0x1000];
@@ -99,6 +178,9 @@ u32 SWRAM_ARM7Mask;
 
 u8 ARM7WRAM[0x10000];
 
+uintptr_t ARM9PageMap[0x100000];
+uintptr_t ARM7PageMap[0x100000];
+
 u16 ExMemCnt[2];
 
 // TODO: these belong in NDSCart!
@@ -151,7 +233,11 @@ bool RunningGame;
 
 void DivDone(u32 param);
 void SqrtDone(u32 param);
+void SchedHeapInsert(u32 id);
+void SchedHeapRemove(u32 id);
 void RunTimer(u32 tid, s32 cycles);
+void TimerOverflowEvent(u32 tid);
+void TimerReschedule(u32 tid);
 void SetWifiWaitCnt(u16 val);
 void SetGBASlotTimings();
 
@@ -173,6 +259,9 @@ bool Init()
     IPCFIFO9 = new FIFO<u32>(16);
     IPCFIFO7 = new FIFO<u32>(16);
 
+    // has to be set up before the subsystems add their registers
+    InitIOMap();
+
     if (!NDSCart::Init()) return false;
     if (!GBACart::Init()) return false;
     if (!GPU::Init()) return false;
@@ -183,6 +272,12 @@ bool Init()
 
     if (!AREngine::Init()) return false;
 
+    if (!ARMJIT::Init()) return false;
+
+    Sema_ARM7Start = Platform::Semaphore_Create();
+    ARM7ThreadRunning = false;
+    ARM7Threaded = false;
+
     return true;
 }
 
@@ -206,6 +301,11 @@ void DeInit()
     Wifi::DeInit();
 
     AREngine::DeInit();
+
+    ARMJIT::DeInit();
+
+    StopARM7Thread();
+    Platform::Semaphore_Free(Sema_ARM7Start);
 }
 
 
@@ -498,6 +598,13 @@ void Reset()
     DivCnt = 0;
     SqrtCnt = 0;
 
+    SetupARM7Thread();
+    ARMJIT::Reset();
+    ARMIdleLoop::Reset();
+#ifdef PROFILING
+    Profiler::Reset();
+#endif
+
     ARM9->Reset();
     ARM7->Reset();
 
@@ -514,6 +621,7 @@ void Reset()
 
     memset(SchedList, 0, sizeof(SchedList));
     SchedListMask = 0;
+    SchedHeapSize = 0;
 
     KeyInput = 0x007F03FF;
     KeyCnt = 0;
@@ -528,11 +636,18 @@ void Reset()
     Wifi::Reset();
 
     AREngine::Reset();
+
+    UpdatePageMap(0x00000000, 0x10000000);
+    UpdatePageMap(0xFFFF0000, 0xFFFFFFFF);
 }
 
 void Stop()
 {
     printf("Stopping: shutdown\n");
+    ARMIdleLoop::PrintStats();
+    GPU::PrintStats();
+    GPU3D::PrintStats();
+    PrintThreadStats();
     Running = false;
     Platform::StopEmu();
     GPU::Stop();
@@ -563,11 +678,13 @@ bool DoSavestate_Scheduler(Savestate* file)
         SPI::TransferDone,
         DivDone,
         SqrtDone,
+        TimerOverflowEvent,
 
         NULL
     };
 
-    int len = Event_MAX;
+    // timer events were added in 5.1
+    int len = file->IsAtleastVersion(5, 1) ? Event_MAX : Event_Timer0;
     if (file->Saving)
     {
         for (int i = 0; i < len; i++)
@@ -684,6 +801,19 @@ bool DoSavestate(Savestate* file)
 
     if (!DoSavestate_Scheduler(file)) return false;
     file->Var32(&SchedListMask);
+
+    if (!file->Saving)
+    {
+        SchedHeapSize = 0;
+        for (u32 i = 0; i < Event_MAX; i++)
+        {
+            if (SchedListMask & (1<<i))
+                SchedHeapInsert(i);
+        }
+
+        for (u32 i = 0; i < 8; i++)
+            TimerReschedule(i);
+    }
     file->Var64(&ARM9Timestamp);
     file->Var64(&ARM9Target);
     file->Var64(&ARM7Timestamp);
@@ -707,6 +837,9 @@ bool DoSavestate(Savestate* file)
         // but we do need to update the mappings
         MapSharedWRAM(WRAMCnt);
 
+        // memory contents changed under our feet
+        ARMJIT::InvalidateAll();
+
         InitTimings();
         SetGBASlotTimings();
 
@@ -732,6 +865,8 @@ bool DoSavestate(Savestate* file)
     if (!file->Saving)
     {
         GPU::SetPowerCnt(PowerControl9);
+
+        UpdatePageMap(0x00000000, 0x10000000);
     }
 
     return true;
@@ -780,43 +915,145 @@ void RelocateSave(const char* path, bool write)
 
 u64 NextTarget()
 {
-    u64 ret = SysTimestamp + kMaxIterationCycles;
+    u64 ret = SysTimestamp + (ARM7Threaded ? kMaxThreadLagCycles : kMaxIterationCycles);
+
+    if (SchedHeapSize && SchedList[SchedHeap[0]].Timestamp < ret)
+        ret = SchedList[SchedHeap[0]].Timestamp;
+
+    return ret;
+}
+
+void RunSystem(u64 timestamp)
+{
+    SysTimestamp = timestamp;
+
+    while (SchedHeapSize)
+    {
+        u32 id = SchedHeap[0];
+        SchedEvent* evt = &SchedList[id];
+        if (evt->Timestamp > SysTimestamp) break;
+
+        PROFILE_SCOPE(Prof_Events);
+
+        SchedHeapRemove(id);
+        SchedListMask &= ~(1<<id);
+        evt->Func(evt->Param);
+    }
+}
 
-    u32 mask = SchedListMask;
-    for (int i = 0; i < Event_MAX; i++)
+void RunARM7(u64 target)
+{
+    while (ARM7Timestamp < target)
     {
-        if (!mask) break;
-        if (mask & 0x1)
+        ARM7Target = target; // might be changed by a reschedule
+
+        if (CPUStop & 0x0FFF0000)
         {
-            if (SchedList[i].Timestamp < ret)
-                ret = SchedList[i].Timestamp;
+            DMAs[4]->Run();
+            DMAs[5]->Run();
+            DMAs[6]->Run();
+            DMAs[7]->Run();
         }
+        else
+        {
+            ARM7->Execute();
+        }
+    }
+}
+
+void StartARM7Slice(u64 target)
+{
+    ARM7SliceTarget = target;
+    ARM7SliceReq.store(ARM7SliceReq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
 
-        mask >>= 1;
+void WaitARM7Slice(bool count)
+{
+    u32 req = ARM7SliceReq.load(std::memory_order_relaxed);
+
+    if (ARM7SliceAck.load(std::memory_order_acquire) == req)
+    {
+        if (count) SliceStalls[1]++;
+        return;
     }
 
-    return ret;
+    if (count) SliceStalls[0]++;
+
+    int spin = 0;
+    while (ARM7SliceAck.load(std::memory_order_acquire) != req)
+        SpinWait(spin);
 }
 
-void RunSystem(u64 timestamp)
+void ARM7ThreadFunc()
 {
-    SysTimestamp = timestamp;
+    CurCPU = 1;
 
-    u32 mask = SchedListMask;
-    for (int i = 0; i < Event_MAX; i++)
+    for (;;)
     {
-        if (!mask) break;
-        if (mask & 0x1)
+        Platform::Semaphore_Wait(Sema_ARM7Start);
+        if (!ARM7ThreadRunning) break;
+
+        for (;;)
         {
-            if (SchedList[i].Timestamp <= SysTimestamp)
-            {
-                SchedListMask &= ~(1<<i);
-                SchedList[i].Func(SchedList[i].Param);
-            }
+            u32 ack = ARM7SliceAck.load(std::memory_order_relaxed);
+            u32 req;
+            int spin = 0;
+            while ((req = ARM7SliceReq.load(std::memory_order_acquire)) == ack)
+                SpinWait(spin);
+
+            u64 target = ARM7SliceTarget;
+            if (target) RunARM7(target);
+
+            ARM7SliceAck.store(req, std::memory_order_release);
+            if (!target) break;
         }
+    }
+}
+
+void StopARM7Thread()
+{
+    if (ARM7ThreadRunning)
+    {
+        ARM7ThreadRunning = false;
+        Platform::Semaphore_Post(Sema_ARM7Start);
+        Platform::Thread_Wait(ARM7Thread);
+        Platform::Thread_Free(ARM7Thread);
+    }
+}
+
+void SetupARM7Thread()
+{
+    ARM7Threaded = (Config::ThreadedARM7 != 0);
+
+    if (ARM7Threaded)
+    {
+        SpinCount = (std::thread::hardware_concurrency() > 1) ? 1000 : 0;
+
+        if (!ARM7ThreadRunning)
+        {
+            Platform::Semaphore_Reset(Sema_ARM7Start);
+            ARM7SliceReq = 0;
+            ARM7SliceAck = 0;
 
-        mask >>= 1;
+            ARM7ThreadRunning = true;
+            ARM7Thread = Platform::Thread_Create(ARM7ThreadFunc);
+        }
     }
+    else
+    {
+        StopARM7Thread();
+    }
+
+    memset(SliceStalls, 0, sizeof(SliceStalls));
+    memset(BusLockStalls, 0, sizeof(BusLockStalls));
+}
+
+void PrintThreadStats()
+{
+    if (!ARM7Threaded) return;
+
+    printf("ARM7 thread: ARM9 waited on %u slices, ARM7 waited on %u, bus lock contended %u/%u times\n",
+           SliceStalls[0], SliceStalls[1], BusLockStalls[0], BusLockStalls[1]);
 }
 
 u32 RunFrame()
@@ -828,6 +1065,9 @@ u32 RunFrame()
 
     GPU::StartFrame();
 
+    if (ARM7Threaded)
+        Platform::Semaphore_Post(Sema_ARM7Start);
+
     while (Running && GPU::TotalScanlines==0)
     {
         // TODO: give it some margin, so it can directly do 17 cycles instead of 16 then 1
@@ -835,6 +1075,9 @@ u32 RunFrame()
         ARM9Target = target << ARM9ClockShift;
         CurCPU = 0;
 
+        if (ARM7Threaded)
+            StartARM7Slice(target);
+
         if (CPUStop & 0x80000000)
         {
             // GXFIFO stall
@@ -854,30 +1097,16 @@ u32 RunFrame()
             ARM9->Execute();
         }
 
-        RunTimers(0);
+        if (ARM7Threaded)
+            WaitARM7Slice(true);
+
         GPU3D::Run();
 
         target = ARM9Timestamp >> ARM9ClockShift;
         CurCPU = 1;
 
-        while (ARM7Timestamp < target)
-        {
-            ARM7Target = target; // might be changed by a reschedule
-
-            if (CPUStop & 0x0FFF0000)
-            {
-                DMAs[4]->Run();
-                DMAs[5]->Run();
-                DMAs[6]->Run();
-                DMAs[7]->Run();
-            }
-            else
-            {
-                ARM7->Execute();
-            }
-
-            RunTimers(1);
-        }
+        // when threaded, this only has to catch up if the ARM9 went past the target
+        RunARM7(target);
 
         RunSystem(target);
 
@@ -890,6 +1119,12 @@ u32 RunFrame()
         }
     }
 
+    if (ARM7Threaded)
+    {
+        StartARM7Slice(0);
+        WaitARM7Slice(false);
+    }
+
 #ifdef DEBUG_CHECK_DESYNC
     printf("[%08X%08X] ARM9=%ld, ARM7=%ld, GPU=%ld\n",
            (u32)(SysTimestamp>>32), (u32)SysTimestamp,
@@ -898,6 +1133,10 @@ u32 RunFrame()
            GPU3D::Timestamp-SysTimestamp);
 #endif
 
+#ifdef PROFILING
+    Profiler::EndFrame();
+#endif
+
     NumFrames++;
 
     return GPU::TotalScanlines;
@@ -917,6 +1156,84 @@ void Reschedule(u64 target)
     }
 }
 
+bool SchedEventBefore(u32 a, u32 b)
+{
+    // events due at the same time run in ID order
+    if (SchedList[a].Timestamp != SchedList[b].Timestamp)
+        return SchedList[a].Timestamp < SchedList[b].Timestamp;
+    return a < b;
+}
+
+void SchedHeapSet(u32 pos, u32 id)
+{
+    SchedHeap[pos] = id;
+    SchedHeapPos[id] = pos;
+}
+
+void SchedHeapUp(u32 pos)
+{
+    u32 id = SchedHeap[pos];
+    while (pos > 0)
+    {
+        u32 parent = (pos - 1) >> 1;
+        if (!SchedEventBefore(id, SchedHeap[parent])) break;
+
+        SchedHeapSet(pos, SchedHeap[parent]);
+        pos = parent;
+    }
+    SchedHeapSet(pos, id);
+}
+
+void SchedHeapDown(u32 pos)
+{
+    u32 id = SchedHeap[pos];
+    for (;;)
+    {
+        u32 child = (pos << 1) + 1;
+        if (child >= SchedHeapSize) break;
+        if (child+1 < SchedHeapSize && SchedEventBefore(SchedHeap[child+1], SchedHeap[child]))
+            child++;
+        if (!SchedEventBefore(SchedHeap[child], id)) break;
+
+        SchedHeapSet(pos, SchedHeap[child]);
+        pos = child;
+    }
+    SchedHeapSet(pos, id);
+}
+
+void SchedHeapInsert(u32 id)
+{
+    SchedHeapSet(SchedHeapSize, id);
+    SchedHeapSize++;
+    SchedHeapUp(SchedHeapSize - 1);
+}
+
+void SchedHeapRemove(u32 id)
+{
+    u32 pos = SchedHeapPos[id];
+    SchedHeapSize--;
+    if (pos == SchedHeapSize) return;
+
+    u32 last = SchedHeap[SchedHeapSize];
+    SchedHeapSet(pos, last);
+    SchedHeapUp(pos);
+    SchedHeapDown(SchedHeapPos[last]);
+}
+
+void ScheduleEventAt(u32 id, u64 timestamp, void (*func)(u32), u32 param)
+{
+    SchedEvent* evt = &SchedList[id];
+
+    evt->Timestamp = timestamp;
+    evt->Func = func;
+    evt->Param = param;
+
+    SchedListMask |= (1<<id);
+    SchedHeapInsert(id);
+
+    Reschedule(evt->Timestamp);
+}
+
 void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 param)
 {
     if (SchedListMask & (1<<id))
@@ -925,29 +1242,26 @@ void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 para
         return;
     }
 
-    SchedEvent* evt = &SchedList[id];
-
+    u64 timestamp;
     if (periodic)
-        evt->Timestamp += delay;
+        timestamp = SchedList[id].Timestamp + delay;
     else
     {
         if (CurCPU == 0)
-            evt->Timestamp = (ARM9Timestamp >> ARM9ClockShift) + delay;
+            timestamp = (ARM9Timestamp >> ARM9ClockShift) + delay;
         else
-            evt->Timestamp = ARM7Timestamp + delay;
+            timestamp = ARM7Timestamp + delay;
     }
 
-    evt->Func = func;
-    evt->Param = param;
-
-    SchedListMask |= (1<<id);
-
-    Reschedule(evt->Timestamp);
+    ScheduleEventAt(id, timestamp, func, param);
 }
 
 void CancelEvent(u32 id)
 {
+    if (!(SchedListMask & (1<<id))) return;
+
     SchedListMask &= ~(1<<id);
+    SchedHeapRemove(id);
 }
 
 
@@ -1010,6 +1324,12 @@ void Halt()
 
 void MapSharedWRAM(u8 val)
 {
+    if ((val & 0x3) != (WRAMCnt & 0x3))
+    {
+        ARMJIT::InvalidateVirtualRange(0, 0x03000000, 0x04000000);
+        ARMJIT::InvalidateVirtualRange(1, 0x03000000, 0x03800000);
+    }
+
     WRAMCnt = val;
 
     switch (WRAMCnt & 0x3)
@@ -1042,6 +1362,97 @@ void MapSharedWRAM(u8 val)
         SWRAM_ARM7Mask = 0x7FFF;
         break;
     }
+
+    UpdatePageMap(0x03000000, 0x04000000);
+
+    // the CPUs might be running from there
+    // a threaded ARM7 can't have its CodeMem changed under it, it sets
+    // it up again on its next jump, and keeps fetching from the old
+    // mapping until then
+    ARM9->SetupCodeMem(ARM9->R[15]);
+    if (ARM7Threaded)
+        ARM7->CodeMemStale.store(true, std::memory_order_relaxed);
+    else
+        ARM7->SetupCodeMem(ARM7->R[15]);
+}
+
+uintptr_t MakePage(u8* mem, u32 offset, u32 flags)
+{
+    if (!mem) return 0;
+
+    // the flags are kept in the low bits
+    uintptr_t ptr = (uintptr_t)&mem[offset & ~0xFFF];
+    if (ptr & Page_FlagMask) return 0;
+
+    return ptr | flags;
+}
+
+uintptr_t ARM9Page(u32 addr)
+{
+    // when the JIT is on, writes to memory that may hold code need
+    // to go through the slow path so that blocks get invalidated
+    u32 ramflags = ARMJIT::Enabled ? Page_Read : (Page_Read | Page_Write | Page_Write8);
+
+    if ((addr & 0xFFFFF000) == 0xFFFF0000)
+        return MakePage(ARM9BIOS, 0, Page_Read);
+
+    switch (addr & 0xFF000000)
+    {
+    case 0x02000000:
+        return MakePage(MainRAM, addr & (MAIN_RAM_SIZE - 1), ramflags);
+
+    case 0x03000000:
+        return MakePage(SWRAM_ARM9, addr & SWRAM_ARM9Mask, ramflags);
+
+    case 0x06000000:
+        // byte writes to VRAM are ignored
+        return MakePage(GPU::GetARM9VRAMPage(addr), 0, Page_Read | Page_Write | Page_Track);
+    }
+
+    // palette and OAM are mirrored every 2K and depend on POWCNT,
+    // they stay on the slow path
+
+    return 0;
+}
+
+uintptr_t ARM7Page(u32 addr)
+{
+    u32 ramflags = ARMJIT::Enabled ? Page_Read : (Page_Read | Page_Write | Page_Write8);
+
+    // BIOS is protected depending on where the CPU is running from
+    switch (addr & 0xFF800000)
+    {
+    case 0x02000000:
+    case 0x02800000:
+        return MakePage(MainRAM, addr & (MAIN_RAM_SIZE - 1), ramflags);
+
+    case 0x03000000:
+        if (SWRAM_ARM7)
+            return MakePage(SWRAM_ARM7, addr & SWRAM_ARM7Mask, ramflags);
+        else
+            return MakePage(ARM7WRAM, addr & 0xFFFF, ramflags);
+
+    case 0x03800000:
+        return MakePage(ARM7WRAM, addr & 0xFFFF, ramflags);
+
+    case 0x06000000:
+    case 0x06800000:
+        return MakePage(GPU::GetARM7VRAMPage(addr), 0, Page_Read | Page_Write | Page_Write8 | Page_Track);
+    }
+
+    return 0;
+}
+
+void UpdatePageMap(u32 start, u32 end)
+{
+    u32 first = start >> 12;
+    u32 last = (end - 1) >> 12;
+
+    for (u32 p = first; p <= last; p++)
+    {
+        ARM9PageMap[p] = ARM9Page(p << 12);
+        ARM7PageMap[p] = ARM7Page(p << 12);
+    }
 }
 
 
@@ -1104,12 +1515,16 @@ void UpdateIRQ(u32 cpu)
 
 void SetIRQ(u32 cpu, u32 irq)
 {
+    BusLock lock;
+
     IF[cpu] |= (1 << irq);
     UpdateIRQ(cpu);
 }
 
 void ClearIRQ(u32 cpu, u32 irq)
 {
+    BusLock lock;
+
     IF[cpu] &= ~(1 << irq);
     UpdateIRQ(cpu);
 }
@@ -1130,6 +1545,8 @@ bool HaltInterrupted(u32 cpu)
 
 void StopCPU(u32 cpu, u32 mask)
 {
+    BusLock lock;
+
     if (cpu)
     {
         CPUStop |= (mask << 16);
@@ -1144,12 +1561,16 @@ void StopCPU(u32 cpu, u32 mask)
 
 void ResumeCPU(u32 cpu, u32 mask)
 {
+    BusLock lock;
+
     if (cpu) mask <<= 16;
     CPUStop &= ~mask;
 }
 
 void GXFIFOStall()
 {
+    BusLock lock;
+
     if (CPUStop & 0x80000000) return;
 
     CPUStop |= 0x80000000;
@@ -1166,11 +1587,15 @@ void GXFIFOStall()
 
 void GXFIFOUnstall()
 {
+    BusLock lock;
+
     CPUStop &= ~0x80000000;
 }
 
 void EnterSleepMode()
 {
+    BusLock lock;
+
     if (CPUStop & 0x40000000) return;
 
     CPUStop |= 0x40000000;
@@ -1348,28 +1773,36 @@ void RunTimer(u32 tid, s32 cycles)
 {
     Timer* timer = &Timers[tid];
 
-    u32 oldcount = timer->Counter;
-    timer->Counter += (cycles << timer->CycleShift);
-    if (timer->Counter < oldcount)
+    // done in 64-bit: with a reload of 0, one whole timer period adds exactly 2^32,
+    // which would leave a 32-bit counter right where it started
+    u64 count = (u64)timer->Counter + ((u64)(u32)cycles << timer->CycleShift);
+    u32 overflows = (u32)(count >> 32);
+
+    timer->Counter = (u32)count;
+    while (overflows--)
         HandleTimerOverflow(tid);
 }
 
 void RunTimers(u32 cpu)
 {
     register u32 timermask = TimerCheckMask[cpu];
-    s32 cycles;
+    u64 timestamp;
 
     if (cpu == 0)
-        cycles = (ARM9Timestamp >> ARM9ClockShift) - TimerTimestamp[0];
+        timestamp = ARM9Timestamp >> ARM9ClockShift;
     else
-        cycles = ARM7Timestamp - TimerTimestamp[1];
+        timestamp = ARM7Timestamp;
+
+    // running timers have overflow events, so this is never more than
+    // one timer period. when no timer runs this can be any length
+    s32 cycles = (s32)(timestamp - TimerTimestamp[cpu]);
 
     if (timermask & 0x1) RunTimer((cpu<<2)+0, cycles);
     if (timermask & 0x2) RunTimer((cpu<<2)+1, cycles);
     if (timermask & 0x4) RunTimer((cpu<<2)+2, cycles);
     if (timermask & 0x8) RunTimer((cpu<<2)+3, cycles);
 
-    TimerTimestamp[cpu] += cycles;
+    TimerTimestamp[cpu] = timestamp;
 }
 
 
@@ -1425,8 +1858,30 @@ u16 TimerGetCounter(u32 timer)
     return ret >> 16;
 }
 
+void TimerReschedule(u32 tid)
+{
+    Timer* timer = &Timers[tid];
+
+    CancelEvent(Event_Timer0 + tid);
+    if ((timer->Cnt & 0x84) != 0x80) return;
+
+    // counters are up to date as of TimerTimestamp
+    u32 cycles = ((0xFFFFFFFF - timer->Counter) >> timer->CycleShift) + 1;
+    ScheduleEventAt(Event_Timer0 + tid, TimerTimestamp[tid >> 2] + cycles, TimerOverflowEvent, tid);
+}
+
+void TimerOverflowEvent(u32 tid)
+{
+    // the overflow itself is dealt with when the counters catch up
+    RunTimers(tid >> 2);
+    TimerReschedule(tid);
+}
+
 void TimerStart(u32 id, u16 cnt)
 {
+    // catch up with the old settings first
+    RunTimers(id >> 2);
+
     Timer* timer = &Timers[id];
     u16 curstart = timer->Cnt & (1<<7);
     u16 newstart = cnt & (1<<7);
@@ -1459,6 +1914,8 @@ void TimerStart(u32 id, u16 cnt)
     }
     else
         TimerCheckMask[id>>2] &= ~(0x11 << (id&0x3));
+
+    TimerReschedule(id);
 }
 
 
@@ -1627,6 +2084,12 @@ void debug(u32 param)
 
 u8 ARM9Read8(u32 addr)
 {
+    uintptr_t page = ARM9PageMap[addr >> 12];
+    if (page & Page_Read)
+        return *(u8*)PagePtr(page, addr);
+
+    BusLock lock;
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u8*)&ARM9BIOS[addr & 0xFFF];
@@ -1692,6 +2155,12 @@ u8 ARM9Read8(u32 addr)
 
 u16 ARM9Read16(u32 addr)
 {
+    uintptr_t page = ARM9PageMap[addr >> 12];
+    if (page & Page_Read)
+        return *(u16*)PagePtr(page, addr);
+
+    BusLock lock;
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u16*)&ARM9BIOS[addr & 0xFFF];
@@ -1757,6 +2226,12 @@ u16 ARM9Read16(u32 addr)
 
 u32 ARM9Read32(u32 addr)
 {
+    uintptr_t page = ARM9PageMap[addr >> 12];
+    if (page & Page_Read)
+        return *(u32*)PagePtr(page, addr);
+
+    BusLock lock;
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u32*)&ARM9BIOS[addr & 0xFFF];
@@ -1822,16 +2297,29 @@ u32 ARM9Read32(u32 addr)
 
 void ARM9Write8(u32 addr, u8 val)
 {
+    uintptr_t page = ARM9PageMap[addr >> 12];
+    if (page & Page_Write8)
+    {
+        u8* ptr = PagePtr(page, addr);
+        *ptr = val;
+        if (page & Page_Track) GPU::MarkVRAMDirtyHost(ptr, sizeof(u8));
+        return;
+    }
+
+    BusLock lock;
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
         *(u8*)&MainRAM[addr & (MAIN_RAM_SIZE - 1)] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1)));
         return;
 
     case 0x03000000:
         if (SWRAM_ARM9)
         {
             *(u8*)&SWRAM_ARM9[addr & SWRAM_ARM9Mask] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_SWRAM + (SWRAM_ARM9 - SharedWRAM) + (addr & SWRAM_ARM9Mask));
         }
         return;
 
@@ -1872,16 +2360,29 @@ void ARM9Write8(u32 addr, u8 val)
 
 void ARM9Write16(u32 addr, u16 val)
 {
+    uintptr_t page = ARM9PageMap[addr >> 12];
+    if (page & Page_Write)
+    {
+        u8* ptr = PagePtr(page, addr);
+        *(u16*)ptr = val;
+        if (page & Page_Track) GPU::MarkVRAMDirtyHost(ptr, sizeof(u16));
+        return;
+    }
+
+    BusLock lock;
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
         *(u16*)&MainRAM[addr & (MAIN_RAM_SIZE - 1)] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1)));
         return;
 
     case 0x03000000:
         if (SWRAM_ARM9)
         {
             *(u16*)&SWRAM_ARM9[addr & SWRAM_ARM9Mask] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_SWRAM + (SWRAM_ARM9 - SharedWRAM) + (addr & SWRAM_ARM9Mask));
         }
         return;
 
@@ -1892,6 +2393,7 @@ void ARM9Write16(u32 addr, u16 val)
     case 0x05000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
         *(u16*)&GPU::Palette[addr & 0x7FF] = val;
+        GPU::MarkPaletteDirty(addr & 0x7FF);
         return;
 
     case 0x06000000:
@@ -1907,6 +2409,7 @@ void ARM9Write16(u32 addr, u16 val)
     case 0x07000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
         *(u16*)&GPU::OAM[addr & 0x7FF] = val;
+        GPU::MarkOAMDirty(addr & 0x7FF);
         return;
 
     case 0x08000000:
@@ -1938,16 +2441,29 @@ void ARM9Write16(u32 addr, u16 val)
 
 void ARM9Write32(u32 addr, u32 val)
 {
+    uintptr_t page = ARM9PageMap[addr >> 12];
+    if (page & Page_Write)
+    {
+        u8* ptr = PagePtr(page, addr);
+        *(u32*)ptr = val;
+        if (page & Page_Track) GPU::MarkVRAMDirtyHost(ptr, sizeof(u32));
+        return;
+    }
+
+    BusLock lock;
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
         *(u32*)&MainRAM[addr & (MAIN_RAM_SIZE - 1)] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1)));
         return ;
 
     case 0x03000000:
         if (SWRAM_ARM9)
         {
             *(u32*)&SWRAM_ARM9[addr & SWRAM_ARM9Mask] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_SWRAM + (SWRAM_ARM9 - SharedWRAM) + (addr & SWRAM_ARM9Mask));
         }
         return;
 
@@ -1958,6 +2474,7 @@ void ARM9Write32(u32 addr, u32 val)
     case 0x05000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
         *(u32*)&GPU::Palette[addr & 0x7FF] = val;
+        GPU::MarkPaletteDirty(addr & 0x7FF);
         return;
 
     case 0x06000000:
@@ -1973,6 +2490,7 @@ void ARM9Write32(u32 addr, u32 val)
     case 0x07000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
         *(u32*)&GPU::OAM[addr & 0x7FF] = val;
+        GPU::MarkOAMDirty(addr & 0x7FF);
         return;
 
     case 0x08000000:
@@ -2037,6 +2555,12 @@ bool ARM9GetMemRegion(u32 addr, bool write, MemRegion* region)
 
 u8 ARM7Read8(u32 addr)
 {
+    uintptr_t page = ARM7PageMap[addr >> 12];
+    if (page & Page_Read)
+        return *(u8*)PagePtr(page, addr);
+
+    BusLock lock;
+
     if (addr < 0x00004000)
     {
         if (ARM7->R[15] >= 0x4000)
@@ -2097,6 +2621,12 @@ u8 ARM7Read8(u32 addr)
 
 u16 ARM7Read16(u32 addr)
 {
+    uintptr_t page = ARM7PageMap[addr >> 12];
+    if (page & Page_Read)
+        return *(u16*)PagePtr(page, addr);
+
+    BusLock lock;
+
     if (addr < 0x00004000)
     {
         if (ARM7->R[15] >= 0x4000)
@@ -2164,6 +2694,12 @@ u16 ARM7Read16(u32 addr)
 
 u32 ARM7Read32(u32 addr)
 {
+    uintptr_t page = ARM7PageMap[addr >> 12];
+    if (page & Page_Read)
+        return *(u32*)PagePtr(page, addr);
+
+    BusLock lock;
+
     if (addr < 0x00004000)
     {
         if (ARM7->R[15] >= 0x4000)
@@ -2231,27 +2767,42 @@ u32 ARM7Read32(u32 addr)
 
 void ARM7Write8(u32 addr, u8 val)
 {
+    uintptr_t page = ARM7PageMap[addr >> 12];
+    if (page & Page_Write8)
+    {
+        u8* ptr = PagePtr(page, addr);
+        *ptr = val;
+        if (page & Page_Track) GPU::MarkVRAMDirtyHost(ptr, sizeof(u8));
+        return;
+    }
+
+    BusLock lock;
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
     case 0x02800000:
         *(u8*)&MainRAM[addr & (MAIN_RAM_SIZE - 1)] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1)));
         return;
 
     case 0x03000000:
         if (SWRAM_ARM7)
         {
             *(u8*)&SWRAM_ARM7[addr & SWRAM_ARM7Mask] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_SWRAM + (SWRAM_ARM7 - SharedWRAM) + (addr & SWRAM_ARM7Mask));
             return;
         }
         else
         {
             *(u8*)&ARM7WRAM[addr & 0xFFFF] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ARM7WRAM + (addr & 0xFFFF));
             return;
         }
 
     case 0x03800000:
         *(u8*)&ARM7WRAM[addr & 0xFFFF] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ARM7WRAM + (addr & 0xFFFF));
         return;
 
     case 0x04000000:
@@ -2290,27 +2841,42 @@ void ARM7Write8(u32 addr, u8 val)
 
 void ARM7Write16(u32 addr, u16 val)
 {
+    uintptr_t page = ARM7PageMap[addr >> 12];
+    if (page & Page_Write)
+    {
+        u8* ptr = PagePtr(page, addr);
+        *(u16*)ptr = val;
+        if (page & Page_Track) GPU::MarkVRAMDirtyHost(ptr, sizeof(u16));
+        return;
+    }
+
+    BusLock lock;
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
     case 0x02800000:
         *(u16*)&MainRAM[addr & (MAIN_RAM_SIZE - 1)] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1)));
         return;
 
     case 0x03000000:
         if (SWRAM_ARM7)
         {
             *(u16*)&SWRAM_ARM7[addr & SWRAM_ARM7Mask] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_SWRAM + (SWRAM_ARM7 - SharedWRAM) + (addr & SWRAM_ARM7Mask));
             return;
         }
         else
         {
             *(u16*)&ARM7WRAM[addr & 0xFFFF] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ARM7WRAM + (addr & 0xFFFF));
             return;
         }
 
     case 0x03800000:
         *(u16*)&ARM7WRAM[addr & 0xFFFF] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ARM7WRAM + (addr & 0xFFFF));
         return;
 
     case 0x04000000:
@@ -2359,27 +2925,42 @@ void ARM7Write16(u32 addr, u16 val)
 
 void ARM7Write32(u32 addr, u32 val)
 {
+    uintptr_t page = ARM7PageMap[addr >> 12];
+    if (page & Page_Write)
+    {
+        u8* ptr = PagePtr(page, addr);
+        *(u32*)ptr = val;
+        if (page & Page_Track) GPU::MarkVRAMDirtyHost(ptr, sizeof(u32));
+        return;
+    }
+
+    BusLock lock;
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
     case 0x02800000:
         *(u32*)&MainRAM[addr & (MAIN_RAM_SIZE - 1)] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_MainRAM + (addr & (MAIN_RAM_SIZE - 1)));
         return;
 
     case 0x03000000:
         if (SWRAM_ARM7)
         {
             *(u32*)&SWRAM_ARM7[addr & SWRAM_ARM7Mask] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_SWRAM + (SWRAM_ARM7 - SharedWRAM) + (addr & SWRAM_ARM7Mask));
             return;
         }
         else
         {
             *(u32*)&ARM7WRAM[addr & 0xFFFF] = val;
+            ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ARM7WRAM + (addr & 0xFFFF));
             return;
         }
 
     case 0x03800000:
         *(u32*)&ARM7WRAM[addr & 0xFFFF] = val;
+        ARMJIT::CheckAndInvalidate(ARMJIT::Canon_ARM7WRAM + (addr & 0xFFFF));
         return;
 
     case 0x04000000:
@@ -2439,18 +3020,24 @@ bool ARM7GetMemRegion(u32 addr, bool write, MemRegion* region)
         return true;
 
     case 0x03000000:
-        // note on this, and why we can only cover it in one particular case:
-        // it is typical for games to map all shared WRAM to the ARM7
-        // then access all the WRAM as one contiguous block starting at 0x037F8000
-        // this case needs a bit of a hack to cover
-        // it's not really worth bothering anyway
-        if (!SWRAM_ARM7)
-        {
-            region->Mem = ARM7WRAM;
-            region->Mask = 0xFFFF;
-            return true;
+        // games typically map all shared WRAM to the ARM7 and use it together
+        // with ARM7 WRAM as one contiguous block starting at 0x037F8000
+        // users of this have to watch out for the switch at 0x03800000
+        {
+            // a threaded ARM7 gets here while the ARM9 might be writing WRAMCNT
+            BusLock lock;
+            if (SWRAM_ARM7)
+            {
+                region->Mem = SWRAM_ARM7;
+                region->Mask = SWRAM_ARM7Mask;
+            }
+            else
+            {
+                region->Mem = ARM7WRAM;
+                region->Mask = 0xFFFF;
+            }
         }
-        break;
+        return true;
 
     case 0x03800000:
         region->Mem = ARM7WRAM;
@@ -2476,6 +3063,432 @@ bool ARM7GetMemRegion(u32 addr, bool write, MemRegion* region)
 
 
 
+// IO registers go through per-CPU tables with one entry per 32-bit word,
+// pointing to the handlers that own it. the tables cover 0x04000000-0x04001FFF,
+// followed by 0x04100000-0x0410001F (IPC FIFO and cart data ports)
+// everything that isn't claimed goes to the system registers, see ARM9SysIORead8() etc
+
+const u32 kIOMapSize = 0x800 + 0x8;
+const int kMaxIOHandlers = 64;
+
+u8 IOMap[2][kIOMapSize];
+IOHandlers IOHandlerList[kMaxIOHandlers];
+int NumIOHandlers;
+
+u8 ARM9SysIORead8(u32 addr);
+u16 ARM9SysIORead16(u32 addr);
+u32 ARM9SysIORead32(u32 addr);
+void ARM9SysIOWrite8(u32 addr, u8 val);
+void ARM9SysIOWrite16(u32 addr, u16 val);
+void ARM9SysIOWrite32(u32 addr, u32 val);
+
+u8 ARM7SysIORead8(u32 addr);
+u16 ARM7SysIORead16(u32 addr);
+u32 ARM7SysIORead32(u32 addr);
+void ARM7SysIOWrite8(u32 addr, u8 val);
+void ARM7SysIOWrite16(u32 addr, u16 val);
+void ARM7SysIOWrite32(u32 addr, u32 val);
+
+inline int IOMapSlot(u32 addr)
+{
+    if ((addr & 0xFFFFE000) == 0x04000000) return (addr & 0x1FFC) >> 2;
+    if ((addr & 0xFFFFFFE0) == 0x04100000) return 0x800 + ((addr & 0x1C) >> 2);
+    return -1;
+}
+
+void RegisterIO(u32 cpu, u32 start, u32 end, const IOHandlers* handlers)
+{
+    // the system handlers for each CPU are the first two entries
+    IOHandlers h = *handlers;
+    IOHandlers& sys = IOHandlerList[cpu];
+    if (!h.Read8)   h.Read8   = sys.Read8;
+    if (!h.Read16)  h.Read16  = sys.Read16;
+    if (!h.Read32)  h.Read32  = sys.Read32;
+    if (!h.Write8)  h.Write8  = sys.Write8;
+    if (!h.Write16) h.Write16 = sys.Write16;
+    if (!h.Write32) h.Write32 = sys.Write32;
+
+    int id = -1;
+    for (int i = 0; i < NumIOHandlers; i++)
+    {
+        if (!memcmp(&IOHandlerList[i], &h, sizeof(IOHandlers)))
+        {
+            id = i;
+            break;
+        }
+    }
+    if (id == -1)
+    {
+        if (NumIOHandlers >= kMaxIOHandlers)
+        {
+            printf("!! too many IO handlers, can't map %08X-%08X\n", start, end);
+            return;
+        }
+
+        id = NumIOHandlers++;
+        IOHandlerList[id] = h;
+    }
+
+    for (u32 addr = start & ~3; addr < end; addr += 4)
+    {
+        int slot = IOMapSlot(addr);
+        if (slot < 0)
+        {
+            printf("!! IO register %08X is out of the IO map\n", addr);
+            continue;
+        }
+
+        IOMap[cpu][slot] = id;
+    }
+}
+
+
+template<u32 cpu>
+u16 TimerIORead16(u32 addr)
+{
+    u32 id = (cpu << 2) + ((addr >> 2) & 0x3);
+    if (addr & 0x2) return Timers[id].Cnt;
+    return TimerGetCounter(id);
+}
+
+template<u32 cpu>
+u32 TimerIORead32(u32 addr)
+{
+    u32 id = (cpu << 2) + ((addr >> 2) & 0x3);
+    return TimerGetCounter(id) | (Timers[id].Cnt << 16);
+}
+
+template<u32 cpu>
+void TimerIOWrite16(u32 addr, u16 val)
+{
+    u32 id = (cpu << 2) + ((addr >> 2) & 0x3);
+    if (addr & 0x2) TimerStart(id, val);
+    else            Timers[id].Reload = val;
+}
+
+template<u32 cpu>
+void TimerIOWrite32(u32 addr, u32 val)
+{
+    u32 id = (cpu << 2) + ((addr >> 2) & 0x3);
+    Timers[id].Reload = val & 0xFFFF;
+    TimerStart(id, val>>16);
+}
+
+// each channel has SAD, DAD and CNT, 12 bytes apart
+template<u32 cpu>
+u16 DMACntIORead16(u32 addr)
+{
+    DMA* dma = DMAs[(cpu << 2) + (addr - 0x040000B8) / 12];
+    if (addr & 0x2) return dma->Cnt >> 16;
+    return dma->Cnt & 0xFFFF;
+}
+
+template<u32 cpu>
+u32 DMAIORead32(u32 addr)
+{
+    u32 offset = addr - 0x040000B0;
+    DMA* dma = DMAs[(cpu << 2) + offset / 12];
+    switch (offset % 12)
+    {
+    case 0: return dma->SrcAddr;
+    case 4: return dma->DstAddr;
+    default: return dma->Cnt;
+    }
+}
+
+template<u32 cpu>
+void DMACntIOWrite16(u32 addr, u16 val)
+{
+    DMA* dma = DMAs[(cpu << 2) + (addr - 0x040000B8) / 12];
+    if (addr & 0x2) dma->WriteCnt((dma->Cnt & 0x0000FFFF) | (val << 16));
+    else            dma->WriteCnt((dma->Cnt & 0xFFFF0000) | val);
+}
+
+template<u32 cpu>
+void DMAIOWrite32(u32 addr, u32 val)
+{
+    u32 offset = addr - 0x040000B0;
+    DMA* dma = DMAs[(cpu << 2) + offset / 12];
+    switch (offset % 12)
+    {
+    case 0: dma->SrcAddr = val; return;
+    case 4: dma->DstAddr = val; return;
+    default: dma->WriteCnt(val); return;
+    }
+}
+
+u16 DMAFillIORead16(u32 addr)
+{
+    return ((u16*)DMA9Fill)[(addr >> 1) & 0x7];
+}
+
+u32 DMAFillIORead32(u32 addr)
+{
+    return DMA9Fill[(addr >> 2) & 0x3];
+}
+
+void DMAFillIOWrite16(u32 addr, u16 val)
+{
+    ((u16*)DMA9Fill)[(addr >> 1) & 0x7] = val;
+}
+
+void DMAFillIOWrite32(u32 addr, u32 val)
+{
+    DMA9Fill[(addr >> 2) & 0x3] = val;
+}
+
+// IPC registers, seen from the given CPU
+template<u32 cpu>
+u16 IPCSyncIORead16(u32 addr)
+{
+    if (addr & 0x2) return 0;
+    return cpu ? IPCSync7 : IPCSync9;
+}
+
+template<u32 cpu>
+u32 IPCSyncIORead32(u32)
+{
+    return cpu ? IPCSync7 : IPCSync9;
+}
+
+template<u32 cpu>
+void IPCSyncIOWrite16(u32 addr, u16 val)
+{
+    if (addr & 0x2) return;
+
+    u16& local = cpu ? IPCSync7 : IPCSync9;
+    u16& remote = cpu ? IPCSync9 : IPCSync7;
+
+    remote &= 0xFFF0;
+    remote |= ((val & 0x0F00) >> 8);
+    local &= 0xB0FF;
+    local |= (val & 0x4F00);
+    if ((val & 0x2000) && (remote & 0x4000))
+    {
+        SetIRQ(cpu^1, IRQ_IPCSync);
+    }
+}
+
+template<u32 cpu>
+void IPCSyncIOWrite32(u32 addr, u32 val)
+{
+    IPCSyncIOWrite16<cpu>(addr, val & 0xFFFF);
+}
+
+template<u32 cpu>
+u16 IPCFIFOCntIORead16(u32 addr)
+{
+    if (addr & 0x2) return 0;
+
+    FIFO<u32>* send = cpu ? IPCFIFO7 : IPCFIFO9;
+    FIFO<u32>* recv = cpu ? IPCFIFO9 : IPCFIFO7;
+
+    u16 val = cpu ? IPCFIFOCnt7 : IPCFIFOCnt9;
+    if (send->IsEmpty())     val |= 0x0001;
+    else if (send->IsFull()) val |= 0x0002;
+    if (recv->IsEmpty())     val |= 0x0100;
+    else if (recv->IsFull()) val |= 0x0200;
+    return val;
+}
+
+template<u32 cpu>
+void IPCFIFOCntIOWrite16(u32 addr, u16 val)
+{
+    if (addr & 0x2) return;
+
+    FIFO<u32>* send = cpu ? IPCFIFO7 : IPCFIFO9;
+    FIFO<u32>* recv = cpu ? IPCFIFO9 : IPCFIFO7;
+    u16& cnt = cpu ? IPCFIFOCnt7 : IPCFIFOCnt9;
+
+    if (val & 0x0008)
+        send->Clear();
+    if ((val & 0x0004) && (!(cnt & 0x0004)) && send->IsEmpty())
+        SetIRQ(cpu, IRQ_IPCSendDone);
+    if ((val & 0x0400) && (!(cnt & 0x0400)) && (!recv->IsEmpty()))
+        SetIRQ(cpu, IRQ_IPCRecv);
+    if (val & 0x4000)
+        cnt &= ~0x4000;
+    cnt = val & 0x8404;
+}
+
+template<u32 cpu>
+void IPCFIFOSendIOWrite32(u32, u32 val)
+{
+    FIFO<u32>* send = cpu ? IPCFIFO7 : IPCFIFO9;
+    u16& cnt = cpu ? IPCFIFOCnt7 : IPCFIFOCnt9;
+    u16 remotecnt = cpu ? IPCFIFOCnt9 : IPCFIFOCnt7;
+
+    if (cnt & 0x8000)
+    {
+        if (send->IsFull())
+            cnt |= 0x4000;
+        else
+        {
+            bool wasempty = send->IsEmpty();
+            send->Write(val);
+            if ((remotecnt & 0x0400) && wasempty)
+                SetIRQ(cpu^1, IRQ_IPCRecv);
+        }
+    }
+}
+
+template<u32 cpu>
+u32 IPCFIFORecvIORead32(u32)
+{
+    FIFO<u32>* recv = cpu ? IPCFIFO9 : IPCFIFO7;
+    u16& cnt = cpu ? IPCFIFOCnt7 : IPCFIFOCnt9;
+    u16 remotecnt = cpu ? IPCFIFOCnt9 : IPCFIFOCnt7;
+
+    if (cnt & 0x8000)
+    {
+        u32 ret;
+        if (recv->IsEmpty())
+        {
+            cnt |= 0x4000;
+            ret = recv->Peek();
+        }
+        else
+        {
+            ret = recv->Read();
+
+            if (recv->IsEmpty() && (remotecnt & 0x0004))
+                SetIRQ(cpu^1, IRQ_IPCSendDone);
+        }
+        return ret;
+    }
+    else
+        return recv->Peek();
+}
+
+template<u32 cpu>
+void RegisterSysIO()
+{
+    IOHandlers timers = {NULL, TimerIORead16<cpu>, TimerIORead32<cpu>, NULL, TimerIOWrite16<cpu>, TimerIOWrite32<cpu>};
+    RegisterIO(cpu, 0x04000100, 0x04000110, &timers);
+
+    IOHandlers dmaaddr = {NULL, NULL, DMAIORead32<cpu>, NULL, NULL, DMAIOWrite32<cpu>};
+    IOHandlers dmacnt = {NULL, DMACntIORead16<cpu>, DMAIORead32<cpu>, NULL, DMACntIOWrite16<cpu>, DMAIOWrite32<cpu>};
+    for (u32 i = 0; i < 4; i++)
+    {
+        u32 base = 0x040000B0 + (i * 12);
+        RegisterIO(cpu, base, base+8, &dmaaddr);
+        RegisterIO(cpu, base+8, base+12, &dmacnt);
+    }
+
+    IOHandlers ipcsync = {NULL, IPCSyncIORead16<cpu>, IPCSyncIORead32<cpu>, NULL, IPCSyncIOWrite16<cpu>, IPCSyncIOWrite32<cpu>};
+    IOHandlers ipcfifocnt = {NULL, IPCFIFOCntIORead16<cpu>, NULL, NULL, IPCFIFOCntIOWrite16<cpu>, NULL};
+    IOHandlers ipcsend = {NULL, NULL, NULL, NULL, NULL, IPCFIFOSendIOWrite32<cpu>};
+    IOHandlers ipcrecv = {NULL, NULL, IPCFIFORecvIORead32<cpu>, NULL, NULL, NULL};
+    RegisterIO(cpu, 0x04000180, 0x04000184, &ipcsync);
+    RegisterIO(cpu, 0x04000184, 0x04000188, &ipcfifocnt);
+    RegisterIO(cpu, 0x04000188, 0x0400018C, &ipcsend);
+    RegisterIO(cpu, 0x04100000, 0x04100004, &ipcrecv);
+}
+
+void InitIOMap()
+{
+    IOHandlers sys9 = {ARM9SysIORead8, ARM9SysIORead16, ARM9SysIORead32, ARM9SysIOWrite8, ARM9SysIOWrite16, ARM9SysIOWrite32};
+    IOHandlers sys7 = {ARM7SysIORead8, ARM7SysIORead16, ARM7SysIORead32, ARM7SysIOWrite8, ARM7SysIOWrite16, ARM7SysIOWrite32};
+    IOHandlerList[0] = sys9;
+    IOHandlerList[1] = sys7;
+    NumIOHandlers = 2;
+
+    memset(IOMap[0], 0, kIOMapSize);
+    memset(IOMap[1], 1, kIOMapSize);
+
+    RegisterSysIO<0>();
+    RegisterSysIO<1>();
+
+    IOHandlers dmafill = {NULL, DMAFillIORead16, DMAFillIORead32, NULL, DMAFillIOWrite16, DMAFillIOWrite32};
+    RegisterIO(0, 0x040000E0, 0x040000F0, &dmafill);
+}
+
+
+u8 ARM9IORead8(u32 addr)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) return ARM9SysIORead8(addr);
+    return IOHandlerList[IOMap[0][slot]].Read8(addr);
+}
+
+u16 ARM9IORead16(u32 addr)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) return ARM9SysIORead16(addr);
+    return IOHandlerList[IOMap[0][slot]].Read16(addr);
+}
+
+u32 ARM9IORead32(u32 addr)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) return ARM9SysIORead32(addr);
+    return IOHandlerList[IOMap[0][slot]].Read32(addr);
+}
+
+void ARM9IOWrite8(u32 addr, u8 val)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) ARM9SysIOWrite8(addr, val);
+    else          IOHandlerList[IOMap[0][slot]].Write8(addr, val);
+}
+
+void ARM9IOWrite16(u32 addr, u16 val)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) ARM9SysIOWrite16(addr, val);
+    else          IOHandlerList[IOMap[0][slot]].Write16(addr, val);
+}
+
+void ARM9IOWrite32(u32 addr, u32 val)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) ARM9SysIOWrite32(addr, val);
+    else          IOHandlerList[IOMap[0][slot]].Write32(addr, val);
+}
+
+u8 ARM7IORead8(u32 addr)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) return ARM7SysIORead8(addr);
+    return IOHandlerList[IOMap[1][slot]].Read8(addr);
+}
+
+u16 ARM7IORead16(u32 addr)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) return ARM7SysIORead16(addr);
+    return IOHandlerList[IOMap[1][slot]].Read16(addr);
+}
+
+u32 ARM7IORead32(u32 addr)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) return ARM7SysIORead32(addr);
+    return IOHandlerList[IOMap[1][slot]].Read32(addr);
+}
+
+void ARM7IOWrite8(u32 addr, u8 val)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) ARM7SysIOWrite8(addr, val);
+    else          IOHandlerList[IOMap[1][slot]].Write8(addr, val);
+}
+
+void ARM7IOWrite16(u32 addr, u16 val)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) ARM7SysIOWrite16(addr, val);
+    else          IOHandlerList[IOMap[1][slot]].Write16(addr, val);
+}
+
+void ARM7IOWrite32(u32 addr, u32 val)
+{
+    int slot = IOMapSlot(addr);
+    if (slot < 0) ARM7SysIOWrite32(addr, val);
+    else          IOHandlerList[IOMap[1][slot]].Write32(addr, val);
+}
+
+
 #define CASE_READ8_16BIT(addr, val) \
     case (addr): return (val) & 0xFF; \
     case (addr+1): return (val) >> 8;
@@ -2486,7 +3499,7 @@ bool ARM7GetMemRegion(u32 addr, bool write, MemRegion* region)
     case (addr+2): return ((val) >> 16) & 0xFF; \
     case (addr+3): return (val) >> 24;
 
-u8 ARM9IORead8(u32 addr)
+u8 ARM9SysIORead8(u32 addr)
 {
     switch (addr)
     {
@@ -2537,75 +3550,17 @@ u8 ARM9IORead8(u32 addr)
     case 0x04000300: return PostFlag9;
     }
 
-    if (addr >= 0x04000000 && addr < 0x04000060)
-    {
-        return GPU::GPU2D_A->Read8(addr);
-    }
-    if (addr >= 0x04001000 && addr < 0x04001060)
-    {
-        return GPU::GPU2D_B->Read8(addr);
-    }
-    if (addr >= 0x04000320 && addr < 0x040006A4)
-    {
-        return GPU3D::Read8(addr);
-    }
-
     printf("unknown ARM9 IO read8 %08X %08X\n", addr, ARM9->R[15]);
     return 0;
 }
 
-u16 ARM9IORead16(u32 addr)
+u16 ARM9SysIORead16(u32 addr)
 {
     switch (addr)
     {
-    case 0x04000004: return GPU::DispStat[0];
-    case 0x04000006: return GPU::VCount;
-
-    case 0x04000060: return GPU3D::Read16(addr);
-    case 0x04000064:
-    case 0x04000066: return GPU::GPU2D_A->Read16(addr);
-
-    case 0x040000B8: return DMAs[0]->Cnt & 0xFFFF;
-    case 0x040000BA: return DMAs[0]->Cnt >> 16;
-    case 0x040000C4: return DMAs[1]->Cnt & 0xFFFF;
-    case 0x040000C6: return DMAs[1]->Cnt >> 16;
-    case 0x040000D0: return DMAs[2]->Cnt & 0xFFFF;
-    case 0x040000D2: return DMAs[2]->Cnt >> 16;
-    case 0x040000DC: return DMAs[3]->Cnt & 0xFFFF;
-    case 0x040000DE: return DMAs[3]->Cnt >> 16;
-
-    case 0x040000E0: return ((u16*)DMA9Fill)[0];
-    case 0x040000E2: return ((u16*)DMA9Fill)[1];
-    case 0x040000E4: return ((u16*)DMA9Fill)[2];
-    case 0x040000E6: return ((u16*)DMA9Fill)[3];
-    case 0x040000E8: return ((u16*)DMA9Fill)[4];
-    case 0x040000EA: return ((u16*)DMA9Fill)[5];
-    case 0x040000EC: return ((u16*)DMA9Fill)[6];
-    case 0x040000EE: return ((u16*)DMA9Fill)[7];
-
-    case 0x04000100: return TimerGetCounter(0);
-    case 0x04000102: return Timers[0].Cnt;
-    case 0x04000104: return TimerGetCounter(1);
-    case 0x04000106: return Timers[1].Cnt;
-    case 0x04000108: return TimerGetCounter(2);
-    case 0x0400010A: return Timers[2].Cnt;
-    case 0x0400010C: return TimerGetCounter(3);
-    case 0x0400010E: return Timers[3].Cnt;
-
     case 0x04000130: return KeyInput & 0xFFFF;
     case 0x04000132: return KeyCnt;
 
-    case 0x04000180: return IPCSync9;
-    case 0x04000184:
-        {
-            u16 val = IPCFIFOCnt9;
-            if (IPCFIFO9->IsEmpty())     val |= 0x0001;
-            else if (IPCFIFO9->IsFull()) val |= 0x0002;
-            if (IPCFIFO7->IsEmpty())     val |= 0x0100;
-            else if (IPCFIFO7->IsFull()) val |= 0x0200;
-            return val;
-        }
-
     case 0x040001A0: return NDSCart::SPICnt;
     case 0x040001A2: return NDSCart::ReadSPIData();
 
@@ -2659,61 +3614,18 @@ u16 ARM9IORead16(u32 addr)
     case 0x04000304: return PowerControl9;
     }
 
-    if ((addr >= 0x04000000 && addr < 0x04000060) || (addr == 0x0400006C))
-    {
-        return GPU::GPU2D_A->Read16(addr);
-    }
-    if ((addr >= 0x04001000 && addr < 0x04001060) || (addr == 0x0400106C))
-    {
-        return GPU::GPU2D_B->Read16(addr);
-    }
-    if (addr >= 0x04000320 && addr < 0x040006A4)
-    {
-        return GPU3D::Read16(addr);
-    }
-
     printf("unknown ARM9 IO read16 %08X %08X\n", addr, ARM9->R[15]);
     return 0;
 }
 
-u32 ARM9IORead32(u32 addr)
+u32 ARM9SysIORead32(u32 addr)
 {
     switch (addr)
     {
-    case 0x04000004: return GPU::DispStat[0] | (GPU::VCount << 16);
-
-    case 0x04000060: return GPU3D::Read32(addr);
-    case 0x04000064: return GPU::GPU2D_A->Read32(addr);
-
-    case 0x040000B0: return DMAs[0]->SrcAddr;
-    case 0x040000B4: return DMAs[0]->DstAddr;
-    case 0x040000B8: return DMAs[0]->Cnt;
-    case 0x040000BC: return DMAs[1]->SrcAddr;
-    case 0x040000C0: return DMAs[1]->DstAddr;
-    case 0x040000C4: return DMAs[1]->Cnt;
-    case 0x040000C8: return DMAs[2]->SrcAddr;
-    case 0x040000CC: return DMAs[2]->DstAddr;
-    case 0x040000D0: return DMAs[2]->Cnt;
-    case 0x040000D4: return DMAs[3]->SrcAddr;
-    case 0x040000D8: return DMAs[3]->DstAddr;
-    case 0x040000DC: return DMAs[3]->Cnt;
-
-    case 0x040000E0: return DMA9Fill[0];
-    case 0x040000E4: return DMA9Fill[1];
-    case 0x040000E8: return DMA9Fill[2];
-    case 0x040000EC: return DMA9Fill[3];
-
     case 0x040000F4: return 0; // ???? Golden Sun Dark Dawn keeps reading this
 
-    case 0x04000100: return TimerGetCounter(0) | (Timers[0].Cnt << 16);
-    case 0x04000104: return TimerGetCounter(1) | (Timers[1].Cnt << 16);
-    case 0x04000108: return TimerGetCounter(2) | (Timers[2].Cnt << 16);
-    case 0x0400010C: return TimerGetCounter(3) | (Timers[3].Cnt << 16);
-
     case 0x04000130: return (KeyInput & 0xFFFF) | (KeyCnt << 16);
 
-    case 0x04000180: return IPCSync9;
-
     case 0x040001A0: return NDSCart::SPICnt | (NDSCart::ReadSPIData() << 16);
     case 0x040001A4: return NDSCart::ROMCnt;
 
@@ -2752,58 +3664,19 @@ u32 ARM9IORead32(u32 addr)
     case 0x04000300: return PostFlag9;
     case 0x04000304: return PowerControl9;
 
-    case 0x04100000:
-        if (IPCFIFOCnt9 & 0x8000)
-        {
-            u32 ret;
-            if (IPCFIFO7->IsEmpty())
-            {
-                IPCFIFOCnt9 |= 0x4000;
-                ret = IPCFIFO7->Peek();
-            }
-            else
-            {
-                ret = IPCFIFO7->Read();
-
-                if (IPCFIFO7->IsEmpty() && (IPCFIFOCnt7 & 0x0004))
-                    SetIRQ(1, IRQ_IPCSendDone);
-            }
-            return ret;
-        }
-        else
-            return IPCFIFO7->Peek();
-
     case 0x04100010:
         if (!(ExMemCnt[0] & (1<<11))) return NDSCart::ReadROMData();
         return 0;
     }
 
-    if ((addr >= 0x04000000 && addr < 0x04000060) || (addr == 0x0400006C))
-    {
-        return GPU::GPU2D_A->Read32(addr);
-    }
-    if ((addr >= 0x04001000 && addr < 0x04001060) || (addr == 0x0400106C))
-    {
-        return GPU::GPU2D_B->Read32(addr);
-    }
-    if (addr >= 0x04000320 && addr < 0x040006A4)
-    {
-        return GPU3D::Read32(addr);
-    }
-
     printf("unknown ARM9 IO read32 %08X %08X\n", addr, ARM9->R[15]);
     return 0;
 }
 
-void ARM9IOWrite8(u32 addr, u8 val)
+void ARM9SysIOWrite8(u32 addr, u8 val)
 {
     switch (addr)
     {
-    case 0x0400006C:
-    case 0x0400006D: GPU::GPU2D_A->Write8(addr, val); return;
-    case 0x0400106C:
-    case 0x0400106D: GPU::GPU2D_B->Write8(addr, val); return;
-
     case 0x04000132:
         KeyCnt = (KeyCnt & 0xFF00) | val;
         return;
@@ -2855,94 +3728,17 @@ void ARM9IOWrite8(u32 addr, u8 val)
         return;
     }
 
-    if (addr >= 0x04000000 && addr < 0x04000060)
-    {
-        GPU::GPU2D_A->Write8(addr, val);
-        return;
-    }
-    if (addr >= 0x04001000 && addr < 0x04001060)
-    {
-        GPU::GPU2D_B->Write8(addr, val);
-        return;
-    }
-    if (addr >= 0x04000320 && addr < 0x040006A4)
-    {
-        GPU3D::Write8(addr, val);
-        return;
-    }
-
     printf("unknown ARM9 IO write8 %08X %02X %08X\n", addr, val, ARM9->R[15]);
 }
 
-void ARM9IOWrite16(u32 addr, u16 val)
+void ARM9SysIOWrite16(u32 addr, u16 val)
 {
     switch (addr)
     {
-    case 0x04000004: GPU::SetDispStat(0, val); return;
-    case 0x04000006: GPU::SetVCount(val); return;
-
-    case 0x04000060: GPU3D::Write16(addr, val); return;
-
-    case 0x04000068:
-    case 0x0400006A: GPU::GPU2D_A->Write16(addr, val); return;
-
-    case 0x0400006C: GPU::GPU2D_A->Write16(addr, val); return;
-    case 0x0400106C: GPU::GPU2D_B->Write16(addr, val); return;
-
-    case 0x040000B8: DMAs[0]->WriteCnt((DMAs[0]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000BA: DMAs[0]->WriteCnt((DMAs[0]->Cnt & 0x0000FFFF) | (val << 16)); return;
-    case 0x040000C4: DMAs[1]->WriteCnt((DMAs[1]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000C6: DMAs[1]->WriteCnt((DMAs[1]->Cnt & 0x0000FFFF) | (val << 16)); return;
-    case 0x040000D0: DMAs[2]->WriteCnt((DMAs[2]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000D2: DMAs[2]->WriteCnt((DMAs[2]->Cnt & 0x0000FFFF) | (val << 16)); return;
-    case 0x040000DC: DMAs[3]->WriteCnt((DMAs[3]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000DE: DMAs[3]->WriteCnt((DMAs[3]->Cnt & 0x0000FFFF) | (val << 16)); return;
-
-    case 0x040000E0: DMA9Fill[0] = (DMA9Fill[0] & 0xFFFF0000) | val; return;
-    case 0x040000E2: DMA9Fill[0] = (DMA9Fill[0] & 0x0000FFFF) | (val << 16); return;
-    case 0x040000E4: DMA9Fill[1] = (DMA9Fill[1] & 0xFFFF0000) | val; return;
-    case 0x040000E6: DMA9Fill[1] = (DMA9Fill[1] & 0x0000FFFF) | (val << 16); return;
-    case 0x040000E8: DMA9Fill[2] = (DMA9Fill[2] & 0xFFFF0000) | val; return;
-    case 0x040000EA: DMA9Fill[2] = (DMA9Fill[2] & 0x0000FFFF) | (val << 16); return;
-    case 0x040000EC: DMA9Fill[3] = (DMA9Fill[3] & 0xFFFF0000) | val; return;
-    case 0x040000EE: DMA9Fill[3] = (DMA9Fill[3] & 0x0000FFFF) | (val << 16); return;
-
-    case 0x04000100: Timers[0].Reload = val; return;
-    case 0x04000102: TimerStart(0, val); return;
-    case 0x04000104: Timers[1].Reload = val; return;
-    case 0x04000106: TimerStart(1, val); return;
-    case 0x04000108: Timers[2].Reload = val; return;
-    case 0x0400010A: TimerStart(2, val); return;
-    case 0x0400010C: Timers[3].Reload = val; return;
-    case 0x0400010E: TimerStart(3, val); return;
-
     case 0x04000132:
         KeyCnt = val;
         return;
 
-    case 0x04000180:
-        IPCSync7 &= 0xFFF0;
-        IPCSync7 |= ((val & 0x0F00) >> 8);
-        IPCSync9 &= 0xB0FF;
-        IPCSync9 |= (val & 0x4F00);
-        if ((val & 0x2000) && (IPCSync7 & 0x4000))
-        {
-            SetIRQ(1, IRQ_IPCSync);
-        }
-        return;
-
-    case 0x04000184:
-        if (val & 0x0008)
-            IPCFIFO9->Clear();
-        if ((val & 0x0004) && (!(IPCFIFOCnt9 & 0x0004)) && IPCFIFO9->IsEmpty())
-            SetIRQ(0, IRQ_IPCSendDone);
-        if ((val & 0x0400) && (!(IPCFIFOCnt9 & 0x0400)) && (!IPCFIFO7->IsEmpty()))
-            SetIRQ(0, IRQ_IPCRecv);
-        if (val & 0x4000)
-            IPCFIFOCnt9 &= ~0x4000;
-        IPCFIFOCnt9 = val & 0x8404;
-        return;
-
     case 0x040001A0:
         if (!(ExMemCnt[0] & (1<<11))) NDSCart::WriteSPICnt(val);
         return;
@@ -3017,98 +3813,16 @@ void ARM9IOWrite16(u32 addr, u16 val)
         return;
     }
 
-    if (addr >= 0x04000000 && addr < 0x04000060)
-    {
-        GPU::GPU2D_A->Write16(addr, val);
-        return;
-    }
-    if (addr >= 0x04001000 && addr < 0x04001060)
-    {
-        GPU::GPU2D_B->Write16(addr, val);
-        return;
-    }
-    if (addr >= 0x04000320 && addr < 0x040006A4)
-    {
-        GPU3D::Write16(addr, val);
-        return;
-    }
-
     printf("unknown ARM9 IO write16 %08X %04X %08X\n", addr, val, ARM9->R[15]);
 }
 
-void ARM9IOWrite32(u32 addr, u32 val)
+void ARM9SysIOWrite32(u32 addr, u32 val)
 {
     switch (addr)
     {
-    case 0x04000004:
-        GPU::SetDispStat(0, val & 0xFFFF);
-        GPU::SetVCount(val >> 16);
-        return;
-
-    case 0x04000060: GPU3D::Write32(addr, val); return;
-    case 0x04000064:
-    case 0x04000068: GPU::GPU2D_A->Write32(addr, val); return;
-
-    case 0x0400006C: GPU::GPU2D_A->Write16(addr, val&0xFFFF); return;
-    case 0x0400106C: GPU::GPU2D_B->Write16(addr, val&0xFFFF); return;
-
-    case 0x040000B0: DMAs[0]->SrcAddr = val; return;
-    case 0x040000B4: DMAs[0]->DstAddr = val; return;
-    case 0x040000B8: DMAs[0]->WriteCnt(val); return;
-    case 0x040000BC: DMAs[1]->SrcAddr = val; return;
-    case 0x040000C0: DMAs[1]->DstAddr = val; return;
-    case 0x040000C4: DMAs[1]->WriteCnt(val); return;
-    case 0x040000C8: DMAs[2]->SrcAddr = val; return;
-    case 0x040000CC: DMAs[2]->DstAddr = val; return;
-    case 0x040000D0: DMAs[2]->WriteCnt(val); return;
-    case 0x040000D4: DMAs[3]->SrcAddr = val; return;
-    case 0x040000D8: DMAs[3]->DstAddr = val; return;
-    case 0x040000DC: DMAs[3]->WriteCnt(val); return;
-
-    case 0x040000E0: DMA9Fill[0] = val; return;
-    case 0x040000E4: DMA9Fill[1] = val; return;
-    case 0x040000E8: DMA9Fill[2] = val; return;
-    case 0x040000EC: DMA9Fill[3] = val; return;
-
-    case 0x04000100:
-        Timers[0].Reload = val & 0xFFFF;
-        TimerStart(0, val>>16);
-        return;
-    case 0x04000104:
-        Timers[1].Reload = val & 0xFFFF;
-        TimerStart(1, val>>16);
-        return;
-    case 0x04000108:
-        Timers[2].Reload = val & 0xFFFF;
-        TimerStart(2, val>>16);
-        return;
-    case 0x0400010C:
-        Timers[3].Reload = val & 0xFFFF;
-        TimerStart(3, val>>16);
-        return;
-
     case 0x04000130:
         KeyCnt = val >> 16;
         return;
-    case 0x04000180:
-        ARM9IOWrite16(addr, val);
-        return;
-
-    case 0x04000188:
-        if (IPCFIFOCnt9 & 0x8000)
-        {
-            if (IPCFIFO9->IsFull())
-                IPCFIFOCnt9 |= 0x4000;
-            else
-            {
-                bool wasempty = IPCFIFO9->IsEmpty();
-                IPCFIFO9->Write(val);
-                if ((IPCFIFOCnt7 & 0x0400) && wasempty)
-                    SetIRQ(1, IRQ_IPCRecv);
-            }
-        }
-        return;
-
     case 0x040001A0:
         if (!(ExMemCnt[0] & (1<<11)))
         {
@@ -3175,27 +3889,11 @@ void ARM9IOWrite32(u32 addr, u32 val)
         return;
     }
 
-    if (addr >= 0x04000000 && addr < 0x04000060)
-    {
-        GPU::GPU2D_A->Write32(addr, val);
-        return;
-    }
-    if (addr >= 0x04001000 && addr < 0x04001060)
-    {
-        GPU::GPU2D_B->Write32(addr, val);
-        return;
-    }
-    if (addr >= 0x04000320 && addr < 0x040006A4)
-    {
-        GPU3D::Write32(addr, val);
-        return;
-    }
-
     printf("unknown ARM9 IO write32 %08X %08X %08X\n", addr, val, ARM9->R[15]);
 }
 
 
-u8 ARM7IORead8(u32 addr)
+u8 ARM7SysIORead8(u32 addr)
 {
     switch (addr)
     {
@@ -3231,40 +3929,14 @@ u8 ARM7IORead8(u32 addr)
     case 0x04000300: return PostFlag7;
     }
 
-    if (addr >= 0x04000400 && addr < 0x04000520)
-    {
-        return SPU::Read8(addr);
-    }
-
     printf("unknown ARM7 IO read8 %08X %08X\n", addr, ARM7->R[15]);
     return 0;
 }
 
-u16 ARM7IORead16(u32 addr)
+u16 ARM7SysIORead16(u32 addr)
 {
     switch (addr)
     {
-    case 0x04000004: return GPU::DispStat[1];
-    case 0x04000006: return GPU::VCount;
-
-    case 0x040000B8: return DMAs[4]->Cnt & 0xFFFF;
-    case 0x040000BA: return DMAs[4]->Cnt >> 16;
-    case 0x040000C4: return DMAs[5]->Cnt & 0xFFFF;
-    case 0x040000C6: return DMAs[5]->Cnt >> 16;
-    case 0x040000D0: return DMAs[6]->Cnt & 0xFFFF;
-    case 0x040000D2: return DMAs[6]->Cnt >> 16;
-    case 0x040000DC: return DMAs[7]->Cnt & 0xFFFF;
-    case 0x040000DE: return DMAs[7]->Cnt >> 16;
-
-    case 0x04000100: return TimerGetCounter(4);
-    case 0x04000102: return Timers[4].Cnt;
-    case 0x04000104: return TimerGetCounter(5);
-    case 0x04000106: return Timers[5].Cnt;
-    case 0x04000108: return TimerGetCounter(6);
-    case 0x0400010A: return Timers[6].Cnt;
-    case 0x0400010C: return TimerGetCounter(7);
-    case 0x0400010E: return Timers[7].Cnt;
-
     case 0x04000130: return KeyInput & 0xFFFF;
     case 0x04000132: return KeyCnt;
     case 0x04000134: return RCnt;
@@ -3272,17 +3944,6 @@ u16 ARM7IORead16(u32 addr)
 
     case 0x04000138: return RTC::Read();
 
-    case 0x04000180: return IPCSync7;
-    case 0x04000184:
-        {
-            u16 val = IPCFIFOCnt7;
-            if (IPCFIFO7->IsEmpty())     val |= 0x0001;
-            else if (IPCFIFO7->IsFull()) val |= 0x0002;
-            if (IPCFIFO9->IsEmpty())     val |= 0x0100;
-            else if (IPCFIFO9->IsFull()) val |= 0x0200;
-            return val;
-        }
-
     case 0x040001A0: return NDSCart::SPICnt;
     case 0x040001A2: return NDSCart::ReadSPIData();
 
@@ -3310,45 +3971,18 @@ u16 ARM7IORead16(u32 addr)
     case 0x04000308: return ARM7BIOSProt;
     }
 
-    if (addr >= 0x04000400 && addr < 0x04000520)
-    {
-        return SPU::Read16(addr);
-    }
-
     printf("unknown ARM7 IO read16 %08X %08X\n", addr, ARM7->R[15]);
     return 0;
 }
 
-u32 ARM7IORead32(u32 addr)
+u32 ARM7SysIORead32(u32 addr)
 {
     switch (addr)
     {
-    case 0x04000004: return GPU::DispStat[1] | (GPU::VCount << 16);
-
-    case 0x040000B0: return DMAs[4]->SrcAddr;
-    case 0x040000B4: return DMAs[4]->DstAddr;
-    case 0x040000B8: return DMAs[4]->Cnt;
-    case 0x040000BC: return DMAs[5]->SrcAddr;
-    case 0x040000C0: return DMAs[5]->DstAddr;
-    case 0x040000C4: return DMAs[5]->Cnt;
-    case 0x040000C8: return DMAs[6]->SrcAddr;
-    case 0x040000CC: return DMAs[6]->DstAddr;
-    case 0x040000D0: return DMAs[6]->Cnt;
-    case 0x040000D4: return DMAs[7]->SrcAddr;
-    case 0x040000D8: return DMAs[7]->DstAddr;
-    case 0x040000DC: return DMAs[7]->Cnt;
-
-    case 0x04000100: return TimerGetCounter(4) | (Timers[4].Cnt << 16);
-    case 0x04000104: return TimerGetCounter(5) | (Timers[5].Cnt << 16);
-    case 0x04000108: return TimerGetCounter(6) | (Timers[6].Cnt << 16);
-    case 0x0400010C: return TimerGetCounter(7) | (Timers[7].Cnt << 16);
-
     case 0x04000130: return (KeyInput & 0xFFFF) | (KeyCnt << 16);
     case 0x04000134: return RCnt | (KeyCnt & 0xFFFF0000);
     case 0x04000138: return RTC::Read();
 
-    case 0x04000180: return IPCSync7;
-
     case 0x040001A0: return NDSCart::SPICnt | (NDSCart::ReadSPIData() << 16);
     case 0x040001A4: return NDSCart::ROMCnt;
 
@@ -3370,42 +4004,16 @@ u32 ARM7IORead32(u32 addr)
 
     case 0x04000308: return ARM7BIOSProt;
 
-    case 0x04100000:
-        if (IPCFIFOCnt7 & 0x8000)
-        {
-            u32 ret;
-            if (IPCFIFO9->IsEmpty())
-            {
-                IPCFIFOCnt7 |= 0x4000;
-                ret = IPCFIFO9->Peek();
-            }
-            else
-            {
-                ret = IPCFIFO9->Read();
-
-                if (IPCFIFO9->IsEmpty() && (IPCFIFOCnt9 & 0x0004))
-                    SetIRQ(0, IRQ_IPCSendDone);
-            }
-            return ret;
-        }
-        else
-            return IPCFIFO9->Peek();
-
     case 0x04100010:
         if (ExMemCnt[0] & (1<<11)) return NDSCart::ReadROMData();
         return 0;
     }
 
-    if (addr >= 0x04000400 && addr < 0x04000520)
-    {
-        return SPU::Read32(addr);
-    }
-
     printf("unknown ARM7 IO read32 %08X %08X\n", addr, ARM7->R[15]);
     return 0;
 }
 
-void ARM7IOWrite8(u32 addr, u8 val)
+void ARM7SysIOWrite8(u32 addr, u8 val)
 {
     switch (addr)
     {
@@ -3470,68 +4078,18 @@ void ARM7IOWrite8(u32 addr, u8 val)
         return;
     }
 
-    if (addr >= 0x04000400 && addr < 0x04000520)
-    {
-        SPU::Write8(addr, val);
-        return;
-    }
-
     printf("unknown ARM7 IO write8 %08X %02X %08X\n", addr, val, ARM7->R[15]);
 }
 
-void ARM7IOWrite16(u32 addr, u16 val)
+void ARM7SysIOWrite16(u32 addr, u16 val)
 {
     switch (addr)
     {
-    case 0x04000004: GPU::SetDispStat(1, val); return;
-    case 0x04000006: GPU::SetVCount(val); return;
-
-    case 0x040000B8: DMAs[4]->WriteCnt((DMAs[4]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000BA: DMAs[4]->WriteCnt((DMAs[4]->Cnt & 0x0000FFFF) | (val << 16)); return;
-    case 0x040000C4: DMAs[5]->WriteCnt((DMAs[5]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000C6: DMAs[5]->WriteCnt((DMAs[5]->Cnt & 0x0000FFFF) | (val << 16)); return;
-    case 0x040000D0: DMAs[6]->WriteCnt((DMAs[6]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000D2: DMAs[6]->WriteCnt((DMAs[6]->Cnt & 0x0000FFFF) | (val << 16)); return;
-    case 0x040000DC: DMAs[7]->WriteCnt((DMAs[7]->Cnt & 0xFFFF0000) | val); return;
-    case 0x040000DE: DMAs[7]->WriteCnt((DMAs[7]->Cnt & 0x0000FFFF) | (val << 16)); return;
-
-    case 0x04000100: Timers[4].Reload = val; return;
-    case 0x04000102: TimerStart(4, val); return;
-    case 0x04000104: Timers[5].Reload = val; return;
-    case 0x04000106: TimerStart(5, val); return;
-    case 0x04000108: Timers[6].Reload = val; return;
-    case 0x0400010A: TimerStart(6, val); return;
-    case 0x0400010C: Timers[7].Reload = val; return;
-    case 0x0400010E: TimerStart(7, val); return;
-
     case 0x04000132: KeyCnt = val; return;
     case 0x04000134: RCnt = val; return;
 
     case 0x04000138: RTC::Write(val, false); return;
 
-    case 0x04000180:
-        IPCSync9 &= 0xFFF0;
-        IPCSync9 |= ((val & 0x0F00) >> 8);
-        IPCSync7 &= 0xB0FF;
-        IPCSync7 |= (val & 0x4F00);
-        if ((val & 0x2000) && (IPCSync9 & 0x4000))
-        {
-            SetIRQ(0, IRQ_IPCSync);
-        }
-        return;
-
-    case 0x04000184:
-        if (val & 0x0008)
-            IPCFIFO7->Clear();
-        if ((val & 0x0004) && (!(IPCFIFOCnt7 & 0x0004)) && IPCFIFO7->IsEmpty())
-            SetIRQ(1, IRQ_IPCSendDone);
-        if ((val & 0x0400) && (!(IPCFIFOCnt7 & 0x0400)) && (!IPCFIFO9->IsEmpty()))
-            SetIRQ(1, IRQ_IPCRecv);
-        if (val & 0x4000)
-            IPCFIFOCnt7 &= ~0x4000;
-        IPCFIFOCnt7 = val & 0x8404;
-        return;
-
     case 0x040001A0:
         if (ExMemCnt[0] & (1<<11))
             NDSCart::WriteSPICnt(val);
@@ -3595,76 +4153,17 @@ void ARM7IOWrite16(u32 addr, u16 val)
         return;
     }
 
-    if (addr >= 0x04000400 && addr < 0x04000520)
-    {
-        SPU::Write16(addr, val);
-        return;
-    }
-
     printf("unknown ARM7 IO write16 %08X %04X %08X\n", addr, val, ARM7->R[15]);
 }
 
-void ARM7IOWrite32(u32 addr, u32 val)
+void ARM7SysIOWrite32(u32 addr, u32 val)
 {
     switch (addr)
     {
-    case 0x04000004:
-        GPU::SetDispStat(1, val & 0xFFFF);
-        GPU::SetVCount(val >> 16);
-        return;
-
-    case 0x040000B0: DMAs[4]->SrcAddr = val; return;
-    case 0x040000B4: DMAs[4]->DstAddr = val; return;
-    case 0x040000B8: DMAs[4]->WriteCnt(val); return;
-    case 0x040000BC: DMAs[5]->SrcAddr = val; return;
-    case 0x040000C0: DMAs[5]->DstAddr = val; return;
-    case 0x040000C4: DMAs[5]->WriteCnt(val); return;
-    case 0x040000C8: DMAs[6]->SrcAddr = val; return;
-    case 0x040000CC: DMAs[6]->DstAddr = val; return;
-    case 0x040000D0: DMAs[6]->WriteCnt(val); return;
-    case 0x040000D4: DMAs[7]->SrcAddr = val; return;
-    case 0x040000D8: DMAs[7]->DstAddr = val; return;
-    case 0x040000DC: DMAs[7]->WriteCnt(val); return;
-
-    case 0x04000100:
-        Timers[4].Reload = val & 0xFFFF;
-        TimerStart(4, val>>16);
-        return;
-    case 0x04000104:
-        Timers[5].Reload = val & 0xFFFF;
-        TimerStart(5, val>>16);
-        return;
-    case 0x04000108:
-        Timers[6].Reload = val & 0xFFFF;
-        TimerStart(6, val>>16);
-        return;
-    case 0x0400010C:
-        Timers[7].Reload = val & 0xFFFF;
-        TimerStart(7, val>>16);
-        return;
-
     case 0x04000130: KeyCnt = val >> 16; return;
     case 0x04000134: RCnt = val & 0xFFFF; return;
     case 0x04000138: RTC::Write(val & 0xFFFF, false); return;
 
-    case 0x04000180:
-        ARM7IOWrite16(addr, val);
-        return;
-    case 0x04000188:
-        if (IPCFIFOCnt7 & 0x8000)
-        {
-            if (IPCFIFO7->IsFull())
-                IPCFIFOCnt7 |= 0x4000;
-            else
-            {
-                bool wasempty = IPCFIFO7->IsEmpty();
-                IPCFIFO7->Write(val);
-                if ((IPCFIFOCnt9 & 0x0400) && wasempty)
-                    SetIRQ(0, IRQ_IPCRecv);
-            }
-        }
-        return;
-
     case 0x040001A0:
         if (ExMemCnt[0] & (1<<11))
         {
@@ -3704,12 +4203,6 @@ void ARM7IOWrite32(u32 addr, u32 val)
         return;
     }
 
-    if (addr >= 0x04000400 && addr < 0x04000520)
-    {
-        SPU::Write32(addr, val);
-        return;
-    }
-
     printf("unknown ARM7 IO write32 %08X %08X %08X\n", addr, val, ARM7->R[15]);
 }
 
@@ -19,6 +19,7 @@
 #ifndef NDS_H
 #define NDS_H
 
+#include <stdint.h>
 #include "Savestate.h"
 #include "types.h"
 
@@ -26,6 +27,9 @@
 // with this enabled, to make sure it doesn't desync
 //#define DEBUG_CHECK_DESYNC
 
+class ARMv5;
+class ARMv4;
+
 namespace NDS
 {
 
@@ -42,6 +46,16 @@ enum
     Event_Div,
     Event_Sqrt,
 
+    // overflow of each hardware timer, ARM9 ones first
+    Event_Timer0,
+    Event_Timer1,
+    Event_Timer2,
+    Event_Timer3,
+    Event_Timer4,
+    Event_Timer5,
+    Event_Timer6,
+    Event_Timer7,
+
     Event_MAX
 };
 
@@ -98,6 +112,22 @@ typedef struct
 
 } MemRegion;
 
+// handlers for a range of IO registers, one per access size
+// entries left NULL go to the system registers, like unclaimed addresses
+typedef struct
+{
+    u8 (*Read8)(u32 addr);
+    u16 (*Read16)(u32 addr);
+    u32 (*Read32)(u32 addr);
+    void (*Write8)(u32 addr, u8 val);
+    void (*Write16)(u32 addr, u16 val);
+    void (*Write32)(u32 addr, u32 val);
+
+} IOHandlers;
+
+extern ARMv5* ARM9;
+extern ARMv4* ARM7;
+
 extern u8 ARM9MemTimings[0x40000][4];
 extern u8 ARM7MemTimings[0x20000][4];
 
@@ -105,6 +135,15 @@ extern u64 ARM9Timestamp, ARM9Target;
 extern u64 ARM7Timestamp, ARM7Target;
 extern u32 ARM9ClockShift;
 
+// whether the ARM7 runs on its own thread (Config::ThreadedARM7, applied on reset)
+extern bool ARM7Threaded;
+
+// stats for the ARM7 thread, cleared on reset
+// SliceStalls: [0] the ARM9 finished a slice first and had to wait, [1] the ARM7 did
+// BusLockStalls: times each CPU found the bus lock taken by the other
+extern u32 SliceStalls[2];
+extern u32 BusLockStalls[2];
+
 // hax
 extern u32 IME[2];
 extern u32 IE[2];
@@ -124,6 +163,36 @@ extern u8 ARM7BIOS[0x4000];
 
 extern u8 MainRAM[MAIN_RAM_SIZE];
 
+extern u8 SharedWRAM[0x8000];
+extern u8* SWRAM_ARM9;
+extern u8* SWRAM_ARM7;
+extern u32 SWRAM_ARM9Mask;
+extern u32 SWRAM_ARM7Mask;
+
+extern u8 ARM7WRAM[0x10000];
+
+// fast path for bus accesses: one entry per 4KB page, holding a host pointer
+// to the start of the page or'd with the kinds of accesses that may use it
+// pages that need special handling (IO, overlapping VRAM banks, GBA slot...)
+// are left at 0 and go through the regular handlers
+enum
+{
+    Page_Read   = (1<<0),
+    Page_Write  = (1<<1), // 16/32-bit writes
+    Page_Write8 = (1<<2),
+    Page_Track  = (1<<3), // writes have to be reported to the GPU dirty tracking
+
+    Page_FlagMask = 0xF
+};
+
+extern uintptr_t ARM9PageMap[0x100000];
+extern uintptr_t ARM7PageMap[0x100000];
+
+inline u8* PagePtr(uintptr_t page, u32 addr)
+{
+    return (u8*)(page & ~(uintptr_t)Page_FlagMask) + (addr & 0xFFF);
+}
+
 bool Init();
 void DeInit();
 void Reset();
@@ -131,6 +200,11 @@ void Stop();
 
 bool DoSavestate(Savestate* file);
 
+// hooks the IO registers in [start, end) for the given CPU (0=ARM9, 1=ARM7)
+// works at 32-bit word granularity, within 0x04000000-0x04001FFF and 0x04100000-0x0410001F
+// meant to be called by subsystems from their Init(), later calls take precedence
+void RegisterIO(u32 cpu, u32 start, u32 end, const IOHandlers* handlers);
+
 void SetARM9RegionTimings(u32 addrstart, u32 addrend, int buswidth, int nonseq, int seq);
 void SetARM7RegionTimings(u32 addrstart, u32 addrend, int buswidth, int nonseq, int seq);
 
@@ -154,6 +228,7 @@ void SetLidClosed(bool closed);
 void MicInputFrame(s16* data, int samples);
 
 void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 param);
+void ScheduleEventAt(u32 id, u64 timestamp, void (*func)(u32), u32 param);
 void CancelEvent(u32 id);
 
 void debug(u32 p);
@@ -161,6 +236,7 @@ void debug(u32 p);
 void Halt();
 
 void MapSharedWRAM(u8 val);
+void UpdatePageMap(u32 start, u32 end);
 
 void SetIRQ(u32 cpu, u32 irq);
 void ClearIRQ(u32 cpu, u32 irq);
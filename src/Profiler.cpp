@@ -0,0 +1,159 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "Profiler.h"
+
+#ifdef PROFILING
+
+namespace Profiler
+{
+
+const char* Names[Prof_MAX] =
+{
+    "ARM9",
+    "ARM7",
+    "2D",
+    "3D cmd",
+    "3D raster",
+    "SPU",
+    "DMA9",
+    "DMA7",
+    "events",
+};
+
+// these only ever go up, frame and total stats are differences between
+// snapshots. the ARM7, 2D engine B and 3D threads count into them too,
+// hence the atomics, and they keep counting while the emu thread takes
+// a snapshot. two threads can be in the same scope at once (2D), the
+// time is then the sum of both
+typedef struct
+{
+    std::atomic<u64> Nanoseconds;
+    std::atomic<u64> Calls;
+
+} RunningCounter;
+
+RunningCounter Running[Prof_MAX];
+
+Counter FrameStart[Prof_MAX];
+Counter LastFrame[Prof_MAX];
+
+Counter TotalStart[Prof_MAX];
+u32 TotalFrames;
+
+// innermost active scope on this thread, and since when it's been charged
+thread_local int Current = -1;
+thread_local u64 Mark;
+
+
+inline u64 Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Scope::Scope(int id)
+{
+    u64 now = Now();
+    if (Current >= 0)
+        Running[Current].Nanoseconds.fetch_add(now - Mark, std::memory_order_relaxed);
+
+    Parent = Current;
+    Current = id;
+    Mark = now;
+
+    Running[id].Calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+Scope::~Scope()
+{
+    u64 now = Now();
+    Running[Current].Nanoseconds.fetch_add(now - Mark, std::memory_order_relaxed);
+
+    Current = Parent;
+    Mark = now;
+}
+
+
+void Reset()
+{
+    for (int i = 0; i < Prof_MAX; i++)
+    {
+        Running[i].Nanoseconds.store(0, std::memory_order_relaxed);
+        Running[i].Calls.store(0, std::memory_order_relaxed);
+    }
+    memset(FrameStart, 0, sizeof(FrameStart));
+    memset(LastFrame, 0, sizeof(LastFrame));
+    memset(TotalStart, 0, sizeof(TotalStart));
+    TotalFrames = 0;
+}
+
+void EndFrame()
+{
+    for (int i = 0; i < Prof_MAX; i++)
+    {
+        Counter cur;
+        cur.Nanoseconds = Running[i].Nanoseconds.load(std::memory_order_relaxed);
+        cur.Calls = Running[i].Calls.load(std::memory_order_relaxed);
+
+        LastFrame[i].Nanoseconds = cur.Nanoseconds - FrameStart[i].Nanoseconds;
+        LastFrame[i].Calls = cur.Calls - FrameStart[i].Calls;
+        FrameStart[i] = cur;
+    }
+
+    TotalFrames++;
+}
+
+void GetTotals(Counter* counters, u32* frames)
+{
+    for (int i = 0; i < Prof_MAX; i++)
+    {
+        counters[i].Nanoseconds = FrameStart[i].Nanoseconds - TotalStart[i].Nanoseconds;
+        counters[i].Calls = FrameStart[i].Calls - TotalStart[i].Calls;
+    }
+
+    *frames = TotalFrames;
+}
+
+void ClearTotals()
+{
+    memcpy(TotalStart, FrameStart, sizeof(TotalStart));
+    TotalFrames = 0;
+}
+
+void Format(char* buf, int len, Counter* counters, u32 frames)
+{
+    if (frames < 1) frames = 1;
+
+    int pos = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < Prof_MAX && pos < len; i++)
+    {
+        double ms = counters[i].Nanoseconds / (frames * 1000000.0);
+        pos += snprintf(&buf[pos], len - pos, "%s%s %.2f", i ? " | " : "", Names[i], ms);
+    }
+}
+
+}
+
+#endif // PROFILING
@@ -0,0 +1,95 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "types.h"
+
+// hot path profiling counters
+// only there in builds with PROFILING defined (ENABLE_PROFILING in CMake),
+// otherwise PROFILE_SCOPE() is a no-op and none of this gets compiled
+
+namespace Profiler
+{
+
+enum
+{
+    Prof_ARM9 = 0,
+    Prof_ARM7,
+    Prof_GPU2D,
+    Prof_GPU3DCmd,
+    Prof_Raster,
+    Prof_SPU,
+    Prof_DMA9,
+    Prof_DMA7,
+    Prof_Events,
+
+    Prof_MAX
+};
+
+typedef struct
+{
+    u64 Nanoseconds;
+    u64 Calls;
+
+} Counter;
+
+#ifdef PROFILING
+
+// time is exclusive: a scope doesn't get charged for the scopes it calls
+// (scheduler callbacks don't count the 2D rendering or SPU mixing they do)
+class Scope
+{
+public:
+    Scope(int id);
+    ~Scope();
+
+private:
+    int Parent;
+};
+
+extern const char* Names[Prof_MAX];
+
+// the frame that just ended
+extern Counter LastFrame[Prof_MAX];
+
+void Reset();
+
+// called at the end of NDS::RunFrame()
+void EndFrame();
+
+// totals since the last ClearTotals()
+void GetTotals(Counter* counters, u32* frames);
+void ClearTotals();
+
+// one line with per-frame averages, in milliseconds
+void Format(char* buf, int len, Counter* counters, u32 frames);
+
+#define PROFILE_SCOPE(id) Profiler::Scope _profscope(Profiler::id)
+
+#else
+
+#define PROFILE_SCOPE(id)
+
+#endif // PROFILING
+
+}
+
+#endif // PROFILER_H
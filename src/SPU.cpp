@@ -20,6 +20,7 @@
 #include <string.h>
 #include "NDS.h"
 #include "SPU.h"
+#include "Profiler.h"
 
 
 // SPU TODO
@@ -78,6 +79,9 @@ CaptureUnit* Capture[2];
 
 bool Init()
 {
+    NDS::IOHandlers io = {Read8, Read16, Read32, Write8, Write16, Write32};
+    NDS::RegisterIO(1, 0x04000400, 0x04000520, &io);
+
     for (int i = 0; i < 16; i++)
         Channels[i] = new Channel(i);
 
@@ -579,6 +583,8 @@ void CaptureUnit::Run(s32 sample)
 
 void Mix(u32 samples)
 {
+    PROFILE_SCOPE(Prof_SPU);
+
     s32 channelbuf[32];
     s32 leftbuf[32], rightbuf[32];
     s32 ch0buf[32], ch1buf[32], ch2buf[32], ch3buf[32];
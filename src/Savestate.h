@@ -23,7 +23,7 @@
 #include "types.h"
 
 #define SAVESTATE_MAJOR 5
-#define SAVESTATE_MINOR 0
+#define SAVESTATE_MINOR 2
 
 class Savestate
 {
@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include "NDS.h"
 #include "SPI.h"
 #include "Wifi.h"
@@ -42,6 +43,13 @@ u64 USCounter;
 u64 USCompare;
 bool BlockBeaconIRQ14;
 
+bool USTimerOn;
+
+// system timestamp of the last microsecond tick that was run
+// while the radio is idle, ticks are only run when something can happen
+// (or when the ARM7 looks at the wifi registers) and are caught up in bulk
+u64 USTimestamp;
+
 u32 CmdCounter;
 
 u16 BBCnt;
@@ -200,6 +208,8 @@ void Reset()
     USCounter = 0;
     USCompare = 0;
     BlockBeaconIRQ14 = false;
+    USTimerOn = false;
+    USTimestamp = 0;
 
     ComStatus = 0;
     TXCurSlot = -1;
@@ -245,6 +255,17 @@ void DoSavestate(Savestate* file)
     file->Var32((u32*)&MPNumReplies);
 
     file->Var32(&CmdCounter);
+
+    if (file->IsAtleastVersion(5, 2))
+    {
+        file->Var32((u32*)&USTimerOn);
+        file->Var64(&USTimestamp);
+    }
+    else if (!file->Saving)
+    {
+        USTimerOn = !(IOPORT(W_PowerUS) & 0x0001);
+        USTimestamp = NDS::ARM7Timestamp;
+    }
 }
 
 
@@ -964,9 +985,9 @@ void MSTimer()
     }
 }
 
-void USTimer(u32 param)
+void USTick()
 {
-    WifiAP::USTimer();
+    WifiAP::USTimer(1);
 
     if (IOPORT(W_USCountCnt))
     {
@@ -1100,10 +1121,98 @@ void USTimer(u32 param)
             IOPORT(W_RXTXAddr) = addr >> 1;
         }
     }
+}
+
+// how many of the upcoming ticks can be run in bulk, ie. won't do anything
+// other than advancing counters
+u32 IdleTicks()
+{
+    if (ComStatus != 0 || IOPORT(W_TXBusy) != 0)
+        return 0;
 
+    u32 ret = 0x10000;
+
+    if (IOPORT(W_RXCnt) & 0x8000)
+    {
+        // next RX poll
+        u32 poll = (0x200 - (RXCounter & 0x1FF)) & 0x1FF;
+        if (poll < ret) ret = poll;
+    }
+
+    if (IOPORT(W_USCountCnt))
+    {
+        // next millisecond boundary
+        u32 uspart = USCounter & 0x3FF;
+        u32 ms = 0x3FF - uspart;
+        if (ms < ret) ret = ms;
+
+        // pre-beacon IRQ within the current millisecond
+        if (IOPORT(W_USCompareCnt) && (IOPORT(W_PreBeacon) >> 10) == IOPORT(W_BeaconCount1))
+        {
+            u32 target = 0x3FF - (IOPORT(W_PreBeacon) & 0x3FF);
+            if (target > uspart)
+            {
+                u32 pre = target - uspart - 1;
+                if (pre < ret) ret = pre;
+            }
+        }
+    }
+
+    return ret;
+}
+
+void SkipTicks(u32 num)
+{
+    WifiAP::USTimer(num);
+
+    if (IOPORT(W_USCountCnt))
+        USCounter += num;
+
+    if (IOPORT(W_CmdCountCnt) & 0x0001)
+    {
+        if (CmdCounter > num) CmdCounter -= num;
+        else                  CmdCounter = 0;
+    }
+
+    if (IOPORT(W_ContentFree) > num) IOPORT(W_ContentFree) -= num;
+    else                             IOPORT(W_ContentFree) = 0;
+
+    RXCounter += num;
+}
+
+void RunUSTimer(u64 timestamp)
+{
+    while ((USTimestamp + 33) <= timestamp)
+    {
+        u32 num = (u32)std::min<u64>((timestamp - USTimestamp) / 33, 0x10000);
+        u32 idle = IdleTicks();
+        if (idle > 0)
+        {
+            if (num > idle) num = idle;
+            SkipTicks(num);
+        }
+        else
+        {
+            num = 1;
+            USTick();
+        }
+
+        USTimestamp += num * 33;
+    }
+}
+
+void ScheduleUSTimer()
+{
     // TODO: make it more accurate, eventually
     // in the DS, the wifi system has its own 22MHz clock and doesn't use the system clock
-    NDS::ScheduleEvent(NDS::Event_Wifi, true, 33, USTimer, 0);
+    NDS::CancelEvent(NDS::Event_Wifi);
+    NDS::ScheduleEventAt(NDS::Event_Wifi, USTimestamp + (IdleTicks() + 1) * 33, USTimer, 0);
+}
+
+void USTimer(u32 param)
+{
+    RunUSTimer(NDS::ARM7Timestamp);
+    ScheduleUSTimer();
 }
 
 
@@ -1157,6 +1266,9 @@ u16 Read(u32 addr)
     if (addr >= 0x2000 && addr < 0x4000)
         return 0xFFFF;
 
+    if (USTimerOn)
+        RunUSTimer(NDS::ARM7Timestamp);
+
     bool activeread = (addr < 0x1000);
 
     switch (addr)
@@ -1233,21 +1345,8 @@ u16 Read(u32 addr)
     return IOPORT(addr&0xFFF);
 }
 
-void Write(u32 addr, u16 val)
+void WriteIO(u32 addr, u16 val)
 {
-    if (addr >= 0x04810000)
-        return;
-
-    addr &= 0x7FFE;
-    //printf("WIFI: write %08X %04X\n", addr, val);
-    if (addr >= 0x4000 && addr < 0x6000)
-    {
-        *(u16*)&RAM[addr & 0x1FFE] = val;
-        return;
-    }
-    if (addr >= 0x2000 && addr < 0x4000)
-        return;
-
     switch (addr)
     {
     case W_ModeReset:
@@ -1350,7 +1449,8 @@ void Write(u32 addr, u16 val)
         if ((IOPORT(W_PowerUS) & 0x0001) && !(val & 0x0001))
         {
             printf("WIFI ON\n");
-            NDS::ScheduleEvent(NDS::Event_Wifi, false, 33, USTimer, 0);
+            USTimerOn = true;
+            USTimestamp = NDS::ARM7Timestamp;
             if (!MPInited)
             {
                 Platform::MP_Init();
@@ -1365,6 +1465,7 @@ void Write(u32 addr, u16 val)
         else if (!(IOPORT(W_PowerUS) & 0x0001) && (val & 0x0001))
         {
             printf("WIFI OFF\n");
+            USTimerOn = false;
             NDS::CancelEvent(NDS::Event_Wifi);
         }
         break;
@@ -1537,6 +1638,32 @@ void Write(u32 addr, u16 val)
     IOPORT(addr&0xFFF) = val;
 }
 
+void Write(u32 addr, u16 val)
+{
+    if (addr >= 0x04810000)
+        return;
+
+    addr &= 0x7FFE;
+    //printf("WIFI: write %08X %04X\n", addr, val);
+    if (addr >= 0x4000 && addr < 0x6000)
+    {
+        *(u16*)&RAM[addr & 0x1FFE] = val;
+        return;
+    }
+    if (addr >= 0x2000 && addr < 0x4000)
+        return;
+
+    // bring the counters up to date, and figure out when the next tick is due
+    // once the write is done (it can start a transfer or change a compare value)
+    if (USTimerOn)
+        RunUSTimer(NDS::ARM7Timestamp);
+
+    WriteIO(addr, val);
+
+    if (USTimerOn)
+        ScheduleUSTimer();
+}
+
 
 u8* GetMAC()
 {
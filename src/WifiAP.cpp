@@ -118,12 +118,12 @@ bool MACIsBroadcast(u8* a)
 }
 
 
-void USTimer()
+void USTimer(u32 num)
 {
-    USCounter++;
+    u64 old = USCounter;
+    USCounter += num;
 
-    u32 chk = (u32)USCounter;
-    if (!(chk & 0x1FFFF))
+    if ((old >> 17) != (USCounter >> 17))
     {
         // send beacon every 128ms
         BeaconDue = true;
@@ -26,7 +26,7 @@ bool Init();
 void DeInit();
 void Reset();
 
-void USTimer();
+void USTimer(u32 num);
 
 // packet format: 12-byte TX header + original 802.11 frame
 int SendPacket(u8* data, int len);
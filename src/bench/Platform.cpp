@@ -0,0 +1,195 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../Platform.h"
+#include "../Config.h"
+
+
+extern bool StopRequested;
+extern const char* DataDirectory;
+
+
+namespace Config
+{
+
+// no frontend settings here
+ConfigEntry PlatformConfigFile[] =
+{
+    {"", -1, NULL, 0, NULL, 0}
+};
+
+}
+
+
+namespace Platform
+{
+
+typedef struct
+{
+    std::mutex Lock;
+    std::condition_variable Cond;
+    int Count;
+
+} Semaphore;
+
+
+void StopEmu()
+{
+    StopRequested = true;
+}
+
+
+FILE* OpenFile(const char* path, const char* mode, bool mustexist)
+{
+    // an empty path means nothing gets saved
+    if (!path[0]) return NULL;
+
+    if (mustexist)
+    {
+        FILE* f = fopen(path, "rb");
+        if (!f) return NULL;
+        fclose(f);
+    }
+
+    return fopen(path, mode);
+}
+
+FILE* OpenLocalFile(const char* path, const char* mode)
+{
+    // everything lives in the data directory, nothing is looked up elsewhere
+    // so that runs don't depend on whoever's config is lying around
+    std::string fullpath = std::string(DataDirectory) + "/" + path;
+    return fopen(fullpath.c_str(), mode);
+}
+
+FILE* OpenDataFile(const char* path)
+{
+    return OpenLocalFile(path, "rb");
+}
+
+
+void* Thread_Create(void (*func)())
+{
+    return new std::thread(func);
+}
+
+void Thread_Free(void* thread)
+{
+    delete (std::thread*)thread;
+}
+
+void Thread_Wait(void* thread)
+{
+    ((std::thread*)thread)->join();
+}
+
+
+void* Semaphore_Create()
+{
+    Semaphore* sema = new Semaphore;
+    sema->Count = 0;
+    return sema;
+}
+
+void Semaphore_Free(void* sema)
+{
+    delete (Semaphore*)sema;
+}
+
+void Semaphore_Reset(void* sema)
+{
+    Semaphore* s = (Semaphore*)sema;
+    std::lock_guard<std::mutex> lock(s->Lock);
+    s->Count = 0;
+}
+
+void Semaphore_Wait(void* sema)
+{
+    Semaphore* s = (Semaphore*)sema;
+    std::unique_lock<std::mutex> lock(s->Lock);
+    while (s->Count == 0) s->Cond.wait(lock);
+    s->Count--;
+}
+
+void Semaphore_Post(void* sema)
+{
+    Semaphore* s = (Semaphore*)sema;
+    {
+        std::lock_guard<std::mutex> lock(s->Lock);
+        s->Count++;
+    }
+    s->Cond.notify_one();
+}
+
+
+void* GL_GetProcAddress(const char*)
+{
+    // always uses the software renderer
+    return NULL;
+}
+
+
+// no networking, the wifi hardware just never hears anything
+
+bool MP_Init()
+{
+    return false;
+}
+
+void MP_DeInit()
+{
+}
+
+int MP_SendPacket(u8*, int)
+{
+    return 0;
+}
+
+int MP_RecvPacket(u8*, bool)
+{
+    return 0;
+}
+
+bool LAN_Init()
+{
+    return false;
+}
+
+void LAN_DeInit()
+{
+}
+
+int LAN_SendPacket(u8*, int)
+{
+    return 0;
+}
+
+int LAN_RecvPacket(u8*)
+{
+    return 0;
+}
+
+}
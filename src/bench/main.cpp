@@ -0,0 +1,524 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+
+// headless benchmark runner
+// runs a ROM for a given number of frames as fast as it can go, and reports
+// how fast that was, along with hashes of what came out of it
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "../types.h"
+#include "../version.h"
+#include "../Config.h"
+#include "../Platform.h"
+#include "../NDS.h"
+#include "../GPU.h"
+#include "../GPU3D.h"
+#include "../SPU.h"
+#include "../ARM.h"
+#include "../ARMIdleLoop.h"
+#include "../Profiler.h"
+
+
+bool StopRequested;
+const char* DataDirectory = ".";
+
+
+// FNV-1a, good enough to tell whether the output changed
+const u64 kHashInit = 0xCBF29CE484222325ULL;
+
+u64 Hash(u64 hash, const void* data, int len)
+{
+    const u8* bytes = (const u8*)data;
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+
+void Usage()
+{
+    printf("melonDS-bench " MELONDS_VERSION "\n");
+    printf("usage: melonDS-bench [options] <rom.nds>\n");
+    printf("  -n <frames>       frames to time (default 3600)\n");
+    printf("  -w <frames>       frames to run before timing starts (default 120)\n");
+    printf("  -d <dir>          where bios7.bin, bios9.bin, firmware.bin and melonDS.ini are (default .)\n");
+    printf("  -c <name>=<val>   override a config setting, eg. -c JIT_Enable=1 (can be repeated)\n");
+    printf("  -s <file>         save file to use (default none, saves are thrown away)\n");
+    printf("  -b                boot through the firmware instead of booting the game directly\n");
+    printf("  -j                output JSON\n");
+    printf("  -t                run the self-checks (SIMD code against scalar code, IRQs in idle loops), then exit\n");
+    printf("  -y                also time the 3D polygon Y-sort on the polygon lists from the run\n");
+}
+
+double Percentile(std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+
+    int i = (int)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+// polygon lists for -y, as their sort keys in the order the polygons were submitted
+std::vector<std::vector<u32>> SortLists;
+
+void RecordPolygonList()
+{
+    u32 num = GPU3D::RenderNumPolygons;
+    if (!num) return;
+
+    // the render list is sorted already, but it points into polygon RAM,
+    // where the polygons are in submission order
+    std::vector<GPU3D::Polygon*> polys(GPU3D::RenderPolygonRAM.begin(), GPU3D::RenderPolygonRAM.begin() + num);
+    std::sort(polys.begin(), polys.end());
+
+    std::vector<u32> keys(num);
+    for (u32 i = 0; i < num; i++)
+        keys[i] = polys[i]->SortKey;
+
+    SortLists.push_back(keys);
+}
+
+typedef struct
+{
+    bool Random;
+    u32 NumLists;
+    double AvgPolygons;
+    double StableSortUs;
+    double RadixSortUs;
+    bool Match;
+
+} SortBenchResult;
+
+void RunSortBench(SortBenchResult* res)
+{
+    res->Random = SortLists.empty();
+    if (res->Random)
+    {
+        // nothing 3D in the run, make up some lists
+        u32 seed = 1;
+        for (int l = 0; l < 64; l++)
+        {
+            std::vector<u32> keys(2048);
+            for (u32& key : keys)
+            {
+                seed = seed * 1103515245 + 12345;
+                u32 ytop = (seed >> 8) % 192;
+                u32 ybot = std::min<u32>(ytop + ((seed >> 20) & 0x1F), 192);
+                key = (ybot << 8) | ytop | ((seed & 0x10) ? 0x10000 : 0);
+            }
+            SortLists.push_back(keys);
+        }
+    }
+
+    static GPU3D::Polygon polys[2048];
+    static GPU3D::Polygon* outref[2048];
+    static GPU3D::Polygon* outradix[2048];
+    const int reps = 16;
+
+    double tref = 0, tradix = 0;
+    u64 numpolys = 0;
+    res->Match = true;
+
+    // both with and without manual sorting of translucent polygons
+    for (int manual = 0; manual < 2; manual++)
+    {
+        for (std::vector<u32>& keys : SortLists)
+        {
+            u32 num = keys.size();
+            for (u32 i = 0; i < num; i++)
+            {
+                polys[i].SortKey = keys[i];
+                polys[i].Translucent = (keys[i] & 0x10000) != 0;
+            }
+
+            auto t0 = std::chrono::steady_clock::now();
+            for (int r = 0; r < reps; r++)
+                GPU3D::SortPolygonsReference(outref, polys, num, manual);
+            auto t1 = std::chrono::steady_clock::now();
+            for (int r = 0; r < reps; r++)
+                GPU3D::SortPolygons(outradix, polys, num, manual);
+            auto t2 = std::chrono::steady_clock::now();
+
+            tref += std::chrono::duration<double, std::micro>(t1 - t0).count();
+            tradix += std::chrono::duration<double, std::micro>(t2 - t1).count();
+            numpolys += num;
+
+            if (memcmp(outref, outradix, num * sizeof(GPU3D::Polygon*)))
+                res->Match = false;
+        }
+    }
+
+    u32 numsorts = SortLists.size() * 2;
+    res->NumLists = SortLists.size();
+    res->AvgPolygons = numpolys / (double)numsorts;
+    res->StableSortUs = tref / (numsorts * reps);
+    res->RadixSortUs = tradix / (numsorts * reps);
+}
+
+// runs the ARM9 in a few idle loops with a VBlank IRQ coming, and checks that
+// idle loop skipping doesn't keep it from getting out. resets the emulator
+bool CheckIdleLoopIRQs()
+{
+    // ARM9 loops sitting in main RAM, waiting for a VBlank IRQ
+    static const u32 loops[2][3] =
+    {
+        // b .
+        {0xEAFFFFFE, 0, 0},
+        // ldr r0, [r1]; cmp r0, #0; beq <ldr>, with r1 pointing to a zero
+        {0xE5910000, 0xE3500000, 0x0AFFFFFC},
+    };
+
+    bool ok = true;
+
+    for (int i = 0; i < 2; i++)
+    {
+        NDS::LoadBIOS();
+        ARMIdleLoop::Enabled = true;
+
+        memcpy(&NDS::MainRAM[0], loops[i], sizeof(loops[i]));
+        *(u32*)&NDS::MainRAM[0x1000] = 0;
+
+        // the IRQ vector just stays put, and so does the ARM7, IRQs off
+        *(u32*)&NDS::ARM9BIOS[0x18] = 0xEAFFFFFE;
+        *(u32*)&NDS::MainRAM[0x380000] = 0xEAFFFFFE;
+
+        NDS::ARM9->CPSR = 0x1F;
+        NDS::ARM9->R[1] = 0x02001000;
+        NDS::ARM9->JumpTo(0x02000000);
+        NDS::ARM7->CPSR = 0x9F;
+        NDS::ARM7->JumpTo(0x02380000);
+
+        NDS::ARM9IOWrite16(0x04000004, 0x0008);
+        NDS::ARM9IOWrite32(0x04000210, 0x1);
+        NDS::ARM9IOWrite32(0x04000208, 0x1);
+
+        bool taken = false;
+        for (int f = 0; f < 5 && !taken; f++)
+        {
+            NDS::RunFrame();
+            taken = ((NDS::ARM9->CPSR & 0x1F) == 0x12);
+        }
+
+        if (!taken)
+        {
+            printf("idle loop %d: IRQ not taken\n", i);
+            ok = false;
+        }
+    }
+
+    NDS::Reset();
+    ARMIdleLoop::Enabled = (Config::IdleLoopSkip != 0);
+    return ok;
+}
+
+void PrintJSONString(FILE* out, const char* str)
+{
+    fputc('"', out);
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', out);
+        if ((u8)*str < 0x20)
+            fprintf(out, "\\u%04x", (u8)*str);
+        else
+            fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+int main(int argc, char** argv)
+{
+    int numframes = 3600;
+    int warmup = 120;
+    const char* rompath = NULL;
+    const char* savepath = "";
+    bool json = false;
+    bool direct = true;
+    bool selfcheck = false;
+    bool sortbench = false;
+    std::vector<const char*> overrides;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool hasval = (i+1 < argc);
+
+        if      (!strcmp(arg, "-n") && hasval) numframes = atoi(argv[++i]);
+        else if (!strcmp(arg, "-w") && hasval) warmup = atoi(argv[++i]);
+        else if (!strcmp(arg, "-d") && hasval) DataDirectory = argv[++i];
+        else if (!strcmp(arg, "-c") && hasval) overrides.push_back(argv[++i]);
+        else if (!strcmp(arg, "-s") && hasval) savepath = argv[++i];
+        else if (!strcmp(arg, "-b")) direct = false;
+        else if (!strcmp(arg, "-j")) json = true;
+        else if (!strcmp(arg, "-t")) selfcheck = true;
+        else if (!strcmp(arg, "-y")) sortbench = true;
+        else if (arg[0] != '-' && !rompath) rompath = arg;
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if ((!rompath && !selfcheck) || numframes < 1 || warmup < 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    // the core logs to stdout, keep that out of the way of the JSON
+    FILE* out = stdout;
+    if (json)
+    {
+        out = fdopen(dup(fileno(stdout)), "w");
+        dup2(fileno(stderr), fileno(stdout));
+    }
+
+    Config::Load();
+    for (const char* entry : overrides)
+    {
+        std::string name(entry);
+        size_t eq = name.find('=');
+        if (eq == std::string::npos || !Config::Set(name.substr(0, eq).c_str(), entry + eq + 1))
+        {
+            fprintf(stderr, "bad config override: %s\n", entry);
+            return 1;
+        }
+    }
+
+    if (!NDS::Init())
+    {
+        fprintf(stderr, "failed to init the emulator\n");
+        return 1;
+    }
+
+    GPU3D::InitRenderer(false);
+
+    if (selfcheck)
+    {
+        bool ok = GPU3D::CheckMatrixKernels(100000);
+        fprintf(out, "3D matrix kernels: %s\n", ok ? "ok" : "MISMATCH");
+
+        // resetting the emulator needs the firmware
+        FILE* f = Platform::OpenLocalFile("firmware.bin", "rb");
+        if (f)
+        {
+            fclose(f);
+
+            bool idleok = CheckIdleLoopIRQs();
+            fprintf(out, "idle loop IRQs: %s\n", idleok ? "ok" : "FAILED");
+            ok = ok && idleok;
+        }
+        else
+            fprintf(out, "idle loop IRQs: skipped, no firmware.bin\n");
+
+        fflush(out);
+        NDS::DeInit();
+        return ok ? 0 : 1;
+    }
+
+    if (!NDS::LoadROM(rompath, savepath, direct))
+    {
+        fprintf(stderr, "failed to load %s\n", rompath);
+        return 1;
+    }
+
+    s16 audiobuf[1024*2];
+    StopRequested = false;
+
+    for (int i = 0; i < warmup && !StopRequested; i++)
+    {
+        NDS::RunFrame();
+        while (SPU::ReadOutput(audiobuf, 1024) > 0);
+    }
+
+#ifdef PROFILING
+    Profiler::ClearTotals();
+#endif
+
+    std::vector<double> frametimes;
+    frametimes.reserve(numframes);
+
+    u64 videohash = kHashInit;
+    u64 audiohash = kHashInit;
+    u64 numsamples = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    double hashtime = 0;
+
+    for (int i = 0; i < numframes && !StopRequested; i++)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        NDS::RunFrame();
+        auto t1 = std::chrono::steady_clock::now();
+
+        frametimes.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+        // hashing isn't part of what's being measured
+        int fb = GPU::FrontBuffer;
+        videohash = Hash(videohash, GPU::Framebuffer[fb][0], 256*192*4);
+        videohash = Hash(videohash, GPU::Framebuffer[fb][1], 256*192*4);
+
+        int num;
+        while ((num = SPU::ReadOutput(audiobuf, 1024)) > 0)
+        {
+            audiohash = Hash(audiohash, audiobuf, num*2*sizeof(s16));
+            numsamples += num;
+        }
+
+        if (sortbench) RecordPolygonList();
+
+        hashtime += std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+    }
+
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - hashtime;
+    int ran = frametimes.size();
+    double fps = ran / total;
+
+    std::vector<double> sorted = frametimes;
+    std::sort(sorted.begin(), sorted.end());
+    double tmin = sorted.empty() ? 0 : sorted.front();
+    double tmax = sorted.empty() ? 0 : sorted.back();
+    double p50 = Percentile(sorted, 0.5);
+    double p90 = Percentile(sorted, 0.9);
+    double p99 = Percentile(sorted, 0.99);
+
+#ifdef PROFILING
+    Profiler::Counter prof[Profiler::Prof_MAX];
+    u32 profframes;
+    Profiler::GetTotals(prof, &profframes);
+    if (profframes < 1) profframes = 1;
+#endif
+
+    SortBenchResult sortres;
+    if (sortbench) RunSortBench(&sortres);
+
+    // the clipping stats count since reset, warmup included
+    double clipframes = (warmup + ran) > 0 ? (double)(warmup + ran) : 1.0;
+
+    if (json)
+    {
+        fprintf(out, "{\n  \"rom\": ");
+        PrintJSONString(out, rompath);
+        fprintf(out, ",\n  \"version\": \"%s\",\n", MELONDS_VERSION);
+        fprintf(out, "  \"config\": [");
+        for (size_t i = 0; i < overrides.size(); i++)
+        {
+            if (i) fprintf(out, ", ");
+            PrintJSONString(out, overrides[i]);
+        }
+        fprintf(out, "],\n");
+        fprintf(out, "  \"frames\": %d,\n  \"warmup\": %d,\n  \"stopped\": %s,\n", ran, warmup, StopRequested ? "true" : "false");
+        fprintf(out, "  \"seconds\": %.6f,\n  \"fps\": %.3f,\n", total, fps);
+        fprintf(out, "  \"frame_ms\": {\"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+                tmin, p50, p90, p99, tmax);
+        fprintf(out, "  \"video_hash\": \"%016llX\",\n", (unsigned long long)videohash);
+        fprintf(out, "  \"audio_hash\": \"%016llX\",\n", (unsigned long long)audiohash);
+        fprintf(out, "  \"audio_samples\": %llu,\n", (unsigned long long)numsamples);
+        fprintf(out, "  \"idle_loops\": {\"arm9_cycles\": %llu, \"arm9_skips\": %u, \"arm7_cycles\": %llu, \"arm7_skips\": %u}",
+                (unsigned long long)ARMIdleLoop::CyclesSkipped[0], ARMIdleLoop::NumSkips[0],
+                (unsigned long long)ARMIdleLoop::CyclesSkipped[1], ARMIdleLoop::NumSkips[1]);
+        fprintf(out, ",\n  \"2d_lines\": {\"a_drawn\": %u, \"a_reused\": %u, \"b_drawn\": %u, \"b_reused\": %u}",
+                GPU::GPU2D_A->LinesDrawn, GPU::GPU2D_A->LinesReused, GPU::GPU2D_B->LinesDrawn, GPU::GPU2D_B->LinesReused);
+        fprintf(out, ",\n  \"3d_clip_per_frame\": {\"inside\": %.1f, \"clipped\": %.1f, \"rejected\": %.1f}",
+                GPU3D::PolygonsAccepted / clipframes, GPU3D::PolygonsClipped / clipframes, GPU3D::PolygonsRejected / clipframes);
+        if (sortbench)
+        {
+            fprintf(out, ",\n  \"ysort\": {\"lists\": %u, \"random\": %s, \"avg_polygons\": %.1f, \"stable_sort_us\": %.3f, \"radix_sort_us\": %.3f, \"match\": %s}",
+                    sortres.NumLists, sortres.Random ? "true" : "false", sortres.AvgPolygons,
+                    sortres.StableSortUs, sortres.RadixSortUs, sortres.Match ? "true" : "false");
+        }
+        if (NDS::ARM7Threaded)
+        {
+            fprintf(out, ",\n  \"arm7_thread\": {\"arm9_waited\": %u, \"arm7_waited\": %u, \"arm9_bus_stalls\": %u, \"arm7_bus_stalls\": %u}",
+                    NDS::SliceStalls[0], NDS::SliceStalls[1], NDS::BusLockStalls[0], NDS::BusLockStalls[1]);
+        }
+#ifdef PROFILING
+        fprintf(out, ",\n  \"profile\": {");
+        for (int i = 0; i < Profiler::Prof_MAX; i++)
+        {
+            fprintf(out, "%s\n    ", i ? "," : "");
+            PrintJSONString(out, Profiler::Names[i]);
+            fprintf(out, ": {\"ms_per_frame\": %.4f, \"calls_per_frame\": %.1f}",
+                    prof[i].Nanoseconds / (profframes * 1000000.0), prof[i].Calls / (double)profframes);
+        }
+        fprintf(out, "\n  }");
+#endif
+        fprintf(out, "\n}\n");
+    }
+    else
+    {
+        fprintf(out, "%s: %d frames (+%d warmup) in %.3fs, %.2f fps%s\n",
+                rompath, ran, warmup, total, fps, StopRequested ? " (emulator stopped early)" : "");
+        fprintf(out, "frame time (ms): min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+                tmin, p50, p90, p99, tmax);
+        fprintf(out, "video hash: %016llX\n", (unsigned long long)videohash);
+        fprintf(out, "audio hash: %016llX (%llu samples)\n", (unsigned long long)audiohash, (unsigned long long)numsamples);
+        fprintf(out, "idle loops: ARM9 skipped %llu cycles in %u loops, ARM7 skipped %llu cycles in %u loops\n",
+                (unsigned long long)ARMIdleLoop::CyclesSkipped[0], ARMIdleLoop::NumSkips[0],
+                (unsigned long long)ARMIdleLoop::CyclesSkipped[1], ARMIdleLoop::NumSkips[1]);
+        fprintf(out, "2D scanlines reused: engine A %u/%u, engine B %u/%u\n",
+                GPU::GPU2D_A->LinesReused, GPU::GPU2D_A->LinesDrawn + GPU::GPU2D_A->LinesReused,
+                GPU::GPU2D_B->LinesReused, GPU::GPU2D_B->LinesDrawn + GPU::GPU2D_B->LinesReused);
+        fprintf(out, "3D clipping (per frame): %.1f polygons inside, %.1f clipped, %.1f rejected\n",
+                GPU3D::PolygonsAccepted / clipframes, GPU3D::PolygonsClipped / clipframes, GPU3D::PolygonsRejected / clipframes);
+        if (sortbench)
+        {
+            fprintf(out, "Y-sort on %u %s lists of %.1f polygons: stable_sort %.3f us, radix %.3f us per list%s\n",
+                    sortres.NumLists, sortres.Random ? "random" : "recorded", sortres.AvgPolygons,
+                    sortres.StableSortUs, sortres.RadixSortUs, sortres.Match ? "" : " (MISMATCH)");
+        }
+        if (NDS::ARM7Threaded)
+        {
+            fprintf(out, "ARM7 thread: ARM9 waited on %u slices, ARM7 waited on %u, bus lock contended %u/%u times\n",
+                    NDS::SliceStalls[0], NDS::SliceStalls[1], NDS::BusLockStalls[0], NDS::BusLockStalls[1]);
+        }
+#ifdef PROFILING
+        fprintf(out, "profile (per frame):\n");
+        for (int i = 0; i < Profiler::Prof_MAX; i++)
+        {
+            fprintf(out, "  %-10s %8.3f ms %10.1f calls\n", Profiler::Names[i],
+                    prof[i].Nanoseconds / (profframes * 1000000.0), prof[i].Calls / (double)profframes);
+        }
+#endif
+    }
+
+    fflush(out);
+
+    NDS::DeInit();
+
+    return StopRequested ? 2 : 0;
+}
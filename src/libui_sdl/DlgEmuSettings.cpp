@@ -37,6 +37,10 @@ bool opened;
 uiWindow* win;
 
 uiCheckbox* cbDirectBoot;
+uiCheckbox* cbJIT;
+uiCheckbox* cbThreadedARM7;
+uiCheckbox* cbThreaded2D;
+uiCheckbox* cbThreadedGeometry;
 
 
 int OnCloseWindow(uiWindow* window, void* blarg)
@@ -54,6 +58,10 @@ void OnCancel(uiButton* btn, void* blarg)
 void OnOk(uiButton* btn, void* blarg)
 {
     Config::DirectBoot = uiCheckboxChecked(cbDirectBoot);
+    Config::JIT_Enable = uiCheckboxChecked(cbJIT);
+    Config::ThreadedARM7 = uiCheckboxChecked(cbThreadedARM7);
+    Config::Threaded2D = uiCheckboxChecked(cbThreaded2D);
+    Config::ThreadedGeometry = uiCheckboxChecked(cbThreadedGeometry);
 
     Config::Save();
 
@@ -83,6 +91,18 @@ void Open()
 
         cbDirectBoot = uiNewCheckbox("Boot game directly");
         uiBoxAppend(in_ctrl, uiControl(cbDirectBoot), 0);
+
+        cbJIT = uiNewCheckbox("JIT recompiler (applied on reset)");
+        uiBoxAppend(in_ctrl, uiControl(cbJIT), 0);
+
+        cbThreadedARM7 = uiNewCheckbox("Run ARM7 on a separate thread (applied on reset)");
+        uiBoxAppend(in_ctrl, uiControl(cbThreadedARM7), 0);
+
+        cbThreaded2D = uiNewCheckbox("Draw engine B on a separate thread (applied on reset)");
+        uiBoxAppend(in_ctrl, uiControl(cbThreaded2D), 0);
+
+        cbThreadedGeometry = uiNewCheckbox("Run the 3D geometry engine on a separate thread (applied on reset)");
+        uiBoxAppend(in_ctrl, uiControl(cbThreadedGeometry), 0);
     }
 
     {
@@ -103,6 +123,10 @@ void Open()
     }
 
     uiCheckboxSetChecked(cbDirectBoot, Config::DirectBoot);
+    uiCheckboxSetChecked(cbJIT, Config::JIT_Enable);
+    uiCheckboxSetChecked(cbThreadedARM7, Config::ThreadedARM7);
+    uiCheckboxSetChecked(cbThreaded2D, Config::Threaded2D);
+    uiCheckboxSetChecked(cbThreadedGeometry, Config::ThreadedGeometry);
 
     uiControlShow(uiControl(win));
 }
@@ -50,6 +50,7 @@
 #include "../Config.h"
 
 #include "../Savestate.h"
+#include "../Profiler.h"
 
 #include "OSD.h"
 
@@ -1112,6 +1113,21 @@ int EmuThreadFunc(void* burp)
                 sprintf(melontitle, "[%d/%.0f] melonDS " MELONDS_VERSION, fps, fpstarget);
                 SDL_UnlockMutex(titlemutex);
                 uiQueueMain(UpdateWindowTitle, titledata);
+
+#ifdef PROFILING
+                // OSD messages stay up for 2.5s, so don't post them faster than that
+                Profiler::Counter prof[Profiler::Prof_MAX];
+                u32 profframes;
+                Profiler::GetTotals(prof, &profframes);
+                if (profframes >= 150)
+                {
+                    char msg[256];
+                    Profiler::Format(msg, sizeof(msg), prof, profframes);
+                    OSD::AddMessage(0xA0C0FF, msg);
+                    printf("profile (ms/frame): %s\n", msg);
+                    Profiler::ClearTotals();
+                }
+#endif
             }
         }
         else